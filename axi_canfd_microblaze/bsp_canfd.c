@@ -1,10 +1,19 @@
 #include "bsp_canfd.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 #include <xcanfd.h>
 #include <xinterrupt_wrap.h>
 #include <xparameters.h>
 
+#include "canfd_bits.h"
+#include "canfd_codec.h"
+#include "canfd_filter.h"
+#include "canfd_ring.h"
+#include "canfd_timing.h"
+#include "canfd_txq.h"
+
 #if BSP_CANFD_DEBUG
 #include <xil_printf.h>
 #define bsp_canfd_debug_printf(...) xil_printf(__VA_ARGS__)
@@ -12,73 +21,174 @@
 #define bsp_canfd_debug_printf(...)
 #endif
 
-static void SendHandler(void *CallBackRef) {}
+// TX buffers of the core, one TRR bit each
+#define BSP_CANFD_TX_BUFFERS 32
 
-static void RecvHandler(void *CallBackRef) {
-  XCanFd *CanPtr = (XCanFd *)CallBackRef;
-  int Status;
-  u32 RxFrame[CANFD_MTU];
+// per instance state next to the Xilinx driver instance
+struct bsp_canfd {
+  XCanFd *InstancePtr;
+  struct canfd_ring RxRing;  // RecvHandler -> bsp_canfd_recv_batch
+  struct canfd_txq TxQueue;  // bsp_canfd_send -> SendHandler, TXOK masked
+  // frames handed to XCanFd_Send whose TRR bit was still set last time
+  u32 TxBusy;
+  struct canfd_txq_meta TxMeta[BSP_CANFD_TX_BUFFERS];
 
-  /* Check for the design 1 - MailBox 0 - Sequential */
-  if (XCANFD_GET_RX_MODE(CanPtr) == 1) {
-    Status = XCanFd_Recv_Mailbox(CanPtr, RxFrame);
-  } else {
-    Status = XCanFd_Recv_Sequential(CanPtr, RxFrame);
+  // written from the interrupt handlers
+  struct bsp_canfd_stats Stats;
+  u32 NominalBitNs;
+  u32 DataBitNs;
+  // since the previous snapshot; RX from RecvHandler only, TX with TXOK
+  // masked, separate so bsp_canfd_send needs no other interrupt masked
+  u64 RxBusNs;
+  u64 TxBusNs;
+  u32 SnapshotStamp;
+  u64 LatencySum;
+  u32 LatencyCount;
+  u32 LatencyMin;
+  u32 LatencyMax;
+};
+
+static struct bsp_canfd bsp_canfd_table[BSP_CANFD_MAX_INSTANCES];
+
+static struct bsp_canfd *bsp_canfd_get(XCanFd *InstancePtr) {
+  for (int i = 0; i < BSP_CANFD_MAX_INSTANCES; i++) {
+    if (bsp_canfd_table[i].InstancePtr == InstancePtr) {
+      return &bsp_canfd_table[i];
+    }
   }
+  return NULL;
+}
 
-  u32 id1 = (RxFrame[0] >> (u32)XCANFD_IDR_ID1_SHIFT) & (u32)0x7FF;
-  u32 is_extended = (RxFrame[0] >> (u32)XCANFD_IDR_IDE_SHIFT) & (u32)0x1;
-  u32 id2 = (RxFrame[0] >> (u32)XCANFD_IDR_ID2_SHIFT) & (u32)0x3FFFF;
-  u32 is_remote = is_extended
-                      ? (RxFrame[0] & 0x01)
-                      : ((RxFrame[0] >> (u32)XCANFD_IDR_SRR_SHIFT) & (u32)0x1);
+static u32 bsp_canfd_bus_ns(struct bsp_canfd *Bsp,
+                            const struct canfd_frame *frame) {
+  struct canfd_frame_bits Bits;
+  canfd_frame_bits(frame, &Bits);
+  return Bits.nominal * Bsp->NominalBitNs + Bits.data * Bsp->DataBitNs;
+}
 
-  /* Get the Dlc inthe form of bytes */
-  u32 len = XCanFd_GetDlc2len(RxFrame[1] & XCANFD_DLCR_DLC_MASK, EDL_CANFD);
-  if (Status != XST_SUCCESS) {
-    bsp_canfd_debug_printf("Error: XCanFd_Recv returned %d\n", Status);
+static int bsp_canfd_hw_send(XCanFd *InstancePtr,
+                             const struct canfd_frame *frame,
+                             u32 *TxBufferNumber) {
+  u32 TxFrame[CANFD_X_FRAME_WORDS];
+  canfd_frame_to_xcanfd(frame, TxFrame);
+  return XCanFd_Send(InstancePtr, TxFrame, TxBufferNumber);
+}
+
+// account the TX buffers the core has sent since the last call
+static void bsp_canfd_tx_done(struct bsp_canfd *Bsp) {
+  u32 Requested = XCanFd_ReadReg(Bsp->InstancePtr->CanFdConfig.BaseAddress,
+                                 XCANFD_TRR_OFFSET);
+  u32 Done = Bsp->TxBusy & ~Requested;
+  if (Done == 0) {
     return;
   }
-  u32 is_brs = RxFrame[1] & XCANFD_DLCR_BRS_MASK ? 1 : 0;
-  u32 is_fdf = RxFrame[1] & XCANFD_DLCR_EDL_MASK ? 1 : 0;
-  // bsp_canfd_debug_printf("%08X ", RxFrame[0]);
-  u8 *FramePtr = (u8 *)(&RxFrame[2]);
-  if (is_extended) {
-    bsp_canfd_debug_printf("%08X ", id1 << 18 | id2);
-  } else {
-    bsp_canfd_debug_printf("%03X ", id1);
+  Bsp->TxBusy &= ~Done;
+  u32 Now = bsp_canfd_timer();
+  while (Done != 0) {
+    int i = __builtin_ctz(Done);
+    Done &= Done - 1;
+    const struct canfd_txq_meta *Meta = &Bsp->TxMeta[i];
+    u32 Latency = Now - Meta->stamp;
+    Bsp->Stats.tx_frames++;
+    Bsp->Stats.tx_bytes += Meta->len;
+    Bsp->TxBusNs += Meta->bus_ns;
+    Bsp->LatencySum += Latency;
+    if (Bsp->LatencyCount == 0 || Latency < Bsp->LatencyMin) {
+      Bsp->LatencyMin = Latency;
+    }
+    if (Latency > Bsp->LatencyMax) {
+      Bsp->LatencyMax = Latency;
+    }
+    Bsp->LatencyCount++;
   }
-  if (is_remote) {
-    bsp_canfd_debug_printf("R [%d]", len);
-  } else {
-    bsp_canfd_debug_printf("D ");
-    if (is_fdf) {
-      bsp_canfd_debug_printf("F ");
-    } else {
-      bsp_canfd_debug_printf("- ");
+}
+
+// move queued frames into free TX buffers, from SendHandler or with TXOK
+// masked
+static void bsp_canfd_tx_refill(struct bsp_canfd *Bsp) {
+  const struct canfd_frame *frame;
+  // before XCanFd_Send hands out a buffer that was just freed
+  bsp_canfd_tx_done(Bsp);
+  while ((frame = canfd_txq_peek(&Bsp->TxQueue)) != NULL) {
+    u32 TxBufferNumber;
+    int Status = bsp_canfd_hw_send(Bsp->InstancePtr, frame, &TxBufferNumber);
+    if (Status == XST_FIFO_NO_ROOM) {
+      break;
     }
-    if (is_brs) {
-      bsp_canfd_debug_printf("B ");
-    } else {
-      bsp_canfd_debug_printf("- ");
+    if (Status != XST_SUCCESS) {
+      // not retried, counted as lost
+      Bsp->TxQueue.drops++;
+    } else if (TxBufferNumber < BSP_CANFD_TX_BUFFERS) {
+      Bsp->TxMeta[TxBufferNumber] = *canfd_txq_peek_meta(&Bsp->TxQueue);
+      Bsp->TxBusy |= (u32)1 << TxBufferNumber;
     }
-    if ((!is_fdf) && (!is_brs)) {
-      bsp_canfd_debug_printf("[%d] ", len);
+    canfd_txq_pop(&Bsp->TxQueue);
+  }
+}
+
+static void SendHandler(void *CallBackRef) {
+  struct bsp_canfd *Bsp = (struct bsp_canfd *)CallBackRef;
+  bsp_canfd_tx_refill(Bsp);
+}
+
+static void RecvHandler(void *CallBackRef) {
+  struct bsp_canfd *Bsp = (struct bsp_canfd *)CallBackRef;
+  XCanFd *CanPtr = Bsp->InstancePtr;
+  u32 RxFrame[CANFD_X_FRAME_WORDS];
+
+  // drain what the hardware holds, no printing in interrupt context
+  for (int i = 0; i < BSP_CANFD_RX_BURST; i++) {
+    int Status;
+    /* Check for the design 1 - MailBox 0 - Sequential */
+    if (XCANFD_GET_RX_MODE(CanPtr) == 1) {
+      Status = XCanFd_Recv_Mailbox(CanPtr, RxFrame);
     } else {
-      bsp_canfd_debug_printf("[%02d] ", len);
+      Status = XCanFd_Recv_Sequential(CanPtr, RxFrame);
+    }
+    if (Status != XST_SUCCESS) {
+      break;
     }
-    for (int i = 0; i < len; i++) {
-      bsp_canfd_debug_printf("%02X ", FramePtr[i]);
+    // ring full: decoded for the statistics only and counted in
+    // RxRing.drops
+    struct canfd_frame Dropped;
+    struct canfd_frame *frame = canfd_ring_reserve(&Bsp->RxRing);
+    xcanfd_to_canfd_frame(RxFrame, frame != NULL ? frame : &Dropped);
+    const struct canfd_frame *Received = frame != NULL ? frame : &Dropped;
+    Bsp->Stats.rx_frames++;
+    if (!(Received->can_id & CAN_RTR_FLAG)) {
+      Bsp->Stats.rx_bytes += Received->len;
+    }
+    Bsp->RxBusNs += bsp_canfd_bus_ns(Bsp, Received);
+    if (frame != NULL) {
+      canfd_ring_commit(&Bsp->RxRing);
     }
   }
-  bsp_canfd_debug_printf("\n");
 }
 
-static void ErrorHandler(void *CallBackRef, u32 ErrorMask) {}
+static void ErrorHandler(void *CallBackRef, u32 ErrorMask) {
+  struct bsp_canfd_stats *Stats = &((struct bsp_canfd *)CallBackRef)->Stats;
+  Stats->bit_errors += ErrorMask & XCANFD_ESR_BERR_MASK ? 1 : 0;
+  Stats->stuff_errors += ErrorMask & XCANFD_ESR_STER_MASK ? 1 : 0;
+  Stats->form_errors += ErrorMask & XCANFD_ESR_FMER_MASK ? 1 : 0;
+  Stats->ack_errors += ErrorMask & XCANFD_ESR_ACKER_MASK ? 1 : 0;
+  Stats->crc_errors += ErrorMask & XCANFD_ESR_CRCER_MASK ? 1 : 0;
+  Stats->fd_bit_errors += ErrorMask & XCANFD_ESR_F_BERR_MASK ? 1 : 0;
+  Stats->fd_stuff_errors += ErrorMask & XCANFD_ESR_F_STER_MASK ? 1 : 0;
+  Stats->fd_form_errors += ErrorMask & XCANFD_ESR_F_FMER_MASK ? 1 : 0;
+  Stats->fd_crc_errors += ErrorMask & XCANFD_ESR_F_CRCER_MASK ? 1 : 0;
+}
 
 static void EventHandler(void *CallBackRef, u32 IntrMask) {
-  XCanFd *CanPtr = (XCanFd *)CallBackRef;
+  struct bsp_canfd *Bsp = (struct bsp_canfd *)CallBackRef;
+  XCanFd *CanPtr = Bsp->InstancePtr;
+  if (IntrMask & XCANFD_IXR_RXOFLW_MASK) {
+    Bsp->Stats.rx_overflows++;
+  }
+  if (IntrMask & XCANFD_IXR_ARBLST_MASK) {
+    Bsp->Stats.arbitration_lost++;
+  }
   if (IntrMask & XCANFD_IXR_BSOFF_MASK) {
+    Bsp->Stats.bus_off++;
     /*
      * The CAN device requires 128 * 11 consecutive recessive bits
      * to recover from bus off.
@@ -88,6 +198,7 @@ static void EventHandler(void *CallBackRef, u32 IntrMask) {
   }
 
   if (IntrMask & XCANFD_IXR_PEE_MASK) {
+    Bsp->Stats.protocol_exceptions++;
     XCanFd_Pee_BusOff_Handler(CanPtr);
     return;
   }
@@ -96,6 +207,28 @@ static void EventHandler(void *CallBackRef, u32 IntrMask) {
 int bsp_canfd_init(XCanFd *InstancePtr, uint32_t BaseAddress, uint32_t BaudRate,
                    float SamplePoint, uint32_t FastBaudRate,
                    float FastSamplePoint) {
+  struct bsp_canfd *Bsp = bsp_canfd_get(InstancePtr);
+  if (Bsp == NULL) {
+    Bsp = bsp_canfd_get(NULL);
+  }
+  if (Bsp == NULL) {
+    bsp_canfd_debug_printf("Error: more than %d instances\n",
+                           BSP_CANFD_MAX_INSTANCES);
+    return -1;
+  }
+  Bsp->InstancePtr = InstancePtr;
+  canfd_ring_init(&Bsp->RxRing);
+  canfd_txq_init(&Bsp->TxQueue);
+  Bsp->TxBusy = 0;
+  memset(&Bsp->Stats, 0, sizeof(Bsp->Stats));
+  Bsp->RxBusNs = 0;
+  Bsp->TxBusNs = 0;
+  Bsp->SnapshotStamp = bsp_canfd_timer();
+  Bsp->LatencySum = 0;
+  Bsp->LatencyCount = 0;
+  Bsp->LatencyMin = 0;
+  Bsp->LatencyMax = 0;
+
   XCanFd_Config *ConfigPtr = XCanFd_LookupConfig(BaseAddress);
   if (ConfigPtr == NULL) {
     bsp_canfd_debug_printf("Error: XCanFd_LookupConfig returned NULL\n");
@@ -125,50 +258,56 @@ int bsp_canfd_init(XCanFd *InstancePtr, uint32_t BaseAddress, uint32_t BaudRate,
     ;
   bsp_canfd_debug_printf("XCanFd_EnterMode: XCANFD_MODE_CONFIG\n");
 
-  // 80MHz / (3 + 1) = 20MHz, 20MHz / (1 + (30 + 1) + (7 + 1)) = 500KHz
-  // XCanFd_SetBitTiming(InstancePtr, 8, 7, 30);
-  XCanFd_SetBaudRatePrescaler(InstancePtr, 0x3);
-  u16 total_tq = 20000000 / BaudRate;
-  u16 tseg1 = (u16)(SamplePoint * total_tq) - 2;
-  u8 tseg2 = (u8)(total_tq - tseg1 - 3);
-  u8 sjw = tseg2 + 1;
-  XCanFd_SetBitTiming(InstancePtr, sjw, tseg2, tseg1);
-
-  // 80MHz, 80 / (1 + (30 + 1) + (7 + 1)) = 2MHz
-  // XCanFd_SetFBitTiming(InstancePtr, 8, 7, 30);
-  XCanFd_SetFBaudRatePrescaler(InstancePtr, 0x0);
-  u16 ftotal_tq = 80000000 / FastBaudRate;
-  u8 ftseg1 = (u8)(FastSamplePoint * ftotal_tq) - 2;
-  u8 ftseg2 = (u8)(ftotal_tq - ftseg1 - 3);
-  u8 fsjw = ftseg2 + 1;
-  XCanFd_SetFBitTiming(InstancePtr, fsjw, ftseg2, ftseg1);
-
-  // TDC, 0~31
-  // XCanFd_Set_Tranceiver_Delay_Compensation(InstancePtr, 0x3);
+  struct canfd_timing Nominal;
+  struct canfd_timing Data;
+  if (canfd_timing_solve(BSP_CANFD_CLOCK_HZ, BaudRate,
+                         (uint16_t)(SamplePoint * 1000 + 0.5f),
+                         &canfd_timing_xcanfd_nominal, &Nominal) != 0 ||
+      canfd_timing_solve(BSP_CANFD_CLOCK_HZ, FastBaudRate,
+                         (uint16_t)(FastSamplePoint * 1000 + 0.5f),
+                         &canfd_timing_xcanfd_data, &Data) != 0) {
+    bsp_canfd_debug_printf("Error: no bit timing for %d/%d\n", BaudRate,
+                           FastBaudRate);
+    return -3;
+  }
+
+  // registers hold the lengths minus one
+  XCanFd_SetBaudRatePrescaler(InstancePtr, Nominal.brp - 1);
+  XCanFd_SetBitTiming(InstancePtr, Nominal.sjw - 1, Nominal.tseg2 - 1,
+                      Nominal.tseg1 - 1);
+  XCanFd_SetFBaudRatePrescaler(InstancePtr, Data.brp - 1);
+  XCanFd_SetFBitTiming(InstancePtr, Data.sjw - 1, Data.tseg2 - 1,
+                       Data.tseg1 - 1);
+  if (Data.tdc) {
+    XCanFd_Set_Tranceiver_Delay_Compensation(InstancePtr, Data.tdco);
+  }
+  Bsp->NominalBitNs = (1000000000U + Nominal.bitrate / 2) / Nominal.bitrate;
+  Bsp->DataBitNs = (1000000000U + Data.bitrate / 2) / Data.bitrate;
+  bsp_canfd_debug_printf(
+      "  nominal: brp %d tseg1 %d tseg2 %d sjw %d, %d ppm\n", Nominal.brp,
+      Nominal.tseg1, Nominal.tseg2, Nominal.sjw, Nominal.bitrate_error);
+  bsp_canfd_debug_printf(
+      "  data: brp %d tseg1 %d tseg2 %d sjw %d tdc %d/%d, %d ppm\n", Data.brp,
+      Data.tseg1, Data.tseg2, Data.sjw, Data.tdc, Data.tdco,
+      Data.bitrate_error);
 
   XCanFd_SetBitRateSwitch_DisableNominal(InstancePtr);
-  bsp_canfd_debug_printf("XCanFd: %d@0.%d, %d@0.%d\n", BaudRate,
-                         (int)(SamplePoint * 1000), FastBaudRate,
-                         (int)(FastSamplePoint * 1000));
+  bsp_canfd_debug_printf("XCanFd: %d@0.%d, %d@0.%d\n", Nominal.bitrate,
+                         Nominal.sample_point, Data.bitrate,
+                         Data.sample_point);
 
-  if (XCANFD_GET_RX_MODE(InstancePtr) == 0) {
-    bsp_canfd_debug_printf(
-        "RX_MODE Sequential Filter: XCANFD_AFR_UAF_ALL_MASK\n");
-    XCanFd_AcceptFilterDisable(InstancePtr, XCANFD_AFR_UAF_ALL_MASK);
-    // XCanFd_AcceptFilterSet(InstancePtr, 0, 0xFFFFFFFF, 0);
-    XCanFd_AcceptFilterEnable(InstancePtr, XCANFD_AFR_UAF_ALL_MASK);
-  } else {
-    bsp_canfd_debug_printf("RX_MODE Mailbox Filter: Need to be implemented\n");
+  if (bsp_canfd_set_filters(InstancePtr, NULL, 0) < 0) {
+    return -4;
   }
 
   XCanFd_SetHandler(InstancePtr, XCANFD_HANDLER_SEND, (void *)SendHandler,
-                    (void *)InstancePtr);
+                    (void *)Bsp);
   XCanFd_SetHandler(InstancePtr, XCANFD_HANDLER_RECV, (void *)RecvHandler,
-                    (void *)InstancePtr);
+                    (void *)Bsp);
   XCanFd_SetHandler(InstancePtr, XCANFD_HANDLER_ERROR, (void *)ErrorHandler,
-                    (void *)InstancePtr);
+                    (void *)Bsp);
   XCanFd_SetHandler(InstancePtr, XCANFD_HANDLER_EVENT, (void *)EventHandler,
-                    (void *)InstancePtr);
+                    (void *)Bsp);
   Status =
       XSetupInterruptSystem(InstancePtr, &XCanFd_IntrHandler, ConfigPtr->IntrId,
                             ConfigPtr->IntrParent, XINTERRUPT_DEFAULT_PRIORITY);
@@ -189,41 +328,174 @@ int bsp_canfd_init(XCanFd *InstancePtr, uint32_t BaseAddress, uint32_t BaudRate,
 }
 
 int bsp_canfd_send(XCanFd *InstancePtr, struct canfd_frame *frame) {
+  struct bsp_canfd *Bsp = bsp_canfd_get(InstancePtr);
+  if (Bsp == NULL) {
+    return -2;
+  }
+  struct canfd_txq_meta Meta;
+  Meta.stamp = bsp_canfd_timer();
+  Meta.bus_ns = bsp_canfd_bus_ns(Bsp, frame);
+  Meta.len = frame->can_id & CAN_RTR_FLAG ? 0 : frame->len;
+  XCanFd_InterruptDisable(InstancePtr, XCANFD_IXR_TXOK_MASK);
+  int Status = canfd_txq_push(&Bsp->TxQueue, frame, &Meta);
+  bsp_canfd_tx_refill(Bsp);
+  XCanFd_InterruptEnable(InstancePtr, XCANFD_IXR_TXOK_MASK);
+  if (Status != 0) {
+    // queue full, counted in TxQueue.drops
+    return -1;
+  }
+  return 0;
+}
+
+int bsp_canfd_get_stats(XCanFd *InstancePtr,
+                        struct bsp_canfd_stats *Stats) {
+  struct bsp_canfd *Bsp = bsp_canfd_get(InstancePtr);
+  if (Bsp == NULL) {
+    return -1;
+  }
+  u32 Enabled = XCanFd_InterruptGetEnabled(InstancePtr);
+  XCanFd_InterruptDisable(InstancePtr, Enabled);
+  bsp_canfd_tx_done(Bsp);
+  *Stats = Bsp->Stats;
+  Stats->rx_drops = Bsp->RxRing.drops;
+  Stats->tx_drops = Bsp->TxQueue.drops;
+  Stats->tx_pending = Bsp->TxQueue.count;
+  Stats->tx_high_water = Bsp->TxQueue.high_water;
+  u32 Now = bsp_canfd_timer();
+  u32 Elapsed = Now - Bsp->SnapshotStamp;
+  u64 BusNs = Bsp->RxBusNs + Bsp->TxBusNs;
+  u64 LatencySum = Bsp->LatencySum;
+  u32 LatencyCount = Bsp->LatencyCount;
+  u32 LatencyMin = Bsp->LatencyMin;
+  u32 LatencyMax = Bsp->LatencyMax;
+  Bsp->SnapshotStamp = Now;
+  Bsp->RxBusNs = 0;
+  Bsp->TxBusNs = 0;
+  Bsp->LatencySum = 0;
+  Bsp->LatencyCount = 0;
+  Bsp->LatencyMin = 0;
+  Bsp->LatencyMax = 0;
+  XCanFd_InterruptEnable(InstancePtr, Enabled);
+
+  // the 32 bit timer wraps, snapshots have to come faster than that
+  u64 ElapsedNs = (u64)Elapsed * 1000000000U / BSP_CANFD_TIMER_HZ;
+  Stats->bus_load = ElapsedNs != 0 ? (u32)(BusNs * 1000 / ElapsedNs) : 0;
+  u64 LatencyAvg = LatencyCount != 0 ? LatencySum / LatencyCount : 0;
+  Stats->tx_latency_min = (u32)(LatencyMin * 1000000ULL / BSP_CANFD_TIMER_HZ);
+  Stats->tx_latency_avg = (u32)(LatencyAvg * 1000000ULL / BSP_CANFD_TIMER_HZ);
+  Stats->tx_latency_max = (u32)(LatencyMax * 1000000ULL / BSP_CANFD_TIMER_HZ);
+  return 0;
+}
+
+int bsp_canfd_set_filters(XCanFd *InstancePtr, struct canfd_filter_range *Wanted,
+                          int Count) {
+  static struct canfd_filter Filter;
+  static struct canfd_filter_range All[2] = {
+      {0, CAN_SFF_MASK, 0},
+      {0, CAN_EFF_MASK, 1},
+  };
+  if (Count == 0) {
+    Wanted = All;
+    Count = 2;
+  }
+  bool is_mailbox = XCANFD_GET_RX_MODE(InstancePtr) == 1;
+  int Slots =
+      is_mailbox ? InstancePtr->CanFdConfig.NumofRxMbBuf : XCANFD_NOOF_AFR;
+  int Pairs = canfd_filter_compile(&Filter, Wanted, Count, Slots);
+  if (Pairs <= 0) {
+    bsp_canfd_debug_printf("Error: canfd_filter_compile failed, %d slots\n",
+                           Slots);
+    return -1;
+  }
+  bsp_canfd_debug_printf("RX_MODE %s Filter: %d/%d, %d false positives\n",
+                         is_mailbox ? "Mailbox" : "Sequential", Pairs, Slots,
+                         Filter.false_positives);
+
+  if (!is_mailbox) {
+    XCanFd_AcceptFilterDisable(InstancePtr, XCANFD_AFR_UAF_ALL_MASK);
+  }
+  for (int i = 0; i < Pairs; i++) {
+    const struct canfd_filter_pair *Pair = &Filter.pairs[i];
+    bsp_canfd_debug_printf("  %s %08X/%08X accepts %d, %d unwanted\n",
+                           Pair->extended ? "EFF" : "SFF", Pair->id,
+                           Pair->mask, Pair->accepted, Pair->false_positives);
+  }
+  u32 EnableMask = 0;
+  for (int i = 0; i < Slots; i++) {
+    u32 MaskValue;
+    u32 IdValue;
+    int Status;
+    if (is_mailbox) {
+      // a mailbox holds a single frame, the ones past the pairs repeat them
+      // so a burst still finds empty mailboxes; the core fills the lowest
+      // empty one, so frames of one pair can come out of order
+      XCanFd_RxBuff_MailBox_DeActive(InstancePtr, i);
+      canfd_filter_to_xcanfd(&Filter.pairs[i % Pairs], &MaskValue, &IdValue);
+      Status = XCanFd_Set_MailBox_IdMask(InstancePtr, i, MaskValue, IdValue);
+      if (Status == XST_SUCCESS) {
+        Status = XCanFd_RxBuff_MailBox_Active(InstancePtr, i);
+      }
+    } else {
+      if (i >= Pairs) {
+        break;
+      }
+      canfd_filter_to_xcanfd(&Filter.pairs[i], &MaskValue, &IdValue);
+      // filters are numbered from 1
+      Status = XCanFd_AcceptFilterSet(InstancePtr, i + 1, MaskValue, IdValue);
+      EnableMask |= (u32)1 << i;
+    }
+    if (Status != XST_SUCCESS) {
+      bsp_canfd_debug_printf("Error: filter %d returned %d\n", i, Status);
+      return -2;
+    }
+  }
+  if (!is_mailbox) {
+    XCanFd_AcceptFilterEnable(InstancePtr, EnableMask);
+  }
+  return Pairs;
+}
+
+int bsp_canfd_recv_batch(XCanFd *InstancePtr, struct canfd_frame *frames,
+                         int max) {
+  struct bsp_canfd *Bsp = bsp_canfd_get(InstancePtr);
+  if (Bsp == NULL) {
+    return -1;
+  }
+  return canfd_ring_pop(&Bsp->RxRing, frames, max);
+}
+
+void bsp_canfd_print(const struct canfd_frame *frame) {
   bool is_extended = frame->can_id & CAN_EFF_FLAG ? true : false;
   bool is_remote = frame->can_id & CAN_RTR_FLAG ? true : false;
-  bool is_fd = frame->flags & CANFD_FDF ? true : false;
+  bool is_fdf = frame->flags & CANFD_FDF ? true : false;
   bool is_brs = frame->flags & CANFD_BRS ? true : false;
-  bool is_esi = frame->flags & CANFD_ESI ? true : false;
-  u32 TxFrame[CANFD_MTU];
-  TxFrame[0] = XCanFd_CreateIdValue(
-      CAN_SFF_MASK & (is_extended ? ((frame->can_id & CAN_EFF_MASK) >> 18)
-                                  : frame->can_id),
-      is_extended ? 1 : (u32)is_remote, (u32)is_extended,
-      (u32)is_extended ? (frame->can_id & 0x3FFFF) : 0,
-      is_extended ? (u32)is_remote : 0);
-  if ((!is_fd) && (!is_brs)) {
-    TxFrame[1] = XCanFd_CreateDlcValue(frame->len);
+  if (is_extended) {
+    bsp_canfd_debug_printf("%08X ", frame->can_id & CAN_EFF_MASK);
   } else {
+    bsp_canfd_debug_printf("%03X ", frame->can_id & CAN_SFF_MASK);
+  }
+  if (is_remote) {
+    bsp_canfd_debug_printf("R [%d]", frame->len);
+  } else {
+    bsp_canfd_debug_printf("D ");
+    if (is_fdf) {
+      bsp_canfd_debug_printf("F ");
+    } else {
+      bsp_canfd_debug_printf("- ");
+    }
     if (is_brs) {
-      TxFrame[1] =
-          XCanFd_Create_CanFD_Dlc_BrsValue(XCanFd_GetLen2Dlc(frame->len));
+      bsp_canfd_debug_printf("B ");
     } else {
-      TxFrame[1] = XCanFd_Create_CanFD_DlcValue(XCanFd_GetLen2Dlc(frame->len));
+      bsp_canfd_debug_printf("- ");
+    }
+    if ((!is_fdf) && (!is_brs)) {
+      bsp_canfd_debug_printf("[%d] ", frame->len);
+    } else {
+      bsp_canfd_debug_printf("[%02d] ", frame->len);
+    }
+    for (int i = 0; i < frame->len; i++) {
+      bsp_canfd_debug_printf("%02X ", frame->data[i]);
     }
   }
-  u8 *FramePtr = (u8 *)(&TxFrame[2]);
-  for (int i = 0; i < frame->len; i++) {
-    FramePtr[i] = frame->data[i];
-  }
-  u32 TxBufferNumber;
-  int status = XCanFd_Send(InstancePtr, TxFrame, &TxBufferNumber);
-  if (status == XST_FIFO_NO_ROOM) {
-    bsp_canfd_debug_printf("Error: XCanFd_Send returned XST_FIFO_NO_ROOM\n");
-    return -1;
-  }
-  if (status != XST_SUCCESS) {
-    bsp_canfd_debug_printf("Error: XCanFd_Send returned %d\n", status);
-    return -2;
-  }
-  return 0;
-}
\ No newline at end of file
+  bsp_canfd_debug_printf("\n");
+}
@@ -4,12 +4,77 @@
 #include <xcanfd.h>
 
 #include "can.h"
+#include "canfd_filter.h"
 
 #define BSP_CANFD_DEBUG 1
 
+// CAN clock of the AXI CAN FD core, bit timings are solved against it
+#define BSP_CANFD_CLOCK_HZ 80000000
+
+// XCanFd instances served by the BSP
+#define BSP_CANFD_MAX_INSTANCES 2
+// most frames the RX interrupt takes out of the hardware per call
+#define BSP_CANFD_RX_BURST 32
+// ticks per second of bsp_canfd_timer()
+#define BSP_CANFD_TIMER_HZ 100000000
+
+struct bsp_canfd_stats {
+  uint32_t rx_frames;     // taken out of the hardware
+  uint32_t rx_bytes;
+  uint32_t rx_drops;      // lost because the RX ring was full
+  uint32_t rx_overflows;  // RX FIFO overflow interrupts
+  uint32_t tx_frames;     // transmitted
+  uint32_t tx_bytes;
+  uint32_t tx_drops;      // TX queue full or refused by XCanFd_Send
+  uint32_t tx_pending;    // frames waiting in the TX queue
+  uint32_t tx_high_water;
+  // error interrupts by type, arbitration phase then data phase
+  uint32_t bit_errors;
+  uint32_t stuff_errors;
+  uint32_t form_errors;
+  uint32_t ack_errors;
+  uint32_t crc_errors;
+  uint32_t fd_bit_errors;
+  uint32_t fd_stuff_errors;
+  uint32_t fd_form_errors;
+  uint32_t fd_crc_errors;
+  uint32_t arbitration_lost;
+  uint32_t bus_off;  // each one followed by a recovery
+  uint32_t protocol_exceptions;
+  // since the previous snapshot
+  uint32_t bus_load;        // per mille, stuffed length of the frames seen
+  uint32_t tx_latency_min;  // bsp_canfd_send to TX complete, us
+  uint32_t tx_latency_avg;
+  uint32_t tx_latency_max;
+};
+
 extern int bsp_canfd_init(XCanFd *InstancePtr, uint32_t BaseAddress,
                           uint32_t BaudRate, float SamplePoint,
                           uint32_t FastBaudRate, float FastSamplePoint);
+// queue the frame for transmission, highest arbitration priority first; the
+// TX done interrupt refills the hardware TX buffers from the queue
+// returns -1 if the queue is full
 extern int bsp_canfd_send(XCanFd *InstancePtr, struct canfd_frame *frame);
+// counters since init, bus load and TX latency since the previous call
+// returns -1 for an unknown instance
+extern int bsp_canfd_get_stats(XCanFd *InstancePtr,
+                               struct bsp_canfd_stats *Stats);
+// free running timer for the bus load and the TX latency, counting
+// BSP_CANFD_TIMER_HZ; provided by the application, main.c reads the AXI
+// Timer (bsp_timer.c)
+extern uint32_t bsp_canfd_timer(void);
+// accept only the wanted identifiers and ranges, Count 0 accepts everything;
+// compiles them into the sequential acceptance filters or the RX mailboxes,
+// whichever the core is built with, wanted is sorted and merged in place;
+// all RX mailboxes are used, the pairs repeated over the ones left over
+// returns the number of filters used or a negative value on error
+extern int bsp_canfd_set_filters(XCanFd *InstancePtr,
+                                 struct canfd_filter_range *Wanted, int Count);
+// frames received since the last call, up to max, from the RX ring the
+// interrupt fills; returns the number of frames or -1 for an unknown instance
+extern int bsp_canfd_recv_batch(XCanFd *InstancePtr, struct canfd_frame *frames,
+                                int max);
+// candump like line, for the main loop, not for interrupt context
+extern void bsp_canfd_print(const struct canfd_frame *frame);
 
 #endif
@@ -0,0 +1,31 @@
+#ifndef BSP_TIMER_H
+#define BSP_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum { BSP_TIMER0 = 0, BSP_TIMERNUM } timer_id_t;
+
+// AXI Timer clock
+#define BSP_TIMER_HZ 100000000
+
+#define MAX_TIMER_CALLBACKS 4
+typedef void (*timer_callback_t)(void *data);
+int bsp_timer_register_callback(timer_id_t timer_id, float period_ms,
+                                timer_callback_t callback, void *data);
+int bsp_timer_init(timer_id_t timer_id, uint32_t base_addr, float period_ms,
+                   bool auto_start);
+void bsp_timer_start(timer_id_t timer_id);
+void bsp_timer_stop(timer_id_t timer_id);
+void bsp_timer_process(void);
+
+uint64_t bsp_uptime_ms(void);
+// the second counter of the timer, free running up at BSP_TIMER_HZ from
+// bsp_timer_init on, wraps every 42.9 s
+uint32_t bsp_timer_ticks(timer_id_t timer_id);
+// us since bsp_timer_init, the ticks since the previous call added up, so
+// it wraps at 2^32 us like a 32 bit us clock; has to be called at least once
+// per wrap of the counter
+uint32_t bsp_timer_us(timer_id_t timer_id);
+
+#endif
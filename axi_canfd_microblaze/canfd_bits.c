@@ -0,0 +1,159 @@
+#include "canfd_bits.h"
+
+#include "canfd_codec.h"
+
+// CRC delimiter, ACK slot, ACK delimiter, 7 bits EOF, 3 bits intermission
+#define CANFD_BITS_TRAILER 13
+
+#define CAN_CRC15_POLY 0x4599
+
+// runs of equal bits in a byte sent MSB first: head << 8 | tail << 4 | max
+static const uint16_t byte_runs[256] = {
+    0x888, 0x717, 0x616, 0x626, 0x525, 0x515, 0x515, 0x535,
+    0x434, 0x414, 0x414, 0x424, 0x424, 0x414, 0x414, 0x444,
+    0x344, 0x313, 0x313, 0x323, 0x323, 0x313, 0x313, 0x333,
+    0x333, 0x313, 0x313, 0x323, 0x323, 0x313, 0x314, 0x355,
+    0x255, 0x214, 0x213, 0x223, 0x222, 0x212, 0x212, 0x233,
+    0x233, 0x212, 0x212, 0x222, 0x222, 0x212, 0x213, 0x244,
+    0x244, 0x213, 0x212, 0x222, 0x222, 0x212, 0x212, 0x233,
+    0x233, 0x213, 0x213, 0x223, 0x224, 0x214, 0x215, 0x266,
+    0x166, 0x115, 0x114, 0x124, 0x123, 0x113, 0x113, 0x133,
+    0x133, 0x112, 0x112, 0x122, 0x122, 0x112, 0x113, 0x144,
+    0x144, 0x113, 0x112, 0x122, 0x122, 0x111, 0x112, 0x133,
+    0x133, 0x112, 0x112, 0x122, 0x123, 0x113, 0x114, 0x155,
+    0x155, 0x114, 0x113, 0x123, 0x122, 0x112, 0x112, 0x133,
+    0x133, 0x112, 0x112, 0x122, 0x122, 0x112, 0x113, 0x144,
+    0x144, 0x113, 0x113, 0x123, 0x123, 0x113, 0x113, 0x133,
+    0x134, 0x114, 0x114, 0x124, 0x125, 0x115, 0x116, 0x177,
+    0x177, 0x116, 0x115, 0x125, 0x124, 0x114, 0x114, 0x134,
+    0x133, 0x113, 0x113, 0x123, 0x123, 0x113, 0x113, 0x144,
+    0x144, 0x113, 0x112, 0x122, 0x122, 0x112, 0x112, 0x133,
+    0x133, 0x112, 0x112, 0x122, 0x123, 0x113, 0x114, 0x155,
+    0x155, 0x114, 0x113, 0x123, 0x122, 0x112, 0x112, 0x133,
+    0x133, 0x112, 0x111, 0x122, 0x122, 0x112, 0x113, 0x144,
+    0x144, 0x113, 0x112, 0x122, 0x122, 0x112, 0x112, 0x133,
+    0x133, 0x113, 0x113, 0x123, 0x124, 0x114, 0x115, 0x166,
+    0x266, 0x215, 0x214, 0x224, 0x223, 0x213, 0x213, 0x233,
+    0x233, 0x212, 0x212, 0x222, 0x222, 0x212, 0x213, 0x244,
+    0x244, 0x213, 0x212, 0x222, 0x222, 0x212, 0x212, 0x233,
+    0x233, 0x212, 0x212, 0x222, 0x223, 0x213, 0x214, 0x255,
+    0x355, 0x314, 0x313, 0x323, 0x323, 0x313, 0x313, 0x333,
+    0x333, 0x313, 0x313, 0x323, 0x323, 0x313, 0x313, 0x344,
+    0x444, 0x414, 0x414, 0x424, 0x424, 0x414, 0x414, 0x434,
+    0x535, 0x515, 0x515, 0x525, 0x626, 0x616, 0x717, 0x888,
+};
+
+struct bit_counter {
+  uint32_t bits;  // stuff bits included
+  uint32_t stuff; // dynamic stuff bits
+  uint32_t run;   // equal bits at the end of the stream
+  uint32_t last;
+  uint32_t crc;   // CRC-15 of a classic frame
+  int crc15;
+};
+
+static void put_bit(struct bit_counter *c, uint32_t bit) {
+  if (c->crc15) {
+    uint32_t msb = (c->crc >> 14) & 0x01;
+    c->crc = (c->crc << 1) & 0x7FFF;
+    if (bit != msb) {
+      c->crc ^= CAN_CRC15_POLY;
+    }
+  }
+  c->bits++;
+  c->run = bit == c->last ? c->run + 1 : 1;
+  c->last = bit;
+  if (c->run == 5) {
+    c->bits++;
+    c->stuff++;
+    c->run = 1;
+    c->last = !bit;
+  }
+}
+
+// low nbits of value, MSB first
+static void put_bits(struct bit_counter *c, uint32_t value, int nbits) {
+  for (int i = nbits - 1; i >= 0; i--) {
+    put_bit(c, (value >> i) & 0x01);
+  }
+}
+
+static void put_byte(struct bit_counter *c, uint8_t byte) {
+  uint32_t runs = byte_runs[byte];
+  uint32_t head = runs >> 8;
+  uint32_t msb = byte >> 7;
+  if (!c->crc15 && (runs & 0x0F) < 5 &&
+      (msb != c->last || c->run + head < 5)) {
+    // no stuff bit can fall inside this byte
+    c->bits += 8;
+    c->run = (runs >> 4) & 0x0F;
+    c->last = byte & 0x01;
+    return;
+  }
+  put_bits(c, byte, 8);
+}
+
+void canfd_frame_bits(const struct canfd_frame *frame,
+                      struct canfd_frame_bits *bits) {
+  struct bit_counter c = {0, 0, 0, 1, 0, 0};
+  uint32_t is_extended = frame->can_id & CAN_EFF_FLAG ? 1 : 0;
+  uint32_t is_fd = frame->flags & (CANFD_FDF | CANFD_BRS) ? 1 : 0;
+  uint32_t is_brs = frame->flags & CANFD_BRS ? 1 : 0;
+  uint32_t id =
+      frame->can_id & (is_extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+
+  if (!is_fd) {
+    uint32_t is_remote = frame->can_id & CAN_RTR_FLAG ? 1 : 0;
+    uint32_t len = frame->len < CAN_MAX_DLEN ? frame->len : CAN_MAX_DLEN;
+    c.crc15 = 1;
+    put_bit(&c, 0);  // SOF
+    if (is_extended) {
+      // id[28:18], SRR, IDE, id[17:0], RTR, r1, r0
+      put_bits(&c, (id >> 18) << 2 | 0x3, 13);
+      put_bits(&c, (id & 0x3FFFF) << 3 | is_remote << 2, 21);
+    } else {
+      // id, RTR, IDE, r0
+      put_bits(&c, id << 3 | is_remote << 2, 14);
+    }
+    put_bits(&c, len, 4);
+    if (!is_remote) {
+      for (uint32_t i = 0; i < len; i++) {
+        put_bits(&c, frame->data[i], 8);
+      }
+    }
+    c.crc15 = 0;
+    put_bits(&c, c.crc, 15);
+    bits->nominal = (uint16_t)(c.bits + CANFD_BITS_TRAILER);
+    bits->data = 0;
+    return;
+  }
+
+  uint32_t len = frame->len < CANFD_MAX_DLEN ? frame->len : CANFD_MAX_DLEN;
+  uint32_t dlc = canfd_codec_len2dlc(len);
+  uint32_t padded = canfd_codec_dlc2len(dlc);
+  uint32_t esi = frame->flags & CANFD_ESI ? 1 : 0;
+  put_bit(&c, 0);  // SOF
+  if (is_extended) {
+    // id[28:18], SRR, IDE, id[17:0], RRS, FDF, res, BRS
+    put_bits(&c, (id >> 18) << 2 | 0x3, 13);
+    put_bits(&c, (id & 0x3FFFF) << 4 | 0x1 << 2 | is_brs, 22);
+  } else {
+    // id, RRS, IDE, FDF, res, BRS
+    put_bits(&c, id << 5 | 0x1 << 2 | is_brs, 16);
+  }
+  uint32_t arbitration = c.bits;
+  put_bits(&c, esi << 4 | dlc, 5);
+  for (uint32_t i = 0; i < padded; i++) {
+    put_byte(&c, i < len ? frame->data[i] : 0);
+  }
+  // stuff count and CRC, a fixed stuff bit before every 4 bits
+  uint32_t field = 4 + (padded > 16 ? 21 : 17);
+  c.bits += field + (field + 3) / 4;
+  if (is_brs) {
+    bits->nominal = (uint16_t)(arbitration + CANFD_BITS_TRAILER);
+    bits->data = (uint16_t)(c.bits - arbitration);
+  } else {
+    bits->nominal = (uint16_t)(c.bits + CANFD_BITS_TRAILER);
+    bits->data = 0;
+  }
+}
@@ -0,0 +1,25 @@
+#ifndef CANFD_BITS_H
+#define CANFD_BITS_H
+
+#include <stdint.h>
+
+#include "can.h"
+
+/*
+ * Bits a frame occupies on the bus, SOF to the end of the intermission,
+ * stuff bits included. The classic frame is stuffed up to the end of its
+ * CRC, so its CRC-15 is computed; a CAN FD frame has dynamic stuffing up to
+ * the end of the data field and fixed stuff bits in the CRC field, so its
+ * length does not depend on the CRC. With CANFD_BRS the bits from ESI to
+ * the end of the CRC field run at the data bitrate. Pure C so it also
+ * builds on the host.
+ */
+struct canfd_frame_bits {
+  uint16_t nominal; /* at the arbitration bitrate */
+  uint16_t data;    /* at the data bitrate, 0 without CANFD_BRS */
+};
+
+extern void canfd_frame_bits(const struct canfd_frame *frame,
+                             struct canfd_frame_bits *bits);
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef CANFD_CODEC_H
+#define CANFD_CODEC_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "can.h"
+
+/*
+ * XCanFd frame words <-> struct canfd_frame, without the Xilinx headers so it
+ * also builds on the host. A frame as XCanFd_Send / XCanFd_Recv_* use it:
+ * word 0 ID register, word 1 DLC register, then the payload bytes in order.
+ * The register layout is the one of xcanfd_hw.h. Both directions work on
+ * whole words and map DLC and length through tables. test/canfd_codec_test.c
+ * checks both directions against a field by field reference.
+ */
+
+/* ID register */
+#define CANFD_X_IDR_ID1_MASK 0xFFE00000U /* id[10:0] or id[28:18] */
+#define CANFD_X_IDR_ID1_SHIFT 21
+#define CANFD_X_IDR_SRR_MASK 0x00100000U /* RTR of a standard frame */
+#define CANFD_X_IDR_IDE_MASK 0x00080000U
+#define CANFD_X_IDR_ID2_MASK 0x0007FFFEU /* id[17:0] */
+#define CANFD_X_IDR_ID2_SHIFT 1
+#define CANFD_X_IDR_RTR_MASK 0x00000001U /* RTR of an extended frame */
+
+/* DLC register */
+#define CANFD_X_DLCR_DLC_MASK 0xF0000000U
+#define CANFD_X_DLCR_DLC_SHIFT 28
+#define CANFD_X_DLCR_EDL_MASK 0x08000000U /* CAN FD frame */
+#define CANFD_X_DLCR_BRS_MASK 0x04000000U
+#define CANFD_X_DLCR_ESI_MASK 0x02000000U /* rx only */
+
+/* ID, DLC and 64 bytes of payload */
+#define CANFD_X_FRAME_WORDS (2 + CANFD_MAX_DLEN / 4)
+
+static inline uint8_t canfd_codec_dlc2len(uint32_t dlc) {
+  static const uint8_t len[16] = {0, 1,  2,  3,  4,  5,  6,  7,
+                                  8, 12, 16, 20, 24, 32, 48, 64};
+  return len[dlc & 0x0F];
+}
+
+/* smallest DLC that holds len bytes, len up to CANFD_MAX_DLEN */
+static inline uint8_t canfd_codec_len2dlc(uint32_t len) {
+  static const uint8_t dlc[CANFD_MAX_DLEN + 1] = {
+      0,  1,  2,  3,  4,  5,  6,  7,  8,  /* 0 - 8 */
+      9,  9,  9,  9,                      /* 9 - 12 */
+      10, 10, 10, 10,                     /* 13 - 16 */
+      11, 11, 11, 11,                     /* 17 - 20 */
+      12, 12, 12, 12,                     /* 21 - 24 */
+      13, 13, 13, 13, 13, 13, 13, 13,     /* 25 - 32 */
+      14, 14, 14, 14, 14, 14, 14, 14,     /* 33 - 40 */
+      14, 14, 14, 14, 14, 14, 14, 14,     /* 41 - 48 */
+      15, 15, 15, 15, 15, 15, 15, 15,     /* 49 - 56 */
+      15, 15, 15, 15, 15, 15, 15, 15};    /* 57 - 64 */
+  return dlc[len < CANFD_MAX_DLEN ? len : CANFD_MAX_DLEN];
+}
+
+/*
+ * Payload in whole words, the frame data is 8 byte aligned and the word
+ * array 4 byte aligned, so each memcpy is a single load and store. Up to
+ * three bytes past len are copied along.
+ */
+static inline void canfd_codec_copy_words(void *dst, const void *src,
+                                          uint32_t len) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  for (uint32_t i = 0; i < len; i += 4) {
+    uint32_t w;
+    memcpy(&w, s + i, 4);
+    memcpy(d + i, &w, 4);
+  }
+}
+
+/* received frame words -> frame */
+static inline void xcanfd_to_canfd_frame(const uint32_t *words,
+                                         struct canfd_frame *frame) {
+  uint32_t idr = words[0];
+  uint32_t dlcr = words[1];
+  uint32_t id1 = (idr & CANFD_X_IDR_ID1_MASK) >> CANFD_X_IDR_ID1_SHIFT;
+  uint32_t dlc = (dlcr & CANFD_X_DLCR_DLC_MASK) >> CANFD_X_DLCR_DLC_SHIFT;
+  int is_remote;
+  if (idr & CANFD_X_IDR_IDE_MASK) {
+    uint32_t id2 = (idr & CANFD_X_IDR_ID2_MASK) >> CANFD_X_IDR_ID2_SHIFT;
+    frame->can_id = (id1 << 18 | id2) | CAN_EFF_FLAG;
+    is_remote = idr & CANFD_X_IDR_RTR_MASK ? 1 : 0;
+  } else {
+    frame->can_id = id1;
+    is_remote = idr & CANFD_X_IDR_SRR_MASK ? 1 : 0;
+  }
+  frame->flags = 0;
+  frame->__res0 = 0;
+  frame->__res1 = 0;
+  if (dlcr & CANFD_X_DLCR_EDL_MASK) {
+    frame->flags |= CANFD_FDF;
+    if (dlcr & CANFD_X_DLCR_BRS_MASK) {
+      frame->flags |= CANFD_BRS;
+    }
+    if (dlcr & CANFD_X_DLCR_ESI_MASK) {
+      frame->flags |= CANFD_ESI;
+    }
+    frame->len = canfd_codec_dlc2len(dlc);
+  } else {
+    frame->len = dlc < CAN_MAX_DLEN ? dlc : CAN_MAX_DLEN;
+  }
+  if (is_remote) {
+    /* len is the requested length, there is no payload */
+    frame->can_id |= CAN_RTR_FLAG;
+    return;
+  }
+  canfd_codec_copy_words(frame->data, &words[2], frame->len);
+}
+
+/* frame -> words for XCanFd_Send, CANFD_X_FRAME_WORDS long */
+static inline void canfd_frame_to_xcanfd(const struct canfd_frame *frame,
+                                         uint32_t *words) {
+  /* CAN FD has no remote frames, CANFD_BRS alone means a CAN FD frame */
+  uint32_t is_fd = frame->flags & (CANFD_FDF | CANFD_BRS) ? 1 : 0;
+  uint32_t is_remote = !is_fd && (frame->can_id & CAN_RTR_FLAG) ? 1 : 0;
+  if (frame->can_id & CAN_EFF_FLAG) {
+    uint32_t id = frame->can_id & CAN_EFF_MASK;
+    words[0] = (id >> 18) << CANFD_X_IDR_ID1_SHIFT | CANFD_X_IDR_SRR_MASK |
+               CANFD_X_IDR_IDE_MASK |
+               (id & 0x3FFFF) << CANFD_X_IDR_ID2_SHIFT |
+               (is_remote ? CANFD_X_IDR_RTR_MASK : 0);
+  } else {
+    words[0] = (frame->can_id & CAN_SFF_MASK) << CANFD_X_IDR_ID1_SHIFT |
+               (is_remote ? CANFD_X_IDR_SRR_MASK : 0);
+  }
+  uint32_t len = frame->len;
+  uint32_t dlcr;
+  if (is_fd) {
+    dlcr = CANFD_X_DLCR_EDL_MASK;
+    if (frame->flags & CANFD_BRS) {
+      dlcr |= CANFD_X_DLCR_BRS_MASK;
+    }
+    if (len > CANFD_MAX_DLEN) {
+      len = CANFD_MAX_DLEN;
+    }
+  } else {
+    dlcr = 0;
+    if (len > CAN_MAX_DLEN) {
+      len = CAN_MAX_DLEN;
+    }
+  }
+  uint32_t dlc = canfd_codec_len2dlc(len);
+  words[1] = dlcr | dlc << CANFD_X_DLCR_DLC_SHIFT;
+  if (!is_remote) {
+    canfd_codec_copy_words(&words[2], frame->data, len);
+    /* a CAN FD length between two DLCs is padded with zeros, not with what
+     * the word array held */
+    uint32_t dlen = canfd_codec_dlc2len(dlc);
+    if (dlen > len) {
+      memset((uint8_t *)&words[2] + len, 0, dlen - len);
+    }
+  }
+}
+
+#endif
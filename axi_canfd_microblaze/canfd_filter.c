@@ -0,0 +1,342 @@
+#include "canfd_filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "canfd_codec.h"
+
+#define CANFD_FILTER_NO_MERGE 0xFFFFFFFFU
+
+static uint32_t id_bits(uint8_t extended) {
+  return extended ? CAN_EFF_ID_BITS : CAN_SFF_ID_BITS;
+}
+
+static uint32_t id_mask(uint8_t extended) {
+  return extended ? CAN_EFF_MASK : CAN_SFF_MASK;
+}
+
+static uint32_t pair_size(const struct canfd_filter_pair *p) {
+  return 1U << (id_bits(p->extended) - __builtin_popcount(p->mask));
+}
+
+// smallest pair accepting both
+static struct canfd_filter_pair pair_merge(const struct canfd_filter_pair *a,
+                                           const struct canfd_filter_pair *b) {
+  struct canfd_filter_pair m;
+  memset(&m, 0, sizeof(m));
+  m.extended = a->extended;
+  m.mask = a->mask & b->mask & ~(a->id ^ b->id);
+  m.id = a->id & m.mask;
+  return m;
+}
+
+// a accepts everything b accepts
+static int pair_covers(const struct canfd_filter_pair *a,
+                       const struct canfd_filter_pair *b) {
+  return a->extended == b->extended && (b->mask & a->mask) == a->mask &&
+         ((a->id ^ b->id) & a->mask) == 0;
+}
+
+// identifiers the merge of a and b accepts that neither accepted before
+static uint32_t merge_cost(const struct canfd_filter_pair *a,
+                           const struct canfd_filter_pair *b) {
+  if (a->extended != b->extended) {
+    return CANFD_FILTER_NO_MERGE;
+  }
+  struct canfd_filter_pair m = pair_merge(a, b);
+  uint32_t both = pair_size(a) + pair_size(b);
+  if (((a->id ^ b->id) & a->mask & b->mask) == 0) {
+    struct canfd_filter_pair i = *a;
+    i.mask = a->mask | b->mask;
+    both -= pair_size(&i);
+  }
+  return pair_size(&m) - both;
+}
+
+static void update_best(struct canfd_filter *f, int i) {
+  f->best[i] = -1;
+  f->best_cost[i] = CANFD_FILTER_NO_MERGE;
+  for (int j = 0; j < CANFD_FILTER_MAX_PAIRS; j++) {
+    if (j == i || !f->alive[j]) {
+      continue;
+    }
+    uint32_t cost = merge_cost(&f->pairs[i], &f->pairs[j]);
+    if (f->best[i] < 0 || cost < f->best_cost[i]) {
+      f->best[i] = (int16_t)j;
+      f->best_cost[i] = cost;
+    }
+  }
+}
+
+// pair i changed or is new, refresh everybody's best partner
+static void pair_changed(struct canfd_filter *f, int i) {
+  for (int k = 0; k < CANFD_FILTER_MAX_PAIRS; k++) {
+    if (k == i || !f->alive[k]) {
+      continue;
+    }
+    if (f->best[k] < 0 || !f->alive[f->best[k]] || f->best[k] == i) {
+      update_best(f, k);
+      continue;
+    }
+    uint32_t cost = merge_cost(&f->pairs[k], &f->pairs[i]);
+    if (cost < f->best_cost[k]) {
+      f->best[k] = (int16_t)i;
+      f->best_cost[k] = cost;
+    }
+  }
+  update_best(f, i);
+}
+
+// one greedy merge, -1 if no two pairs can be merged
+static int merge_step(struct canfd_filter *f) {
+  int i = -1;
+  for (int k = 0; k < CANFD_FILTER_MAX_PAIRS; k++) {
+    if (f->alive[k] && f->best[k] >= 0 &&
+        f->best_cost[k] != CANFD_FILTER_NO_MERGE &&
+        (i < 0 || f->best_cost[k] < f->best_cost[i])) {
+      i = k;
+    }
+  }
+  if (i < 0) {
+    return -1;
+  }
+  int j = f->best[i];
+  f->pairs[i] = pair_merge(&f->pairs[i], &f->pairs[j]);
+  f->alive[j] = 0;
+  f->count--;
+  // pairs the merged one swallowed
+  for (int k = 0; k < CANFD_FILTER_MAX_PAIRS; k++) {
+    if (k != i && f->alive[k] && pair_covers(&f->pairs[i], &f->pairs[k])) {
+      f->alive[k] = 0;
+      f->count--;
+    }
+  }
+  pair_changed(f, i);
+  return 0;
+}
+
+static int add_block(struct canfd_filter *f, uint32_t id, uint32_t mask,
+                     uint8_t extended) {
+  struct canfd_filter_pair p;
+  memset(&p, 0, sizeof(p));
+  p.id = id;
+  p.mask = mask;
+  p.extended = extended;
+  for (int k = 0; k < CANFD_FILTER_MAX_PAIRS; k++) {
+    if (f->alive[k] && pair_covers(&f->pairs[k], &p)) {
+      return 0;
+    }
+  }
+  if (f->count == CANFD_FILTER_MAX_PAIRS && merge_step(f) != 0) {
+    return -1;
+  }
+  int slot = 0;
+  while (f->alive[slot]) {
+    slot++;
+  }
+  f->pairs[slot] = p;
+  f->alive[slot] = 1;
+  f->count++;
+  pair_changed(f, slot);
+  return 0;
+}
+
+static int range_compare(const void *a, const void *b) {
+  const struct canfd_filter_range *ra = a;
+  const struct canfd_filter_range *rb = b;
+  if (ra->extended != rb->extended) {
+    return ra->extended < rb->extended ? -1 : 1;
+  }
+  if (ra->first != rb->first) {
+    return ra->first < rb->first ? -1 : 1;
+  }
+  return 0;
+}
+
+static int normalise(struct canfd_filter_range *wanted, int nwanted) {
+  for (int i = 0; i < nwanted; i++) {
+    if (wanted[i].first > wanted[i].last ||
+        wanted[i].last > id_mask(wanted[i].extended)) {
+      return -1;
+    }
+  }
+  qsort(wanted, nwanted, sizeof(*wanted), range_compare);
+  int n = 0;
+  for (int i = 0; i < nwanted; i++) {
+    if (n > 0 && wanted[n - 1].extended == wanted[i].extended &&
+        (uint64_t)wanted[n - 1].last + 1 >= wanted[i].first) {
+      if (wanted[i].last > wanted[n - 1].last) {
+        wanted[n - 1].last = wanted[i].last;
+      }
+      continue;
+    }
+    wanted[n++] = wanted[i];
+  }
+  return n;
+}
+
+// identifiers in [0, n] with x & mask == id
+static uint32_t count_upto(uint32_t n, uint32_t id, uint32_t mask,
+                           uint32_t bits) {
+  uint32_t count = 0;
+  uint32_t free_below = bits - __builtin_popcount(mask);
+  for (int b = (int)bits - 1; b >= 0; b--) {
+    uint32_t bit = 1U << b;
+    if (!(mask & bit)) {
+      free_below--;
+    }
+    if (n & bit) {
+      // this bit 0 and everything below free
+      if (!(mask & bit) || !(id & bit)) {
+        count += 1U << free_below;
+      }
+      if ((mask & bit) && !(id & bit)) {
+        return count;
+      }
+    } else if ((mask & bit) && (id & bit)) {
+      return count;
+    }
+  }
+  return count + 1;
+}
+
+static uint32_t wanted_in_pair(const struct canfd_filter_pair *p,
+                               const struct canfd_filter_range *wanted,
+                               int nwanted) {
+  uint32_t bits = id_bits(p->extended);
+  uint32_t count = 0;
+  for (int i = 0; i < nwanted; i++) {
+    if (wanted[i].extended != p->extended) {
+      continue;
+    }
+    count += count_upto(wanted[i].last, p->id, p->mask, bits);
+    if (wanted[i].first > 0) {
+      count -= count_upto(wanted[i].first - 1, p->id, p->mask, bits);
+    }
+  }
+  return count;
+}
+
+static int is_wanted(const struct canfd_filter_range *wanted, int nwanted,
+                     uint32_t id, uint8_t extended) {
+  int lo = 0;
+  int hi = nwanted;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    const struct canfd_filter_range *r = &wanted[mid];
+    if (r->extended < extended ||
+        (r->extended == extended && r->last < id)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < nwanted && wanted[lo].extended == extended &&
+         wanted[lo].first <= id;
+}
+
+int canfd_filter_compile(struct canfd_filter *filter,
+                         struct canfd_filter_range *wanted, int nwanted,
+                         int slots) {
+  memset(filter, 0, sizeof(*filter));
+  int n = normalise(wanted, nwanted);
+  if (n < 0) {
+    return -1;
+  }
+  filter->nwanted = n;
+  int types = (n > 0 && !wanted[0].extended) + (n > 0 && wanted[n - 1].extended);
+  if (slots > CANFD_FILTER_MAX_PAIRS) {
+    slots = CANFD_FILTER_MAX_PAIRS;
+  }
+  if (slots < types) {
+    return -1;
+  }
+
+  // exact cover, each range as aligned power of two blocks
+  for (int i = 0; i < n; i++) {
+    uint32_t full = id_mask(wanted[i].extended);
+    uint64_t first = wanted[i].first;
+    uint64_t last = wanted[i].last;
+    while (first <= last) {
+      uint64_t size = first ? first & -first : (uint64_t)full + 1;
+      while (first + size - 1 > last) {
+        size >>= 1;
+      }
+      if (add_block(filter, (uint32_t)first, full & ~(uint32_t)(size - 1),
+                    wanted[i].extended) != 0) {
+        return -1;
+      }
+      first += size;
+    }
+  }
+  while (filter->count > slots) {
+    if (merge_step(filter) != 0) {
+      return -1;
+    }
+  }
+
+  // compact and account
+  int count = 0;
+  for (int k = 0; k < CANFD_FILTER_MAX_PAIRS; k++) {
+    if (!filter->alive[k]) {
+      continue;
+    }
+    struct canfd_filter_pair *p = &filter->pairs[count];
+    *p = filter->pairs[k];
+    p->accepted = pair_size(p);
+    p->false_positives = p->accepted - wanted_in_pair(p, wanted, n);
+    filter->false_positives += p->false_positives;
+    filter->alive[count++] = 1;
+  }
+  memset(&filter->alive[count], 0, CANFD_FILTER_MAX_PAIRS - count);
+  filter->count = count;
+  return count;
+}
+
+int canfd_filter_match(const struct canfd_filter_pair *pair, canid_t can_id) {
+  uint8_t extended = can_id & CAN_EFF_FLAG ? 1 : 0;
+  uint32_t id = can_id & id_mask(extended);
+  return pair->extended == extended && (id & pair->mask) == pair->id;
+}
+
+int canfd_filter_false_positives(const struct canfd_filter *filter,
+                                 const struct canfd_filter_range *wanted,
+                                 canid_t *ids, int max) {
+  int n = 0;
+  for (int i = 0; i < filter->count && n < max; i++) {
+    const struct canfd_filter_pair *p = &filter->pairs[i];
+    if (p->false_positives == 0) {
+      continue;
+    }
+    uint32_t free_bits = id_mask(p->extended) & ~p->mask;
+    uint32_t sub = 0;
+    do {
+      uint32_t id = p->id | sub;
+      canid_t can_id = id | (p->extended ? CAN_EFF_FLAG : 0);
+      int seen = is_wanted(wanted, filter->nwanted, id, p->extended);
+      for (int j = 0; j < i && !seen; j++) {
+        seen = canfd_filter_match(&filter->pairs[j], can_id);
+      }
+      if (!seen) {
+        ids[n++] = can_id;
+      }
+      sub = (sub - free_bits) & free_bits;
+    } while (sub != 0 && n < max);
+  }
+  return n;
+}
+
+void canfd_filter_to_xcanfd(const struct canfd_filter_pair *pair,
+                            uint32_t *MaskValue, uint32_t *IdValue) {
+  if (pair->extended) {
+    *MaskValue = (pair->mask >> 18) << CANFD_X_IDR_ID1_SHIFT |
+                 CANFD_X_IDR_IDE_MASK |
+                 (pair->mask & 0x3FFFF) << CANFD_X_IDR_ID2_SHIFT;
+    *IdValue = (pair->id >> 18) << CANFD_X_IDR_ID1_SHIFT |
+               CANFD_X_IDR_SRR_MASK | CANFD_X_IDR_IDE_MASK |
+               (pair->id & 0x3FFFF) << CANFD_X_IDR_ID2_SHIFT;
+  } else {
+    *MaskValue = pair->mask << CANFD_X_IDR_ID1_SHIFT | CANFD_X_IDR_IDE_MASK;
+    *IdValue = pair->id << CANFD_X_IDR_ID1_SHIFT;
+  }
+}
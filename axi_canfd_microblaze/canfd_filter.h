@@ -0,0 +1,78 @@
+#ifndef CANFD_FILTER_H
+#define CANFD_FILTER_H
+
+#include <stdint.h>
+
+#include "can.h"
+
+/*
+ * Acceptance filter compiler: turns a list of wanted identifiers and
+ * identifier ranges into at most `slots` ID/mask pairs, the form the
+ * sequential acceptance filters and the RX mailboxes of the AXI CAN FD core
+ * take. The exact cover (aligned blocks of each range) is used when it fits;
+ * otherwise pairs are merged greedily, always picking the merge that
+ * accepts the fewest additional identifiers. Standard and extended
+ * identifiers never share a pair. Pure C so it also builds on the host.
+ */
+
+/* pairs the compiler works with, bigger sets are merged while they are added */
+#ifndef CANFD_FILTER_MAX_PAIRS
+#define CANFD_FILTER_MAX_PAIRS 128
+#endif
+
+struct canfd_filter_range {
+  uint32_t first; /* identifier without flags */
+  uint32_t last;  /* inclusive, first for a single identifier */
+  uint8_t extended;
+};
+
+struct canfd_filter_pair {
+  uint32_t id;              /* id & mask == id */
+  uint32_t mask;            /* 1 = bit compared */
+  uint8_t extended;         /* IDE compared against this */
+  uint32_t accepted;        /* identifiers the pair accepts */
+  uint32_t false_positives; /* of those, identifiers nobody asked for */
+};
+
+struct canfd_filter {
+  int count;
+  int nwanted; /* ranges left in wanted after sorting and merging */
+  /* sum of the pairs' false positives, an identifier accepted by two
+   * overlapping pairs counts twice */
+  uint32_t false_positives;
+  struct canfd_filter_pair pairs[CANFD_FILTER_MAX_PAIRS];
+  /* compiler workspace */
+  uint8_t alive[CANFD_FILTER_MAX_PAIRS];
+  int16_t best[CANFD_FILTER_MAX_PAIRS];
+  uint32_t best_cost[CANFD_FILTER_MAX_PAIRS];
+};
+
+/*
+ * Compile wanted into at most slots pairs. wanted is sorted and merged in
+ * place; returns the number of pairs, or -1 if slots cannot hold even one
+ * pair per identifier type or a range is invalid.
+ */
+extern int canfd_filter_compile(struct canfd_filter *filter,
+                                struct canfd_filter_range *wanted,
+                                int nwanted, int slots);
+
+/* 1 if the pair accepts the identifier (CAN_EFF_FLAG selects the type) */
+extern int canfd_filter_match(const struct canfd_filter_pair *pair,
+                              canid_t can_id);
+
+/*
+ * Unwanted identifiers the compiled filter accepts, each once, with
+ * CAN_EFF_FLAG set for extended ones. wanted must be the array
+ * canfd_filter_compile() normalised. Writes at most max identifiers and
+ * returns how many were written. Walks every identifier a pair accepts, so
+ * it is slow for wide extended pairs.
+ */
+extern int canfd_filter_false_positives(const struct canfd_filter *filter,
+                                        const struct canfd_filter_range *wanted,
+                                        canid_t *ids, int max);
+
+/* pair -> ID register layout of the acceptance filter / mailbox registers */
+extern void canfd_filter_to_xcanfd(const struct canfd_filter_pair *pair,
+                                   uint32_t *MaskValue, uint32_t *IdValue);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef CANFD_RING_H
+#define CANFD_RING_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "can.h"
+
+/* frames per ring, power of two */
+#ifndef CANFD_RING_SIZE
+#define CANFD_RING_SIZE 64
+#endif
+
+#if (CANFD_RING_SIZE & (CANFD_RING_SIZE - 1)) != 0
+#error "CANFD_RING_SIZE must be a power of two"
+#endif
+
+/*
+ * Single producer / single consumer ring of frames, e.g. the RX interrupt
+ * fills it and the main loop drains it. head and the producer statistics are
+ * only written by the producer, tail only by the consumer; a release store
+ * of an index publishes the slots before it. No locks and no interrupt
+ * masking, pure C so it also builds on the host.
+ */
+struct canfd_ring {
+  uint32_t head;       /* free running, next slot to fill */
+  uint32_t tail;       /* free running, next slot to drain */
+  uint32_t drops;      /* frames lost because the ring was full */
+  uint32_t high_water; /* most frames ever waiting at once */
+  struct canfd_frame frames[CANFD_RING_SIZE];
+};
+
+static inline void canfd_ring_init(struct canfd_ring *ring) {
+  memset(ring, 0, sizeof(*ring));
+}
+
+static inline uint32_t canfd_ring_count(const struct canfd_ring *ring) {
+  return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+         __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/* producer: slot to fill, NULL and one drop counted if the ring is full */
+static inline struct canfd_frame *canfd_ring_reserve(struct canfd_ring *ring) {
+  uint32_t head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+      CANFD_RING_SIZE) {
+    ring->drops++;
+    return NULL;
+  }
+  return &ring->frames[head & (CANFD_RING_SIZE - 1)];
+}
+
+/* producer: publish the slot returned by canfd_ring_reserve() */
+static inline void canfd_ring_commit(struct canfd_ring *ring) {
+  uint32_t head = ring->head + 1;
+  uint32_t count = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (count > ring->high_water) {
+    ring->high_water = count;
+  }
+  __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+}
+
+/* consumer: copy out up to max frames, returns the number copied */
+static inline int canfd_ring_pop(struct canfd_ring *ring,
+                                 struct canfd_frame *frames, int max) {
+  uint32_t tail = ring->tail;
+  uint32_t count = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+  int n = count < (uint32_t)max ? (int)count : max;
+  for (int i = 0; i < n; i++) {
+    frames[i] = ring->frames[(tail + i) & (CANFD_RING_SIZE - 1)];
+  }
+  __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include "canfd_stream.h"
+
+#include <string.h>
+
+#include "bsp_crc.h"
+
+static void put16(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+void canfd_stream_init(struct canfd_stream *stream) {
+  memset(stream, 0, sizeof(*stream));
+  stream->used = CANFD_STREAM_HEADER_SIZE;
+}
+
+int canfd_stream_add(struct canfd_stream *stream,
+                     const struct canfd_frame *frame, uint32_t time) {
+  uint32_t len = frame->len;
+  uint32_t max = frame->flags & CANFD_FDF ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+  if (len > max) {
+    len = max;
+  }
+  uint32_t data_len = frame->can_id & CAN_RTR_FLAG ? 0 : len;
+  if (stream->used + CANFD_STREAM_RECORD_SIZE + data_len >
+      CANFD_STREAM_PACKET_SIZE) {
+    return -1;
+  }
+  if (stream->records == 0) {
+    stream->time = time;
+  } else if (time - stream->time > 0xFFFF) {
+    return -1;
+  }
+  uint8_t *p = &stream->packets[stream->fill][stream->used];
+  put32(p, frame->can_id);
+  put16(p + 4, time - stream->time);
+  p[6] = (uint8_t)len;
+  p[7] = frame->flags & (CANFD_FDF | CANFD_BRS | CANFD_ESI);
+  memcpy(p + CANFD_STREAM_RECORD_SIZE, frame->data, data_len);
+  stream->used += CANFD_STREAM_RECORD_SIZE + data_len;
+  stream->records++;
+  return 0;
+}
+
+const uint8_t *canfd_stream_finish(struct canfd_stream *stream,
+                                   uint32_t *len) {
+  if (stream->records == 0) {
+    *len = 0;
+    return NULL;
+  }
+  uint8_t *packet = stream->packets[stream->fill];
+  put32(packet, CANFD_STREAM_MAGIC);
+  put16(packet + 8, stream->seq++);
+  put16(packet + 10, stream->used - CANFD_STREAM_HEADER_SIZE);
+  put32(packet + 12, stream->time);
+  put32(packet + 4, bsp_crc32(packet + 8, stream->used - 8, 0));
+  *len = stream->used;
+  stream->fill ^= 1;
+  stream->used = CANFD_STREAM_HEADER_SIZE;
+  stream->records = 0;
+  return packet;
+}
@@ -0,0 +1,70 @@
+#ifndef CANFD_STREAM_H
+#define CANFD_STREAM_H
+
+#include <stdint.h>
+
+#include "can.h"
+
+/*
+ * Binary CAN-over-UART stream: frames are batched into CRC protected
+ * packets, about len + 8 bytes per frame instead of the 40 odd characters
+ * of a printed line. All fields little endian.
+ *
+ * packet header, 16 bytes
+ *   u32 magic  CANFD_STREAM_MAGIC, the receiver resyncs on it
+ *   u32 crc    bsp_crc32 of everything after this field
+ *   u16 seq    packet counter, a gap means lost packets
+ *   u16 len    bytes of records after the header
+ *   u32 time   us, timestamp of the first record
+ * record, 8 bytes + payload
+ *   u32 can_id SocketCAN identifier with CAN_EFF/RTR/ERR_FLAG
+ *   u16 dt     us after time
+ *   u8  len    payload length, no payload follows for remote frames
+ *   u8  flags  CANFD_FDF/BRS/ESI, 0 for a classic frame
+ *
+ * Two packet buffers: one is filled while the other one is on the wire, so
+ * a packet goes out as one contiguous, word aligned transfer. Pure C so it
+ * also builds on the host.
+ */
+
+#define CANFD_STREAM_MAGIC 0x53444643U /* "CFDS" */
+#define CANFD_STREAM_HEADER_SIZE 16
+#define CANFD_STREAM_RECORD_SIZE 8
+
+#ifndef CANFD_STREAM_PACKET_SIZE
+#define CANFD_STREAM_PACKET_SIZE 1024
+#endif
+
+#if CANFD_STREAM_PACKET_SIZE < CANFD_STREAM_HEADER_SIZE + \
+                                   CANFD_STREAM_RECORD_SIZE + CANFD_MAX_DLEN
+#error "CANFD_STREAM_PACKET_SIZE must hold at least one CAN FD frame"
+#endif
+
+struct canfd_stream {
+  uint8_t packets[2][CANFD_STREAM_PACKET_SIZE] __attribute__((aligned(4)));
+  uint32_t fill;    /* packet being filled */
+  uint32_t used;    /* its bytes, header included */
+  uint32_t records; /* its records */
+  uint32_t time;    /* its first record's time */
+  uint16_t seq;
+};
+
+extern void canfd_stream_init(struct canfd_stream *stream);
+
+/*
+ * Append a frame with its receive time in us. Returns -1 if it does not
+ * fit into the open packet, or is more than 65 ms after its first record;
+ * finish the packet and add the frame again.
+ */
+extern int canfd_stream_add(struct canfd_stream *stream,
+                            const struct canfd_frame *frame, uint32_t time);
+
+/*
+ * Close the open packet and start the next one in the other buffer.
+ * Returns the packet and its length in *len, NULL if it had no records.
+ * The packet stays untouched until the next call.
+ */
+extern const uint8_t *canfd_stream_finish(struct canfd_stream *stream,
+                                          uint32_t *len);
+
+#endif
@@ -0,0 +1,121 @@
+#include "canfd_timing.h"
+
+#include <string.h>
+
+// register fields of BRPR/BTR and F_BRPR/F_BTR hold the value minus one
+const struct canfd_timing_limits canfd_timing_xcanfd_nominal = {
+    1, 256, 1, 256, 1, 128, 128, 0,
+};
+const struct canfd_timing_limits canfd_timing_xcanfd_data = {
+    1, 256, 1, 32, 1, 16, 16, 31,
+};
+
+// bitrate error above which no solution is returned, ppm
+#define CANFD_TIMING_MAX_ERROR 10000
+
+static uint32_t abs_diff(uint32_t a, uint32_t b) {
+  return a > b ? a - b : b - a;
+}
+
+// 1 if a is a better choice than b
+static int timing_better(const struct canfd_timing *a,
+                         const struct canfd_timing *b, uint16_t sample_point) {
+  uint32_t ea = (uint32_t)(a->bitrate_error < 0 ? -a->bitrate_error
+                                                : a->bitrate_error);
+  uint32_t eb = (uint32_t)(b->bitrate_error < 0 ? -b->bitrate_error
+                                                : b->bitrate_error);
+  if (ea != eb) {
+    return ea < eb;
+  }
+  uint32_t sa = abs_diff(a->sample_point, sample_point);
+  uint32_t sb = abs_diff(b->sample_point, sample_point);
+  if (sa != sb) {
+    return sa < sb;
+  }
+  return a->brp < b->brp;
+}
+
+static void timing_fill(uint32_t clock, uint32_t bitrate,
+                        const struct canfd_timing_limits *limits,
+                        struct canfd_timing *t) {
+  uint32_t total = 1 + t->tseg1 + t->tseg2;
+  uint64_t cycles = (uint64_t)t->brp * total;
+  t->bitrate = (uint32_t)((clock + cycles / 2) / cycles);
+  int64_t diff = (int64_t)clock - (int64_t)bitrate * (int64_t)cycles;
+  t->bitrate_error =
+      (int32_t)(diff * 1000000 / ((int64_t)bitrate * (int64_t)cycles));
+  t->sample_point = (uint16_t)((1000 * (1 + t->tseg1) + total / 2) / total);
+  t->sjw = t->tseg2 < t->tseg1 ? t->tseg2 : t->tseg1;
+  if (t->sjw > limits->sjw_max) {
+    t->sjw = limits->sjw_max;
+  }
+  t->tdc = 0;
+  t->tdco = 0;
+  if (limits->tdco_max > 0 && t->brp <= 2) {
+    uint32_t ssp = t->brp * (1 + t->tseg1);
+    t->tdc = 1;
+    t->tdco = (uint16_t)(ssp < limits->tdco_max ? ssp : limits->tdco_max);
+  }
+}
+
+int canfd_timing_solve(uint32_t clock, uint32_t bitrate,
+                       uint16_t sample_point,
+                       const struct canfd_timing_limits *limits,
+                       struct canfd_timing *timing) {
+  struct canfd_timing best;
+  int found = 0;
+  if (bitrate == 0 || sample_point == 0 || sample_point >= 1000) {
+    return -1;
+  }
+  uint32_t total_min = 1 + limits->tseg1_min + limits->tseg2_min;
+  uint32_t total_max = 1 + limits->tseg1_max + limits->tseg2_max;
+  for (uint32_t brp = limits->brp_min; brp <= limits->brp_max; brp++) {
+    uint32_t ideal = clock / (brp * bitrate);
+    // the two totals around the ideal one
+    for (uint32_t total = ideal; total <= ideal + 1; total++) {
+      if (total < total_min || total > total_max) {
+        continue;
+      }
+      // sync + tseg1 ends on the sample point, try both neighbours
+      uint32_t sync_tseg1 = total * sample_point / 1000;
+      for (uint32_t s = sync_tseg1; s <= sync_tseg1 + 1; s++) {
+        if (s < (uint32_t)limits->tseg1_min + 1) {
+          continue;
+        }
+        uint32_t tseg1 = s - 1;
+        if (tseg1 > limits->tseg1_max) {
+          tseg1 = limits->tseg1_max;
+        }
+        if (total - 1 - tseg1 > limits->tseg2_max) {
+          tseg1 = total - 1 - limits->tseg2_max;
+        }
+        if (total - 1 - tseg1 < limits->tseg2_min) {
+          tseg1 = total - 1 - limits->tseg2_min;
+        }
+        if (tseg1 < limits->tseg1_min || tseg1 > limits->tseg1_max) {
+          continue;
+        }
+        struct canfd_timing t;
+        memset(&t, 0, sizeof(t));
+        t.brp = (uint16_t)brp;
+        t.tseg1 = (uint16_t)tseg1;
+        t.tseg2 = (uint16_t)(total - 1 - tseg1);
+        timing_fill(clock, bitrate, limits, &t);
+        if (!found || timing_better(&t, &best, sample_point)) {
+          best = t;
+          found = 1;
+        }
+      }
+    }
+    if (ideal < total_min) {
+      // larger prescalers only get further away
+      break;
+    }
+  }
+  if (!found || best.bitrate_error > CANFD_TIMING_MAX_ERROR ||
+      best.bitrate_error < -CANFD_TIMING_MAX_ERROR) {
+    return -1;
+  }
+  *timing = best;
+  return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef CANFD_TIMING_H
+#define CANFD_TIMING_H
+
+#include <stdint.h>
+
+/*
+ * Bit timing solver. For a core clock, bitrate and sample point it searches
+ * every prescaler and every TSEG1/TSEG2 split the controller allows and
+ * keeps, in this order, the smallest bitrate error, the smallest sample
+ * point error and the smallest prescaler (most time quanta per bit). SJW is
+ * the largest the segments allow. For a data phase with prescaler 1 or 2
+ * transmitter delay compensation is enabled with the secondary sample point
+ * on the sample point, as ISO 11898-1 11.3.3 and Linux can_calc_tdco() do.
+ * All lengths are in time quanta, not register values. Integer only, pure
+ * C so it also builds on the host.
+ *
+ * Configurations checked against the solver for the 80 MHz core clock,
+ * asserted by test/canfd_timing_test.c:
+ *
+ *   phase    bitrate  sp    brp tseg1 tseg2 sjw  tdco  error
+ *   nominal   125000  87.5   4   139   20   20    -      0
+ *   nominal   250000  87.5   2   139   20   20    -      0
+ *   nominal   500000  80.0   1   127   32   32    -      0
+ *   nominal   500000  87.5   1   139   20   20    -      0
+ *   nominal  1000000  80.0   1    63   16   16    -      0
+ *   data     1000000  80.0   2    31    8    8   31      0
+ *   data     2000000  80.0   1    31    8    8   31      0
+ *   data     4000000  80.0   1    15    4    4   16      0
+ *   data     5000000  75.0   1    11    4    4   12      0
+ *   data     5000000  80.0   1    12    3    3   13      0  (81.3 %)
+ *   data     8000000  80.0   1     7    2    2    8      0
+ *   data    10000000  75.0   1     5    2    2    6      0
+ *
+ * tdco is clamped to the 31 cycles the core takes, at 1 and 2 Mbit/s the
+ * secondary sample point then sits a little ahead of the sample point.
+ */
+
+struct canfd_timing_limits {
+  uint16_t brp_min;
+  uint16_t brp_max;
+  uint16_t tseg1_min; /* prop + phase segment 1 */
+  uint16_t tseg1_max;
+  uint16_t tseg2_min;
+  uint16_t tseg2_max;
+  uint16_t sjw_max;
+  uint16_t tdco_max; /* 0 if the phase has no delay compensation */
+};
+
+struct canfd_timing {
+  uint16_t brp;
+  uint16_t tseg1;
+  uint16_t tseg2;
+  uint16_t sjw;
+  uint8_t tdc;   /* transmitter delay compensation enabled */
+  uint16_t tdco; /* secondary sample point offset, core clock cycles */
+  uint32_t bitrate;       /* achieved */
+  int32_t bitrate_error;  /* achieved - requested, ppm */
+  uint16_t sample_point;  /* achieved, per mille */
+};
+
+/* AXI CAN FD (PG223) arbitration and data phase */
+extern const struct canfd_timing_limits canfd_timing_xcanfd_nominal;
+extern const struct canfd_timing_limits canfd_timing_xcanfd_data;
+
+/*
+ * sample_point in per mille, e.g. 875. Returns 0, or -1 if no combination
+ * reaches the bitrate within 1 %.
+ */
+extern int canfd_timing_solve(uint32_t clock, uint32_t bitrate,
+                              uint16_t sample_point,
+                              const struct canfd_timing_limits *limits,
+                              struct canfd_timing *timing);
+
+#endif
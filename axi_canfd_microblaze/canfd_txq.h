@@ -0,0 +1,151 @@
+#ifndef CANFD_TXQ_H
+#define CANFD_TXQ_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "can.h"
+
+/* frames per queue, at most 256 */
+#ifndef CANFD_TXQ_SIZE
+#define CANFD_TXQ_SIZE 64
+#endif
+
+#if CANFD_TXQ_SIZE > 256
+#error "CANFD_TXQ_SIZE must be at most 256"
+#endif
+
+/* carried along with a frame, not looked at by the queue */
+struct canfd_txq_meta {
+  uint32_t stamp;  /* when the frame was queued */
+  uint32_t bus_ns; /* time it takes on the bus */
+  uint32_t len;    /* payload bytes */
+};
+
+/*
+ * Software TX queue ordered like bus arbitration: the frame that would win
+ * arbitration is taken first, frames with the same key in the order they
+ * were pushed. A binary min heap of slot numbers over a fixed frame pool,
+ * no allocation. Not thread safe, the caller serialises the producer and
+ * the TX done interrupt. Pure C so it also builds on the host.
+ */
+struct canfd_txq_entry {
+  uint32_t key; /* canfd_txq_key(), lower wins */
+  uint32_t seq; /* push order among equal keys */
+  uint8_t slot; /* index into frames */
+};
+
+struct canfd_txq {
+  uint32_t count;
+  uint32_t seq;
+  uint32_t high_water; /* most frames ever waiting at once */
+  uint32_t drops;      /* frames refused because the queue was full */
+  uint8_t free[CANFD_TXQ_SIZE];
+  uint32_t nfree;
+  struct canfd_txq_entry heap[CANFD_TXQ_SIZE];
+  struct canfd_frame frames[CANFD_TXQ_SIZE];
+  struct canfd_txq_meta meta[CANFD_TXQ_SIZE];
+};
+
+/*
+ * Arbitration field as it goes on the wire, dominant (0) first: base id,
+ * RTR of a standard frame or SRR of an extended one, IDE, then the id
+ * extension and RTR of an extended frame. CAN FD frames carry no RTR bit.
+ */
+static inline uint32_t canfd_txq_key(const struct canfd_frame *frame) {
+  uint32_t rtr =
+      !(frame->flags & CANFD_FDF) && (frame->can_id & CAN_RTR_FLAG) ? 1 : 0;
+  if (frame->can_id & CAN_EFF_FLAG) {
+    uint32_t id = frame->can_id & CAN_EFF_MASK;
+    return (id >> 18) << 21 | 1u << 20 | 1u << 19 | (id & 0x3FFFF) << 1 | rtr;
+  }
+  return (frame->can_id & CAN_SFF_MASK) << 21 | rtr << 20;
+}
+
+static inline void canfd_txq_init(struct canfd_txq *q) {
+  memset(q, 0, sizeof(*q));
+  for (uint32_t i = 0; i < CANFD_TXQ_SIZE; i++) {
+    q->free[i] = (uint8_t)(CANFD_TXQ_SIZE - 1 - i);
+  }
+  q->nfree = CANFD_TXQ_SIZE;
+}
+
+static inline int canfd_txq_less(const struct canfd_txq_entry *a,
+                                 const struct canfd_txq_entry *b) {
+  if (a->key != b->key) {
+    return a->key < b->key;
+  }
+  /* wrap safe */
+  return (int32_t)(a->seq - b->seq) < 0;
+}
+
+/* copy the frame in, -1 and one drop counted if the queue is full */
+static inline int canfd_txq_push(struct canfd_txq *q,
+                                 const struct canfd_frame *frame,
+                                 const struct canfd_txq_meta *meta) {
+  if (q->nfree == 0) {
+    q->drops++;
+    return -1;
+  }
+  uint8_t slot = q->free[--q->nfree];
+  q->frames[slot] = *frame;
+  q->meta[slot] = *meta;
+  struct canfd_txq_entry e = {canfd_txq_key(frame), q->seq++, slot};
+  uint32_t i = q->count++;
+  while (i > 0) {
+    uint32_t parent = (i - 1) / 2;
+    if (!canfd_txq_less(&e, &q->heap[parent])) {
+      break;
+    }
+    q->heap[i] = q->heap[parent];
+    i = parent;
+  }
+  q->heap[i] = e;
+  if (q->count > q->high_water) {
+    q->high_water = q->count;
+  }
+  return 0;
+}
+
+/* highest priority frame, NULL if the queue is empty */
+static inline const struct canfd_frame *canfd_txq_peek(
+    const struct canfd_txq *q) {
+  if (q->count == 0) {
+    return NULL;
+  }
+  return &q->frames[q->heap[0].slot];
+}
+
+/* meta of the frame returned by canfd_txq_peek() */
+static inline const struct canfd_txq_meta *canfd_txq_peek_meta(
+    const struct canfd_txq *q) {
+  return &q->meta[q->heap[0].slot];
+}
+
+/* remove the frame returned by canfd_txq_peek() */
+static inline void canfd_txq_pop(struct canfd_txq *q) {
+  if (q->count == 0) {
+    return;
+  }
+  q->free[q->nfree++] = q->heap[0].slot;
+  struct canfd_txq_entry e = q->heap[--q->count];
+  uint32_t i = 0;
+  for (;;) {
+    uint32_t child = 2 * i + 1;
+    if (child >= q->count) {
+      break;
+    }
+    if (child + 1 < q->count &&
+        canfd_txq_less(&q->heap[child + 1], &q->heap[child])) {
+      child++;
+    }
+    if (!canfd_txq_less(&q->heap[child], &e)) {
+      break;
+    }
+    q->heap[i] = q->heap[child];
+    i = child;
+  }
+  q->heap[i] = e;
+}
+
+#endif
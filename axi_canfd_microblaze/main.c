@@ -1,10 +1,47 @@
+#include <stddef.h>
 #include <xil_printf.h>
 #include <xparameters.h>
 
 #include "bsp_canfd.h"
+#include "bsp_timer.h"
+#include "bsp_uart.h"
+#include "canfd_stream.h"
+
+// 1: received frames go to the host as binary canfd_stream packets on the
+// UART, 0: printed as text
+#define MAIN_STREAM 1
+
+static struct canfd_stream Stream;
+static uint8_t uart0_rx_buf[16];
+static bool StreamSending = false;
+
+#if BSP_TIMER_HZ != BSP_CANFD_TIMER_HZ
+#error "bsp_canfd_timer() has to count BSP_CANFD_TIMER_HZ"
+#endif
+
+uint32_t bsp_canfd_timer(void) { return bsp_timer_ticks(BSP_TIMER0); }
+
+// hand the open packet to the UART once the previous one is out
+static void stream_flush(bool wait) {
+  if (StreamSending) {
+    while (wait && !bsp_uart_tx_done(BSP_UART0)) {
+    }
+    if (!bsp_uart_tx_done(BSP_UART0)) {
+      return;
+    }
+  }
+  uint32_t len;
+  const uint8_t *packet = canfd_stream_finish(&Stream, &len);
+  if (packet != NULL) {
+    bsp_uart_write(BSP_UART0, packet, len);
+    StreamSending = true;
+  }
+}
 
 int main() {
   xil_printf("============================================\n");
+  // before bsp_canfd_init, which takes the first statistics stamp
+  bsp_timer_init(BSP_TIMER0, XPAR_AXI_TIMER_0_BASEADDR, 1, true);
 
   XCanFd CanFd0;
   int Status =
@@ -77,7 +114,30 @@ int main() {
     }
   }
 
+#if MAIN_STREAM
+  bsp_uart_init(BSP_UART0, XPAR_XUARTLITE_0_BASEADDR, uart0_rx_buf,
+                sizeof(uart0_rx_buf), NULL, 0);
+  canfd_stream_init(&Stream);
+#endif
+
+  struct canfd_frame RxFrames[16];
   while (1) {
+    int n = bsp_canfd_recv_batch(&CanFd0, RxFrames, 16);
+#if MAIN_STREAM
+    uint32_t Now = bsp_timer_us(BSP_TIMER0);
+    for (int i = 0; i < n; i++) {
+      if (canfd_stream_add(&Stream, &RxFrames[i], Now) != 0) {
+        stream_flush(true);
+        canfd_stream_add(&Stream, &RxFrames[i], Now);
+      }
+    }
+    // batches build up while the previous packet is on the wire
+    stream_flush(false);
+#else
+    for (int i = 0; i < n; i++) {
+      bsp_canfd_print(&RxFrames[i]);
+    }
+#endif
   }
 
   return 0;
@@ -0,0 +1,318 @@
+// bsp_canfd.c against the fake core: frames packed into RX words the way
+// the core presents them come out of bsp_canfd_recv_batch() unchanged, in
+// order, with the ring's drops counted
+//
+// bsp_canfd_test [frames]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsp_canfd.h"
+#include "canfd_bits.h"
+#include "canfd_ring.h"
+#include "fake_xcanfd.h"
+
+#define SEQ_BASE 0x40000000
+#define MAILBOX_BASE 0x40010000
+
+static int failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond) && failures++ < 16) {                                   \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+    }                                                                   \
+  } while (0)
+
+static uint32_t test_now;
+// one instance per core, the BSP keeps state for two
+static XCanFd SeqCan;
+static XCanFd MailboxCan;
+
+uint32_t bsp_canfd_timer(void) { return test_now; }
+
+static uint32_t rng_state = 0x12345678;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// any frame the bus can carry, as xcanfd_to_canfd_frame() reports it
+static void make_frame(struct canfd_frame *frame) {
+  static const uint8_t dlc2len[16] = {0, 1, 2, 3, 4, 5, 6, 7,
+                                      8, 12, 16, 20, 24, 32, 48, 64};
+  uint32_t r = rng();
+  memset(frame, 0, sizeof(*frame));
+  if (r & 1) {
+    frame->can_id = (rng() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  } else {
+    frame->can_id = rng() & CAN_SFF_MASK;
+  }
+  if (r & 2) {
+    frame->flags =
+        CANFD_FDF | (r & 4 ? CANFD_BRS : 0) | (r & 8 ? CANFD_ESI : 0);
+    frame->len = dlc2len[(r >> 4) & 0x0F];
+  } else {
+    frame->len = (r >> 4) % (CAN_MAX_DLEN + 1);
+    if (r & 4) {
+      frame->can_id |= CAN_RTR_FLAG;
+    }
+  }
+  if (!(frame->can_id & CAN_RTR_FLAG)) {
+    for (int i = 0; i < frame->len; i++) {
+      frame->data[i] = (uint8_t)rng();
+    }
+  }
+}
+
+static int frame_equal(const struct canfd_frame *a,
+                       const struct canfd_frame *b) {
+  if (a->can_id != b->can_id || a->len != b->len || a->flags != b->flags) {
+    return 0;
+  }
+  return (a->can_id & CAN_RTR_FLAG) || memcmp(a->data, b->data, a->len) == 0;
+}
+
+// frames through the FIFO in bursts, drained in random batch sizes
+static void test_sequential(int n) {
+  static struct canfd_frame sent[FAKE_XCANFD_RX_FIFO];
+  struct canfd_frame got[CANFD_RING_SIZE];
+  struct fake_xcanfd *core = fake_xcanfd_add(SEQ_BASE, 0, 0, 8);
+  CHECK(bsp_canfd_init(&SeqCan, SEQ_BASE, 500000, 0.8f, 4000000, 0.8f) == 0);
+  int received = 0;
+  int mismatch = 0;
+  while (received < n) {
+    int burst = 1 + rng() % FAKE_XCANFD_RX_FIFO;
+    for (int i = 0; i < burst; i++) {
+      make_frame(&sent[i]);
+      CHECK(fake_xcanfd_rx(core, &sent[i]) == 1);
+    }
+    // the ring holds the whole FIFO, the interrupt takes a burst per call
+    while (core->rx_head != core->rx_tail) {
+      XCanFd_IntrHandler(&SeqCan);
+    }
+    int done = 0;
+    while (done < burst) {
+      int max = 1 + rng() % CANFD_RING_SIZE;
+      int got_n = bsp_canfd_recv_batch(&SeqCan, got, max);
+      CHECK(got_n > 0 && got_n <= max);
+      if (got_n <= 0) {
+        break;
+      }
+      for (int i = 0; i < got_n; i++) {
+        if (!frame_equal(&got[i], &sent[done + i]) && mismatch++ < 8) {
+          fprintf(stderr, "mismatch: sent %08X len %d flags %d, got %08X "
+                  "len %d flags %d\n", sent[done + i].can_id,
+                  sent[done + i].len, sent[done + i].flags, got[i].can_id,
+                  got[i].len, got[i].flags);
+        }
+      }
+      done += got_n;
+    }
+    CHECK(bsp_canfd_recv_batch(&SeqCan, got, CANFD_RING_SIZE) == 0);
+    received += burst;
+  }
+  struct bsp_canfd_stats Stats;
+  CHECK(bsp_canfd_get_stats(&SeqCan, &Stats) == 0);
+  CHECK(Stats.rx_frames == (uint32_t)received);
+  CHECK(Stats.rx_drops == 0);
+  CHECK(mismatch == 0);
+  printf("sequential: %d frames, mismatch: %d\n", received, mismatch);
+}
+
+// the main loop falls behind: the ring fills, later frames are counted in
+// rx_drops and the ones in the ring stay intact
+static void test_ring_full(void) {
+  static struct canfd_frame sent[CANFD_RING_SIZE + 16];
+  struct canfd_frame got[CANFD_RING_SIZE];
+  struct fake_xcanfd *core = fake_xcanfd_add(SEQ_BASE, 0, 0, 8);
+  CHECK(bsp_canfd_init(&SeqCan, SEQ_BASE, 500000, 0.8f, 4000000, 0.8f) == 0);
+  int total = CANFD_RING_SIZE + 16;
+  for (int i = 0; i < total; i++) {
+    make_frame(&sent[i]);
+    if (core->rx_head - core->rx_tail == FAKE_XCANFD_RX_FIFO) {
+      XCanFd_IntrHandler(&SeqCan);
+    }
+    CHECK(fake_xcanfd_rx(core, &sent[i]) == 1);
+  }
+  while (core->rx_head != core->rx_tail) {
+    XCanFd_IntrHandler(&SeqCan);
+  }
+  struct bsp_canfd_stats Stats;
+  CHECK(bsp_canfd_get_stats(&SeqCan, &Stats) == 0);
+  CHECK(Stats.rx_frames == (uint32_t)total);
+  CHECK(Stats.rx_drops == 16);
+  CHECK(bsp_canfd_recv_batch(&SeqCan, got, CANFD_RING_SIZE) == CANFD_RING_SIZE);
+  int mismatch = 0;
+  for (int i = 0; i < CANFD_RING_SIZE; i++) {
+    mismatch += !frame_equal(&got[i], &sent[i]);
+  }
+  CHECK(mismatch == 0);
+  CHECK(bsp_canfd_recv_batch(&SeqCan, got, CANFD_RING_SIZE) == 0);
+  printf("ring full: %d frames, %d dropped, mismatch: %d\n", total,
+         Stats.rx_drops, mismatch);
+}
+
+// mailbox mode, one frame at a time
+static void test_mailbox(int n) {
+  struct canfd_frame sent;
+  struct canfd_frame got[4];
+  struct fake_xcanfd *core = fake_xcanfd_add(MAILBOX_BASE, 1, 16, 8);
+  CHECK(bsp_canfd_init(&MailboxCan, MAILBOX_BASE, 500000, 0.8f, 4000000,
+                       0.8f) == 0);
+  int mismatch = 0;
+  for (int i = 0; i < n; i++) {
+    make_frame(&sent);
+    CHECK(fake_xcanfd_rx(core, &sent) == 1);
+    XCanFd_IntrHandler(&MailboxCan);
+    CHECK(bsp_canfd_recv_batch(&MailboxCan, got, 4) == 1);
+    mismatch += !frame_equal(&got[0], &sent);
+  }
+  CHECK(mismatch == 0);
+  printf("mailbox: %d frames, mismatch: %d\n", n, mismatch);
+}
+
+// bus time of a frame at 500 kbit/s and 4 Mbit/s
+static uint64_t frame_bus_ns(const struct canfd_frame *frame) {
+  struct canfd_frame_bits Bits;
+  canfd_frame_bits(frame, &Bits);
+  return (uint64_t)Bits.nominal * 2000 + (uint64_t)Bits.data * 250;
+}
+
+// RX interrupts taken inside bsp_canfd_send's refill, TX completions and
+// error interrupts in between: every counter and the bus time of both
+// directions end up in the snapshot
+static void test_stats(int n) {
+  struct canfd_frame got[CANFD_RING_SIZE];
+  struct fake_xcanfd *core = fake_xcanfd_add(SEQ_BASE, 0, 0, 8);
+  test_now = 1000;
+  CHECK(bsp_canfd_init(&SeqCan, SEQ_BASE, 500000, 0.8f, 4000000, 0.8f) == 0);
+  core->rx_in_send = 1;
+  uint64_t bus_ns = 0;
+  uint32_t rx_bytes = 0;
+  uint32_t tx_bytes = 0;
+  uint32_t crc_errors = 0;
+  int in_send = 0;
+  for (int i = 0; i < n; i++) {
+    struct canfd_frame rx;
+    struct canfd_frame tx;
+    make_frame(&rx);
+    make_frame(&tx);
+    tx.flags &= ~CANFD_ESI;
+    CHECK(fake_xcanfd_rx(core, &rx) == 1);
+    bus_ns += frame_bus_ns(&rx) + frame_bus_ns(&tx);
+    rx_bytes += rx.can_id & CAN_RTR_FLAG ? 0 : rx.len;
+    tx_bytes += tx.can_id & CAN_RTR_FLAG ? 0 : tx.len;
+    CHECK(bsp_canfd_send(&SeqCan, &tx) == 0);
+    // taken by the interrupt from inside XCanFd_Send
+    in_send += core->rx_head == core->rx_tail;
+    XCanFd_IntrHandler(&SeqCan);
+    CHECK(bsp_canfd_recv_batch(&SeqCan, got, CANFD_RING_SIZE) == 1);
+    if (rng() % 4 == 0) {
+      fake_xcanfd_tx_complete(core, 1 + rng() % 8);
+      XCanFd_IntrHandler(&SeqCan);
+    }
+    if (rng() % 16 == 0) {
+      fake_xcanfd_event(core, XCANFD_IXR_ERROR_MASK, XCANFD_ESR_CRCER_MASK);
+      XCanFd_IntrHandler(&SeqCan);
+      crc_errors++;
+    }
+    test_now += 100000;
+  }
+  while (core->trr != 0) {
+    fake_xcanfd_tx_complete(core, 8);
+    XCanFd_IntrHandler(&SeqCan);
+  }
+  struct bsp_canfd_stats Stats;
+  CHECK(bsp_canfd_get_stats(&SeqCan, &Stats) == 0);
+  CHECK(in_send == n);
+  CHECK(Stats.rx_frames == (uint32_t)n && Stats.rx_bytes == rx_bytes);
+  CHECK(Stats.tx_frames == (uint32_t)n && Stats.tx_bytes == tx_bytes);
+  CHECK(Stats.tx_pending == 0 && Stats.tx_drops == 0);
+  CHECK(Stats.crc_errors == crc_errors);
+  uint64_t elapsed_ns = (uint64_t)(test_now - 1000) * 1000000000U /
+                        BSP_CANFD_TIMER_HZ;
+  CHECK(Stats.bus_load == (uint32_t)(bus_ns * 1000 / elapsed_ns));
+  uint32_t load = Stats.bus_load;
+  // the next snapshot starts from zero
+  test_now += 100000;
+  CHECK(bsp_canfd_get_stats(&SeqCan, &Stats) == 0);
+  CHECK(Stats.bus_load == 0);
+  core->rx_in_send = 0;
+  printf("stats: %d frames each way, bus load %u per mille, %u crc errors\n",
+         n, load, crc_errors);
+}
+
+static int frame_compare(const void *a, const void *b) {
+  const struct canfd_frame *fa = a;
+  const struct canfd_frame *fb = b;
+  if (fa->can_id != fb->can_id) {
+    return fa->can_id < fb->can_id ? -1 : 1;
+  }
+  return memcmp(fa->data, fb->data, sizeof(fa->data));
+}
+
+// every mailbox is used, the compiled pairs repeated, so a burst as long as
+// the mailboxes of each pair's share arrives without loss
+static void test_mailbox_burst(int rounds) {
+  struct canfd_frame sent[16];
+  struct canfd_frame got[16];
+  struct fake_xcanfd *core = fake_xcanfd_add(MAILBOX_BASE, 1, 16, 8);
+  CHECK(bsp_canfd_init(&MailboxCan, MAILBOX_BASE, 500000, 0.8f, 4000000,
+                       0.8f) == 0);
+  CHECK(core->mb_active == 0xFFFF);
+  // accept everything: a standard and an extended pair, 8 mailboxes each
+  int lost = 0;
+  int mismatch = 0;
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < 16; i++) {
+      do {
+        make_frame(&sent[i]);
+      } while (!(sent[i].can_id & CAN_EFF_FLAG) != (i < 8));
+      lost += fake_xcanfd_rx(core, &sent[i]) != 1;
+    }
+    XCanFd_IntrHandler(&MailboxCan);
+    CHECK(bsp_canfd_recv_batch(&MailboxCan, got, 16) == 16);
+    // the order within a burst is the mailboxes', not the bus'; sent is
+    // zero past len and for remote frames, got is made so
+    for (int i = 0; i < 16; i++) {
+      int len = got[i].can_id & CAN_RTR_FLAG ? 0 : got[i].len;
+      memset(got[i].data + len, 0, CANFD_MAX_DLEN - len);
+    }
+    qsort(sent, 16, sizeof(sent[0]), frame_compare);
+    qsort(got, 16, sizeof(got[0]), frame_compare);
+    for (int i = 0; i < 16; i++) {
+      mismatch += !frame_equal(&got[i], &sent[i]);
+    }
+  }
+  // three pairs over 16 mailboxes
+  struct canfd_filter_range Wanted[3] = {
+      {0x100, 0x10F, 0},
+      {0x700, 0x700, 0},
+      {0x18DA0000, 0x18DAFFFF, 1},
+  };
+  CHECK(bsp_canfd_set_filters(&MailboxCan, Wanted, 3) == 3);
+  CHECK(core->mb_active == 0xFFFF);
+  for (int i = 3; i < 16; i++) {
+    CHECK(core->mb_id[i] == core->mb_id[i % 3] &&
+          core->mb_mask[i] == core->mb_mask[i % 3]);
+  }
+  CHECK(lost == 0);
+  CHECK(mismatch == 0);
+  printf("mailbox burst: %d x 16 frames, lost: %d, mismatch: %d\n", rounds,
+         lost, mismatch);
+}
+
+int main(int argc, char *argv[]) {
+  int n = argc > 1 ? (int)strtoul(argv[1], NULL, 0) : 200000;
+  test_sequential(n);
+  test_ring_full();
+  test_mailbox(n / 10);
+  test_mailbox_burst(n / 100);
+  test_stats(n / 100);
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,281 @@
+// canfd_codec.h against a field by field reference, the way bsp_canfd.c
+// converted frames before: every standard identifier and a spread of
+// extended ones, every combination of RTR/FDF/BRS/ESI and every DLC, both
+// directions. Then cycles per frame of both, rdtsc on x86, ns elsewhere.
+//
+// canfd_codec_test [frames]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS() __rdtsc()
+#define TICK_UNIT "cycles"
+#else
+#define TICKS() now_ns()
+#define TICK_UNIT "ns"
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+#include "canfd_codec.h"
+
+static int failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond) && failures++ < 16) {                                   \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+    }                                                                   \
+  } while (0)
+
+static uint32_t rng_state = 0x9E3779B9;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static const uint8_t ref_dlc2len[16] = {0, 1, 2, 3, 4, 5, 6, 7,
+                                        8, 12, 16, 20, 24, 32, 48, 64};
+
+// ---- reference, one field at a time (xcanfd_hw.h layout)
+
+static uint32_t ref_len2dlc(uint32_t len) {
+  uint32_t dlc = 0;
+  while (dlc < 15 && ref_dlc2len[dlc] < len) {
+    dlc++;
+  }
+  return dlc;
+}
+
+static void ref_to_words(const struct canfd_frame *frame, uint32_t *words) {
+  int is_extended = frame->can_id & CAN_EFF_FLAG ? 1 : 0;
+  int is_fd = frame->flags & (CANFD_FDF | CANFD_BRS) ? 1 : 0;
+  int is_brs = frame->flags & CANFD_BRS ? 1 : 0;
+  int is_remote = !is_fd && (frame->can_id & CAN_RTR_FLAG) ? 1 : 0;
+  uint32_t id = frame->can_id & (is_extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+  memset(words, 0, CANFD_X_FRAME_WORDS * sizeof(uint32_t));
+  if (is_extended) {
+    words[0] |= (id >> 18) << 21;
+    words[0] |= 1u << 20;  // SRR
+    words[0] |= 1u << 19;  // IDE
+    words[0] |= (id & 0x3FFFF) << 1;
+    words[0] |= (uint32_t)is_remote;
+  } else {
+    words[0] |= id << 21;
+    words[0] |= (uint32_t)is_remote << 20;
+  }
+  uint32_t len = frame->len;
+  uint32_t max = is_fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+  if (len > max) {
+    len = max;
+  }
+  uint32_t dlc = ref_len2dlc(len);
+  words[1] |= dlc << 28;
+  words[1] |= (uint32_t)is_fd << 27;
+  words[1] |= (uint32_t)is_brs << 26;
+  if (!is_remote) {
+    uint8_t *p = (uint8_t *)&words[2];
+    for (uint32_t i = 0; i < len; i++) {
+      p[i] = frame->data[i];
+    }
+  }
+}
+
+static void ref_from_words(const uint32_t *words, struct canfd_frame *frame) {
+  uint32_t id1 = (words[0] >> 21) & 0x7FF;
+  uint32_t srr = (words[0] >> 20) & 1;
+  uint32_t ide = (words[0] >> 19) & 1;
+  uint32_t id2 = (words[0] >> 1) & 0x3FFFF;
+  uint32_t rtr = words[0] & 1;
+  uint32_t dlc = (words[1] >> 28) & 0x0F;
+  uint32_t edl = (words[1] >> 27) & 1;
+  uint32_t brs = (words[1] >> 26) & 1;
+  uint32_t esi = (words[1] >> 25) & 1;
+  memset(frame, 0, sizeof(*frame));
+  int is_remote = ide ? rtr : srr;
+  frame->can_id = ide ? (id1 << 18 | id2) | CAN_EFF_FLAG : id1;
+  if (is_remote) {
+    frame->can_id |= CAN_RTR_FLAG;
+  }
+  if (edl) {
+    frame->flags = CANFD_FDF | (brs ? CANFD_BRS : 0) | (esi ? CANFD_ESI : 0);
+    frame->len = ref_dlc2len[dlc];
+  } else {
+    frame->len = dlc < 8 ? dlc : 8;
+  }
+  if (!is_remote) {
+    const uint8_t *p = (const uint8_t *)&words[2];
+    for (uint32_t i = 0; i < frame->len; i++) {
+      frame->data[i] = p[i];
+    }
+  }
+}
+
+// ----
+
+// what the core sends for these words: the two registers and the payload
+// bytes of the DLC, CAN FD lengths between two DLCs padded up
+static int words_equal(const uint32_t *a, const uint32_t *b) {
+  if (a[0] != b[0] || a[1] != b[1]) {
+    return 0;
+  }
+  int is_remote = a[0] & (1u << 19) ? a[0] & 1 : (a[0] >> 20) & 1;
+  uint32_t dlc = a[1] >> 28;
+  uint32_t len = a[1] & (1u << 27) ? ref_dlc2len[dlc] : (dlc < 8 ? dlc : 8);
+  return is_remote || memcmp(&a[2], &b[2], len) == 0;
+}
+
+static int frame_equal(const struct canfd_frame *a,
+                       const struct canfd_frame *b) {
+  if (a->can_id != b->can_id || a->len != b->len || a->flags != b->flags) {
+    return 0;
+  }
+  return (a->can_id & CAN_RTR_FLAG) || memcmp(a->data, b->data, a->len) == 0;
+}
+
+static uint32_t tx_checked;
+static uint32_t rx_checked;
+
+// one identifier with every flag combination and every length
+static void check_id(canid_t id) {
+  struct canfd_frame frame;
+  uint32_t words[CANFD_X_FRAME_WORDS];
+  uint32_t ref[CANFD_X_FRAME_WORDS];
+  for (uint32_t flags = 0; flags < 16; flags++) {
+    // frame lengths: every DLC, plus the ones between CAN FD DLCs
+    for (uint32_t len = 0; len <= CANFD_MAX_DLEN; len++) {
+      if (len > 8 && ref_dlc2len[ref_len2dlc(len)] != len && (len & 1)) {
+        continue;
+      }
+      memset(&frame, 0, sizeof(frame));
+      frame.can_id = id | (flags & 1 ? CAN_RTR_FLAG : 0);
+      frame.flags = (flags & 2 ? CANFD_FDF : 0) | (flags & 4 ? CANFD_BRS : 0) |
+                    (flags & 8 ? CANFD_ESI : 0);
+      frame.len = (uint8_t)len;
+      for (uint32_t i = 0; i < CANFD_MAX_DLEN; i++) {
+        frame.data[i] = (uint8_t)rng();
+      }
+
+      // TX: the fields, the payload up to the DLC's length, zero padded
+      memset(words, 0xA5, sizeof(words));
+      canfd_frame_to_xcanfd(&frame, words);
+      ref_to_words(&frame, ref);
+      if (!words_equal(words, ref) && failures++ < 16) {
+        fprintf(stderr, "tx: id %08X flags %X len %u: %08X %08X, ref %08X "
+                "%08X\n", frame.can_id, frame.flags, len, words[0], words[1],
+                ref[0], ref[1]);
+      }
+      tx_checked++;
+
+      // RX: what the core delivers for those words, with ESI as it can
+      // arrive on a CAN FD frame
+      if (ref[1] & (1u << 27) && (flags & 8)) {
+        ref[1] |= 1u << 25;
+      }
+      struct canfd_frame got;
+      struct canfd_frame want;
+      xcanfd_to_canfd_frame(ref, &got);
+      ref_from_words(ref, &want);
+      if (!frame_equal(&got, &want) && failures++ < 16) {
+        fprintf(stderr, "rx: %08X %08X: id %08X flags %X len %u, ref id "
+                "%08X flags %X len %u\n", ref[0], ref[1], got.can_id,
+                got.flags, got.len, want.can_id, want.flags, want.len);
+      }
+      // and back, the frame as it was sent
+      if (!(flags & 8) || !(ref[1] & (1u << 27))) {
+        uint32_t again[CANFD_X_FRAME_WORDS];
+        canfd_frame_to_xcanfd(&got, again);
+        CHECK(words_equal(again, ref));
+      }
+      rx_checked++;
+    }
+  }
+}
+
+static void test_round_trip(void) {
+  for (canid_t id = 0; id <= CAN_SFF_MASK; id++) {
+    check_id(id);
+  }
+  // every single bit, all bits, the ID1/ID2 boundary and random ones
+  check_id(CAN_EFF_FLAG);
+  check_id(CAN_EFF_FLAG | CAN_EFF_MASK);
+  for (int b = 0; b < CAN_EFF_ID_BITS; b++) {
+    check_id(CAN_EFF_FLAG | 1u << b);
+    check_id(CAN_EFF_FLAG | (CAN_EFF_MASK & ~(1u << b)));
+  }
+  check_id(CAN_EFF_FLAG | 0x3FFFF);
+  check_id(CAN_EFF_FLAG | 0x40000);
+  for (int i = 0; i < 2048; i++) {
+    check_id(CAN_EFF_FLAG | (rng() & CAN_EFF_MASK));
+  }
+  printf("round trip: %u tx, %u rx frames\n", tx_checked, rx_checked);
+}
+
+// a mix like a CAN FD bus: classic and FD, short and long
+static void make_frames(struct canfd_frame *frames, int n) {
+  for (int i = 0; i < n; i++) {
+    uint32_t r = rng();
+    struct canfd_frame *f = &frames[i];
+    memset(f, 0, sizeof(*f));
+    f->can_id = r & 1 ? (rng() & CAN_EFF_MASK) | CAN_EFF_FLAG
+                      : rng() & CAN_SFF_MASK;
+    if (r & 2) {
+      f->flags = CANFD_FDF | (r & 4 ? CANFD_BRS : 0);
+      f->len = ref_dlc2len[(r >> 4) & 0x0F];
+    } else {
+      f->len = (r >> 4) % 9;
+    }
+    for (int j = 0; j < f->len; j++) {
+      f->data[j] = (uint8_t)rng();
+    }
+  }
+}
+
+static void bench(int n) {
+  struct canfd_frame *frames = malloc(n * sizeof(*frames));
+  uint32_t(*words)[CANFD_X_FRAME_WORDS] = malloc(n * sizeof(*words));
+  struct canfd_frame out;
+  make_frames(frames, n);
+  uint64_t t0 = TICKS();
+  for (int i = 0; i < n; i++) {
+    ref_to_words(&frames[i], words[i]);
+  }
+  uint64_t t1 = TICKS();
+  for (int i = 0; i < n; i++) {
+    canfd_frame_to_xcanfd(&frames[i], words[i]);
+  }
+  uint64_t t2 = TICKS();
+  for (int i = 0; i < n; i++) {
+    ref_from_words(words[i], &out);
+    asm volatile("" : : "r"(&out) : "memory");
+  }
+  uint64_t t3 = TICKS();
+  for (int i = 0; i < n; i++) {
+    xcanfd_to_canfd_frame(words[i], &out);
+    asm volatile("" : : "r"(&out) : "memory");
+  }
+  uint64_t t4 = TICKS();
+  printf("encode: reference %.1f, codec %.1f " TICK_UNIT "/frame\n",
+         (double)(t1 - t0) / n, (double)(t2 - t1) / n);
+  printf("decode: reference %.1f, codec %.1f " TICK_UNIT "/frame\n",
+         (double)(t3 - t2) / n, (double)(t4 - t3) / n);
+  free(frames);
+  free(words);
+}
+
+int main(int argc, char *argv[]) {
+  int n = argc > 1 ? (int)strtoul(argv[1], NULL, 0) : 1000000;
+  test_round_trip();
+  bench(n);
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+// canfd_filter_compile checked by brute force on random wanted sets: every
+// wanted identifier is accepted, each pair's false positives and the list
+// canfd_filter_false_positives() returns match a walk over the identifiers,
+// no more pairs than slots. Then the compile time on large identifier sets.
+//
+// canfd_filter_test [sets]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "canfd_filter.h"
+
+// extended identifiers of a set are drawn from one window of this size, so
+// the pairs stay small enough to walk
+#define EFF_WINDOW 0x10000
+#define MAX_WANTED 4096
+
+static int failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond) && failures++ < 16) {                                   \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+    }                                                                   \
+  } while (0)
+
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct canfd_filter filter;
+static struct canfd_filter_range wanted[MAX_WANTED];
+static struct canfd_filter_range original[MAX_WANTED];
+// wanted, one flag per identifier: standard ids, then the extended window
+static uint8_t want_sff[CAN_SFF_MASK + 1];
+static uint8_t want_eff[EFF_WINDOW];
+static uint8_t seen_sff[CAN_SFF_MASK + 1];
+static uint8_t seen_eff[EFF_WINDOW];
+static canid_t fp_ids[CAN_SFF_MASK + 1 + EFF_WINDOW];
+
+// aligned power of two blocks of [first, last], what the exact cover uses
+static int range_blocks(uint32_t first, uint32_t last) {
+  int blocks = 0;
+  uint64_t f = first;
+  while (f <= last) {
+    uint64_t size = f ? f & -f : (uint64_t)1 << 29;
+    while (f + size - 1 > last) {
+      size >>= 1;
+    }
+    f += size;
+    blocks++;
+  }
+  return blocks;
+}
+
+// one random set, compiled into slots pairs and checked
+static void check_set(int n, int slots, uint32_t eff_base) {
+  memset(want_sff, 0, sizeof(want_sff));
+  memset(want_eff, 0, sizeof(want_eff));
+  int blocks = 0;
+  for (int i = 0; i < n; i++) {
+    struct canfd_filter_range *r = &original[i];
+    uint32_t kind = rng();
+    r->extended = kind & 1;
+    uint32_t span = kind & 2 ? 1 + rng() % (kind & 4 ? 300 : 16) : 1;
+    uint32_t limit = r->extended ? EFF_WINDOW : CAN_SFF_MASK + 1;
+    r->first = rng() % limit;
+    r->last = r->first + span - 1 < limit ? r->first + span - 1 : limit - 1;
+    uint8_t *want = r->extended ? want_eff : want_sff;
+    for (uint32_t id = r->first; id <= r->last; id++) {
+      want[id] = 1;
+    }
+    if (r->extended) {
+      r->first += eff_base;
+      r->last += eff_base;
+    }
+    blocks += range_blocks(r->first, r->last);
+  }
+  memcpy(wanted, original, n * sizeof(wanted[0]));
+  int pairs = canfd_filter_compile(&filter, wanted, n, slots);
+  CHECK(pairs > 0 && pairs <= slots && pairs == filter.count);
+  if (pairs <= 0) {
+    return;
+  }
+
+  // every identifier the pairs accept, walked per pair
+  memset(seen_sff, 0, sizeof(seen_sff));
+  memset(seen_eff, 0, sizeof(seen_eff));
+  uint32_t fp_sum = 0;
+  for (int p = 0; p < pairs; p++) {
+    const struct canfd_filter_pair *pair = &filter.pairs[p];
+    uint32_t full = pair->extended ? CAN_EFF_MASK : CAN_SFF_MASK;
+    CHECK((pair->id & ~pair->mask) == 0 && (pair->mask & ~full) == 0);
+    uint32_t free_bits = full & ~pair->mask;
+    uint32_t accepted = 0;
+    uint32_t unwanted = 0;
+    uint32_t sub = 0;
+    do {
+      uint32_t id = pair->id | sub;
+      uint8_t is_wanted;
+      if (pair->extended) {
+        // anything outside the window is unwanted
+        uint32_t off = id - eff_base;
+        is_wanted = id >= eff_base && off < EFF_WINDOW && want_eff[off];
+        if (id >= eff_base && off < EFF_WINDOW) {
+          seen_eff[off] = 1;
+        }
+      } else {
+        is_wanted = want_sff[id];
+        seen_sff[id] = 1;
+      }
+      accepted++;
+      unwanted += !is_wanted;
+      sub = (sub - free_bits) & free_bits;
+    } while (sub != 0 && accepted < (1u << 20));
+    CHECK(accepted == pair->accepted);
+    CHECK(unwanted == pair->false_positives);
+    fp_sum += unwanted;
+  }
+  CHECK(fp_sum == filter.false_positives);
+
+  // all wanted accepted; unique unwanted ones against the list
+  uint32_t unique = 0;
+  for (uint32_t id = 0; id <= CAN_SFF_MASK; id++) {
+    CHECK(!want_sff[id] || seen_sff[id]);
+    unique += seen_sff[id] && !want_sff[id];
+  }
+  for (uint32_t off = 0; off < EFF_WINDOW; off++) {
+    CHECK(!want_eff[off] || seen_eff[off]);
+    unique += seen_eff[off] && !want_eff[off];
+  }
+  int listed = canfd_filter_false_positives(&filter, wanted, fp_ids,
+                                            (int)(sizeof(fp_ids) /
+                                                  sizeof(fp_ids[0])));
+  // the window is aligned, extended pairs built from it stay inside
+  for (int i = 0; i < listed; i++) {
+    canid_t can_id = fp_ids[i];
+    uint32_t id = can_id & CAN_EFF_MASK;
+    uint8_t *seen = &seen_sff[id & CAN_SFF_MASK];
+    uint8_t is_wanted = want_sff[id & CAN_SFF_MASK];
+    if (can_id & CAN_EFF_FLAG) {
+      uint32_t off = id - eff_base;
+      CHECK(id >= eff_base && off < EFF_WINDOW);
+      seen = &seen_eff[off % EFF_WINDOW];
+      is_wanted = want_eff[off % EFF_WINDOW];
+    } else {
+      CHECK(id <= CAN_SFF_MASK);
+    }
+    // listed twice fails here the second time
+    CHECK(*seen == 1 && !is_wanted);
+    *seen = 2;
+  }
+  CHECK((uint32_t)listed == unique);
+  CHECK(fp_sum >= (uint32_t)listed);
+  // no merging needed, no false positives
+  if (blocks <= slots && blocks <= CANFD_FILTER_MAX_PAIRS) {
+    CHECK(filter.false_positives == 0);
+  }
+}
+
+// compile time of n random identifiers, singles and short runs of standard
+// ones, extended ones from the J1939 priority 6 space
+static void bench(int n, int slots, int rounds) {
+  static struct canfd_filter_range big[1 << 17];
+  double total = 0;
+  uint32_t fp = 0;
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < n; i++) {
+      uint32_t kind = rng();
+      big[i].extended = kind & 1;
+      big[i].first = big[i].extended ? 0x18000000 | (rng() & 0x00FFFFFF)
+                                     : rng() & CAN_SFF_MASK;
+      big[i].last = big[i].first;
+      if ((kind & 6) == 6 && big[i].first < CAN_SFF_MASK - 8) {
+        big[i].last = big[i].first + 7;
+      }
+    }
+    double t0 = now_s();
+    int pairs = canfd_filter_compile(&filter, big, n, slots);
+    total += now_s() - t0;
+    CHECK(pairs > 0 && pairs <= slots);
+    fp = filter.false_positives;
+  }
+  printf("%6d ids -> %2d slots: %8.3f ms, %u unwanted accepted\n", n, slots,
+         total * 1e3 / rounds, fp);
+}
+
+int main(int argc, char *argv[]) {
+  int sets = argc > 1 ? (int)strtoul(argv[1], NULL, 0) : 2000;
+  for (int s = 0; s < sets; s++) {
+    int n = 1 + rng() % (s % 4 == 0 ? 200 : 24);
+    int slots = 2 + rng() % 63;
+    uint32_t eff_base = (rng() & CAN_EFF_MASK) & ~(uint32_t)(EFF_WINDOW - 1);
+    check_set(n, slots, eff_base);
+  }
+  printf("brute force: %d sets\n", sets);
+
+  bench(100, 32, 100);
+  bench(1000, 32, 20);
+  bench(10000, 32, 5);
+  bench(100000, 32, 1);
+  bench(1000, 48, 20);
+  bench(100000, 48, 1);
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+// canfd_timing_solve against the table of verified configurations in
+// canfd_timing.h, the PG223 register limits and an exhaustive search over
+// every prescaler / TSEG1 / TSEG2 combination
+//
+// canfd_timing_test
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "canfd_timing.h"
+
+#define CLOCK_HZ 80000000
+
+static int failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond) && failures++ < 16) {                                   \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+    }                                                                   \
+  } while (0)
+
+// canfd_timing.h, tdco 0 for the nominal phase
+static const struct {
+  int data;
+  uint32_t bitrate;
+  uint16_t sample_point;
+  uint16_t brp;
+  uint16_t tseg1;
+  uint16_t tseg2;
+  uint16_t sjw;
+  uint16_t tdco;
+  uint16_t achieved_sp;
+} table[] = {
+    {0, 125000, 875, 4, 139, 20, 20, 0, 875},
+    {0, 250000, 875, 2, 139, 20, 20, 0, 875},
+    {0, 500000, 800, 1, 127, 32, 32, 0, 800},
+    {0, 500000, 875, 1, 139, 20, 20, 0, 875},
+    {0, 1000000, 800, 1, 63, 16, 16, 0, 800},
+    {1, 1000000, 800, 2, 31, 8, 8, 31, 800},
+    {1, 2000000, 800, 1, 31, 8, 8, 31, 800},
+    {1, 4000000, 800, 1, 15, 4, 4, 16, 800},
+    {1, 5000000, 750, 1, 11, 4, 4, 12, 750},
+    {1, 5000000, 800, 1, 12, 3, 3, 13, 813},
+    {1, 8000000, 800, 1, 7, 2, 2, 8, 800},
+    {1, 10000000, 750, 1, 5, 2, 2, 6, 750},
+};
+
+// PG223 BRPR / BTR and F_BRPR / F_BTR fields, lengths in time quanta
+struct pg223_limits {
+  uint32_t brp_max;
+  uint32_t tseg1_max;
+  uint32_t tseg2_max;
+  uint32_t sjw_max;
+  uint32_t tdco_max;
+};
+static const struct pg223_limits pg223_nominal = {256, 256, 128, 128, 0};
+static const struct pg223_limits pg223_data = {256, 32, 16, 16, 31};
+
+static void check_limits(const struct canfd_timing *t,
+                         const struct pg223_limits *l) {
+  CHECK(t->brp >= 1 && t->brp <= l->brp_max);
+  CHECK(t->tseg1 >= 1 && t->tseg1 <= l->tseg1_max);
+  CHECK(t->tseg2 >= 1 && t->tseg2 <= l->tseg2_max);
+  CHECK(t->sjw >= 1 && t->sjw <= l->sjw_max);
+  CHECK(t->sjw <= t->tseg1 && t->sjw <= t->tseg2);
+  CHECK(t->tdc ? t->tdco <= l->tdco_max && l->tdco_max > 0 : t->tdco == 0);
+}
+
+static uint32_t abs32(int32_t v) { return (uint32_t)(v < 0 ? -v : v); }
+
+// bitrate error in ppm and sample point in per mille, as the solver
+// defines them
+static void measure(uint32_t clock, uint32_t bitrate, uint32_t brp,
+                    uint32_t tseg1, uint32_t tseg2, int32_t *error,
+                    uint32_t *sp) {
+  uint32_t total = 1 + tseg1 + tseg2;
+  int64_t cycles = (int64_t)brp * total;
+  int64_t diff = (int64_t)clock - (int64_t)bitrate * cycles;
+  *error = (int32_t)(diff * 1000000 / ((int64_t)bitrate * cycles));
+  *sp = (1000 * (1 + tseg1) + total / 2) / total;
+}
+
+// every combination, ordered like the solver: bitrate error, sample point
+// error, prescaler; returns 0 and the best if one is within 1 %. Totals
+// outside +-1 % of the ideal one are skipped, they cannot qualify.
+static int exhaustive(uint32_t clock, uint32_t bitrate, uint16_t sample_point,
+                      const struct pg223_limits *l, uint32_t *best_error,
+                      uint32_t *best_sp_error, uint32_t *best_brp) {
+  int found = 0;
+  for (uint32_t brp = 1; brp <= l->brp_max; brp++) {
+    uint64_t ideal = (uint64_t)clock * 100 / ((uint64_t)brp * bitrate);
+    uint64_t total_min = ideal / 101;
+    uint64_t total_max = ideal / 99 + 1;
+    for (uint64_t total = total_min > 3 ? total_min : 3; total <= total_max;
+         total++) {
+      for (uint32_t tseg1 = 1; tseg1 <= l->tseg1_max && tseg1 + 2 <= total;
+           tseg1++) {
+        uint32_t tseg2 = (uint32_t)total - 1 - tseg1;
+        if (tseg2 > l->tseg2_max) {
+          continue;
+        }
+        int32_t error;
+        uint32_t sp;
+        measure(clock, bitrate, brp, tseg1, tseg2, &error, &sp);
+        uint32_t e = abs32(error);
+        uint32_t s = sp > sample_point ? sp - sample_point : sample_point - sp;
+        if (e > 10000) {
+          continue;
+        }
+        if (!found || e < *best_error ||
+            (e == *best_error && s < *best_sp_error) ||
+            (e == *best_error && s == *best_sp_error && brp < *best_brp)) {
+          *best_error = e;
+          *best_sp_error = s;
+          *best_brp = brp;
+          found = 1;
+        }
+      }
+    }
+  }
+  return found ? 0 : -1;
+}
+
+static void test_table(void) {
+  int n = (int)(sizeof(table) / sizeof(table[0]));
+  for (int i = 0; i < n; i++) {
+    const struct canfd_timing_limits *limits =
+        table[i].data ? &canfd_timing_xcanfd_data
+                      : &canfd_timing_xcanfd_nominal;
+    struct canfd_timing t;
+    int ret = canfd_timing_solve(CLOCK_HZ, table[i].bitrate,
+                                 table[i].sample_point, limits, &t);
+    CHECK(ret == 0);
+    int ok = ret == 0 && t.brp == table[i].brp &&
+             t.tseg1 == table[i].tseg1 && t.tseg2 == table[i].tseg2 &&
+             t.sjw == table[i].sjw && t.tdco == table[i].tdco &&
+             t.tdc == (table[i].tdco != 0) && t.bitrate == table[i].bitrate &&
+             t.bitrate_error == 0 && t.sample_point == table[i].achieved_sp;
+    if (!ok) {
+      failures++;
+      fprintf(stderr,
+              "%s %u @ %u: brp %u tseg1 %u tseg2 %u sjw %u tdc %u/%u, "
+              "%d ppm, sp %u\n",
+              table[i].data ? "data" : "nominal", table[i].bitrate,
+              table[i].sample_point, t.brp, t.tseg1, t.tseg2, t.sjw, t.tdc,
+              t.tdco, t.bitrate_error, t.sample_point);
+    }
+    check_limits(&t, table[i].data ? &pg223_data : &pg223_nominal);
+  }
+  printf("table: %d configurations\n", n);
+}
+
+// the limits the solver is given are the PG223 ones
+static void test_xcanfd_limits(void) {
+  const struct canfd_timing_limits *n = &canfd_timing_xcanfd_nominal;
+  const struct canfd_timing_limits *d = &canfd_timing_xcanfd_data;
+  CHECK(n->brp_min == 1 && n->brp_max == pg223_nominal.brp_max);
+  CHECK(n->tseg1_min == 1 && n->tseg1_max == pg223_nominal.tseg1_max);
+  CHECK(n->tseg2_min == 1 && n->tseg2_max == pg223_nominal.tseg2_max);
+  CHECK(n->sjw_max == pg223_nominal.sjw_max && n->tdco_max == 0);
+  CHECK(d->brp_min == 1 && d->brp_max == pg223_data.brp_max);
+  CHECK(d->tseg1_min == 1 && d->tseg1_max == pg223_data.tseg1_max);
+  CHECK(d->tseg2_min == 1 && d->tseg2_max == pg223_data.tseg2_max);
+  CHECK(d->sjw_max == pg223_data.sjw_max &&
+        d->tdco_max == pg223_data.tdco_max);
+}
+
+// clocks, bitrates and sample points around the usual ones: the solver
+// finds what the exhaustive search finds, or both find nothing
+static void test_exhaustive(void) {
+  static const uint32_t clocks[] = {20000000, 40000000, 80000000, 100000000};
+  static const uint32_t nominal[] = {50000,  83333,  125000, 250000,
+                                     500000, 800000, 1000000};
+  static const uint32_t data[] = {1000000, 2000000, 4000000,
+                                  5000000, 8000000, 10000000};
+  static const uint16_t sps[] = {700, 750, 800, 812, 875, 900};
+  int cases = 0;
+  for (unsigned c = 0; c < sizeof(clocks) / sizeof(clocks[0]); c++) {
+    for (int phase = 0; phase < 2; phase++) {
+      const uint32_t *rates = phase ? data : nominal;
+      unsigned nrates = phase ? sizeof(data) / sizeof(data[0])
+                              : sizeof(nominal) / sizeof(nominal[0]);
+      const struct canfd_timing_limits *limits =
+          phase ? &canfd_timing_xcanfd_data : &canfd_timing_xcanfd_nominal;
+      const struct pg223_limits *pg = phase ? &pg223_data : &pg223_nominal;
+      for (unsigned r = 0; r < nrates; r++) {
+        for (unsigned s = 0; s < sizeof(sps) / sizeof(sps[0]); s++) {
+          struct canfd_timing t;
+          int ret = canfd_timing_solve(clocks[c], rates[r], sps[s], limits, &t);
+          uint32_t error = 0;
+          uint32_t sp_error = 0;
+          uint32_t brp = 0;
+          int want = exhaustive(clocks[c], rates[r], sps[s], pg, &error,
+                                &sp_error, &brp);
+          CHECK(ret == want);
+          if (ret == 0 && want == 0) {
+            uint32_t got_sp_error = t.sample_point > sps[s]
+                                        ? t.sample_point - sps[s]
+                                        : sps[s] - t.sample_point;
+            int ok = abs32(t.bitrate_error) == error &&
+                     got_sp_error == sp_error && t.brp == brp;
+            if (!ok) {
+              failures++;
+              fprintf(stderr,
+                      "%u Hz %s %u @ %u: solver brp %u %d ppm sp %u, "
+                      "exhaustive brp %u %u ppm sp error %u\n",
+                      clocks[c], phase ? "data" : "nominal", rates[r], sps[s],
+                      t.brp, t.bitrate_error, t.sample_point, brp, error,
+                      sp_error);
+            }
+            check_limits(&t, pg);
+            // delay compensation for fast data phases, secondary sample
+            // point on the sample point unless the offset is clamped
+            if (phase && t.brp <= 2) {
+              uint32_t ssp = t.brp * (1 + t.tseg1);
+              CHECK(t.tdc &&
+                    t.tdco == (ssp < pg->tdco_max ? ssp : pg->tdco_max));
+            } else {
+              CHECK(!t.tdc);
+            }
+          }
+          cases++;
+        }
+      }
+    }
+  }
+  printf("exhaustive: %d cases\n", cases);
+}
+
+int main(void) {
+  test_xcanfd_limits();
+  test_table();
+  test_exhaustive();
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
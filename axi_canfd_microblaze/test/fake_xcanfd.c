@@ -0,0 +1,413 @@
+// fake AXI CAN FD core, see fake_xcanfd.h
+#include "fake_xcanfd.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xil_printf.h"
+#include "xinterrupt_wrap.h"
+
+#define FAKE_XCANFD_CORES 4
+
+int fake_xcanfd_verbose = 0;
+
+static struct fake_xcanfd fake_cores[FAKE_XCANFD_CORES];
+static int fake_ncores;
+
+void xil_printf(const char *fmt, ...) {
+  if (!fake_xcanfd_verbose) {
+    return;
+  }
+  va_list ap;
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+}
+
+static struct fake_xcanfd *fake_by_base(UINTPTR base_addr) {
+  for (int i = 0; i < fake_ncores; i++) {
+    if (fake_cores[i].config.BaseAddress == base_addr) {
+      return &fake_cores[i];
+    }
+  }
+  return NULL;
+}
+
+static struct fake_xcanfd *fake_of(XCanFd *InstancePtr) {
+  return fake_by_base(InstancePtr->CanFdConfig.BaseAddress);
+}
+
+struct fake_xcanfd *fake_xcanfd_add(UINTPTR base_addr, u32 rx_mode,
+                                    u32 rx_buffers, u32 tx_buffers) {
+  struct fake_xcanfd *core = fake_by_base(base_addr);
+  if (core == NULL) {
+    if (fake_ncores == FAKE_XCANFD_CORES) {
+      return NULL;
+    }
+    core = &fake_cores[fake_ncores++];
+  }
+  memset(core, 0, sizeof(*core));
+  core->config.BaseAddress = base_addr;
+  core->config.Rx_Mode = rx_mode;
+  core->config.NumofRxMbBuf =
+      rx_buffers < FAKE_XCANFD_MAILBOXES ? rx_buffers : FAKE_XCANFD_MAILBOXES;
+  core->config.NumofTxBuf = tx_buffers < FAKE_XCANFD_TX_BUFFERS
+                                ? tx_buffers
+                                : FAKE_XCANFD_TX_BUFFERS;
+  core->mode = XCANFD_MODE_CONFIG;
+  return core;
+}
+
+// ID register, DLC register and payload as the core presents a received
+// frame, one field at a time (xcanfd_hw.h layout)
+void fake_xcanfd_pack(const struct canfd_frame *frame, u32 *words) {
+  static const u8 dlc2len[16] = {0, 1, 2, 3, 4, 5, 6, 7,
+                                 8, 12, 16, 20, 24, 32, 48, 64};
+  int is_fd = frame->flags & CANFD_FDF ? 1 : 0;
+  int is_remote = !is_fd && (frame->can_id & CAN_RTR_FLAG) ? 1 : 0;
+  memset(words, 0, CANFD_X_FRAME_WORDS * sizeof(u32));
+  if (frame->can_id & CAN_EFF_FLAG) {
+    u32 id = frame->can_id & CAN_EFF_MASK;
+    words[0] |= (id >> 18) << 21;      // ID1
+    words[0] |= 1u << 20;              // SRR
+    words[0] |= 1u << 19;              // IDE
+    words[0] |= (id & 0x3FFFF) << 1;   // ID2
+    words[0] |= is_remote ? 1u : 0u;   // RTR
+  } else {
+    words[0] |= (frame->can_id & CAN_SFF_MASK) << 21;
+    words[0] |= is_remote ? 1u << 20 : 0u;  // SRR is the RTR
+  }
+  u32 dlc = 0;
+  while (dlc < 15 && dlc2len[dlc] < frame->len) {
+    dlc++;
+  }
+  if (!is_fd && dlc > 8) {
+    dlc = 8;
+  }
+  words[1] |= dlc << 28;
+  if (is_fd) {
+    words[1] |= 1u << 27;  // EDL
+    words[1] |= frame->flags & CANFD_BRS ? 1u << 26 : 0u;
+    words[1] |= frame->flags & CANFD_ESI ? 1u << 25 : 0u;
+  }
+  if (!is_remote) {
+    memcpy(&words[2], frame->data, dlc2len[dlc]);
+  }
+}
+
+static int fake_match(u32 idr, u32 mask, u32 id) {
+  return (idr & mask) == (id & mask);
+}
+
+int fake_xcanfd_rx(struct fake_xcanfd *core, const struct canfd_frame *frame) {
+  u32 words[CANFD_X_FRAME_WORDS];
+  fake_xcanfd_pack(frame, words);
+  if (core->config.Rx_Mode == 1) {
+    int matched = 0;
+    for (u32 i = 0; i < core->config.NumofRxMbBuf; i++) {
+      u64 bit = (u64)1 << i;
+      if (!(core->mb_active & bit) ||
+          !fake_match(words[0], core->mb_mask[i], core->mb_id[i])) {
+        continue;
+      }
+      matched = 1;
+      if (!(core->mb_full & bit)) {
+        memcpy(core->mb[i], words, sizeof(words));
+        core->mb_full |= bit;
+        return 1;
+      }
+    }
+    if (matched) {
+      core->rx_lost++;
+      core->isr |= XCANFD_IXR_RXOFLW_MASK;
+      return -1;
+    }
+    core->rx_filtered++;
+    return 0;
+  }
+  // no filter enabled: everything is stored
+  if (core->afr_enabled != 0) {
+    int matched = 0;
+    for (int i = 0; i < XCANFD_NOOF_AFR && !matched; i++) {
+      matched = (core->afr_enabled & (1u << i)) &&
+                fake_match(words[0], core->afr_mask[i], core->afr_id[i]);
+    }
+    if (!matched) {
+      core->rx_filtered++;
+      return 0;
+    }
+  }
+  if (core->rx_head - core->rx_tail == FAKE_XCANFD_RX_FIFO) {
+    core->rx_lost++;
+    core->isr |= XCANFD_IXR_RXOFLW_MASK;
+    return -1;
+  }
+  memcpy(core->rx[core->rx_head++ % FAKE_XCANFD_RX_FIFO], words,
+         sizeof(words));
+  return 1;
+}
+
+int fake_xcanfd_tx_complete(struct fake_xcanfd *core, int n) {
+  int sent = 0;
+  while (sent < n && core->trr != 0) {
+    int i = __builtin_ctz(core->trr);
+    core->trr &= core->trr - 1;
+    if (core->tx_count < FAKE_XCANFD_TX_LOG) {
+      memcpy(core->tx_log[core->tx_count], core->tx[i], sizeof(core->tx[i]));
+    }
+    core->tx_count++;
+    sent++;
+  }
+  if (sent > 0) {
+    core->isr |= XCANFD_IXR_TXOK_MASK;
+  }
+  return sent;
+}
+
+void fake_xcanfd_event(struct fake_xcanfd *core, u32 ixr, u32 esr) {
+  core->isr |= ixr;
+  core->esr |= esr;
+}
+
+static u32 fake_rx_pending(const struct fake_xcanfd *core) {
+  if (core->config.Rx_Mode == 1) {
+    return core->mb_full != 0;
+  }
+  return core->rx_head != core->rx_tail;
+}
+
+// ----
+
+XCanFd_Config *XCanFd_LookupConfig(UINTPTR BaseAddress) {
+  struct fake_xcanfd *core = fake_by_base(BaseAddress);
+  return core != NULL ? &core->config : NULL;
+}
+
+int XCanFd_CfgInitialize(XCanFd *InstancePtr, XCanFd_Config *ConfigPtr,
+                         UINTPTR EffectiveAddr) {
+  memset(InstancePtr, 0, sizeof(*InstancePtr));
+  InstancePtr->CanFdConfig = *ConfigPtr;
+  InstancePtr->CanFdConfig.BaseAddress = EffectiveAddr;
+  InstancePtr->IsReady = 1;
+  struct fake_xcanfd *core = fake_of(InstancePtr);
+  if (core == NULL) {
+    return XST_FAILURE;
+  }
+  core->instance = InstancePtr;
+  return XST_SUCCESS;
+}
+
+u32 XCanFd_ReadReg(UINTPTR BaseAddress, u32 RegOffset) {
+  struct fake_xcanfd *core = fake_by_base(BaseAddress);
+  if (core != NULL && RegOffset == XCANFD_TRR_OFFSET) {
+    return core->trr;
+  }
+  return 0;
+}
+
+void XCanFd_EnterMode(XCanFd *InstancePtr, u8 OperationMode) {
+  fake_of(InstancePtr)->mode = OperationMode;
+}
+
+u8 XCanFd_GetMode(XCanFd *InstancePtr) { return fake_of(InstancePtr)->mode; }
+
+int XCanFd_SetBaudRatePrescaler(XCanFd *InstancePtr, u8 Prescaler) {
+  fake_of(InstancePtr)->brp = Prescaler;
+  return XST_SUCCESS;
+}
+
+int XCanFd_SetBitTiming(XCanFd *InstancePtr, u8 SyncJumpWidth,
+                        u8 TimeSegment2, u16 TimeSegment1) {
+  struct fake_xcanfd *core = fake_of(InstancePtr);
+  core->sjw = SyncJumpWidth;
+  core->tseg2 = TimeSegment2;
+  core->tseg1 = TimeSegment1;
+  return XST_SUCCESS;
+}
+
+int XCanFd_SetFBaudRatePrescaler(XCanFd *InstancePtr, u8 Prescaler) {
+  fake_of(InstancePtr)->f_brp = Prescaler;
+  return XST_SUCCESS;
+}
+
+int XCanFd_SetFBitTiming(XCanFd *InstancePtr, u8 SyncJumpWidth,
+                         u8 TimeSegment2, u8 TimeSegment1) {
+  struct fake_xcanfd *core = fake_of(InstancePtr);
+  core->f_sjw = SyncJumpWidth;
+  core->f_tseg2 = TimeSegment2;
+  core->f_tseg1 = TimeSegment1;
+  return XST_SUCCESS;
+}
+
+int XCanFd_Set_Tranceiver_Delay_Compensation(XCanFd *InstancePtr,
+                                             u32 TdcOffset) {
+  fake_of(InstancePtr)->tdco = TdcOffset;
+  return XST_SUCCESS;
+}
+
+void XCanFd_SetBitRateSwitch_DisableNominal(XCanFd *InstancePtr) {
+  (void)InstancePtr;
+}
+
+int XCanFd_Send(XCanFd *InstancePtr, u32 *FramePtr, u32 *TxBufferNumber) {
+  struct fake_xcanfd *core = fake_of(InstancePtr);
+  if (core->rx_in_send && fake_rx_pending(core) &&
+      (core->ier & XCANFD_IXR_RXOK_MASK)) {
+    XCanFd_IntrHandler(InstancePtr);
+  }
+  for (u32 i = 0; i < InstancePtr->CanFdConfig.NumofTxBuf; i++) {
+    if (!(core->trr & (1u << i))) {
+      memcpy(core->tx[i], FramePtr, sizeof(core->tx[i]));
+      core->trr |= 1u << i;
+      *TxBufferNumber = i;
+      return XST_SUCCESS;
+    }
+  }
+  return XST_FIFO_NO_ROOM;
+}
+
+int XCanFd_Recv_Sequential(XCanFd *InstancePtr, u32 *FramePtr) {
+  struct fake_xcanfd *core = fake_of(InstancePtr);
+  if (core->rx_head == core->rx_tail) {
+    return XST_NO_DATA;
+  }
+  memcpy(FramePtr, core->rx[core->rx_tail++ % FAKE_XCANFD_RX_FIFO],
+         CANFD_X_FRAME_WORDS * sizeof(u32));
+  return XST_SUCCESS;
+}
+
+int XCanFd_Recv_Mailbox(XCanFd *InstancePtr, u32 *FramePtr) {
+  struct fake_xcanfd *core = fake_of(InstancePtr);
+  if (core->mb_full == 0) {
+    return XST_NO_DATA;
+  }
+  int i = __builtin_ctzll(core->mb_full);
+  core->mb_full &= core->mb_full - 1;
+  memcpy(FramePtr, core->mb[i], CANFD_X_FRAME_WORDS * sizeof(u32));
+  return XST_SUCCESS;
+}
+
+void XCanFd_AcceptFilterEnable(XCanFd *InstancePtr, u32 FilterIndexMask) {
+  fake_of(InstancePtr)->afr_enabled |= FilterIndexMask;
+}
+
+void XCanFd_AcceptFilterDisable(XCanFd *InstancePtr, u32 FilterIndexMask) {
+  fake_of(InstancePtr)->afr_enabled &= ~FilterIndexMask;
+}
+
+int XCanFd_AcceptFilterSet(XCanFd *InstancePtr, u32 FilterIndex,
+                           u32 MaskValue, u32 IdValue) {
+  struct fake_xcanfd *core = fake_of(InstancePtr);
+  if (FilterIndex < 1 || FilterIndex > XCANFD_NOOF_AFR ||
+      (core->afr_enabled & (1u << (FilterIndex - 1)))) {
+    return XST_FAILURE;
+  }
+  core->afr_mask[FilterIndex - 1] = MaskValue;
+  core->afr_id[FilterIndex - 1] = IdValue;
+  return XST_SUCCESS;
+}
+
+int XCanFd_Set_MailBox_IdMask(XCanFd *InstancePtr, u32 RxBuffer,
+                              u32 MaskValue, u32 IdValue) {
+  struct fake_xcanfd *core = fake_of(InstancePtr);
+  if (RxBuffer >= InstancePtr->CanFdConfig.NumofRxMbBuf ||
+      (core->mb_active & ((u64)1 << RxBuffer))) {
+    return XST_FAILURE;
+  }
+  core->mb_mask[RxBuffer] = MaskValue;
+  core->mb_id[RxBuffer] = IdValue;
+  return XST_SUCCESS;
+}
+
+u32 XCanFd_RxBuff_MailBox_Active(XCanFd *InstancePtr, u32 RxBuffer) {
+  if (RxBuffer >= InstancePtr->CanFdConfig.NumofRxMbBuf) {
+    return XST_FAILURE;
+  }
+  fake_of(InstancePtr)->mb_active |= (u64)1 << RxBuffer;
+  return XST_SUCCESS;
+}
+
+u32 XCanFd_RxBuff_MailBox_DeActive(XCanFd *InstancePtr, u32 RxBuffer) {
+  if (RxBuffer >= InstancePtr->CanFdConfig.NumofRxMbBuf) {
+    return XST_FAILURE;
+  }
+  fake_of(InstancePtr)->mb_active &= ~((u64)1 << RxBuffer);
+  return XST_SUCCESS;
+}
+
+int XCanFd_SetHandler(XCanFd *InstancePtr, u32 HandlerType,
+                      void *CallBackFunc, void *CallBackRef) {
+  switch (HandlerType) {
+    case XCANFD_HANDLER_SEND:
+      InstancePtr->SendHandler = (XCanFd_SendRecvHandler)CallBackFunc;
+      InstancePtr->SendRef = CallBackRef;
+      break;
+    case XCANFD_HANDLER_RECV:
+      InstancePtr->RecvHandler = (XCanFd_SendRecvHandler)CallBackFunc;
+      InstancePtr->RecvRef = CallBackRef;
+      break;
+    case XCANFD_HANDLER_ERROR:
+      InstancePtr->ErrorHandler = (XCanFd_ErrorHandler)CallBackFunc;
+      InstancePtr->ErrorRef = CallBackRef;
+      break;
+    case XCANFD_HANDLER_EVENT:
+      InstancePtr->EventHandler = (XCanFd_EventHandler)CallBackFunc;
+      InstancePtr->EventRef = CallBackRef;
+      break;
+    default:
+      return XST_FAILURE;
+  }
+  return XST_SUCCESS;
+}
+
+// the order of the driver's handler: errors, events, RX, TX
+void XCanFd_IntrHandler(void *InstancePtr) {
+  XCanFd *CanPtr = (XCanFd *)InstancePtr;
+  struct fake_xcanfd *core = fake_of(CanPtr);
+  u32 pending = core->isr | (fake_rx_pending(core) ? XCANFD_IXR_RXOK_MASK : 0);
+  pending &= core->ier;
+  core->isr &= ~pending;
+  if ((pending & XCANFD_IXR_ERROR_MASK) && CanPtr->ErrorHandler != NULL) {
+    u32 esr = core->esr;
+    core->esr = 0;
+    CanPtr->ErrorHandler(CanPtr->ErrorRef, esr);
+  }
+  u32 events = pending & (XCANFD_IXR_RXOFLW_MASK | XCANFD_IXR_ARBLST_MASK |
+                          XCANFD_IXR_BSOFF_MASK | XCANFD_IXR_PEE_MASK);
+  if (events != 0 && CanPtr->EventHandler != NULL) {
+    CanPtr->EventHandler(CanPtr->EventRef, events);
+  }
+  if ((pending & XCANFD_IXR_RXOK_MASK) && CanPtr->RecvHandler != NULL) {
+    CanPtr->RecvHandler(CanPtr->RecvRef);
+  }
+  if ((pending & XCANFD_IXR_TXOK_MASK) && CanPtr->SendHandler != NULL) {
+    CanPtr->SendHandler(CanPtr->SendRef);
+  }
+}
+
+void XCanFd_InterruptEnable(XCanFd *InstancePtr, u32 Mask) {
+  fake_of(InstancePtr)->ier |= Mask & XCANFD_IXR_ALL;
+}
+
+void XCanFd_InterruptDisable(XCanFd *InstancePtr, u32 Mask) {
+  fake_of(InstancePtr)->ier &= ~Mask;
+}
+
+u32 XCanFd_InterruptGetEnabled(XCanFd *InstancePtr) {
+  return fake_of(InstancePtr)->ier;
+}
+
+void XCanFd_Pee_BusOff_Handler(XCanFd *InstancePtr) {
+  fake_of(InstancePtr)->bus_off_recoveries++;
+}
+
+int XSetupInterruptSystem(void *DriverInstance, void *IntrHandler, u32 IntrId,
+                          UINTPTR IntrParent, u16 Priority) {
+  (void)DriverInstance;
+  (void)IntrHandler;
+  (void)IntrId;
+  (void)IntrParent;
+  (void)Priority;
+  return XST_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#ifndef FAKE_XCANFD_H
+#define FAKE_XCANFD_H
+
+#include "can.h"
+#include "canfd_codec.h"
+#include "xcanfd.h"
+
+/*
+ * Fake AXI CAN FD core behind the xcanfd.h stand-in, so bsp_canfd.c runs on
+ * the host as it is. The test is the bus: fake_xcanfd_rx() packs a frame
+ * into ID/DLC/data words field by field (not through canfd_codec.h) and
+ * puts it through the acceptance filters or mailboxes into the RX FIFO,
+ * fake_xcanfd_tx_complete() sends what XCanFd_Send queued. Interrupts are
+ * delivered when the test calls XCanFd_IntrHandler(), nothing runs on its
+ * own.
+ */
+
+#define FAKE_XCANFD_RX_FIFO 64  // sequential RX FIFO, frames
+#define FAKE_XCANFD_MAILBOXES 48
+#define FAKE_XCANFD_TX_BUFFERS 32
+#define FAKE_XCANFD_TX_LOG 4096
+
+struct fake_xcanfd {
+  XCanFd_Config config;
+  XCanFd *instance;
+  u8 mode;
+  u32 ier;
+  u32 isr;  // latched interrupts, RXOK follows the RX FIFO / mailboxes
+  u32 esr;  // error bits for the next ERROR interrupt
+  // sequential RX FIFO
+  u32 rx[FAKE_XCANFD_RX_FIFO][CANFD_X_FRAME_WORDS];
+  u32 rx_head;
+  u32 rx_tail;
+  u32 afr_enabled;
+  u32 afr_mask[XCANFD_NOOF_AFR];
+  u32 afr_id[XCANFD_NOOF_AFR];
+  // RX mailboxes, one frame each
+  u64 mb_active;
+  u64 mb_full;
+  u32 mb_mask[FAKE_XCANFD_MAILBOXES];
+  u32 mb_id[FAKE_XCANFD_MAILBOXES];
+  u32 mb[FAKE_XCANFD_MAILBOXES][CANFD_X_FRAME_WORDS];
+  u32 rx_filtered;  // no filter or mailbox took the frame
+  u32 rx_lost;      // FIFO or every matching mailbox full
+  // TX buffers, TRR
+  u32 trr;
+  u32 tx[FAKE_XCANFD_TX_BUFFERS][CANFD_X_FRAME_WORDS];
+  u32 tx_log[FAKE_XCANFD_TX_LOG][CANFD_X_FRAME_WORDS];
+  u32 tx_count;
+  // run the RX interrupt from inside XCanFd_Send when a frame is waiting
+  // and RXOK is enabled, an RX interrupt during bsp_canfd_send's refill
+  int rx_in_send;
+  // bit timing as programmed, register values
+  u32 brp;
+  u32 tseg1;
+  u32 tseg2;
+  u32 sjw;
+  u32 f_brp;
+  u32 f_tseg1;
+  u32 f_tseg2;
+  u32 f_sjw;
+  u32 tdco;
+  u32 bus_off_recoveries;
+};
+
+// xil_printf goes to stdout when set
+extern int fake_xcanfd_verbose;
+
+// new core at base_addr for XCanFd_LookupConfig, rx_mode 1 for mailboxes
+struct fake_xcanfd *fake_xcanfd_add(UINTPTR base_addr, u32 rx_mode,
+                                    u32 rx_buffers, u32 tx_buffers);
+// a frame arrives from the bus: 1 stored, 0 filtered out, -1 lost
+int fake_xcanfd_rx(struct fake_xcanfd *core, const struct canfd_frame *frame);
+// the words fake_xcanfd_rx stores for a frame
+void fake_xcanfd_pack(const struct canfd_frame *frame, u32 *words);
+// send up to n of the requested TX buffers, lowest first, into tx_log and
+// latch TXOK; returns the number sent
+int fake_xcanfd_tx_complete(struct fake_xcanfd *core, int n);
+// latch error or event interrupts, esr for XCANFD_IXR_ERROR_MASK
+void fake_xcanfd_event(struct fake_xcanfd *core, u32 ixr, u32 esr);
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef XCANFD_H
+#define XCANFD_H
+
+#include <stdint.h>
+
+// the parts of xcanfd.h, xcanfd_hw.h, xil_types.h and xstatus.h the BSP
+// uses, backed by the fake core in fake_xcanfd.c
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef uintptr_t UINTPTR;
+
+#define XST_SUCCESS 0L
+#define XST_FAILURE 1L
+#define XST_FIFO_NO_ROOM 503L
+#define XST_NO_DATA 13L
+
+#define XCANFD_TRR_OFFSET 0x090
+
+#define XCANFD_MODE_CONFIG 0x00000001
+#define XCANFD_MODE_NORMAL 0x00000004
+
+// interrupt status / enable bits
+#define XCANFD_IXR_ARBLST_MASK 0x00000001
+#define XCANFD_IXR_TXOK_MASK 0x00000002
+#define XCANFD_IXR_PEE_MASK 0x00000004
+#define XCANFD_IXR_RXOK_MASK 0x00000010
+#define XCANFD_IXR_RXOFLW_MASK 0x00000040
+#define XCANFD_IXR_ERROR_MASK 0x00000100
+#define XCANFD_IXR_BSOFF_MASK 0x00000200
+#define XCANFD_IXR_ALL 0x000003FF
+
+// error status bits
+#define XCANFD_ESR_CRCER_MASK 0x00000001
+#define XCANFD_ESR_FMER_MASK 0x00000002
+#define XCANFD_ESR_STER_MASK 0x00000004
+#define XCANFD_ESR_BERR_MASK 0x00000008
+#define XCANFD_ESR_ACKER_MASK 0x00000010
+#define XCANFD_ESR_F_CRCER_MASK 0x00000100
+#define XCANFD_ESR_F_FMER_MASK 0x00000200
+#define XCANFD_ESR_F_STER_MASK 0x00000400
+#define XCANFD_ESR_F_BERR_MASK 0x00000800
+
+#define XCANFD_NOOF_AFR 32
+#define XCANFD_AFR_UAF_ALL_MASK 0xFFFFFFFF
+
+#define XCANFD_HANDLER_SEND 1
+#define XCANFD_HANDLER_RECV 2
+#define XCANFD_HANDLER_ERROR 3
+#define XCANFD_HANDLER_EVENT 4
+
+typedef void (*XCanFd_SendRecvHandler)(void *CallBackRef);
+typedef void (*XCanFd_ErrorHandler)(void *CallBackRef, u32 ErrorMask);
+typedef void (*XCanFd_EventHandler)(void *CallBackRef, u32 Mask);
+
+typedef struct {
+  UINTPTR BaseAddress;
+  u32 Rx_Mode;  // 1 mailbox, 0 sequential
+  u32 NumofRxMbBuf;
+  u32 NumofTxBuf;
+  u16 IntrId;
+  UINTPTR IntrParent;
+} XCanFd_Config;
+
+typedef struct {
+  XCanFd_Config CanFdConfig;
+  u32 IsReady;
+  XCanFd_SendRecvHandler SendHandler;
+  void *SendRef;
+  XCanFd_SendRecvHandler RecvHandler;
+  void *RecvRef;
+  XCanFd_ErrorHandler ErrorHandler;
+  void *ErrorRef;
+  XCanFd_EventHandler EventHandler;
+  void *EventRef;
+} XCanFd;
+
+#define XCANFD_GET_RX_MODE(InstancePtr) ((InstancePtr)->CanFdConfig.Rx_Mode)
+
+XCanFd_Config *XCanFd_LookupConfig(UINTPTR BaseAddress);
+int XCanFd_CfgInitialize(XCanFd *InstancePtr, XCanFd_Config *ConfigPtr,
+                         UINTPTR EffectiveAddr);
+u32 XCanFd_ReadReg(UINTPTR BaseAddress, u32 RegOffset);
+void XCanFd_EnterMode(XCanFd *InstancePtr, u8 OperationMode);
+u8 XCanFd_GetMode(XCanFd *InstancePtr);
+int XCanFd_SetBaudRatePrescaler(XCanFd *InstancePtr, u8 Prescaler);
+int XCanFd_SetBitTiming(XCanFd *InstancePtr, u8 SyncJumpWidth,
+                        u8 TimeSegment2, u16 TimeSegment1);
+int XCanFd_SetFBaudRatePrescaler(XCanFd *InstancePtr, u8 Prescaler);
+int XCanFd_SetFBitTiming(XCanFd *InstancePtr, u8 SyncJumpWidth,
+                         u8 TimeSegment2, u8 TimeSegment1);
+int XCanFd_Set_Tranceiver_Delay_Compensation(XCanFd *InstancePtr,
+                                             u32 TdcOffset);
+void XCanFd_SetBitRateSwitch_DisableNominal(XCanFd *InstancePtr);
+int XCanFd_Send(XCanFd *InstancePtr, u32 *FramePtr, u32 *TxBufferNumber);
+int XCanFd_Recv_Sequential(XCanFd *InstancePtr, u32 *FramePtr);
+int XCanFd_Recv_Mailbox(XCanFd *InstancePtr, u32 *FramePtr);
+void XCanFd_AcceptFilterEnable(XCanFd *InstancePtr, u32 FilterIndexMask);
+void XCanFd_AcceptFilterDisable(XCanFd *InstancePtr, u32 FilterIndexMask);
+int XCanFd_AcceptFilterSet(XCanFd *InstancePtr, u32 FilterIndex,
+                           u32 MaskValue, u32 IdValue);
+int XCanFd_Set_MailBox_IdMask(XCanFd *InstancePtr, u32 RxBuffer,
+                              u32 MaskValue, u32 IdValue);
+u32 XCanFd_RxBuff_MailBox_Active(XCanFd *InstancePtr, u32 RxBuffer);
+u32 XCanFd_RxBuff_MailBox_DeActive(XCanFd *InstancePtr, u32 RxBuffer);
+int XCanFd_SetHandler(XCanFd *InstancePtr, u32 HandlerType,
+                      void *CallBackFunc, void *CallBackRef);
+void XCanFd_IntrHandler(void *InstancePtr);
+void XCanFd_InterruptEnable(XCanFd *InstancePtr, u32 Mask);
+void XCanFd_InterruptDisable(XCanFd *InstancePtr, u32 Mask);
+u32 XCanFd_InterruptGetEnabled(XCanFd *InstancePtr);
+void XCanFd_Pee_BusOff_Handler(XCanFd *InstancePtr);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef XIL_PRINTF_H
+#define XIL_PRINTF_H
+
+// the host build's xil_printf, in fake_xcanfd.c, silent unless
+// fake_xcanfd_verbose is set
+void xil_printf(const char *fmt, ...);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef XINTERRUPT_WRAP_H
+#define XINTERRUPT_WRAP_H
+
+#include "xcanfd.h"
+
+#define XINTERRUPT_DEFAULT_PRIORITY 0xA0
+
+// the fake core has no interrupt controller, tests call XCanFd_IntrHandler
+int XSetupInterruptSystem(void *DriverInstance, void *IntrHandler, u32 IntrId,
+                          UINTPTR IntrParent, u16 Priority);
+
+#endif
@@ -1,211 +1,144 @@
-#include <linux/can.h>
-#include <linux/can/raw.h>
-
+#include <algorithm>
 #include <asio.hpp>
 #include <chrono>
 #include <cstdbool>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
 #include <thread>
 #include <vector>
 
-int main(int argc, char *argv[]) {
-  asio::io_context iocxt;
+#include "ser_can_bridge.hpp"
 
-  // serial, 1 start bit, 8 data bits, 1 stop bit, no parity, 2.5M baud
-  // CAN 100K, Serial 1M, 1 start bit, 8 data bits, 1 stop bit, no parity
-  // CAN 250K, Serial 2M, 1 start bit, 6 data bits, 1 stop bit, no parity
-  // CAN 500K, Serial 4M, 1 start bit, 6 data bits, 1 stop bit, no parity
-  asio::serial_port ser(iocxt, "/dev/ttyACM0");
-  ser.set_option(asio::serial_port::baud_rate(2000000));
-  ser.set_option(asio::serial_port::character_size(6));
-  ser.set_option(
-      asio::serial_port::stop_bits(asio::serial_port::stop_bits::one));
-  ser.set_option(asio::serial_port::parity(asio::serial_port::parity::none));
-  ser.set_option(
-      asio::serial_port::flow_control(asio::serial_port::flow_control::none));
-  if (!ser.is_open()) {
-    std::cerr << "Failed to open serial port" << std::endl;
-    return -1;
-  }
+static void usage(const char *prog) {
+  std::cerr << "usage: " << prog
+            << " [-j threads] [-s stats_seconds] [-m metrics_seconds]"
+            << " [serial=can ...]\n"
+            << "       " << prog << " [serial] [can]\n"
+            << "e.g.   " << prog
+            << " -j 4 /dev/ttyACM0=vxcan0 /dev/ttyACM1=vxcan1\n"
+            << "SIGUSR1 or every metrics_seconds: one JSON line per port"
+            << std::endl;
+}
 
-  // can
-  int dev = socket(PF_CAN, SOCK_RAW, CAN_RAW);
-  if (dev < 0) {
-    std::cerr << "Failed to open can" << std::endl;
-    return -1;
-  }
-  struct ifreq ifr;
-  std::strcpy(ifr.ifr_name, "vxcan0");
-  if (ioctl(dev, SIOCGIFINDEX, &ifr) < 0) {
-    std::cerr << "Failed to ioctl can" << std::endl;
-    return -1;
+int main(int argc, char *argv[]) {
+  // worker threads, default one per pair up to the number of cores
+  unsigned threads = 0;
+  std::chrono::seconds stats_period(10);
+  // JSON metrics dump, 0 for SIGUSR1 only
+  std::chrono::seconds metrics_period(0);
+  std::vector<ch343::SerCanBridgeConfig> configs;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "-j" || arg == "-s" || arg == "-m") && i + 1 < argc) {
+      unsigned long value = std::strtoul(argv[++i], nullptr, 0);
+      if (arg == "-j") {
+        threads = value;
+      } else if (arg == "-s") {
+        stats_period = std::chrono::seconds(value);
+      } else {
+        metrics_period = std::chrono::seconds(value);
+      }
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+      return arg == "-h" ? 0 : -1;
+    } else if (arg.find('=') != std::string::npos) {
+      ch343::SerCanBridgeConfig config;
+      config.ser_name = arg.substr(0, arg.find('='));
+      config.can_name = arg.substr(arg.find('=') + 1);
+      configs.push_back(config);
+    } else {
+      positional.push_back(arg);
+    }
   }
-  struct sockaddr_can addr;
-  addr.can_family = AF_CAN;
-  addr.can_ifindex = ifr.ifr_ifindex;
-  int enable_canfd = 1;
-  if (setsockopt(dev, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable_canfd,
-                 sizeof(enable_canfd)) < 0) {
-    std::cerr << "Failed to setsockopt canfd" << std::endl;
+  // chvxcan [serial] [can], e.g. chvxcan /dev/ttyACM0 vxcan0
+  if (configs.empty()) {
+    ch343::SerCanBridgeConfig config;
+    if (positional.size() > 0) {
+      config.ser_name = positional[0];
+    }
+    if (positional.size() > 1) {
+      config.can_name = positional[1];
+    }
+    configs.push_back(config);
+  } else if (!positional.empty()) {
+    usage(argv[0]);
     return -1;
   }
-  if (bind(dev, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-    std::cerr << "Failed to bind can" << std::endl;
-    return -1;
+  if (threads == 0) {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<unsigned>(configs.size(), cores);
   }
-  asio::posix::stream_descriptor can(iocxt, dev);
 
-  constexpr uint8_t Bit0 = 0x00;
-  constexpr uint8_t Bit1 = 0xFF;
+  asio::io_context iocxt((int)threads);
 
-  // can crc15 calculation
-  auto crc15 = [&](const std::vector<uint8_t> &data) {
-    bool crc[15] = {0};
-    for (int i = 0; i < data.size(); i++) {
-      bool inv = (data[i] == Bit1) ^ crc[14];
-      crc[14] = crc[13] ^ inv;
-      crc[13] = crc[12];
-      crc[12] = crc[11];
-      crc[11] = crc[10];
-      crc[10] = crc[9] ^ inv;
-      crc[9] = crc[8];
-      crc[8] = crc[7] ^ inv;
-      crc[7] = crc[6] ^ inv;
-      crc[6] = crc[5];
-      crc[5] = crc[4];
-      crc[4] = crc[3] ^ inv;
-      crc[3] = crc[2] ^ inv;
-      crc[2] = crc[1];
-      crc[1] = crc[0];
-      crc[0] = inv;
-    }
-    uint16_t res = 0;
-    for (int i = 0; i < 15; i++) {
-      res |= crc[i] << i;
-    }
-    return res;
-  };
-
-  // fill stuff bits
-  auto fsb_insert = [&](std::vector<uint8_t> &data) {
-    uint8_t count = 0;
-    bool last = true;
-    std::vector<uint8_t> newdata;
-    for (auto it = data.begin(); it != data.end(); it++) {
-      bool current = *it == Bit0 ? false : true;
-      newdata.push_back(*it);
-      if (current == last) {
-        count++;
-      } else {
-        count = 1;
-      }
-      if (count == 5) {
-        newdata.push_back(current ? Bit0 : Bit1);
-        count = 1;
-        last = !current;
-      } else {
-        last = current;
-      }
+  std::vector<std::unique_ptr<ch343::SerCanBridge>> bridges;
+  for (auto &config : configs) {
+    config.stats_period = stats_period;
+    bridges.push_back(std::make_unique<ch343::SerCanBridge>(iocxt, config));
+    if (!bridges.back()->open()) {
+      return -1;
     }
-    return newdata;
-  };
+  }
+  for (auto &bridge : bridges) {
+    std::cout << bridge->name() << std::endl;
+    bridge->start();
+  }
+  std::cout << bridges.size() << " ports, " << threads << " threads"
+            << std::endl;
 
-  // socketcan frame to serial frame
-  auto can2ser = [&](const can_frame &frame) {
-    std::vector<uint8_t> data;
-    uint32_t id = 0;
-    bool is_extended = frame.can_id & CAN_EFF_FLAG ? true : false;
-    bool is_remote = frame.can_id & CAN_RTR_FLAG;
-    uint8_t dlc = frame.can_dlc;
-    data.push_back(Bit0);  // SOF, Start of frame
-    if (is_extended) {
-      id = frame.can_id & CAN_EFF_MASK;
-      // High 11 bits id
-      for (uint8_t i = 0; i < 11; i++) {
-        uint8_t tmp = ((uint8_t)(id >> (28 - i)) & 0x01) ? Bit1 : Bit0;
-        data.push_back(tmp);
-      }
-      data.push_back(Bit1);  // SRR, Substitute remote request
-      data.push_back(Bit1);  // IDE, Identifier extension
-      // Low 18 bits id
-      for (uint8_t i = 0; i < 18; i++) {
-        uint8_t tmp = ((uint8_t)(id >> (17 - i)) & 0x01) ? Bit1 : Bit0;
-        data.push_back(tmp);
-      }
-      // RTR
-      if (is_remote) {
-        data.push_back(Bit1);
-      } else {
-        data.push_back(Bit0);
-      }
-      data.push_back(Bit0);  // RB1, reserved bit 1
-    } else {
-      id = frame.can_id & CAN_SFF_MASK;
-      for (uint8_t i = 0; i < 11; i++) {
-        uint8_t tmp = ((uint8_t)(id >> (10 - i)) & 0x01) ? Bit1 : Bit0;
-        data.push_back(tmp);
-      }
-      // RTR
-      if (is_remote) {
-        data.push_back(Bit1);
-      } else {
-        data.push_back(Bit0);
-      }
-      data.push_back(Bit0);  // IDE, Identifier extension
-    }
-    data.push_back(Bit0);  // RB0, reserved bit 0
-    // 4 bits DLC
-    for (uint8_t i = 0; i < 4; i++) {
-      uint8_t tmp = ((uint8_t)(dlc >> (3 - i)) & 0x01) ? Bit1 : Bit0;
-      data.push_back(tmp);
+  // machine readable metrics, on their own strand so that a signal and the
+  // timer never dump at the same time; the counters are read lock free while
+  // the ports keep running
+  auto metrics_strand = asio::make_strand(iocxt);
+  auto metrics_dump = [&bridges]() {
+    std::ostringstream os;
+    for (auto &bridge : bridges) {
+      bridge->dump_json(os);
+      os << "\n";
     }
-    // 0~64 bits data
-    for (uint8_t i = 0; i < frame.can_dlc; i++) {
-      for (uint8_t j = 0; j < 8; j++) {
-        uint8_t tmp = ((frame.data[i] >> (7 - j)) & 0x01) ? Bit1 : Bit0;
-        data.push_back(tmp);
-      }
-    }
-    // CRC15
-    uint16_t crc = crc15(data);
-    for (uint8_t i = 0; i < 15; i++) {
-      uint8_t tmp = ((crc >> (14 - i)) & 0x01) ? Bit1 : Bit0;
-      data.push_back(tmp);
-    }
-    data.push_back(Bit1);  // CRC Delimiter
-    // ACK, ACK Delimiter, EOF, IFS will not be cared
-    return data;
+    std::cout << os.str() << std::flush;
   };
-
-  // read socketcan frame and write to serial
-  uint8_t can_buffer[1024];
-  std::function<void(const asio::error_code &, std::size_t)> can2ser_read =
-      [&](const asio::error_code &ec, std::size_t bytes_transferred) {
+  asio::signal_set signals(metrics_strand, SIGUSR1);
+  std::function<void(const asio::error_code &, int)> metrics_signal =
+      [&](const asio::error_code &ec, int) {
         if (ec) {
-          std::cerr << "Read error: " << ec.message() << std::endl;
-        } else {
-          if (bytes_transferred == CAN_MTU) {
-            struct can_frame frame;
-            std::memcpy(&frame, can_buffer, sizeof(can_frame));
-            auto data0 = can2ser(frame);
-            auto data = fsb_insert(data0);
-
-            asio::async_write(
-                ser, asio::buffer(data),
-                [&](const asio::error_code &ec, std::size_t bytes_transferred) {
-                  if (ec) {
-                    std::cerr << "Write error: " << ec.message() << std::endl;
-                  }
-                });
-          }
+          return;
         }
-        can.async_read_some(asio::buffer(can_buffer), can2ser_read);
+        metrics_dump();
+        signals.async_wait(metrics_signal);
       };
-  can.async_read_some(asio::buffer(can_buffer), can2ser_read);
+  signals.async_wait(metrics_signal);
+  asio::steady_timer metrics_timer(metrics_strand);
+  std::function<void(const asio::error_code &)> metrics_tick =
+      [&](const asio::error_code &ec) {
+        if (ec) {
+          std::cerr << "Timer error: " << ec.message() << std::endl;
+          return;
+        }
+        metrics_dump();
+        metrics_timer.expires_at(metrics_timer.expiry() + metrics_period);
+        metrics_timer.async_wait(metrics_tick);
+      };
+  if (metrics_period.count() > 0) {
+    metrics_timer.expires_after(metrics_period);
+    metrics_timer.async_wait(metrics_tick);
+  }
 
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads; i++) {
+    workers.emplace_back([&iocxt]() { iocxt.run(); });
+  }
   iocxt.run();
+  for (auto &worker : workers) {
+    worker.join();
+  }
 
   return 0;
-}
\ No newline at end of file
+}
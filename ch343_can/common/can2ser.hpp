@@ -0,0 +1,375 @@
+#ifndef CH343_CAN2SER_HPP
+#define CH343_CAN2SER_HPP
+
+#include <linux/can.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// socketcan frame -> serial symbols, one UART character per CAN bit.
+// The serial line is idle high, so a character of 0x00 is a dominant bit
+// and 0xFF is a recessive bit (only the low character_size bits are sent).
+namespace ch343 {
+
+constexpr uint8_t Bit0 = 0x00;
+constexpr uint8_t Bit1 = 0xFF;
+
+// SOF, 11 + 18 bits id, SRR, IDE, RTR, r1, r0, 4 bits DLC, 64 bits data,
+// 15 bits CRC, CRC delimiter
+constexpr std::size_t CanMaxBits = 1 + 11 + 1 + 1 + 18 + 1 + 1 + 1 + 4 + 64 + 15 + 1;
+// first stuff bit after 5 equal bits, then at most one every 4 bits
+constexpr std::size_t CanMaxStuffBits = (CanMaxBits - 1) / 4;
+constexpr std::size_t CanMaxSymbols = CanMaxBits + CanMaxStuffBits;
+
+using CanSerBuffer = std::array<uint8_t, CanMaxSymbols>;
+
+namespace detail {
+
+// byte-wise CRC-15/CAN, x^15 + x^14 + x^10 + x^8 + x^7 + x^4 + x^3 + 1
+constexpr uint16_t Crc15Poly = 0x4599;
+
+constexpr std::array<uint16_t, 256> make_crc15_table() {
+  std::array<uint16_t, 256> table{};
+  for (int i = 0; i < 256; i++) {
+    uint16_t crc = (uint16_t)(i << 7);
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x4000) ? (uint16_t)((crc << 1) ^ Crc15Poly)
+                           : (uint16_t)(crc << 1);
+    }
+    table[i] = crc & 0x7FFF;
+  }
+  return table;
+}
+
+// one byte -> 8 symbols, MSB first
+constexpr std::array<std::array<uint8_t, 8>, 256> make_symbol_table() {
+  std::array<std::array<uint8_t, 8>, 256> table{};
+  for (int i = 0; i < 256; i++) {
+    for (int j = 0; j < 8; j++) {
+      table[i][j] = ((i >> (7 - j)) & 0x01) ? Bit1 : Bit0;
+    }
+  }
+  return table;
+}
+
+// run lengths of equal bits inside one byte, MSB first
+struct ByteRuns {
+  uint8_t head;  // leading run, starting at bit 7
+  uint8_t tail;  // trailing run, ending at bit 0
+  uint8_t max;   // longest run anywhere in the byte
+};
+
+constexpr std::array<ByteRuns, 256> make_runs_table() {
+  std::array<ByteRuns, 256> table{};
+  for (int i = 0; i < 256; i++) {
+    uint8_t run = 1;
+    uint8_t max = 1;
+    uint8_t head = 0;
+    for (int j = 6; j >= 0; j--) {
+      if (((i >> j) & 0x01) == ((i >> (j + 1)) & 0x01)) {
+        run++;
+      } else {
+        if (head == 0) {
+          head = run;
+        }
+        run = 1;
+      }
+      if (run > max) {
+        max = run;
+      }
+    }
+    table[i].head = head == 0 ? run : head;
+    table[i].tail = run;
+    table[i].max = max;
+  }
+  return table;
+}
+
+inline constexpr auto crc15_table = make_crc15_table();
+inline constexpr auto symbol_table = make_symbol_table();
+inline constexpr auto runs_table = make_runs_table();
+
+// bit stuffing state carried across bytes
+struct Stuffer {
+  uint8_t *out;
+  uint8_t count = 0;
+  bool last = true;
+
+  uint16_t stuff_bits = 0;  // stuff bits inserted so far
+
+  void put_bit(bool current) {
+    *out++ = current ? Bit1 : Bit0;
+    count = current == last ? count + 1 : 1;
+    if (count == 5) {
+      *out++ = current ? Bit0 : Bit1;
+      stuff_bits++;
+      count = 1;
+      last = !current;
+    } else {
+      last = current;
+    }
+  }
+
+  // low nbits of value, MSB first
+  void put_bits(uint64_t value, int nbits) {
+    for (int i = nbits - 1; i >= 0; i--) {
+      put_bit((value >> i) & 0x01);
+    }
+  }
+
+  void put_byte(uint8_t byte) {
+    const ByteRuns &runs = runs_table[byte];
+    bool msb = byte & 0x80;
+    if (runs.max < 5 && (msb != last || count + runs.head < 5)) {
+      // no stuff bit can fall inside this byte
+      std::memcpy(out, symbol_table[byte].data(), 8);
+      out += 8;
+      last = byte & 0x01;
+      count = runs.tail;
+    } else {
+      put_bits(byte, 8);
+    }
+  }
+};
+
+}  // namespace detail
+
+// crc15 over a bit stream packed MSB first into bytes. The CAN CRC starts
+// from zero, so leading zero padding bits do not change the result.
+inline uint16_t crc15(const uint8_t *data, std::size_t len) {
+  uint16_t crc = 0;
+  for (std::size_t i = 0; i < len; i++) {
+    crc = (uint16_t)((crc << 8) ^
+                     detail::crc15_table[((crc >> 7) ^ data[i]) & 0xFF]) &
+          0x7FFF;
+  }
+  return crc;
+}
+
+// SOF .. data of a frame packed MSB first and right aligned in bytes, so that
+// CRC15 + CRC delimiter appended after it ends exactly on a byte boundary.
+// Returns the number of bytes, first_bits is the number of frame bits in
+// packed[0]. packed must hold CanMaxPackedBytes.
+constexpr std::size_t CanMaxPackedBytes = 5 + CAN_MAX_DLEN + 2;
+
+inline std::size_t can_pack(const can_frame &frame, uint8_t *packed,
+                            int &first_bits) {
+  bool is_extended = frame.can_id & CAN_EFF_FLAG ? true : false;
+  bool is_remote = frame.can_id & CAN_RTR_FLAG ? true : false;
+  uint8_t len = frame.can_dlc < CAN_MAX_DLEN ? frame.can_dlc : CAN_MAX_DLEN;
+  // DLC 9..15 of an 8 byte frame is carried in len8_dlc
+  uint8_t dlc = (len == CAN_MAX_DLEN && frame.len8_dlc > CAN_MAX_DLEN &&
+                 frame.len8_dlc <= CAN_MAX_RAW_DLC)
+                    ? frame.len8_dlc
+                    : len;
+  // remote frames have no data field
+  if (is_remote) {
+    len = 0;
+  }
+
+  uint64_t header;
+  int header_bits;
+  int header_bytes;
+  if (is_extended) {
+    uint32_t id = frame.can_id & CAN_EFF_MASK;
+    // SOF, id[28:18], SRR, IDE, id[17:0], RTR, r1, r0, DLC
+    header = (uint64_t)(id >> 18) << 27 | (uint64_t)1 << 26 |
+             (uint64_t)1 << 25 | (uint64_t)(id & 0x3FFFF) << 7 |
+             (uint64_t)is_remote << 6 | dlc;
+    header_bits = 39;
+    header_bytes = 5;
+  } else {
+    uint32_t id = frame.can_id & CAN_SFF_MASK;
+    // SOF, id[10:0], RTR, IDE, r0, DLC
+    header = (uint64_t)id << 7 | (uint64_t)is_remote << 6 | dlc;
+    header_bits = 19;
+    header_bytes = 3;
+  }
+  for (int i = 0; i < header_bytes; i++) {
+    packed[i] = (uint8_t)(header >> (8 * (header_bytes - 1 - i)));
+  }
+  std::memcpy(packed + header_bytes, frame.data, len);
+  first_bits = header_bits - 8 * (header_bytes - 1);
+  return header_bytes + len;
+}
+
+// CRC15 of a socketcan frame as sent on the bus
+inline uint16_t can_crc15(const can_frame &frame) {
+  uint8_t packed[CanMaxPackedBytes];
+  int first_bits;
+  return crc15(packed, can_pack(frame, packed, first_bits));
+}
+
+// recessive ACK slot (nobody acks on the serial side), ACK delimiter, EOF
+// and intermission, sent after every frame so that back to back frames keep
+// the bus idle time
+constexpr std::size_t CanTrailerBits = 1 + 1 + 7 + 3;
+inline constexpr std::array<uint8_t, CanTrailerBits> can_trailer = {
+    Bit1, Bit1, Bit1, Bit1, Bit1, Bit1, Bit1, Bit1, Bit1, Bit1, Bit1, Bit1};
+
+// socketcan frame to stuffed serial frame, returns the number of symbols
+// written to out. Bit stuffing covers SOF .. CRC, the CRC delimiter is sent
+// as is. ACK, ACK Delimiter, EOF, IFS are not included, see can_trailer.
+inline std::size_t can2ser(const can_frame &frame, uint8_t *out) {
+  uint8_t packed[CanMaxPackedBytes];
+  int first_bits;
+  std::size_t n = can_pack(frame, packed, first_bits);
+  uint16_t crc = crc15(packed, n);
+  // CRC15 followed by the recessive CRC delimiter
+  uint16_t crc_field = (uint16_t)(crc << 1 | 0x01);
+  packed[n++] = (uint8_t)(crc_field >> 8);
+  packed[n++] = (uint8_t)crc_field;
+
+  detail::Stuffer stuffer{out};
+  stuffer.put_bits(packed[0], first_bits);
+  for (std::size_t i = 1; i < n - 1; i++) {
+    stuffer.put_byte(packed[i]);
+  }
+  stuffer.put_bits(packed[n - 1] >> 1, 7);
+  *stuffer.out++ = Bit1;  // CRC delimiter
+  return stuffer.out - out;
+}
+
+inline std::size_t can2ser(const can_frame &frame, CanSerBuffer &out) {
+  return can2ser(frame, out.data());
+}
+
+// CAN FD frames (ISO 11898-1:2015) without bit rate switching, every bit at
+// the nominal rate.
+
+// SOF, 11 + 18 bits id, SRR, IDE, RRS, FDF, res, BRS, ESI, 4 bits DLC, 512
+// bits data: the part with dynamic bit stuffing
+constexpr std::size_t CanFdMaxDynamicBits =
+    1 + 11 + 1 + 1 + 18 + 1 + 1 + 1 + 1 + 1 + 4 + 8 * CANFD_MAX_DLEN;
+// 4 bits stuff count and 21 bits CRC, a fixed stuff bit before every 4 bits
+constexpr std::size_t CanFdMaxCrcSymbols = 4 + 21 + (4 + 21 + 3) / 4;
+// + CRC delimiter
+constexpr std::size_t CanFdMaxSymbols = CanFdMaxDynamicBits +
+                                        (CanFdMaxDynamicBits - 1) / 4 +
+                                        CanFdMaxCrcSymbols + 1;
+
+using CanFdSerBuffer = std::array<uint8_t, CanFdMaxSymbols>;
+
+namespace detail {
+
+// CRC-17 up to 16 data bytes, CRC-21 above, register starts with the MSB set
+constexpr uint32_t Crc17Poly = 0x1685B;
+constexpr uint32_t Crc21Poly = 0x102899;
+
+// bit serial over symbols, they include the dynamic stuff bits
+inline uint32_t crcfd(uint32_t crc, uint32_t poly, int width,
+                      const uint8_t *symbols, std::size_t n) {
+  uint32_t top = 1u << (width - 1);
+  uint32_t mask = (top << 1) - 1;
+  for (std::size_t i = 0; i < n; i++) {
+    bool bit = symbols[i] != Bit0;
+    bool msb = crc & top;
+    crc = (crc << 1) & mask;
+    if (bit != msb) {
+      crc ^= poly;
+    }
+  }
+  return crc;
+}
+
+// dynamic stuff bit count mod 8, Gray coded, followed by even parity
+constexpr std::array<uint8_t, 8> stuff_count_table = {
+    0x0, 0x3, 0x6, 0x5, 0xC, 0xF, 0xA, 0x9};
+
+}  // namespace detail
+
+// DLC of a CAN FD payload length, lengths between the valid ones round up
+inline uint8_t canfd_len2dlc(uint8_t len) {
+  static constexpr uint8_t table[CANFD_MAX_DLEN + 1] = {
+      0,  1,  2,  3,  4,  5,  6,  7,  8,                           // 0..8
+      9,  9,  9,  9,                                               // 9..12
+      10, 10, 10, 10,                                              // 13..16
+      11, 11, 11, 11,                                              // 17..20
+      12, 12, 12, 12,                                              // 21..24
+      13, 13, 13, 13, 13, 13, 13, 13,                              // 25..32
+      14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,  // 33..47
+      14,                                                          // 48
+      15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  // 49..63
+      15};                                                         // 64
+  return table[len < CANFD_MAX_DLEN ? len : CANFD_MAX_DLEN];
+}
+
+inline uint8_t canfd_dlc2len(uint8_t dlc) {
+  static constexpr uint8_t table[16] = {0, 1,  2,  3,  4,  5,  6,  7,
+                                        8, 12, 16, 20, 24, 32, 48, 64};
+  return table[dlc & 0x0F];
+}
+
+// CAN FD frame to serial symbols, SOF .. CRC delimiter, returns the number of
+// symbols written to out. BRS is sent dominant, ESI from CANFD_ESI. A length
+// that is no valid CAN FD length is padded with zero bytes up to the next.
+inline std::size_t canfd2ser(const canfd_frame &frame, uint8_t *out) {
+  bool is_extended = frame.can_id & CAN_EFF_FLAG ? true : false;
+  bool esi = frame.flags & CANFD_ESI ? true : false;
+  uint8_t dlc = canfd_len2dlc(frame.len);
+  uint8_t len = canfd_dlc2len(dlc);
+  uint8_t data_len = frame.len < len ? frame.len : len;
+
+  // FDF, res, BRS, ESI, DLC after a dominant RRS (and IDE)
+  uint64_t control = (uint64_t)1 << 7 | (uint64_t)esi << 4 | dlc;
+  uint64_t header;
+  int header_bits;
+  if (is_extended) {
+    uint32_t id = frame.can_id & CAN_EFF_MASK;
+    // SOF, id[28:18], SRR, IDE, id[17:0], RRS, FDF, res, BRS, ESI, DLC
+    header = (uint64_t)(id >> 18) << 29 | (uint64_t)1 << 28 |
+             (uint64_t)1 << 27 | (uint64_t)(id & 0x3FFFF) << 9 | control;
+    header_bits = 41;
+  } else {
+    uint32_t id = frame.can_id & CAN_SFF_MASK;
+    // SOF, id[10:0], RRS, IDE, FDF, res, BRS, ESI, DLC
+    header = (uint64_t)id << 10 | control;
+    header_bits = 22;
+  }
+
+  detail::Stuffer stuffer{out};
+  stuffer.put_bits(header, header_bits);
+  for (uint8_t i = 0; i < len; i++) {
+    stuffer.put_byte(i < data_len ? frame.data[i] : 0);
+  }
+  std::size_t n = stuffer.out - out;
+
+  // stuff count, then CRC over everything so far
+  uint8_t stuff_count = detail::stuff_count_table[stuffer.stuff_bits & 0x07];
+  uint8_t sc_symbols[4];
+  for (int i = 0; i < 4; i++) {
+    sc_symbols[i] = (stuff_count >> (3 - i)) & 0x01 ? Bit1 : Bit0;
+  }
+  bool crc21 = len > 16;
+  int width = crc21 ? 21 : 17;
+  uint32_t poly = crc21 ? detail::Crc21Poly : detail::Crc17Poly;
+  uint32_t crc = detail::crcfd(1u << (width - 1), poly, width, out, n);
+  crc = detail::crcfd(crc, poly, width, sc_symbols, 4);
+
+  // fixed stuff bits: the complement of the previous bit, before the stuff
+  // count and then after every 4 bits of stuff count + CRC
+  uint32_t field = (uint32_t)stuff_count << width | crc;
+  int field_bits = 4 + width;
+  uint8_t *p = out + n;
+  bool previous = p[-1] != Bit0;
+  for (int i = field_bits - 1; i >= 0; i--) {
+    if ((field_bits - 1 - i) % 4 == 0) {
+      *p++ = previous ? Bit0 : Bit1;
+      previous = !previous;
+    }
+    previous = (field >> i) & 0x01;
+    *p++ = previous ? Bit1 : Bit0;
+  }
+  *p++ = Bit1;  // CRC delimiter
+  return p - out;
+}
+
+inline std::size_t canfd2ser(const canfd_frame &frame, CanFdSerBuffer &out) {
+  return canfd2ser(frame, out.data());
+}
+
+}  // namespace ch343
+
+#endif  // CH343_CAN2SER_HPP
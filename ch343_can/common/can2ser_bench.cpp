@@ -0,0 +1,212 @@
+// can2ser throughput and bit exactness, table driven encoder vs the original
+// per-bit std::vector lambdas. The reference carries the two bus conformance
+// fixes made since: remote frames have no data field and the CRC delimiter
+// is not part of bit stuffing.
+#include <linux/can.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "can2ser.hpp"
+
+using ch343::Bit0;
+using ch343::Bit1;
+
+// can crc15 calculation
+static uint16_t legacy_crc15(const std::vector<uint8_t> &data) {
+  bool crc[15] = {0};
+  for (size_t i = 0; i < data.size(); i++) {
+    bool inv = (data[i] == Bit1) ^ crc[14];
+    crc[14] = crc[13] ^ inv;
+    crc[13] = crc[12];
+    crc[12] = crc[11];
+    crc[11] = crc[10];
+    crc[10] = crc[9] ^ inv;
+    crc[9] = crc[8];
+    crc[8] = crc[7] ^ inv;
+    crc[7] = crc[6] ^ inv;
+    crc[6] = crc[5];
+    crc[5] = crc[4];
+    crc[4] = crc[3] ^ inv;
+    crc[3] = crc[2] ^ inv;
+    crc[2] = crc[1];
+    crc[1] = crc[0];
+    crc[0] = inv;
+  }
+  uint16_t res = 0;
+  for (int i = 0; i < 15; i++) {
+    res |= crc[i] << i;
+  }
+  return res;
+}
+
+// fill stuff bits, SOF .. CRC
+static std::vector<uint8_t> legacy_fsb_insert(std::vector<uint8_t> &data) {
+  uint8_t count = 0;
+  bool last = true;
+  std::vector<uint8_t> newdata;
+  for (auto it = data.begin(); it != data.end() - 1; it++) {
+    bool current = *it == Bit0 ? false : true;
+    newdata.push_back(*it);
+    if (current == last) {
+      count++;
+    } else {
+      count = 1;
+    }
+    if (count == 5) {
+      newdata.push_back(current ? Bit0 : Bit1);
+      count = 1;
+      last = !current;
+    } else {
+      last = current;
+    }
+  }
+  newdata.push_back(data.back());  // CRC Delimiter
+  return newdata;
+}
+
+// socketcan frame to serial frame
+static std::vector<uint8_t> legacy_can2ser(const can_frame &frame) {
+  std::vector<uint8_t> data;
+  uint32_t id = 0;
+  bool is_extended = frame.can_id & CAN_EFF_FLAG ? true : false;
+  bool is_remote = frame.can_id & CAN_RTR_FLAG;
+  uint8_t dlc = frame.can_dlc;
+  data.push_back(Bit0);  // SOF, Start of frame
+  if (is_extended) {
+    id = frame.can_id & CAN_EFF_MASK;
+    // High 11 bits id
+    for (uint8_t i = 0; i < 11; i++) {
+      uint8_t tmp = ((uint8_t)(id >> (28 - i)) & 0x01) ? Bit1 : Bit0;
+      data.push_back(tmp);
+    }
+    data.push_back(Bit1);  // SRR, Substitute remote request
+    data.push_back(Bit1);  // IDE, Identifier extension
+    // Low 18 bits id
+    for (uint8_t i = 0; i < 18; i++) {
+      uint8_t tmp = ((uint8_t)(id >> (17 - i)) & 0x01) ? Bit1 : Bit0;
+      data.push_back(tmp);
+    }
+    // RTR
+    if (is_remote) {
+      data.push_back(Bit1);
+    } else {
+      data.push_back(Bit0);
+    }
+    data.push_back(Bit0);  // RB1, reserved bit 1
+  } else {
+    id = frame.can_id & CAN_SFF_MASK;
+    for (uint8_t i = 0; i < 11; i++) {
+      uint8_t tmp = ((uint8_t)(id >> (10 - i)) & 0x01) ? Bit1 : Bit0;
+      data.push_back(tmp);
+    }
+    // RTR
+    if (is_remote) {
+      data.push_back(Bit1);
+    } else {
+      data.push_back(Bit0);
+    }
+    data.push_back(Bit0);  // IDE, Identifier extension
+  }
+  data.push_back(Bit0);  // RB0, reserved bit 0
+  // 4 bits DLC
+  for (uint8_t i = 0; i < 4; i++) {
+    uint8_t tmp = ((uint8_t)(dlc >> (3 - i)) & 0x01) ? Bit1 : Bit0;
+    data.push_back(tmp);
+  }
+  // 0~64 bits data
+  for (uint8_t i = 0; i < (is_remote ? 0 : frame.can_dlc); i++) {
+    for (uint8_t j = 0; j < 8; j++) {
+      uint8_t tmp = ((frame.data[i] >> (7 - j)) & 0x01) ? Bit1 : Bit0;
+      data.push_back(tmp);
+    }
+  }
+  // CRC15
+  uint16_t crc = legacy_crc15(data);
+  for (uint8_t i = 0; i < 15; i++) {
+    uint8_t tmp = ((crc >> (14 - i)) & 0x01) ? Bit1 : Bit0;
+    data.push_back(tmp);
+  }
+  data.push_back(Bit1);  // CRC Delimiter
+  return data;
+}
+
+static std::vector<can_frame> make_frames(std::size_t n) {
+  std::mt19937 rng(0x343);
+  std::vector<can_frame> frames;
+  frames.reserve(n);
+  for (std::size_t i = 0; i < n; i++) {
+    can_frame frame;
+    std::memset(&frame, 0, sizeof(frame));
+    uint32_t r = rng();
+    bool is_extended = r & 0x01;
+    frame.can_id = is_extended ? ((rng() & CAN_EFF_MASK) | CAN_EFF_FLAG)
+                               : (rng() & CAN_SFF_MASK);
+    if (r & 0x02) {
+      frame.can_id |= CAN_RTR_FLAG;
+    }
+    frame.can_dlc = (r >> 8) % (CAN_MAX_DLEN + 1);
+    // mix random payloads with long runs of equal bits to exercise stuffing
+    uint8_t fill = (r >> 16) & 0x03;
+    for (int j = 0; j < CAN_MAX_DLEN; j++) {
+      frame.data[j] = fill == 0   ? 0x00
+                      : fill == 1 ? 0xFF
+                      : fill == 2 ? (uint8_t)(0x3C + j)
+                                  : (uint8_t)rng();
+    }
+    frames.push_back(frame);
+  }
+  return frames;
+}
+
+int main(int argc, char *argv[]) {
+  std::size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 1000000;
+  auto frames = make_frames(n);
+
+  // bit exact
+  ch343::CanSerBuffer buf;
+  std::size_t mismatch = 0;
+  for (const auto &frame : frames) {
+    auto data0 = legacy_can2ser(frame);
+    auto data = legacy_fsb_insert(data0);
+    std::size_t size = ch343::can2ser(frame, buf);
+    if (size != data.size() || std::memcmp(buf.data(), data.data(), size)) {
+      if (mismatch++ < 8) {
+        std::cerr << "mismatch: id 0x" << std::hex << frame.can_id << std::dec
+                  << " dlc " << (int)frame.can_dlc << std::endl;
+      }
+    }
+  }
+  std::cout << "frames: " << n << ", mismatch: " << mismatch << std::endl;
+
+  // throughput
+  std::size_t symbols = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  for (const auto &frame : frames) {
+    auto data0 = legacy_can2ser(frame);
+    auto data = legacy_fsb_insert(data0);
+    symbols += data.size();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  for (const auto &frame : frames) {
+    symbols -= ch343::can2ser(frame, buf);
+    // keep the encoder from being optimized away
+    asm volatile("" : : "r"(buf.data()) : "memory");
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  double legacy_s = std::chrono::duration<double>(t1 - t0).count();
+  double table_s = std::chrono::duration<double>(t2 - t1).count();
+  std::cout << "legacy: " << n / legacy_s / 1e6 << " Mframes/s, "
+            << legacy_s * 1e9 / n << " ns/frame" << std::endl;
+  std::cout << "table : " << n / table_s / 1e6 << " Mframes/s, "
+            << table_s * 1e9 / n << " ns/frame" << std::endl;
+  std::cout << "speedup: " << legacy_s / table_s << "x" << std::endl;
+
+  return (mismatch == 0 && symbols == 0) ? 0 : 1;
+}
@@ -0,0 +1,425 @@
+// Replays a candump log (candump -l / -L format) through can2ser / canfd2ser
+// into a sink, to compare encoder changes on recorded traffic.
+//
+// can2ser_replay [-t] [-n loops] log [out]
+//   -t        original timing, frames are written at their logged offsets
+//   -n loops  replay the log that many times, default 1
+//   out       file or tty to write the symbols to, "pty" for a new raw
+//             pseudo terminal (its name is printed), default /dev/null;
+//             like a serial line the pty does not wait for a reader, what
+//             does not fit into its buffer is dropped and counted
+//
+// Without -t frames are encoded in batches and written as fast as the sink
+// takes them. Reported: frames/s, encoded bytes per frame, stuff bit
+// overhead distribution and CPU time per frame.
+#include <fcntl.h>
+#include <linux/can.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "can2ser.hpp"
+
+// frames encoded before one write() in the as fast as possible mode
+constexpr std::size_t ReplayBatch = 64;
+// how long a full pty may take to drain before the rest is dropped
+constexpr int ReplayPtyWaitMs = 100;
+
+struct ReplayFrame {
+  canfd_frame frame;  // a can_frame when !fd
+  bool fd;
+  uint64_t ts_ns;  // log timestamp
+};
+
+static uint64_t clock_ns(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+// "(1436509052.249713) vcan0 12345678#1122334455667788_9" or, CAN FD,
+// "(1436509052.249713) vcan0 123##1112233"; error frames and malformed
+// lines return false
+static bool parse_line(const char *p, const char *end, ReplayFrame &out) {
+  if (p == end || *p++ != '(') {
+    return false;
+  }
+  uint64_t sec = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    sec = sec * 10 + (*p++ - '0');
+  }
+  if (p == end || *p++ != '.') {
+    return false;
+  }
+  uint64_t frac = 0;
+  uint64_t scale = 1000000000ull;
+  while (p < end && *p >= '0' && *p <= '9') {
+    if (scale > 1) {
+      scale /= 10;
+      frac += (*p - '0') * scale;
+    }
+    p++;
+  }
+  if (p == end || *p++ != ')') {
+    return false;
+  }
+  out.ts_ns = sec * 1000000000ull + frac;
+  // interface
+  while (p < end && *p == ' ') {
+    p++;
+  }
+  while (p < end && *p != ' ') {
+    p++;
+  }
+  while (p < end && *p == ' ') {
+    p++;
+  }
+  // id, 3 hex digits standard, 8 extended
+  const char *id_start = p;
+  canid_t id = 0;
+  while (p < end && hex_value(*p) >= 0) {
+    id = id << 4 | hex_value(*p++);
+  }
+  if (p == end || *p++ != '#' || p - id_start < 2) {
+    return false;
+  }
+  if (id & CAN_ERR_FLAG) {
+    return false;
+  }
+  canid_t can_id = p - id_start - 1 > 3 ? (id & CAN_EFF_MASK) | CAN_EFF_FLAG
+                                        : id & CAN_SFF_MASK;
+  std::memset(&out.frame, 0, sizeof(out.frame));
+  out.fd = p < end && *p == '#';
+  if (out.fd) {
+    // '#', flags as one hex digit, data
+    canfd_frame &frame = out.frame;
+    frame.can_id = can_id;
+    if (++p == end || hex_value(*p) < 0) {
+      return false;
+    }
+    frame.flags = hex_value(*p++);
+    while (p + 1 < end && hex_value(p[0]) >= 0 && hex_value(p[1]) >= 0) {
+      if (frame.len == CANFD_MAX_DLEN) {
+        return false;
+      }
+      frame.data[frame.len++] = hex_value(p[0]) << 4 | hex_value(p[1]);
+      p += 2;
+    }
+    return true;
+  }
+  can_frame &frame = *(can_frame *)&out.frame;
+  frame.can_id = can_id;
+  if (p < end && *p == 'R') {
+    frame.can_id |= CAN_RTR_FLAG;
+    p++;
+    if (p < end && hex_value(*p) >= 0) {
+      int dlc = hex_value(*p++);
+      frame.can_dlc = dlc < CAN_MAX_DLEN ? dlc : CAN_MAX_DLEN;
+    }
+    return true;
+  }
+  while (p + 1 < end && hex_value(p[0]) >= 0 && hex_value(p[1]) >= 0) {
+    if (frame.can_dlc == CAN_MAX_DLEN) {
+      return false;
+    }
+    frame.data[frame.can_dlc++] = hex_value(p[0]) << 4 | hex_value(p[1]);
+    p += 2;
+  }
+  // DLC 9..15 of an 8 byte frame
+  if (p + 1 < end && *p == '_' && frame.can_dlc == CAN_MAX_DLEN) {
+    int dlc = hex_value(p[1]);
+    if (dlc > CAN_MAX_DLEN) {
+      frame.len8_dlc = dlc;
+    }
+  }
+  return true;
+}
+
+// whole file, read only
+static std::vector<ReplayFrame> load(const char *path, std::size_t &skipped) {
+  std::vector<ReplayFrame> frames;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Failed to open " << path << ": " << std::strerror(errno)
+              << std::endl;
+    return frames;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    return frames;
+  }
+  void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    std::cerr << "Failed to mmap " << path << ": " << std::strerror(errno)
+              << std::endl;
+    return frames;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  const char *p = (const char *)map;
+  const char *end = p + st.st_size;
+  // about 40 bytes per line
+  frames.reserve(st.st_size / 40);
+  while (p < end) {
+    const char *eol = (const char *)std::memchr(p, '\n', end - p);
+    if (eol == nullptr) {
+      eol = end;
+    }
+    ReplayFrame frame;
+    if (parse_line(p, eol, frame)) {
+      frames.push_back(frame);
+    } else if (eol > p) {
+      skipped++;
+    }
+    p = eol + 1;
+  }
+  munmap(map, st.st_size);
+  return frames;
+}
+
+// sink for the symbols, -1 on error
+static int open_sink(const char *path) {
+  if (std::strcmp(path, "pty") != 0) {
+    int fd = open(path, O_WRONLY | O_NOCTTY);
+    if (fd < 0) {
+      std::cerr << "Failed to open " << path << ": " << std::strerror(errno)
+                << std::endl;
+    }
+    return fd;
+  }
+  int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+    std::cerr << "Failed to open pty: " << std::strerror(errno) << std::endl;
+    return -1;
+  }
+  // raw like a serial port opened by asio: no echo, no line
+  // buffering, no output processing; set on the master, it is the slave's
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+      std::cerr << "Failed to configure pty: " << std::strerror(errno)
+                << std::endl;
+      close(fd);
+      return -1;
+    }
+  }
+  std::cout << "pty: " << ptsname(fd) << std::endl;
+  return fd;
+}
+
+// a non-blocking sink (the pty) that has taken nothing for ReplayPtyWaitMs
+// gets the rest of the data dropped, counted in dropped, until it takes
+// something again; stalled is when it last took nothing, 0 while it takes
+// data. A pty master reports POLLOUT while a write still fails, so it is
+// retried every ms instead of polled
+static bool write_all(int fd, const uint8_t *data, std::size_t size,
+                      uint64_t &stalled, uint64_t &dropped) {
+  while (size > 0) {
+    ssize_t n = write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        uint64_t now = clock_ns(CLOCK_MONOTONIC);
+        stalled = stalled != 0 ? stalled : now;
+        if (now - stalled >= ReplayPtyWaitMs * 1000000ull) {
+          dropped += size;
+          return true;
+        }
+        usleep(1000);
+        continue;
+      }
+      std::cerr << "Write error: " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    stalled = 0;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// SOF .. CRC delimiter without stuff bits
+static std::size_t unstuffed_bits(const ReplayFrame &replay) {
+  if (replay.fd) {
+    const canfd_frame &frame = replay.frame;
+    std::size_t len = ch343::canfd_dlc2len(ch343::canfd_len2dlc(frame.len));
+    std::size_t header = frame.can_id & CAN_EFF_FLAG ? 41 : 22;
+    // stuff count, CRC17 / CRC21, CRC delimiter
+    return header + 8 * len + 4 + (len > 16 ? 21 : 17) + 1;
+  }
+  uint8_t packed[ch343::CanMaxPackedBytes];
+  int first_bits;
+  std::size_t n = ch343::can_pack(*(const can_frame *)&replay.frame, packed,
+                                  first_bits);
+  return first_bits + 8 * (n - 1) + 15 + 1;
+}
+
+static std::size_t encode(const ReplayFrame &replay, uint8_t *out) {
+  if (replay.fd) {
+    return ch343::canfd2ser(replay.frame, out);
+  }
+  return ch343::can2ser(*(const can_frame *)&replay.frame, out);
+}
+
+int main(int argc, char *argv[]) {
+  bool timing = false;
+  unsigned long loops = 1;
+  std::vector<const char *> paths;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "-t") == 0) {
+      timing = true;
+    } else if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      loops = std::strtoul(argv[++i], nullptr, 0);
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      paths.clear();
+      break;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty() || paths.size() > 2) {
+    std::cerr << "usage: " << argv[0] << " [-t] [-n loops] log [out]"
+              << std::endl;
+    return -1;
+  }
+
+  std::size_t skipped = 0;
+  auto frames = load(paths[0], skipped);
+  if (frames.empty()) {
+    std::cerr << "No CAN frames in " << paths[0] << std::endl;
+    return -1;
+  }
+  int sink = open_sink(paths.size() > 1 ? paths[1] : "/dev/null");
+  if (sink < 0) {
+    return -1;
+  }
+  std::size_t fd_frames = std::count_if(
+      frames.begin(), frames.end(),
+      [](const ReplayFrame &frame) { return frame.fd; });
+  std::cout << "frames: " << frames.size() << " (" << fd_frames << " FD)"
+            << ", skipped lines: " << skipped
+            << ", loops: " << loops << (timing ? ", original timing" : "")
+            << std::endl;
+
+  // per frame: stuff bits -> count, the fixed ones included for CAN FD
+  std::array<uint64_t, ch343::CanFdMaxSymbols> stuff_hist{};
+  uint64_t symbols = 0;
+  uint64_t stuff_bits = 0;
+  uint64_t frame_bits = 0;  // without stuff bits and trailer
+  uint64_t encode_ns = 0;
+  uint64_t late_max_ns = 0;
+  uint64_t stalled = 0;
+  uint64_t dropped = 0;
+  std::vector<uint8_t> out(ReplayBatch *
+                           (ch343::CanFdMaxSymbols + ch343::CanTrailerBits));
+
+  uint64_t cpu0 = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  uint64_t t0 = clock_ns(CLOCK_MONOTONIC);
+  uint64_t log_t0 = frames.front().ts_ns;
+  uint64_t loop_t0 = t0;
+  bool ok = true;
+  for (unsigned long loop = 0; ok && loop < loops; loop++) {
+    for (std::size_t i = 0; ok && i < frames.size();) {
+      std::size_t batch = timing ? 1 : ReplayBatch;
+      if (timing) {
+        // logged offset from the first frame of the log
+        uint64_t offset = frames[i].ts_ns > log_t0 ? frames[i].ts_ns - log_t0
+                                                   : 0;
+        uint64_t due = loop_t0 + offset;
+        struct timespec ts = {(time_t)(due / 1000000000ull),
+                              (long)(due % 1000000000ull)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+               EINTR) {
+        }
+        uint64_t now = clock_ns(CLOCK_MONOTONIC);
+        if (now > due && now - due > late_max_ns) {
+          late_max_ns = now - due;
+        }
+      }
+      uint64_t e0 = clock_ns(CLOCK_MONOTONIC);
+      std::size_t size = 0;
+      std::size_t end = std::min(i + batch, frames.size());
+      for (; i < end; i++) {
+        std::size_t n = encode(frames[i], out.data() + size);
+        std::size_t stuff = n - unstuffed_bits(frames[i]);
+        stuff_hist[stuff]++;
+        stuff_bits += stuff;
+        frame_bits += n - stuff;
+        size += n;
+        std::memcpy(out.data() + size, ch343::can_trailer.data(),
+                    ch343::CanTrailerBits);
+        size += ch343::CanTrailerBits;
+      }
+      encode_ns += clock_ns(CLOCK_MONOTONIC) - e0;
+      symbols += size;
+      ok = write_all(sink, out.data(), size, stalled, dropped);
+    }
+    if (timing) {
+      // next loop starts where this one ended
+      loop_t0 = clock_ns(CLOCK_MONOTONIC);
+    }
+  }
+  uint64_t t1 = clock_ns(CLOCK_MONOTONIC);
+  uint64_t cpu1 = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  close(sink);
+
+  uint64_t n = (uint64_t)frames.size() * loops;
+  double seconds = (t1 - t0) / 1e9;
+  std::cout << "frames/s: " << n / seconds << std::endl;
+  std::cout << "bytes/frame: " << (double)symbols / n
+            << " (frame + " << ch343::CanTrailerBits << " trailer)"
+            << std::endl;
+  std::cout << "stuff bits/frame: " << (double)stuff_bits / n << ", overhead "
+            << 100.0 * stuff_bits / frame_bits << "%"
+            << std::endl;
+  std::cout << "cpu/frame: " << (double)(cpu1 - cpu0) / n
+            << " ns (encode " << (double)encode_ns / n << " ns)" << std::endl;
+  if (dropped != 0) {
+    std::cout << "dropped: " << dropped << " bytes, the pty was full"
+              << std::endl;
+  }
+  if (timing) {
+    std::cout << "late max: " << late_max_ns / 1e3 << " us" << std::endl;
+  }
+  std::cout << "stuff bits distribution:" << std::endl;
+  for (std::size_t i = 0; i < stuff_hist.size(); i++) {
+    if (stuff_hist[i] != 0) {
+      std::cout << std::setw(4) << i << ": " << std::setw(10) << stuff_hist[i]
+                << " " << std::fixed << std::setprecision(2)
+                << 100.0 * stuff_hist[i] / n << "%" << std::defaultfloat
+                << std::setprecision(6) << std::endl;
+    }
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+#ifndef CH343_CAN_BATCH_READER_HPP
+#define CH343_CAN_BATCH_READER_HPP
+
+#include <linux/can.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <sys/socket.h>
+
+#include <asio.hpp>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "metric_counter.hpp"
+
+namespace ch343 {
+
+struct CanRxFrame {
+  canfd_frame frame;  // a can_frame when size == CAN_MTU
+  std::size_t size;   // CAN_MTU or CANFD_MTU
+  uint64_t stamp_ns;  // kernel rx timestamp, 0 if not available
+};
+
+// single writer, readable from any thread
+struct CanRxStats {
+  MetricCounter wakeups;    // readiness events
+  MetricCounter frames;     // frames delivered to the handler
+  MetricCounter fd_frames;  // of which CAN FD
+  MetricCounter bad;        // unexpected size or truncated
+  MetricCounter max_batch;
+
+  double batch() const {
+    uint64_t n = wakeups;
+    return n ? (double)frames / n : 0.0;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &os, const CanRxStats &s) {
+  return os << "wakeups " << s.wakeups << ", frames " << s.frames
+            << ", fd_frames " << s.fd_frames << ", bad " << s.bad
+            << ", batch " << s.batch() << ", max_batch " << s.max_batch;
+}
+
+// Pulls up to `batch` frames per readiness event from a CAN_RAW socket with
+// recvmmsg, together with their SO_TIMESTAMPING software rx timestamps.
+class CanBatchReader {
+ public:
+  using Handler = std::function<void(const CanRxFrame &)>;
+
+  CanBatchReader(asio::posix::stream_descriptor &can, std::size_t batch)
+      : can_(can),
+        frames_(batch),
+        iovs_(batch),
+        msgs_(batch),
+        cmsgs_(batch * CMSG_SPACE(sizeof(struct scm_timestamping))) {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (setsockopt(can_.native_handle(), SOL_SOCKET, SO_TIMESTAMPING, &flags,
+                   sizeof(flags)) < 0) {
+      std::cerr << "Failed to setsockopt SO_TIMESTAMPING, no rx timestamps"
+                << std::endl;
+    }
+    for (std::size_t i = 0; i < batch; i++) {
+      iovs_[i].iov_base = &frames_[i].frame;
+      iovs_[i].iov_len = sizeof(canfd_frame);
+    }
+  }
+
+  void start(Handler handler) {
+    handler_ = std::move(handler);
+    wait();
+  }
+
+  const CanRxStats &stats() const { return stats_; }
+
+ private:
+  void wait() {
+    can_.async_wait(asio::posix::stream_descriptor::wait_read,
+                    [this](const asio::error_code &ec) {
+                      if (ec) {
+                        std::cerr << "Read error: " << ec.message()
+                                  << std::endl;
+                        return;
+                      }
+                      stats_.wakeups++;
+                      receive();
+                      wait();
+                    });
+  }
+
+  void receive() {
+    const std::size_t cmsg_size = CMSG_SPACE(sizeof(struct scm_timestamping));
+    for (std::size_t i = 0; i < msgs_.size(); i++) {
+      std::memset(&msgs_[i], 0, sizeof(msgs_[i]));
+      msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+      msgs_[i].msg_hdr.msg_iovlen = 1;
+      msgs_[i].msg_hdr.msg_control = &cmsgs_[i * cmsg_size];
+      msgs_[i].msg_hdr.msg_controllen = cmsg_size;
+    }
+    int n = recvmmsg(can_.native_handle(), msgs_.data(), msgs_.size(),
+                     MSG_DONTWAIT, nullptr);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        std::cerr << "Read error: " << std::strerror(errno) << std::endl;
+      }
+      return;
+    }
+    stats_.max_batch.max(n);
+    for (int i = 0; i < n; i++) {
+      CanRxFrame &rx = frames_[i];
+      struct msghdr &hdr = msgs_[i].msg_hdr;
+      rx.size = msgs_[i].msg_len;
+      if ((hdr.msg_flags & MSG_TRUNC) ||
+          (rx.size != CAN_MTU && rx.size != CANFD_MTU)) {
+        stats_.bad++;
+        continue;
+      }
+      rx.stamp_ns = 0;
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+           cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_TIMESTAMPING) {
+          struct scm_timestamping ts;
+          std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+          rx.stamp_ns =
+              (uint64_t)ts.ts[0].tv_sec * 1000000000ull + ts.ts[0].tv_nsec;
+        }
+      }
+      stats_.frames++;
+      if (rx.size == CANFD_MTU) {
+        stats_.fd_frames++;
+      }
+      handler_(rx);
+    }
+  }
+
+  asio::posix::stream_descriptor &can_;
+  std::vector<CanRxFrame> frames_;
+  std::vector<struct iovec> iovs_;
+  std::vector<struct mmsghdr> msgs_;
+  std::vector<uint8_t> cmsgs_;
+  Handler handler_;
+  CanRxStats stats_;
+};
+
+}  // namespace ch343
+
+#endif  // CH343_CAN_BATCH_READER_HPP
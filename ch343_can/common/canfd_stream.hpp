@@ -0,0 +1,166 @@
+#pragma once
+
+// Decoder for the binary CAN-over-UART stream of axi_canfd_microblaze
+// (canfd_stream.h there): CRC-32 protected packets of timestamped frames.
+//
+// packet header, 16 bytes, little endian
+//   u32 magic  CanFdStreamMagic
+//   u32 crc    crc32 (bsp_crc32) of everything after this field
+//   u16 seq    packet counter
+//   u16 len    bytes of records after the header
+//   u32 time   us, timestamp of the first record
+// record, 8 bytes + payload
+//   u32 can_id, u16 dt (us after time), u8 len, u8 flags, payload (none for
+//   remote frames)
+
+#include <linux/can.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ch343 {
+
+constexpr uint32_t CanFdStreamMagic = 0x53444643;  // "CFDS"
+constexpr std::size_t CanFdStreamHeaderSize = 16;
+constexpr std::size_t CanFdStreamRecordSize = 8;
+// CANFD_STREAM_PACKET_SIZE the sender is built with by default
+constexpr std::size_t CanFdStreamPacketSize = 1024;
+
+namespace detail {
+
+constexpr std::array<uint32_t, 256> make_crc32_table() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+inline constexpr std::array<uint32_t, 256> crc32_table = make_crc32_table();
+
+inline uint16_t get16(const uint8_t *p) { return (uint16_t)(p[0] | p[1] << 8); }
+
+inline uint32_t get32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+}  // namespace detail
+
+// same as bsp_crc32 of the boot project: reflected 0x04C11DB7, crc_init 0
+inline uint32_t crc32(const uint8_t *data, std::size_t len,
+                      uint32_t crc_init = 0) {
+  uint32_t crc = crc_init ^ 0xFFFFFFFF;
+  for (std::size_t i = 0; i < len; i++) {
+    crc = detail::crc32_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFF;
+}
+
+struct CanFdStreamStats {
+  uint64_t packets = 0;     // packets with a good CRC
+  uint64_t frames = 0;      // records decoded
+  uint64_t crc_errors = 0;  // packets dropped for their CRC or length
+  uint64_t lost = 0;        // packets missing according to seq
+  uint64_t skipped = 0;     // bytes thrown away while resyncing
+};
+
+// Feed it whatever the serial port returns; for every frame of a good packet
+// on_frame(const canfd_frame &frame, bool fd, uint64_t time_us) is called.
+// fd is false for classic frames, time_us is the sender's clock extended to
+// 64 bits. max_len is the sender's CANFD_STREAM_PACKET_SIZE minus the header;
+// a header claiming more is dropped like a bad CRC instead of waiting for up
+// to 64 KiB that never come.
+class CanFdStreamDecoder {
+ public:
+  explicit CanFdStreamDecoder(
+      std::size_t max_len = CanFdStreamPacketSize - CanFdStreamHeaderSize)
+      : max_len_(max_len) {}
+
+  template <typename OnFrame>
+  void feed(const uint8_t *data, std::size_t n, OnFrame &&on_frame) {
+    buf_.insert(buf_.end(), data, data + n);
+    std::size_t pos = 0;
+    while (buf_.size() - pos >= CanFdStreamHeaderSize) {
+      const uint8_t *p = buf_.data() + pos;
+      if (detail::get32(p) != CanFdStreamMagic) {
+        pos++;
+        stats_.skipped++;
+        continue;
+      }
+      std::size_t len = detail::get16(p + 10);
+      std::size_t size = CanFdStreamHeaderSize + len;
+      if (len <= max_len_ && buf_.size() - pos < size) {
+        break;
+      }
+      if (len > max_len_ || crc32(p + 8, size - 8) != detail::get32(p + 4)) {
+        // maybe a magic inside the payload, look again one byte later
+        stats_.crc_errors++;
+        pos++;
+        stats_.skipped++;
+        continue;
+      }
+      packet(p, size, on_frame);
+      pos += size;
+    }
+    buf_.erase(buf_.begin(), buf_.begin() + pos);
+  }
+
+  const CanFdStreamStats &stats() const { return stats_; }
+
+ private:
+  template <typename OnFrame>
+  void packet(const uint8_t *p, std::size_t size, OnFrame &on_frame) {
+    uint16_t seq = detail::get16(p + 8);
+    if (stats_.packets > 0) {
+      stats_.lost += (uint16_t)(seq - seq_ - 1);
+    }
+    seq_ = seq;
+    stats_.packets++;
+
+    uint32_t time = detail::get32(p + 12);
+    if (stats_.packets > 1 && time < last_time_) {
+      time_high_ += (uint64_t)1 << 32;
+    }
+    last_time_ = time;
+
+    std::size_t pos = CanFdStreamHeaderSize;
+    while (size - pos >= CanFdStreamRecordSize) {
+      const uint8_t *r = p + pos;
+      canfd_frame frame{};
+      frame.can_id = detail::get32(r);
+      uint16_t dt = detail::get16(r + 4);
+      frame.len = r[6];
+      frame.flags = r[7];
+      bool fd = frame.flags & CANFD_FDF;
+      if (frame.len > (fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN)) {
+        break;
+      }
+      std::size_t data_len = frame.can_id & CAN_RTR_FLAG ? 0 : frame.len;
+      if (size - pos - CanFdStreamRecordSize < data_len) {
+        break;
+      }
+      std::memcpy(frame.data, r + CanFdStreamRecordSize, data_len);
+      pos += CanFdStreamRecordSize + data_len;
+      stats_.frames++;
+      on_frame(static_cast<const canfd_frame &>(frame), fd,
+               time_high_ + time + dt);
+    }
+  }
+
+  std::size_t max_len_;
+  std::vector<uint8_t> buf_;
+  CanFdStreamStats stats_;
+  uint16_t seq_ = 0;
+  uint32_t last_time_ = 0;
+  uint64_t time_high_ = 0;
+};
+
+}  // namespace ch343
@@ -0,0 +1,251 @@
+// Receives the binary CAN stream of axi_canfd_microblaze (MAIN_STREAM in its
+// main.c) from a serial port and writes the frames to a CAN interface.
+//
+// canfd_stream2can [-b baud] [-p packet_size] [-s stats_seconds] serial can|-
+//   -b baud           serial baud rate, default 115200
+//   -p packet_size    the sender's CANFD_STREAM_PACKET_SIZE, default 1024;
+//                     longer packets are dropped like a bad CRC
+//   -s stats_seconds  print the decoder counters that often, default 0, off
+//   can               SocketCAN interface, e.g. vcan0, "-" prints the frames
+//                     candump -L style with the sender's timestamps
+//
+// Packets with a bad CRC are dropped, the decoder resyncs on the next magic;
+// gaps in the packet counter are reported as lost packets.
+#include <fcntl.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "canfd_stream.hpp"
+
+static speed_t baud_to_speed(unsigned long baud) {
+  switch (baud) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    case 1000000: return B1000000;
+    case 1500000: return B1500000;
+    case 2000000: return B2000000;
+    case 3000000: return B3000000;
+    case 4000000: return B4000000;
+    default: return B0;
+  }
+}
+
+// raw 8N1, -1 on error
+static int open_serial(const char *path, unsigned long baud) {
+  speed_t speed = baud_to_speed(baud);
+  if (speed == B0) {
+    std::cerr << "Unsupported baud rate " << baud << std::endl;
+    return -1;
+  }
+  int fd = open(path, O_RDONLY | O_NOCTTY);
+  if (fd < 0) {
+    std::cerr << "Failed to open " << path << ": " << std::strerror(errno)
+              << std::endl;
+    return -1;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+      std::cerr << "Failed to configure " << path << ": "
+                << std::strerror(errno) << std::endl;
+      close(fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+// CAN_RAW socket bound to the interface with CAN FD frames enabled
+static int open_can(const char *name) {
+  int fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+  if (fd < 0) {
+    std::cerr << "Failed to open CAN socket: " << std::strerror(errno)
+              << std::endl;
+    return -1;
+  }
+  int enable = 1;
+  setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable));
+  struct ifreq ifr;
+  std::memset(&ifr, 0, sizeof(ifr));
+  std::strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+  struct sockaddr_can addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+    std::cerr << "No CAN interface " << name << ": " << std::strerror(errno)
+              << std::endl;
+    close(fd);
+    return -1;
+  }
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    std::cerr << "Failed to bind " << name << ": " << std::strerror(errno)
+              << std::endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// "(12.345678) serial 123#1122" or "(12.345678) serial 123##1112233"
+static void print_frame(const canfd_frame &frame, bool fd, uint64_t time_us) {
+  char line[256];
+  int n = std::snprintf(line, sizeof(line), "(%llu.%06llu) serial ",
+                        (unsigned long long)(time_us / 1000000),
+                        (unsigned long long)(time_us % 1000000));
+  if (frame.can_id & CAN_EFF_FLAG) {
+    n += std::snprintf(line + n, sizeof(line) - n, "%08X",
+                       frame.can_id & CAN_EFF_MASK);
+  } else {
+    n += std::snprintf(line + n, sizeof(line) - n, "%03X",
+                       frame.can_id & CAN_SFF_MASK);
+  }
+  if (fd) {
+    n += std::snprintf(line + n, sizeof(line) - n, "##%X",
+                       frame.flags & ~CANFD_FDF);
+  } else if (frame.can_id & CAN_RTR_FLAG) {
+    n += std::snprintf(line + n, sizeof(line) - n, "#R%X", frame.len);
+  } else {
+    line[n++] = '#';
+  }
+  if (!(frame.can_id & CAN_RTR_FLAG)) {
+    for (int i = 0; i < frame.len; i++) {
+      n += std::snprintf(line + n, sizeof(line) - n, "%02X", frame.data[i]);
+    }
+  }
+  line[n++] = '\n';
+  std::fwrite(line, 1, n, stdout);
+}
+
+static uint64_t clock_s() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+static void print_stats(const ch343::CanFdStreamStats &stats,
+                        uint64_t can_errors) {
+  std::cerr << "packets: " << stats.packets << ", frames: " << stats.frames
+            << ", lost: " << stats.lost << ", crc errors: " << stats.crc_errors
+            << ", skipped bytes: " << stats.skipped
+            << ", can write errors: " << can_errors << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long baud = 115200;
+  unsigned long packet_size = ch343::CanFdStreamPacketSize;
+  unsigned long stats_seconds = 0;
+  const char *paths[2] = {nullptr, nullptr};
+  int npaths = 0;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      baud = std::strtoul(argv[++i], nullptr, 0);
+    } else if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      packet_size = std::strtoul(argv[++i], nullptr, 0);
+    } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      stats_seconds = std::strtoul(argv[++i], nullptr, 0);
+    } else if ((argv[i][0] == '-' && argv[i][1] != '\0') || npaths == 2) {
+      npaths = 0;
+      break;
+    } else {
+      paths[npaths++] = argv[i];
+    }
+  }
+  if (npaths != 2 || packet_size <= ch343::CanFdStreamHeaderSize ||
+      packet_size > ch343::CanFdStreamHeaderSize + 0xFFFF) {
+    std::cerr << "usage: " << argv[0]
+              << " [-b baud] [-p packet_size] [-s stats_seconds] serial can|-"
+              << std::endl;
+    return -1;
+  }
+
+  int serial = open_serial(paths[0], baud);
+  if (serial < 0) {
+    return -1;
+  }
+  bool to_stdout = std::strcmp(paths[1], "-") == 0;
+  int can = to_stdout ? -1 : open_can(paths[1]);
+  if (!to_stdout && can < 0) {
+    close(serial);
+    return -1;
+  }
+
+  ch343::CanFdStreamDecoder decoder(packet_size -
+                                    ch343::CanFdStreamHeaderSize);
+  uint64_t can_errors = 0;
+  auto on_frame = [&](const canfd_frame &frame, bool fd, uint64_t time_us) {
+    if (to_stdout) {
+      print_frame(frame, fd, time_us);
+      return;
+    }
+    std::size_t size = fd ? CANFD_MTU : CAN_MTU;
+    if (write(can, &frame, size) != (ssize_t)size) {
+      can_errors++;
+    }
+  };
+
+  uint8_t buf[4096];
+  uint64_t last_stats = clock_s();
+  while (true) {
+    struct pollfd pfd = {serial, POLLIN, 0};
+    int ret = poll(&pfd, 1, stats_seconds > 0 ? 1000 : -1);
+    if (ret < 0 && errno != EINTR) {
+      std::cerr << "Poll error: " << std::strerror(errno) << std::endl;
+      break;
+    }
+    if (ret > 0) {
+      ssize_t n = read(serial, buf, sizeof(buf));
+      if (n == 0 || (n < 0 && errno == EIO)) {
+        // device unplugged or the other side of a pty closed
+        break;
+      }
+      if (n < 0 && errno != EINTR && errno != EAGAIN) {
+        std::cerr << "Read error: " << std::strerror(errno) << std::endl;
+        break;
+      }
+      if (n > 0) {
+        decoder.feed(buf, n, on_frame);
+        if (to_stdout) {
+          std::fflush(stdout);
+        }
+      }
+    }
+    if (stats_seconds > 0 && clock_s() - last_stats >= stats_seconds) {
+      last_stats = clock_s();
+      print_stats(decoder.stats(), can_errors);
+    }
+  }
+
+  print_stats(decoder.stats(), can_errors);
+  close(serial);
+  if (can >= 0) {
+    close(can);
+  }
+  return 0;
+}
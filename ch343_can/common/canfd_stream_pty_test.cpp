@@ -0,0 +1,265 @@
+// CanFdStreamDecoder over a pty pair, the way canfd_stream2can reads the
+// UART: a stand-in for canfd_stream.c of axi_canfd_microblaze writes packets
+// to the master side in random chunks, the decoder reads the raw slave side.
+// Between the good packets go a packet with a flipped byte, line noise and a
+// header claiming 64 KiB; the good packets after them have to come out
+// without waiting for more input.
+//
+// canfd_stream_pty_test [packets]
+#include <fcntl.h>
+#include <linux/can.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "canfd_stream.hpp"
+
+// canfd_stream_add / canfd_stream_finish with CANFD_STREAM_PACKET_SIZE 1024
+class StreamSender {
+ public:
+  // false if the frame does not fit, finish() and add it again
+  bool add(const canfd_frame &frame, uint32_t time) {
+    std::size_t max = frame.flags & CANFD_FDF ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+    std::size_t len = frame.len < max ? frame.len : max;
+    std::size_t data_len = frame.can_id & CAN_RTR_FLAG ? 0 : len;
+    if (packet_.size() + ch343::CanFdStreamRecordSize + data_len >
+        ch343::CanFdStreamPacketSize) {
+      return false;
+    }
+    if (records_ == 0) {
+      time_ = time;
+    } else if (time - time_ > 0xFFFF) {
+      return false;
+    }
+    put32(frame.can_id);
+    put16(time - time_);
+    packet_.push_back((uint8_t)len);
+    packet_.push_back(frame.flags & (CANFD_FDF | CANFD_BRS | CANFD_ESI));
+    packet_.insert(packet_.end(), frame.data, frame.data + data_len);
+    records_++;
+    return true;
+  }
+
+  std::vector<uint8_t> finish() {
+    std::vector<uint8_t> packet;
+    packet.swap(packet_);
+    uint8_t *p = packet.data();
+    set32(p, ch343::CanFdStreamMagic);
+    set16(p + 8, seq_++);
+    set16(p + 10, packet.size() - ch343::CanFdStreamHeaderSize);
+    set32(p + 12, time_);
+    set32(p + 4, ch343::crc32(p + 8, packet.size() - 8));
+    packet_.assign(ch343::CanFdStreamHeaderSize, 0);
+    records_ = 0;
+    return packet;
+  }
+
+ private:
+  static void set16(uint8_t *p, std::size_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+  }
+  static void set32(uint8_t *p, uint32_t v) {
+    set16(p, v);
+    set16(p + 2, v >> 16);
+  }
+  void put16(uint32_t v) {
+    packet_.push_back((uint8_t)v);
+    packet_.push_back((uint8_t)(v >> 8));
+  }
+  void put32(uint32_t v) {
+    put16(v);
+    put16(v >> 16);
+  }
+
+  std::vector<uint8_t> packet_ =
+      std::vector<uint8_t>(ch343::CanFdStreamHeaderSize, 0);
+  uint32_t records_ = 0;
+  uint32_t time_ = 0;
+  uint16_t seq_ = 0;
+};
+
+struct Received {
+  canfd_frame frame;
+  bool fd;
+  uint64_t time_us;
+};
+
+static canfd_frame make_frame(std::mt19937 &rng) {
+  static const uint8_t dlc2len[16] = {0, 1, 2, 3, 4, 5, 6, 7,
+                                      8, 12, 16, 20, 24, 32, 48, 64};
+  canfd_frame frame{};
+  uint32_t r = rng();
+  frame.can_id = r & 1 ? (rng() & CAN_EFF_MASK) | CAN_EFF_FLAG
+                       : rng() & CAN_SFF_MASK;
+  if (r & 2) {
+    frame.flags = CANFD_FDF | (r & 4 ? CANFD_BRS : 0);
+    frame.len = dlc2len[(r >> 4) & 0x0F];
+  } else {
+    frame.len = (r >> 4) % (CAN_MAX_DLEN + 1);
+    if (r & 8) {
+      frame.can_id |= CAN_RTR_FLAG;
+    }
+  }
+  if (!(frame.can_id & CAN_RTR_FLAG)) {
+    for (int i = 0; i < frame.len; i++) {
+      frame.data[i] = (uint8_t)rng();
+    }
+  }
+  return frame;
+}
+
+static bool same(const Received &got, const Received &want) {
+  if (got.frame.can_id != want.frame.can_id ||
+      got.frame.len != want.frame.len ||
+      got.frame.flags != want.frame.flags || got.fd != want.fd ||
+      got.time_us != want.time_us) {
+    return false;
+  }
+  return (got.frame.can_id & CAN_RTR_FLAG) ||
+         std::memcmp(got.frame.data, want.frame.data, got.frame.len) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  int packets = argc > 1 ? std::atoi(argv[1]) : 200;
+  std::mt19937 rng(1);
+
+  int master;
+  int slave;
+  if (openpty(&master, &slave, nullptr, nullptr, nullptr) < 0) {
+    std::cerr << "openpty: " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  // as open_serial in canfd_stream2can.cpp
+  struct termios tio;
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  tcsetattr(slave, TCSANOW, &tio);
+
+  // the byte stream and the frames expected out of it
+  std::vector<uint8_t> wire;
+  std::vector<Received> want;
+  StreamSender sender;
+  uint32_t time = 1000;
+  int corrupted = 0;
+  int oversized = 0;
+  canfd_frame frame = make_frame(rng);
+  for (int p = 0; p < packets; p++) {
+    std::vector<Received> frames;
+    while (sender.add(frame, time)) {
+      frames.push_back({frame, (frame.flags & CANFD_FDF) != 0, time});
+      frame = make_frame(rng);
+      time += rng() % 500;
+    }
+    std::vector<uint8_t> packet = sender.finish();
+    int kind = p % 10;
+    if (kind == 3) {
+      // a flipped bit in a record: dropped, the seq gap counts it lost
+      packet[ch343::CanFdStreamHeaderSize + rng() % (packet.size() - 16)] ^=
+          1u << (rng() % 8);
+      corrupted++;
+      frames.clear();
+    } else if (kind == 6) {
+      // noise, then a header claiming far more than a packet holds
+      for (int i = 0; i < 20; i++) {
+        wire.push_back((uint8_t)rng());
+      }
+      uint8_t header[ch343::CanFdStreamHeaderSize] = {0x43, 0x46, 0x44, 0x53};
+      header[10] = 0xFF;
+      header[11] = 0xFF;
+      wire.insert(wire.end(), header, header + sizeof(header));
+      oversized++;
+    }
+    wire.insert(wire.end(), packet.begin(), packet.end());
+    want.insert(want.end(), frames.begin(), frames.end());
+  }
+  // the last packet right after an oversized header
+  uint8_t header[ch343::CanFdStreamHeaderSize] = {0x43, 0x46, 0x44, 0x53};
+  header[10] = 0xFF;
+  header[11] = 0xFF;
+  wire.insert(wire.end(), header, header + sizeof(header));
+  oversized++;
+  for (int i = 0; i < 4; i++) {
+    sender.add(frame, time);
+    want.push_back({frame, (frame.flags & CANFD_FDF) != 0, time});
+    frame = make_frame(rng);
+    time += 100;
+  }
+  std::vector<uint8_t> last = sender.finish();
+  wire.insert(wire.end(), last.begin(), last.end());
+
+  // the UART: random chunks, the master side blocks while the pty is full
+  std::thread writer([&]() {
+    std::mt19937 chunks(2);
+    std::size_t pos = 0;
+    while (pos < wire.size()) {
+      std::size_t n = 1 + chunks() % 300;
+      if (n > wire.size() - pos) {
+        n = wire.size() - pos;
+      }
+      ssize_t written = write(master, wire.data() + pos, n);
+      if (written < 0 && errno != EINTR) {
+        break;
+      }
+      pos += written > 0 ? written : 0;
+    }
+  });
+
+  // canfd_stream2can's loop; all frames within a second of the last byte
+  ch343::CanFdStreamDecoder decoder(ch343::CanFdStreamPacketSize -
+                                    ch343::CanFdStreamHeaderSize);
+  std::vector<Received> got;
+  auto on_frame = [&](const canfd_frame &f, bool fd, uint64_t time_us) {
+    got.push_back({f, fd, time_us});
+  };
+  uint8_t buf[4096];
+  while (got.size() < want.size()) {
+    struct pollfd pfd = {slave, POLLIN, 0};
+    if (poll(&pfd, 1, 1000) <= 0) {
+      break;
+    }
+    ssize_t n = read(slave, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    decoder.feed(buf, n, on_frame);
+  }
+  writer.join();
+  close(master);
+  close(slave);
+
+  int mismatch = 0;
+  for (std::size_t i = 0; i < got.size() && i < want.size(); i++) {
+    if (!same(got[i], want[i]) && mismatch++ < 8) {
+      std::cerr << "frame " << i << ": got " << std::hex << got[i].frame.can_id
+                << " want " << want[i].frame.can_id << std::dec << std::endl;
+    }
+  }
+  const ch343::CanFdStreamStats &stats = decoder.stats();
+  std::cout << "pty: " << wire.size() << " bytes, " << got.size() << "/"
+            << want.size() << " frames, mismatch: " << mismatch
+            << ", packets: " << stats.packets << ", lost: " << stats.lost
+            << ", crc errors: " << stats.crc_errors
+            << ", skipped bytes: " << stats.skipped << std::endl;
+  // every corrupted packet is a gap in seq; oversized headers and the
+  // corrupted packets are both counted as crc errors, noise may add some
+  bool ok = got.size() == want.size() && mismatch == 0 &&
+            stats.packets == (uint64_t)(packets - corrupted + 1) &&
+            stats.lost == (uint64_t)corrupted &&
+            stats.crc_errors >= (uint64_t)(corrupted + oversized);
+  std::cout << (ok ? "ok" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
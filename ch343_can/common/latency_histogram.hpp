@@ -0,0 +1,116 @@
+#ifndef CH343_LATENCY_HISTOGRAM_HPP
+#define CH343_LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "metric_counter.hpp"
+
+namespace ch343 {
+
+// Log-linear histogram of nanosecond latencies, HDR style: each power of two
+// range is split into 2^SubBits equal buckets, so every recorded value is
+// known to within 1 / 2^SubBits (12.5%) of itself. Values below 2^SubBits ns
+// are exact, values from 2^(MaxBits + 1) ns (about 36 minutes) are clamped.
+// Lock free: one writer records, any thread may read percentiles meanwhile;
+// a reader racing with record() may see that one sample half applied.
+class LatencyHistogram {
+ public:
+  static constexpr int SubBits = 3;
+  static constexpr int MaxBits = 40;
+  static constexpr std::size_t SubBuckets = 1 << SubBits;
+  static constexpr std::size_t Buckets = (MaxBits - SubBits + 2) * SubBuckets;
+
+  void record(uint64_t ns) {
+    buckets_[index(ns)]++;
+    count_++;
+    sum_ += ns;
+    max_.max(ns);
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+  double mean() const {
+    uint64_t n = count_;
+    return n ? (double)sum_ / n : 0.0;
+  }
+
+  // upper bound of the bucket holding the p quantile, p in 0 .. 1
+  uint64_t percentile(double p) const {
+    std::array<uint64_t, Buckets> snapshot;
+    uint64_t total = 0;
+    for (std::size_t i = 0; i < Buckets; i++) {
+      snapshot[i] = buckets_[i];
+      total += snapshot[i];
+    }
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t rank = (uint64_t)(p * total);
+    if (rank >= total) {
+      rank = total - 1;
+    }
+    uint64_t seen = 0;
+    uint64_t max = max_;
+    for (std::size_t i = 0; i < Buckets; i++) {
+      seen += snapshot[i];
+      if (seen > rank) {
+        uint64_t upper = value(i + 1) - 1;
+        return upper < max ? upper : max;
+      }
+    }
+    return max;
+  }
+
+  // writer side only
+  void reset() {
+    for (auto &bucket : buckets_) {
+      bucket = 0;
+    }
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+  }
+
+  // {"count":..,"mean":..,"p50":..,"p90":..,"p99":..,"p999":..,"max":..}, ns
+  void dump_json(std::ostream &os) const {
+    os << "{\"count\":" << count() << ",\"mean\":" << (uint64_t)mean()
+       << ",\"p50\":" << percentile(0.5) << ",\"p90\":" << percentile(0.9)
+       << ",\"p99\":" << percentile(0.99) << ",\"p999\":"
+       << percentile(0.999) << ",\"max\":" << max() << "}";
+  }
+
+  // bucket of a value and the lowest value of a bucket
+  static std::size_t index(uint64_t ns) {
+    if (ns < SubBuckets) {
+      return ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    if (msb > MaxBits) {
+      return Buckets - 1;
+    }
+    int shift = msb - SubBits;
+    return (std::size_t)(shift + 1) * SubBuckets +
+           ((ns >> shift) & (SubBuckets - 1));
+  }
+
+  static uint64_t value(std::size_t index) {
+    if (index < SubBuckets) {
+      return index;
+    }
+    int shift = (int)(index / SubBuckets) - 1;
+    return (SubBuckets | (index % SubBuckets)) << shift;
+  }
+
+ private:
+  std::array<MetricCounter, Buckets> buckets_;
+  MetricCounter count_;
+  MetricCounter sum_;
+  MetricCounter max_;
+};
+
+}  // namespace ch343
+
+#endif  // CH343_LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,42 @@
+#ifndef CH343_METRIC_COUNTER_HPP
+#define CH343_METRIC_COUNTER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace ch343 {
+
+// Counter with a single writer (the strand owning it) that any thread may
+// read at any time. Relaxed load + store instead of fetch_add: there is only
+// one writer, so no locked instruction is needed on the hot path.
+class MetricCounter {
+ public:
+  MetricCounter() = default;
+  MetricCounter(const MetricCounter &) = delete;
+  MetricCounter &operator=(const MetricCounter &) = delete;
+
+  uint64_t load() const { return value_.load(std::memory_order_relaxed); }
+  operator uint64_t() const { return load(); }
+
+  MetricCounter &operator=(uint64_t v) {
+    value_.store(v, std::memory_order_relaxed);
+    return *this;
+  }
+  MetricCounter &operator+=(uint64_t n) { return *this = load() + n; }
+  MetricCounter &operator++() { return *this += 1; }
+  void operator++(int) { *this += 1; }
+
+  // keep the high water mark
+  void max(uint64_t v) {
+    if (v > load()) {
+      *this = v;
+    }
+  }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+}  // namespace ch343
+
+#endif  // CH343_METRIC_COUNTER_HPP
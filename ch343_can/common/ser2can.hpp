@@ -0,0 +1,517 @@
+#ifndef CH343_SER2CAN_HPP
+#define CH343_SER2CAN_HPP
+
+#include <linux/can.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+
+#include "can2ser.hpp"
+#include "metric_counter.hpp"
+
+// serial symbols -> socketcan frame, the receive side of can2ser and
+// canfd2ser. Every received UART character is one CAN bit; its
+// character_size data bits are samples of that bit and a majority vote gives
+// the bit value, which tolerates the edge of the next bit leaking into the
+// last samples. CAN FD frames are read at the same rate all through, the
+// way canfd2ser sends them; BRS only comes out as CANFD_BRS.
+//
+// One character per CAN bit only holds for what can2ser sent, i.e. the echo
+// of our own frames through the transceiver: every recessive bit there is a
+// 0xFF character and the trailer supplies the idle bits. A frame of another
+// node gives no character for a recessive run (the line just stays high), so
+// its bits cannot be counted and the 10 recessive characters the decoder
+// waits for before SOF never arrive.
+namespace ch343 {
+
+// single writer, readable from any thread
+struct Ser2CanStats {
+  MetricCounter symbols;       // UART characters fed
+  MetricCounter frames;        // valid frames delivered
+  MetricCounter fd_frames;     // of which CAN FD
+  MetricCounter stuff_errors;  // six equal bits, or a bad fixed stuff bit
+  MetricCounter form_errors;   // dominant CRC delimiter
+  MetricCounter crc_errors;    // including a bad CAN FD stuff count
+  MetricCounter resyncs;  // frame starts found again after an error or noise
+};
+
+inline std::ostream &operator<<(std::ostream &os, const Ser2CanStats &s) {
+  return os << "symbols " << s.symbols << ", frames " << s.frames
+            << ", fd_frames " << s.fd_frames << ", stuff_errors "
+            << s.stuff_errors << ", form_errors " << s.form_errors
+            << ", crc_errors " << s.crc_errors << ", resyncs " << s.resyncs;
+}
+
+namespace detail {
+
+// bit string packed MSB first, appended in pieces of up to 32 bits
+template <std::size_t Bits>
+class BitString {
+ public:
+  int size() const { return size_; }
+  void clear() { size_ = 0; }
+
+  // the bits past size() are never read, so nothing needs clearing
+  void append(uint64_t v, int n) {
+    if (n == 0) {
+      return;
+    }
+    int idx = size_ >> 6;
+    int used = size_ & 63;
+    int free = 64 - used;
+    uint64_t head = used ? words_[idx] : 0;
+    if (n <= free) {
+      words_[idx] = head | v << (free - n);
+    } else {
+      words_[idx] = head | v >> (n - free);
+      words_[idx + 1] = v << (64 - (n - free));
+    }
+    size_ += n;
+  }
+
+  // n <= 32 bits starting at bit i
+  uint32_t get(int i, int n) const {
+    int idx = i >> 6;
+    int off = i & 63;
+    uint64_t v;
+    if (off + n <= 64) {
+      v = words_[idx] >> (64 - off - n);
+    } else {
+      v = words_[idx] << (off + n - 64) | words_[idx + 1] >> (128 - off - n);
+    }
+    return (uint32_t)(v & ((1ull << n) - 1));
+  }
+
+ private:
+  // one spare word for an append that ends on a word boundary
+  std::array<uint64_t, Bits / 64 + 2> words_;
+  int size_ = 0;
+};
+
+}  // namespace detail
+
+// Streaming decoder, symbols may be split across feed() calls anywhere.
+// Raw bits are taken in chunks of up to 32; stuff bit positions of a whole
+// chunk come from a SWAR scan for five equal bits in a 64 bit word, so the
+// per bit work is only the symbol table lookup. A CAN FD frame leaves the
+// scan after its data field, the stuff count and CRC with their fixed stuff
+// bits go bit by bit.
+class Ser2Can {
+ public:
+  explicit Ser2Can(int character_size) {
+    int mask = (1 << character_size) - 1;
+    for (int i = 0; i < 256; i++) {
+      bit_table_[i] = __builtin_popcount(i & mask) * 2 > character_size;
+    }
+  }
+
+  // handler(const can_frame &) is called for every classic frame with a good
+  // CRC, handler(const canfd_frame &) for every CAN FD frame
+  template <typename Handler>
+  void feed(const uint8_t *data, std::size_t size, Handler &&handler) {
+    stats_.symbols += size;
+    std::size_t i = 0;
+    while (i < size) {
+      switch (state_) {
+        case State::Idle:
+          // bus idle after CanIdleBits recessive bits, then SOF
+          while (i < size && bit_table_[data[i]]) {
+            idle_++;
+            i++;
+          }
+          if (i == size) {
+            break;
+          }
+          if (idle_ < CanIdleBits) {
+            // dominant before bus idle, wait for it again
+            lost_ = true;
+            idle_ = 0;
+            i++;
+            break;
+          }
+          i++;
+          if (lost_) {
+            stats_.resyncs++;
+            lost_ = false;
+          }
+          start_frame();
+          break;
+        case State::Frame:
+          i += scan(data + i, size - i);
+          break;
+        case State::CrcEnd:
+          crc_end(bit_table_[data[i++]], handler);
+          break;
+        case State::FdCrc:
+          fd_crc(bit_table_[data[i++]], handler);
+          break;
+      }
+    }
+  }
+
+  const Ser2CanStats &stats() const { return stats_; }
+
+ private:
+  // ACK delimiter, EOF and the first two intermission bits
+  static constexpr int CanIdleBits = 10;
+
+  // Frame: SOF .. CRC (classic) or .. data (FD) through scan()
+  // CrcEnd: classic, a possible stuff bit and the CRC delimiter
+  // FdCrc: FD, a possible stuff bit, stuff count, CRC and CRC delimiter
+  enum class State { Idle, Frame, CrcEnd, FdCrc };
+
+  void start_frame() {
+    state_ = State::Frame;
+    window_ = 0;  // SOF
+    since_sof_ = 1;
+    bits_.clear();
+    bits_.append(0, 1);
+    raw_.clear();
+    raw_.append(0, 1);
+    needed_ = 14;  // up to IDE
+  }
+
+  void error(MetricCounter &counter) {
+    counter++;
+    state_ = State::Idle;
+    idle_ = 0;
+    lost_ = true;
+  }
+
+  bool extended() const { return bits_.get(13, 1); }
+
+  // FDF in place of r0, or of r1 in an extended frame
+  int fdf_bit() const { return extended() ? 33 : 14; }
+  bool fd() const { return bits_.get(fdf_bit(), 1); }
+
+  // SOF .. DLC
+  int header_bits() const {
+    return extended() ? (fd() ? 41 : 39) : (fd() ? 22 : 19);
+  }
+
+  // CRC-17 up to 16 data bytes, CRC-21 above
+  int fd_crc_width() const { return fd_len_ > 16 ? 21 : 17; }
+
+  // once the header is in, needed_ is the end of the CRC sequence of a
+  // classic frame or the end of the data field of an FD frame
+  void update_needed() {
+    int nbits = bits_.size();
+    if (nbits < 14) {
+      return;
+    }
+    if (nbits <= fdf_bit()) {
+      needed_ = fdf_bit() + 1;
+      return;
+    }
+    int header = header_bits();
+    if (nbits < header) {
+      needed_ = header;
+      return;
+    }
+    int dlc = bits_.get(header - 4, 4);
+    if (fd()) {
+      fd_len_ = canfd_dlc2len(dlc);
+      needed_ = header + 8 * fd_len_;
+    } else {
+      bool is_remote = bits_.get(header == 39 ? 32 : 12, 1);
+      int len = is_remote ? 0 : (dlc < CAN_MAX_DLEN ? dlc : CAN_MAX_DLEN);
+      needed_ = header + 8 * len + 15;
+    }
+    if (nbits < needed_) {
+      return;
+    }
+    if (!fd()) {
+      state_ = State::CrcEnd;
+      return;
+    }
+    state_ = State::FdCrc;
+    // the last data bits may still call for a dynamic stuff bit
+    fd_stuff_ = window_ == 0 || window_ == 0x1F;
+    fd_raw_ = 0;
+    fd_field_ = 0;
+    fd_field_bits_ = 0;
+  }
+
+  // destuff raw bits until the CRC sequence (classic) or the data field (FD)
+  // is complete, returns the number of symbols consumed
+  std::size_t scan(const uint8_t *data, std::size_t size) {
+    std::size_t used = 0;
+    while (used < size && state_ == State::Frame) {
+      // a raw bit yields at most one destuffed bit, never overshoot needed_
+      int k = (int)std::min<std::size_t>(size - used, 32);
+      k = std::min(k, needed_ - bits_.size());
+      uint64_t x = 0;
+      for (int j = 0; j < k; j++) {
+        x = x << 1 | bit_table_[data[used + j]];
+      }
+      // w: 5 previous raw bits followed by the k new ones, newest at bit 0
+      uint64_t w = (window_ << k) | x;
+      uint64_t eq = ~(w ^ (w >> 1));
+      // bit b set: raw bits b .. b+4 of w are equal
+      uint64_t run5 = eq & (eq >> 1) & (eq >> 2) & (eq >> 3);
+      // new bit at b is a stuff bit when the five bits before it are equal
+      uint64_t stuff = (run5 >> 1) & ((1ull << k) - 1);
+      // the five bits must all be after SOF
+      if (since_sof_ < 5) {
+        int valid = k - (5 - since_sof_);
+        stuff &= valid > 0 ? (1ull << valid) - 1 : 0;
+      }
+      if (stuff & eq) {
+        // stuff bit equal to the bit before it, the bits after the first
+        // such one may already be bus idle and the next SOF
+        int b = 63 - __builtin_clzll(stuff & eq);
+        error(stats_.stuff_errors);
+        return used + k - b;
+      }
+      // the CAN FD CRC runs over the stuffed bits
+      raw_.append(x, k);
+      // drop stuff bits, highest first keeps the lower positions valid
+      int n = k - __builtin_popcountll(stuff);
+      while (stuff != 0) {
+        int b = 63 - __builtin_clzll(stuff);
+        x = (x & ((1ull << b) - 1)) | ((x >> (b + 1)) << b);
+        stuff &= ~(1ull << b);
+      }
+      bits_.append(x, n);
+      window_ = w & 0x1F;
+      since_sof_ += k;
+      used += k;
+      update_needed();
+    }
+    return used;
+  }
+
+  // raw bit after the last CRC bit: a stuff bit if the CRC ended in five
+  // equal bits, then the CRC delimiter
+  template <typename Handler>
+  void crc_end(bool bit, Handler &&handler) {
+    uint64_t last = window_ & 1;
+    if (window_ == 0 || window_ == 0x1F) {
+      if (bit == last) {
+        error(stats_.stuff_errors);
+        return;
+      }
+      window_ = (window_ << 1 | bit) & 0x1F;
+      return;
+    }
+    if (!bit) {
+      error(stats_.form_errors);
+      return;
+    }
+    state_ = State::Idle;
+    idle_ = 1;
+
+    can_frame frame;
+    std::memset(&frame, 0, sizeof(frame));
+    int header = header_bits();
+    if (header == 39) {
+      frame.can_id =
+          bits_.get(1, 11) << 18 | bits_.get(14, 18) | CAN_EFF_FLAG;
+      if (bits_.get(32, 1)) {
+        frame.can_id |= CAN_RTR_FLAG;
+      }
+    } else {
+      frame.can_id = bits_.get(1, 11);
+      if (bits_.get(12, 1)) {
+        frame.can_id |= CAN_RTR_FLAG;
+      }
+    }
+    uint8_t dlc = bits_.get(header - 4, 4);
+    frame.can_dlc = dlc < CAN_MAX_DLEN ? dlc : CAN_MAX_DLEN;
+    if (dlc > CAN_MAX_DLEN) {
+      frame.len8_dlc = dlc;
+    }
+    int len = (frame.can_id & CAN_RTR_FLAG) ? 0 : frame.can_dlc;
+    for (int i = 0; i < len; i++) {
+      frame.data[i] = bits_.get(header + 8 * i, 8);
+    }
+    if (bits_.get(needed_ - 15, 15) != can_crc15(frame)) {
+      stats_.crc_errors++;
+      return;
+    }
+    stats_.frames++;
+    handler(frame);
+  }
+
+  // raw bits after the FD data field: a dynamic stuff bit if the data ended
+  // in five equal bits, then stuff count and CRC with a fixed stuff bit
+  // before every 4 bits, then the CRC delimiter
+  template <typename Handler>
+  void fd_crc(bool bit, Handler &&handler) {
+    bool last = window_ & 1;
+    window_ = (window_ << 1 | bit) & 0x1F;
+    if (fd_stuff_) {
+      fd_stuff_ = false;
+      if (bit == last) {
+        error(stats_.stuff_errors);
+        return;
+      }
+      raw_.append(bit, 1);
+      return;
+    }
+    int width = fd_crc_width();
+    if (fd_field_bits_ < 4 + width) {
+      if (fd_raw_++ % 5 == 0) {
+        // fixed stuff bit, the complement of the bit before it
+        if (bit == last) {
+          error(stats_.stuff_errors);
+        }
+        return;
+      }
+      fd_field_ = fd_field_ << 1 | bit;
+      fd_field_bits_++;
+      return;
+    }
+    if (!bit) {
+      error(stats_.form_errors);
+      return;
+    }
+    state_ = State::Idle;
+    idle_ = 1;
+
+    // dynamic stuff bits mod 8, Gray coded with parity, then the CRC over
+    // the stuffed bits and the stuff count
+    uint32_t stuff_count = fd_field_ >> width;
+    int dynamic = raw_.size() - bits_.size();
+    uint32_t poly = width == 21 ? detail::Crc21Poly : detail::Crc17Poly;
+    uint32_t top = 1u << (width - 1);
+    uint32_t crc = top;
+    for (int i = 0; i < raw_.size() + 4; i++) {
+      bool b = i < raw_.size() ? raw_.get(i, 1)
+                               : (stuff_count >> (raw_.size() + 3 - i)) & 1;
+      bool msb = crc & top;
+      crc = (crc << 1) & ((top << 1) - 1);
+      if (b != msb) {
+        crc ^= poly;
+      }
+    }
+    if (stuff_count != detail::stuff_count_table[dynamic & 0x07] ||
+        (fd_field_ & ((top << 1) - 1)) != crc) {
+      stats_.crc_errors++;
+      return;
+    }
+
+    canfd_frame frame;
+    std::memset(&frame, 0, sizeof(frame));
+    int header = header_bits();
+    if (header == 41) {
+      frame.can_id =
+          bits_.get(1, 11) << 18 | bits_.get(14, 18) | CAN_EFF_FLAG;
+    } else {
+      frame.can_id = bits_.get(1, 11);
+    }
+    frame.flags = CANFD_FDF;
+    if (bits_.get(header - 6, 1)) {
+      frame.flags |= CANFD_BRS;
+    }
+    if (bits_.get(header - 5, 1)) {
+      frame.flags |= CANFD_ESI;
+    }
+    frame.len = fd_len_;
+    for (int i = 0; i < fd_len_; i++) {
+      frame.data[i] = bits_.get(header + 8 * i, 8);
+    }
+    stats_.frames++;
+    stats_.fd_frames++;
+    handler(frame);
+  }
+
+  std::array<uint8_t, 256> bit_table_;
+  State state_ = State::Idle;
+  int idle_ = CanIdleBits;  // the line is taken as idle at start
+  bool lost_ = false;       // out of sync since an error or noise
+  uint64_t window_ = 0;     // last 5 raw bits, newest at bit 0
+  int since_sof_ = 0;       // raw bits since SOF, including it
+  // destuffed SOF .. CRC (classic) or SOF .. data (FD)
+  detail::BitString<CanFdMaxDynamicBits> bits_;
+  // the same stuffed, and a dynamic stuff bit after the FD data
+  detail::BitString<CanFdMaxDynamicBits + CanFdMaxDynamicBits / 4 + 1> raw_;
+  int needed_ = 0;
+  int fd_len_ = 0;
+  bool fd_stuff_ = false;  // a dynamic stuff bit is due
+  int fd_raw_ = 0;         // raw bits since the data field and its stuff bit
+  uint32_t fd_field_ = 0;  // stuff count and CRC
+  int fd_field_bits_ = 0;
+  Ser2CanStats stats_;
+};
+
+// Drops the frames that come back on the serial receive line because the
+// transceiver echoes our own transmission. Frames are expected back in the
+// order they were sent; the oldest entries age out when the window is full.
+// CAN FD frames are kept as they go over the wire: padded to a valid length
+// and without BRS, which canfd2ser always sends dominant.
+class CanEchoFilter {
+ public:
+  explicit CanEchoFilter(std::size_t window) : window_(window) {}
+
+  void sent(const can_frame &frame) { add(classic(frame)); }
+
+  void sent(const canfd_frame &frame) {
+    Entry entry{frame, true};
+    uint8_t len = canfd_dlc2len(canfd_len2dlc(frame.len));
+    for (uint8_t i = frame.len < len ? frame.len : len; i < len; i++) {
+      entry.frame.data[i] = 0;
+    }
+    entry.frame.len = len;
+    entry.frame.flags = frame.flags & CANFD_ESI;
+    add(entry);
+  }
+
+  // true if frame is the echo of a sent frame
+  bool echo(const can_frame &frame) { return match(classic(frame)); }
+
+  bool echo(const canfd_frame &frame) {
+    Entry entry{frame, true};
+    entry.frame.flags = frame.flags & CANFD_ESI;
+    return match(entry);
+  }
+
+ private:
+  // a classic frame in canfd_frame, can_dlc as len
+  struct Entry {
+    canfd_frame frame;
+    bool fd;
+  };
+
+  static Entry classic(const can_frame &frame) {
+    Entry entry{};
+    entry.frame.can_id = frame.can_id;
+    entry.frame.len = frame.can_dlc;
+    std::memcpy(entry.frame.data, frame.data, CAN_MAX_DLEN);
+    return entry;
+  }
+
+  void add(const Entry &entry) {
+    if (pending_.size() == window_) {
+      pending_.pop_front();
+    }
+    pending_.push_back(entry);
+  }
+
+  bool match(const Entry &entry) {
+    const canfd_frame &frame = entry.frame;
+    for (auto it = pending_.begin(); it != pending_.end(); it++) {
+      if (it->fd == entry.fd && it->frame.can_id == frame.can_id &&
+          it->frame.len == frame.len && it->frame.flags == frame.flags &&
+          ((frame.can_id & CAN_RTR_FLAG) ||
+           std::memcmp(it->frame.data, frame.data, frame.len) == 0)) {
+        // everything before it was lost on the bus
+        pending_.erase(pending_.begin(), it + 1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::size_t window_;
+  std::deque<Entry> pending_;
+};
+
+}  // namespace ch343
+
+#endif  // CH343_SER2CAN_HPP
@@ -0,0 +1,327 @@
+// Ser2Can against can2ser and canfd2ser: random classic and CAN FD frames,
+// each followed by can_trailer, fed to the decoder in random splits for 6 and
+// 8 data bits per character, with one sample of every character flipped.
+// Between the good frames go frames with a wrong CRC (or CAN FD stuff
+// count), frames with an inverted stuff bit and a dominant glitch in the
+// trailer, which have to show up exactly in the crc_errors, stuff_errors and
+// resyncs counters; then random line noise, after which every good frame
+// still has to come out in order.
+//
+// ser2can_test [frames]
+#include <linux/can.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "can2ser.hpp"
+#include "ser2can.hpp"
+
+static int failures;
+
+#define CHECK(cond)                                                       \
+  do {                                                                    \
+    if (!(cond) && failures++ < 16) {                                     \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond " failed\n"; \
+    }                                                                     \
+  } while (0)
+
+static std::mt19937 rng(0x5EC2CA4);
+
+static can_frame random_frame() {
+  can_frame frame;
+  std::memset(&frame, 0, sizeof(frame));
+  if (rng() & 1) {
+    frame.can_id = (rng() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  } else {
+    frame.can_id = rng() & CAN_SFF_MASK;
+  }
+  if (rng() % 8 == 0) {
+    frame.can_id |= CAN_RTR_FLAG;
+  }
+  frame.can_dlc = rng() % (CAN_MAX_DLEN + 1);
+  if (frame.can_dlc == CAN_MAX_DLEN && rng() % 4 == 0) {
+    frame.len8_dlc =
+        CAN_MAX_DLEN + 1 + rng() % (CAN_MAX_RAW_DLC - CAN_MAX_DLEN);
+  }
+  if (!(frame.can_id & CAN_RTR_FLAG)) {
+    // long runs of equal bits now and then, for the stuff bits
+    uint8_t fill = rng() % 4 == 0 ? (rng() & 1 ? 0xFF : 0x00) : 0;
+    for (int i = 0; i < frame.can_dlc; i++) {
+      frame.data[i] = fill ? fill : (uint8_t)rng();
+    }
+  }
+  return frame;
+}
+
+// any length, BRS and ESI now and then
+static canfd_frame random_fd_frame() {
+  canfd_frame frame;
+  std::memset(&frame, 0, sizeof(frame));
+  if (rng() & 1) {
+    frame.can_id = (rng() & CAN_EFF_MASK) | CAN_EFF_FLAG;
+  } else {
+    frame.can_id = rng() & CAN_SFF_MASK;
+  }
+  frame.flags = CANFD_FDF | (rng() & 1 ? CANFD_BRS : 0) |
+                (rng() % 4 == 0 ? CANFD_ESI : 0);
+  frame.len = rng() % (CANFD_MAX_DLEN + 1);
+  uint8_t fill = rng() % 4 == 0 ? (rng() & 1 ? 0xFF : 0x00) : 0;
+  for (int i = 0; i < frame.len; i++) {
+    frame.data[i] = fill ? fill : (uint8_t)rng();
+  }
+  return frame;
+}
+
+// a frame as the decoder delivers it, a can_frame in canfd_frame unless fd
+struct Frame {
+  canfd_frame frame;
+  bool fd;
+};
+
+static Frame classic(const can_frame &frame) {
+  Frame f{};
+  std::memcpy(&f.frame, &frame, sizeof(frame));
+  return f;
+}
+
+// as it goes over the wire: padded to a valid length, BRS sent dominant
+static Frame wire(const canfd_frame &frame) {
+  Frame f{frame, true};
+  f.frame.len = ch343::canfd_dlc2len(ch343::canfd_len2dlc(frame.len));
+  f.frame.flags &= ~CANFD_BRS;
+  return f;
+}
+
+static bool same_frame(const Frame &a, const Frame &b) {
+  if (a.fd != b.fd) {
+    return false;
+  }
+  if (a.fd) {
+    return a.frame.can_id == b.frame.can_id && a.frame.len == b.frame.len &&
+           a.frame.flags == b.frame.flags &&
+           std::memcmp(a.frame.data, b.frame.data, a.frame.len) == 0;
+  }
+  can_frame x;
+  can_frame y;
+  std::memcpy(&x, &a.frame, sizeof(x));
+  std::memcpy(&y, &b.frame, sizeof(y));
+  int len = (x.can_id & CAN_RTR_FLAG) ? 0 : x.can_dlc;
+  return x.can_id == y.can_id && x.can_dlc == y.can_dlc &&
+         x.len8_dlc == y.len8_dlc && std::memcmp(x.data, y.data, len) == 0;
+}
+
+static void append(std::vector<uint8_t> &out, const uint8_t *symbols,
+                   std::size_t n) {
+  out.insert(out.end(), symbols, symbols + n);
+}
+
+// can2ser with the CRC sequence xor crc_xor
+static std::size_t can2ser_crc(const can_frame &frame, uint16_t crc_xor,
+                               uint8_t *out) {
+  uint8_t packed[ch343::CanMaxPackedBytes];
+  int first_bits;
+  std::size_t n = ch343::can_pack(frame, packed, first_bits);
+  uint16_t crc = ch343::crc15(packed, n) ^ crc_xor;
+  ch343::detail::Stuffer stuffer{out};
+  stuffer.put_bits(packed[0], first_bits);
+  for (std::size_t i = 1; i < n; i++) {
+    stuffer.put_byte(packed[i]);
+  }
+  stuffer.put_bits(crc, 15);
+  *stuffer.out++ = ch343::Bit1;
+  return stuffer.out - out;
+}
+
+// symbols of the CAN FD stuff count and CRC with their fixed stuff bits
+static std::size_t fd_crc_symbols(const canfd_frame &frame) {
+  int len = ch343::canfd_dlc2len(ch343::canfd_len2dlc(frame.len));
+  std::size_t bits = 4 + (len > 16 ? 21 : 17);
+  return bits + (bits + 3) / 4;
+}
+
+// position of the first stuff bit of an encoded frame, 0 if there is none
+static std::size_t first_stuff_bit(const uint8_t *symbols, std::size_t n) {
+  int count = 0;
+  // the CRC delimiter is not stuffed
+  for (std::size_t i = 1; i + 1 < n; i++) {
+    count = symbols[i] == symbols[i - 1] ? count + 1 : 1;
+    if (count == 5) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// every character slightly off: one of its samples flipped, the bits above
+// character_size random
+static void blur(std::vector<uint8_t> &symbols, int character_size) {
+  for (uint8_t &c : symbols) {
+    uint8_t above = (uint8_t)(rng() & ~((1u << character_size) - 1));
+    uint8_t flip = (uint8_t)(1u << (rng() % character_size));
+    c = (uint8_t)((c ^ flip) & ((1u << character_size) - 1)) | above;
+  }
+}
+
+struct Stream {
+  std::vector<uint8_t> symbols;
+  std::vector<Frame> frames;  // the good ones, in order
+  int bad_crc = 0;
+  int bad_stuff = 0;
+  int glitches = 0;
+  int noise = 0;
+};
+
+// frames frames, about one in four with an error; noise adds bursts of
+// random characters, each followed by enough recessive bits for bus idle
+static Stream make_stream(int frames, bool noise) {
+  Stream s;
+  ch343::CanFdSerBuffer buffer;
+  for (int i = 0; i < frames; i++) {
+    bool fd = rng() % 4 == 0;
+    can_frame frame = random_frame();
+    canfd_frame fd_frame = random_fd_frame();
+    int kind = rng() % 8;
+    std::size_t n = fd ? ch343::canfd2ser(fd_frame, buffer)
+                       : ch343::can2ser(frame, buffer.data());
+    std::size_t stuff = first_stuff_bit(buffer.data(), n);
+    if (kind == 0 && fd) {
+      // the last CRC bit or one of the first three stuff count bits, no
+      // fixed stuff bit depends on them
+      std::size_t crc = n - 1 - fd_crc_symbols(fd_frame);
+      std::size_t at = rng() & 1 ? n - 2 : crc + 1 + rng() % 3;
+      buffer[at] = buffer[at] == ch343::Bit0 ? ch343::Bit1 : ch343::Bit0;
+      s.bad_crc++;
+    } else if (kind == 0) {
+      n = can2ser_crc(frame, 1 + rng() % 0x7FFE, buffer.data());
+      s.bad_crc++;
+    } else if (kind == 1 && stuff != 0) {
+      buffer[stuff] = buffer[stuff - 1];
+      s.bad_stuff++;
+    } else {
+      s.frames.push_back(fd ? wire(fd_frame) : classic(frame));
+    }
+    append(s.symbols, buffer.data(), n);
+    if (kind == 2) {
+      // a dominant bit within the first three idle bits
+      std::size_t at = rng() % 3;
+      append(s.symbols, ch343::can_trailer.data(), at);
+      s.symbols.push_back(ch343::Bit0);
+      s.glitches++;
+    }
+    append(s.symbols, ch343::can_trailer.data(), ch343::can_trailer.size());
+    if (noise && kind == 3) {
+      std::size_t len = 1 + rng() % 64;
+      s.symbols.push_back(ch343::Bit0);
+      for (std::size_t j = 1; j < len; j++) {
+        s.symbols.push_back((uint8_t)rng());
+      }
+      s.symbols.insert(s.symbols.end(), 3 * ch343::can_trailer.size(),
+                       ch343::Bit1);
+      s.noise++;
+    }
+  }
+  // a good frame last, it resynchronises after whatever came before
+  can_frame frame = random_frame();
+  append(s.symbols, buffer.data(), ch343::can2ser(frame, buffer.data()));
+  append(s.symbols, ch343::can_trailer.data(), ch343::can_trailer.size());
+  s.frames.push_back(classic(frame));
+  return s;
+}
+
+// one handler for both kinds of frames
+struct Collect {
+  std::vector<Frame> &frames;
+  void operator()(const can_frame &frame) { frames.push_back(classic(frame)); }
+  void operator()(const canfd_frame &frame) {
+    frames.push_back({frame, true});
+  }
+};
+
+static std::vector<Frame> decode(ch343::Ser2Can &decoder,
+                                 const std::vector<uint8_t> &symbols) {
+  std::vector<Frame> frames;
+  std::size_t i = 0;
+  while (i < symbols.size()) {
+    // single characters, a few bits and whole frames at once
+    std::size_t max = rng() % 4 == 0 ? 1 : rng() % 2 ? 40 : 400;
+    std::size_t n =
+        std::min<std::size_t>(1 + rng() % max, symbols.size() - i);
+    decoder.feed(symbols.data() + i, n, Collect{frames});
+    i += n;
+  }
+  return frames;
+}
+
+static bool same_frames(const std::vector<Frame> &got,
+                        const std::vector<Frame> &want) {
+  if (got.size() != want.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < got.size(); i++) {
+    if (!same_frame(got[i], want[i])) {
+      std::cerr << "frame " << i << ": id " << std::hex
+                << got[i].frame.can_id << ", want " << want[i].frame.can_id
+                << std::dec << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+static uint64_t fd_frames(const std::vector<Frame> &frames) {
+  uint64_t n = 0;
+  for (const Frame &f : frames) {
+    n += f.fd;
+  }
+  return n;
+}
+
+static void test_errors(int frames, int character_size) {
+  Stream s = make_stream(frames, false);
+  blur(s.symbols, character_size);
+  ch343::Ser2Can decoder(character_size);
+  std::vector<Frame> got = decode(decoder, s.symbols);
+  const ch343::Ser2CanStats &stats = decoder.stats();
+  CHECK(same_frames(got, s.frames));
+  CHECK(stats.symbols == s.symbols.size());
+  CHECK(stats.frames == s.frames.size());
+  CHECK(stats.fd_frames == fd_frames(s.frames));
+  CHECK(stats.crc_errors == (uint64_t)s.bad_crc);
+  CHECK(stats.stuff_errors == (uint64_t)s.bad_stuff);
+  CHECK(stats.form_errors == 0);
+  CHECK(stats.resyncs == (uint64_t)(s.bad_stuff + s.glitches));
+  std::cout << "character_size " << character_size << ": " << s.frames.size()
+            << " good, " << s.bad_crc << " bad crc, " << s.bad_stuff
+            << " bad stuff bit, " << s.glitches << " glitches: " << stats
+            << std::endl;
+}
+
+static void test_noise(int frames) {
+  Stream s = make_stream(frames, true);
+  ch343::Ser2Can decoder(6);
+  std::vector<Frame> got = decode(decoder, s.symbols);
+  const ch343::Ser2CanStats &stats = decoder.stats();
+  CHECK(same_frames(got, s.frames));
+  CHECK(stats.frames == s.frames.size());
+  CHECK(stats.crc_errors >= (uint64_t)s.bad_crc);
+  CHECK(stats.stuff_errors >= (uint64_t)s.bad_stuff);
+  // every noise burst starts a frame that cannot end well
+  CHECK(stats.crc_errors + stats.stuff_errors + stats.form_errors >=
+        (uint64_t)(s.bad_crc + s.bad_stuff + s.noise));
+  CHECK(stats.resyncs >= (uint64_t)(s.bad_stuff + s.glitches));
+  std::cout << "noise: " << s.frames.size() << " good, " << s.noise
+            << " bursts: " << stats << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  int frames = argc > 1 ? std::atoi(argv[1]) : 20000;
+  test_errors(frames, 6);
+  test_errors(frames, 8);
+  test_noise(frames);
+  std::cout << (failures ? "FAILED" : "ok") << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,364 @@
+#ifndef CH343_SER_CAN_BRIDGE_HPP
+#define CH343_SER_CAN_BRIDGE_HPP
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "can2ser.hpp"
+#include "can_batch_reader.hpp"
+#include "ser2can.hpp"
+#include "ser_tx_queue.hpp"
+
+namespace ch343 {
+
+struct SerCanBridgeConfig {
+  std::string ser_name = "/dev/ttyACM0";
+  std::string can_name = "vxcan0";
+  // serial, 1 start bit, character_size data bits, 1 stop bit, no parity
+  // CAN 100K, Serial 1M, 1 start bit, 8 data bits, 1 stop bit, no parity
+  // CAN 250K, Serial 2M, 1 start bit, 6 data bits, 1 stop bit, no parity
+  // CAN 500K, Serial 4M, 1 start bit, 6 data bits, 1 stop bit, no parity
+  uint32_t baud_rate = 2000000;
+  int character_size = 6;
+  // CAN bitrate the writes are paced to, 0 for one UART character per CAN
+  // bit: baud_rate / (1 + character_size + 1)
+  uint32_t can_bitrate = 0;
+  // frames, enough for a burst at 4 Mbaud while the host is busy
+  std::size_t tx_queue_size = 256;
+  // frames per recvmmsg call
+  std::size_t recv_batch = 32;
+  // statistics period, 0 for none
+  std::chrono::seconds stats_period{10};
+};
+
+// One serial port <-> one CAN interface. Every I/O object of the pair is
+// bound to the same strand, so the handlers of a pair never run concurrently
+// and the single threaded queue, reader and decoder need no locking, while
+// different pairs run in parallel on the io_context worker threads.
+class SerCanBridge {
+ public:
+  SerCanBridge(asio::io_context &iocxt, SerCanBridgeConfig config)
+      : config_(std::move(config)),
+        strand_(asio::make_strand(iocxt)),
+        ser_(strand_),
+        can_(strand_),
+        stats_timer_(strand_),
+        tx_queue_(ser_, config_.tx_queue_size, can_bitrate(config_)),
+        echo_filter_(config_.tx_queue_size),
+        ser_decoder_(config_.character_size) {
+    // our own frames come back on the serial rx line in the order they went
+    // out, which is not the order they came in
+    tx_queue_.on_write([this](const canfd_frame &frame, bool fd) {
+      if (fd) {
+        echo_filter_.sent(frame);
+      } else {
+        can_frame classic;
+        std::memcpy(&classic, &frame, sizeof(classic));
+        echo_filter_.sent(classic);
+      }
+    });
+  }
+
+  SerCanBridge(const SerCanBridge &) = delete;
+  SerCanBridge &operator=(const SerCanBridge &) = delete;
+
+  // "serial=can"
+  std::string name() const { return config_.ser_name + "=" + config_.can_name; }
+
+  // open and configure both ends, false with the reason on std::cerr
+  bool open() { return open_serial() && open_can(); }
+
+  // the same with the CAN side on an already open socket instead of the
+  // can_name interface, e.g. one end of a socketpair(AF_UNIX,
+  // SOCK_SEQPACKET) standing in for it in a test. Takes ownership of can.
+  bool open(int can) {
+    // closed with can_ even if the serial port fails
+    can_.assign(can);
+    if (!open_serial()) {
+      return false;
+    }
+    can_reader_ = std::make_unique<CanBatchReader>(can_, config_.recv_batch);
+    return true;
+  }
+
+  // One JSON object with every counter, the rates since the previous dump
+  // and the tx stage latencies in ns, no newline. Reads only single writer
+  // atomics, so it may run on any thread while the pair is busy, but not
+  // concurrently with itself.
+  void dump_json(std::ostream &os) {
+    uint64_t now = realtime_ns();
+    double seconds = dump_last_ns_ ? (now - dump_last_ns_) / 1e9 : 0.0;
+    const CanRxStats &rx = can_reader_->stats();
+    const SerTxStats &tx = tx_queue_.stats();
+    const Ser2CanStats &ser = ser_decoder_.stats();
+    uint64_t written = tx.written;
+    uint64_t bytes = tx.bytes;
+    uint64_t decoded = ser.frames;
+    auto rate = [seconds](uint64_t current, uint64_t last) {
+      return seconds > 0.0 ? (current - last) / seconds : 0.0;
+    };
+    os << "{\"time_ns\":" << now << ",\"port\":";
+    json_string(os, name());
+    os << ",\"interval_s\":" << seconds
+       << ",\"can_rx\":{\"wakeups\":" << rx.wakeups
+       << ",\"frames\":" << rx.frames << ",\"fd_frames\":" << rx.fd_frames
+       << ",\"bad\":" << rx.bad << ",\"max_batch\":" << rx.max_batch
+       << "},\"ser_tx\":{\"frames\":" << tx.frames
+       << ",\"drops\":" << tx.drops << ",\"writes\":" << tx.writes
+       << ",\"written\":" << written << ",\"bytes\":" << bytes
+       << ",\"errors\":" << tx.errors << ",\"paced\":" << tx.paced
+       << ",\"wire_bits\":" << tx.wire_bits << ",\"depth\":" << tx.depth
+       << ",\"max_depth\":" << tx.max_depth
+       << ",\"frames_per_s\":" << rate(written, dump_written_)
+       << ",\"bytes_per_s\":" << rate(bytes, dump_bytes_)
+       << "},\"ser_rx\":{\"symbols\":" << ser.symbols
+       << ",\"frames\":" << decoded << ",\"fd_frames\":" << ser.fd_frames
+       << ",\"stuff_errors\":" << ser.stuff_errors
+       << ",\"form_errors\":" << ser.form_errors
+       << ",\"crc_errors\":" << ser.crc_errors
+       << ",\"resyncs\":" << ser.resyncs
+       << ",\"can_write_errors\":" << can_write_errors_
+       << ",\"frames_per_s\":" << rate(decoded, dump_decoded_)
+       << "},\"latency_ns\":{";
+    const SerTxLatency &latency = tx_queue_.latency();
+    os << "\"socket\":";
+    latency.socket.dump_json(os);
+    os << ",\"encode\":";
+    latency.encode.dump_json(os);
+    os << ",\"queue\":";
+    latency.queue.dump_json(os);
+    os << ",\"write\":";
+    latency.write.dump_json(os);
+    os << ",\"total\":";
+    latency.total.dump_json(os);
+    os << "}}";
+    dump_last_ns_ = now;
+    dump_written_ = written;
+    dump_bytes_ = bytes;
+    dump_decoded_ = decoded;
+  }
+
+  // start the CAN -> serial and serial -> CAN paths on the strand
+  void start() {
+    asio::post(strand_, [this]() {
+      start_can_read();
+      start_ser_read();
+      if (config_.stats_period.count() > 0) {
+        stats_last_ = std::chrono::steady_clock::now();
+        stats_timer_.expires_after(config_.stats_period);
+        stats_timer_.async_wait(
+            [this](const asio::error_code &ec) { stats_print(ec); });
+      }
+    });
+  }
+
+ private:
+  // quoted JSON string, device paths are not restricted to safe characters
+  static void json_string(std::ostream &os, const std::string &str) {
+    static const char hex[] = "0123456789abcdef";
+    os << '"';
+    for (unsigned char c : str) {
+      if (c == '"' || c == '\\') {
+        os << '\\' << c;
+      } else if (c < 0x20) {
+        os << "\\u00" << hex[c >> 4] << hex[c & 0xF];
+      } else {
+        os << c;
+      }
+    }
+    os << '"';
+  }
+
+  // serial port with the configured framing
+  bool open_serial() {
+    asio::error_code ec;
+    ser_.open(config_.ser_name, ec);
+    if (ec) {
+      std::cerr << name() << ": Failed to open serial port: " << ec.message()
+                << std::endl;
+      return false;
+    }
+    ser_.set_option(asio::serial_port::baud_rate(config_.baud_rate));
+    ser_.set_option(
+        asio::serial_port::character_size(config_.character_size));
+    ser_.set_option(
+        asio::serial_port::stop_bits(asio::serial_port::stop_bits::one));
+    ser_.set_option(
+        asio::serial_port::parity(asio::serial_port::parity::none));
+    ser_.set_option(asio::serial_port::flow_control(
+        asio::serial_port::flow_control::none));
+    return true;
+  }
+
+  // CAN_RAW socket with CAN FD frames, bound to can_name
+  bool open_can() {
+    int dev = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (dev < 0) {
+      std::cerr << name() << ": Failed to open can" << std::endl;
+      return false;
+    }
+    // owned by can_ from here on, closed with it
+    can_.assign(dev);
+    struct ifreq ifr;
+    std::strncpy(ifr.ifr_name, config_.can_name.c_str(), IFNAMSIZ - 1);
+    ifr.ifr_name[IFNAMSIZ - 1] = '\0';
+    if (ioctl(dev, SIOCGIFINDEX, &ifr) < 0) {
+      std::cerr << name() << ": Failed to ioctl can" << std::endl;
+      return false;
+    }
+    struct sockaddr_can addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = ifr.ifr_ifindex;
+    int enable_canfd = 1;
+    if (setsockopt(dev, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable_canfd,
+                   sizeof(enable_canfd)) < 0) {
+      std::cerr << name() << ": Failed to setsockopt canfd" << std::endl;
+      return false;
+    }
+    if (bind(dev, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      std::cerr << name() << ": Failed to bind can" << std::endl;
+      return false;
+    }
+    can_reader_ = std::make_unique<CanBatchReader>(can_, config_.recv_batch);
+    return true;
+  }
+
+  static uint32_t can_bitrate(const SerCanBridgeConfig &config) {
+    return config.can_bitrate != 0
+               ? config.can_bitrate
+               : config.baud_rate / (1 + config.character_size + 1);
+  }
+
+  // read socketcan frames in batches and write to serial
+  void start_can_read() {
+    can_reader_->start([this](const CanRxFrame &rx) {
+      if (rx.size == CAN_MTU) {
+        struct can_frame frame;
+        std::memcpy(&frame, &rx.frame, sizeof(can_frame));
+        tx_queue_.push(frame, rx.stamp_ns);
+      } else {
+        tx_queue_.push(rx.frame, rx.stamp_ns);
+      }
+    });
+  }
+
+  // read serial symbols, decode and write valid frames to socketcan
+  void start_ser_read() {
+    ser_.async_read_some(
+        asio::buffer(ser_buffer_),
+        [this](const asio::error_code &ec, std::size_t bytes_transferred) {
+          if (ec) {
+            std::cerr << name() << ": Serial read error: " << ec.message()
+                      << std::endl;
+            return;
+          }
+          ser_decoder_.feed(ser_buffer_, bytes_transferred,
+                            [this](const auto &frame) {
+                              // can_frame or canfd_frame, CAN_MTU or
+                              // CANFD_MTU
+                              if (echo_filter_.echo(frame)) {
+                                return;
+                              }
+                              if (write(can_.native_handle(), &frame,
+                                        sizeof(frame)) !=
+                                  (ssize_t)sizeof(frame)) {
+                                can_write_errors_++;
+                              }
+                            });
+          start_ser_read();
+        });
+  }
+
+  // print rx/tx statistics and rates when there was traffic
+  void stats_print(const asio::error_code &ec) {
+    if (ec) {
+      std::cerr << name() << ": Timer error: " << ec.message() << std::endl;
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - stats_last_).count();
+    stats_last_ = now;
+    const auto &tx = tx_queue_.stats();
+    const auto &ser = ser_decoder_.stats();
+    uint64_t activity = tx.frames + tx.drops + ser.symbols;
+    if (activity != stats_activity_) {
+      stats_activity_ = activity;
+      // one write per report keeps lines of different ports apart
+      std::ostringstream os;
+      os << name() << " rx: " << can_reader_->stats() << "\n"
+         << name() << " tx: " << tx << ", "
+         << (tx.written - stats_written_) / seconds << " frames/s, "
+         << (tx.bytes - stats_bytes_) / seconds << " bytes/s, bus load "
+         << 100.0 * (tx.wire_bits - stats_wire_bits_) / seconds /
+                can_bitrate(config_)
+         << "%\n"
+         << name() << " ser: " << ser << ", can_write_errors "
+         << can_write_errors_ << ", "
+         << (ser.frames - stats_decoded_) / seconds << " frames/s\n"
+         << name() << " tx latency p50/p99/max:";
+      const SerTxLatency &latency = tx_queue_.latency();
+      for (const auto &stage : {std::make_pair("socket", &latency.socket),
+                                std::make_pair("encode", &latency.encode),
+                                std::make_pair("queue", &latency.queue),
+                                std::make_pair("write", &latency.write),
+                                std::make_pair("total", &latency.total)}) {
+        os << " " << stage.first << " " << stage.second->percentile(0.5) / 1e3
+           << "/" << stage.second->percentile(0.99) / 1e3 << "/"
+           << stage.second->max() / 1e3 << " us";
+      }
+      os << "\n" << name() << " tx queueing latency by id:\n";
+      tx_queue_.print_id_latency(os);
+      std::cout << os.str() << std::flush;
+    }
+    stats_written_ = tx.written;
+    stats_bytes_ = tx.bytes;
+    stats_wire_bits_ = tx.wire_bits;
+    stats_decoded_ = ser.frames;
+    stats_timer_.expires_at(stats_timer_.expiry() + config_.stats_period);
+    stats_timer_.async_wait(
+        [this](const asio::error_code &ec) { stats_print(ec); });
+  }
+
+  SerCanBridgeConfig config_;
+  asio::strand<asio::io_context::executor_type> strand_;
+  asio::serial_port ser_;
+  asio::posix::stream_descriptor can_;
+  asio::steady_timer stats_timer_;
+  // encoded frames wait here until the serial port is free
+  SerTxQueue<asio::serial_port> tx_queue_;
+  CanEchoFilter echo_filter_;
+  std::unique_ptr<CanBatchReader> can_reader_;
+  Ser2Can ser_decoder_;
+  uint8_t ser_buffer_[4096];
+  MetricCounter can_write_errors_;
+  std::chrono::steady_clock::time_point stats_last_;
+  uint64_t stats_activity_ = 0;
+  uint64_t stats_written_ = 0;
+  uint64_t stats_bytes_ = 0;
+  uint64_t stats_wire_bits_ = 0;
+  uint64_t stats_decoded_ = 0;
+  uint64_t dump_last_ns_ = 0;
+  uint64_t dump_written_ = 0;
+  uint64_t dump_bytes_ = 0;
+  uint64_t dump_decoded_ = 0;
+};
+
+}  // namespace ch343
+
+#endif  // CH343_SER_CAN_BRIDGE_HPP
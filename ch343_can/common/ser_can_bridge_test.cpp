@@ -0,0 +1,223 @@
+// SerCanBridge with a pty pair as the serial port and a socketpair in place
+// of the CAN interface. Classic and CAN FD frames written to the CAN side
+// have to come out of the pty master as can2ser / canfd2ser symbols in order;
+// the test sends them straight back like the transceiver does, and the echo
+// filter has to drop them. Foreign frames written to the master in random
+// chunks then have to show up on the CAN side, in order and nothing else.
+//
+// ser_can_bridge_test [frames]
+#include <linux/can.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <asio.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "can2ser.hpp"
+#include "ser2can.hpp"
+#include "ser_can_bridge.hpp"
+
+// a can_frame in canfd_frame unless fd
+struct Frame {
+  canfd_frame frame;
+  bool fd;
+};
+
+// every third one CAN FD, of any length and with BRS now and then
+static Frame make_frame(std::mt19937 &rng, canid_t can_id) {
+  Frame f{};
+  f.frame.can_id = can_id;
+  f.fd = rng() % 3 == 0;
+  if (f.fd) {
+    f.frame.flags = CANFD_FDF | (rng() & 1 ? CANFD_BRS : 0);
+    f.frame.len = rng() % (CANFD_MAX_DLEN + 1);
+  } else {
+    if (rng() % 8 == 0) {
+      f.frame.can_id |= CAN_RTR_FLAG;
+    }
+    f.frame.len = rng() % (CAN_MAX_DLEN + 1);
+  }
+  if (!(f.frame.can_id & CAN_RTR_FLAG)) {
+    for (int i = 0; i < f.frame.len; i++) {
+      f.frame.data[i] = (uint8_t)rng();
+    }
+  }
+  return f;
+}
+
+// as it comes back from the wire: padded to a valid length, BRS dominant
+static Frame wire(Frame f) {
+  if (f.fd) {
+    f.frame.len = ch343::canfd_dlc2len(ch343::canfd_len2dlc(f.frame.len));
+    f.frame.flags &= ~CANFD_BRS;
+  }
+  return f;
+}
+
+static std::size_t mtu(const Frame &f) { return f.fd ? CANFD_MTU : CAN_MTU; }
+
+static bool same(const Frame &got, const Frame &want) {
+  int len = (got.frame.can_id & CAN_RTR_FLAG) ? 0 : got.frame.len;
+  return got.fd == want.fd && got.frame.can_id == want.frame.can_id &&
+         got.frame.len == want.frame.len &&
+         got.frame.flags == want.frame.flags &&
+         std::memcmp(got.frame.data, want.frame.data, len) == 0;
+}
+
+static int mismatches(const std::vector<Frame> &got,
+                      const std::vector<Frame> &want, const char *what) {
+  int mismatch = 0;
+  for (std::size_t i = 0; i < got.size() && i < want.size(); i++) {
+    if (!same(got[i], wire(want[i])) && mismatch++ < 8) {
+      std::cerr << what << " frame " << i << ": got " << std::hex
+                << got[i].frame.can_id << " want " << want[i].frame.can_id
+                << std::dec << std::endl;
+    }
+  }
+  return mismatch;
+}
+
+int main(int argc, char *argv[]) {
+  int frames = argc > 1 ? std::atoi(argv[1]) : 200;
+  std::mt19937 rng(1);
+
+  int master;
+  int slave;
+  if (openpty(&master, &slave, nullptr, nullptr, nullptr) < 0) {
+    std::cerr << "openpty: " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  struct termios tio;
+  tcgetattr(master, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(master, TCSANOW, &tio);
+  int can[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, can) < 0) {
+    std::cerr << "socketpair: " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+
+  asio::io_context iocxt(1);
+  ch343::SerCanBridgeConfig config;
+  config.ser_name = ptsname(master);
+  config.can_name = "socketpair";
+  // CAN 100K: a pty takes no character size but 8
+  config.baud_rate = 1000000;
+  config.character_size = 8;
+  config.stats_period = std::chrono::seconds(0);
+  ch343::SerCanBridge bridge(iocxt, config);
+  if (!bridge.open(can[0])) {
+    return 1;
+  }
+  // the bridge has its own descriptor of the slave now
+  close(slave);
+  bridge.start();
+  std::thread worker([&iocxt]() { iocxt.run(); });
+
+  // CAN -> serial: increasing ids keep the arbitration order the send order
+  std::vector<Frame> sent;
+  for (int i = 0; i < frames; i++) {
+    sent.push_back(make_frame(rng, 0x100 + i));
+    if (write(can[1], &sent.back().frame, mtu(sent.back())) !=
+        (ssize_t)mtu(sent.back())) {
+      std::cerr << "write can: " << std::strerror(errno) << std::endl;
+      return 1;
+    }
+  }
+  ch343::Ser2Can decoder(config.character_size);
+  std::vector<Frame> on_serial;
+  uint8_t buf[4096];
+  while (on_serial.size() < sent.size()) {
+    struct pollfd pfd = {master, POLLIN, 0};
+    if (poll(&pfd, 1, 1000) <= 0) {
+      break;
+    }
+    ssize_t n = read(master, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    // the echo of the transceiver
+    if (write(master, buf, n) != n) {
+      break;
+    }
+    decoder.feed(buf, n, [&on_serial](const auto &frame) {
+      Frame f{};
+      std::memcpy(&f.frame, &frame, sizeof(frame));
+      f.fd = sizeof(frame) == CANFD_MTU;
+      on_serial.push_back(f);
+    });
+  }
+
+  // serial -> CAN: frames of another node, behind our echoes
+  std::vector<uint8_t> wire;
+  std::vector<Frame> foreign;
+  ch343::CanFdSerBuffer symbols;
+  for (int i = 0; i < frames; i++) {
+    canid_t can_id = rng() & 1 ? (rng() & CAN_EFF_MASK) | CAN_EFF_FLAG
+                               : rng() & CAN_SFF_MASK;
+    foreign.push_back(make_frame(rng, can_id));
+    const Frame &f = foreign.back();
+    can_frame classic;
+    std::memcpy(&classic, &f.frame, sizeof(classic));
+    std::size_t n = f.fd ? ch343::canfd2ser(f.frame, symbols)
+                         : ch343::can2ser(classic, symbols.data());
+    wire.insert(wire.end(), symbols.begin(), symbols.begin() + n);
+    wire.insert(wire.end(), ch343::can_trailer.begin(),
+                ch343::can_trailer.end());
+  }
+  for (std::size_t pos = 0; pos < wire.size();) {
+    std::size_t n =
+        std::min<std::size_t>(1 + rng() % 300, wire.size() - pos);
+    ssize_t written = write(master, wire.data() + pos, n);
+    if (written < 0 && errno != EINTR) {
+      break;
+    }
+    pos += written > 0 ? written : 0;
+  }
+  std::vector<Frame> on_can;
+  for (;;) {
+    // a moment longer than needed, anything beyond foreign is an echo
+    struct pollfd pfd = {can[1], POLLIN, 0};
+    if (poll(&pfd, 1, on_can.size() < foreign.size() ? 1000 : 100) <= 0) {
+      break;
+    }
+    Frame f{};
+    ssize_t n = read(can[1], &f.frame, sizeof(f.frame));
+    if (n != CAN_MTU && n != CANFD_MTU) {
+      break;
+    }
+    f.fd = n == CANFD_MTU;
+    on_can.push_back(f);
+  }
+
+  std::ostringstream metrics;
+  bridge.dump_json(metrics);
+  iocxt.stop();
+  worker.join();
+  close(master);
+  close(can[1]);
+
+  int mismatch = mismatches(on_serial, sent, "serial") +
+                 mismatches(on_can, foreign, "can");
+  std::cout << "bridge: " << on_serial.size() << "/" << sent.size()
+            << " frames on serial, " << on_can.size() << "/" << foreign.size()
+            << " on can, mismatch: " << mismatch << "\n"
+            << metrics.str() << std::endl;
+  bool ok = on_serial.size() == sent.size() &&
+            on_can.size() == foreign.size() && mismatch == 0 &&
+            decoder.stats().crc_errors == 0;
+  std::cout << (ok ? "ok" : "FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#ifndef CH343_SER_PACKER_HPP
+#define CH343_SER_PACKER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include "can2ser.hpp"
+
+// Several CAN bit times per UART character.
+//
+// A character is start bit (0), character_size data bits LSB first and the
+// stop bits (1), all at the serial baud rate. With ratio = baud / bitrate
+// UART bits per CAN bit and a character length that is a multiple of ratio,
+// one character carries (1 + character_size + stop_bits) / ratio CAN bits.
+// The start bit forces the first 1/ratio of the first CAN bit dominant and
+// the stop bits force the end of the last CAN bit recessive. Both only matter
+// before or after the CAN sample point:
+//   - the start bit glitch begins exactly at a bit boundary, so it is at most
+//     a resynchronisation edge with zero phase error
+//   - the sample point has to fall after the start bit and before the stop bit
+//
+// CAN 500K, Serial 4M, 6 data bits, 1 stop bit: ratio 8, 1 CAN bit per char,
+//           sample point 12.5% .. 87.5%
+// CAN 500K, Serial 2M, 6 data bits, 1 stop bit: ratio 4, 2 CAN bits per char,
+//           sample point 25% .. 75%
+// CAN 1M,   Serial 4M, 6 data bits, 1 stop bit: ratio 4, 2 CAN bits per char,
+//           sample point 25% .. 75%
+namespace ch343 {
+
+struct SerFraming {
+  uint32_t baud_rate;
+  uint32_t can_bitrate;
+  int character_size;  // 5 .. 8
+  int stop_bits;       // 1 or 2
+  double sample_point;  // of the CAN receivers, e.g. 0.75
+};
+
+class SerPacker {
+ public:
+  // ratio >= 2 to leave room for the start bit, 11 UART bits at most
+  static constexpr int MaxBitsPerSymbol = 5;
+
+  // true if the framing puts every CAN bit exactly on the wire, otherwise
+  // the reason is written to err
+  static bool check(const SerFraming &f, std::ostream &err) {
+    if (f.character_size < 5 || f.character_size > 8) {
+      err << "character_size " << f.character_size << " not in 5..8";
+      return false;
+    }
+    if (f.stop_bits != 1 && f.stop_bits != 2) {
+      err << "stop_bits " << f.stop_bits << " not 1 or 2";
+      return false;
+    }
+    if (f.can_bitrate == 0 || f.baud_rate % f.can_bitrate != 0) {
+      err << "baud " << f.baud_rate << " is not a multiple of CAN bitrate "
+          << f.can_bitrate << ", the bits would drift";
+      return false;
+    }
+    int ratio = f.baud_rate / f.can_bitrate;
+    int length = 1 + f.character_size + f.stop_bits;
+    if (length % ratio != 0) {
+      err << "character of " << length << " UART bits is not a whole number "
+          << "of CAN bits of " << ratio << " UART bits";
+      return false;
+    }
+    // sample point window in UART bits
+    double sample = f.sample_point * ratio;
+    if (sample <= 1.0) {
+      err << "sample point " << f.sample_point << " inside the start bit";
+      return false;
+    }
+    if (sample >= ratio - f.stop_bits) {
+      err << "sample point " << f.sample_point << " inside the stop bit";
+      return false;
+    }
+    return true;
+  }
+
+  // on-wire timing of the framing
+  static void report(const SerFraming &f, std::ostream &os) {
+    int ratio = f.baud_rate / f.can_bitrate;
+    int length = 1 + f.character_size + f.stop_bits;
+    os << "CAN " << f.can_bitrate << " bit/s, " << 1e9 / f.can_bitrate
+       << " ns/bit; serial " << f.baud_rate << " baud, " << ratio
+       << " UART bits per CAN bit, " << length / ratio
+       << " CAN bits per character; sample point window "
+       << 100.0 / ratio << "% .. "
+       << 100.0 * (ratio - f.stop_bits) / ratio << "%";
+  }
+
+  // check() must have passed
+  explicit SerPacker(const SerFraming &f)
+      : ratio_(f.baud_rate / f.can_bitrate),
+        bits_((1 + f.character_size + f.stop_bits) / ratio_) {
+    for (int pattern = 0; pattern < (1 << bits_); pattern++) {
+      uint8_t c = 0;
+      for (int i = 0; i < 8; i++) {
+        // data bit i is UART bit i + 1, bits past character_size repeat the
+        // last data bit so that a one bit per character table is 0x00/0xFF
+        int uart_bit = (i < f.character_size ? i : f.character_size - 1) + 1;
+        int can_bit = uart_bit / ratio_;
+        if (pattern >> can_bit & 0x01) {
+          c |= 1 << i;
+        }
+      }
+      table_[pattern] = c;
+    }
+  }
+
+  int bits_per_symbol() const { return bits_; }
+
+  // characters needed for n CAN bits
+  std::size_t symbols(std::size_t n) const { return (n + bits_ - 1) / bits_; }
+
+  // one Bit0/Bit1 symbol per CAN bit (can2ser output) -> UART characters,
+  // the last character is padded with recessive bits. out may alias in.
+  std::size_t pack(const uint8_t *in, std::size_t n, uint8_t *out) const {
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < n; i += bits_) {
+      int pattern = 0;
+      for (int j = 0; j < bits_; j++) {
+        bool bit = i + j < n ? in[i + j] != Bit0 : true;
+        pattern |= bit << j;
+      }
+      out[count++] = table_[pattern];
+    }
+    return count;
+  }
+
+ private:
+  int ratio_;
+  int bits_;
+  std::array<uint8_t, 1 << MaxBitsPerSymbol> table_;
+};
+
+}  // namespace ch343
+
+#endif  // CH343_SER_PACKER_HPP
@@ -0,0 +1,351 @@
+#ifndef CH343_SER_TX_QUEUE_HPP
+#define CH343_SER_TX_QUEUE_HPP
+
+#include <time.h>
+
+#include <algorithm>
+#include <asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "can2ser.hpp"
+#include "latency_histogram.hpp"
+#include "metric_counter.hpp"
+
+namespace ch343 {
+
+// CLOCK_REALTIME in ns, the clock the kernel uses for software rx timestamps
+inline uint64_t realtime_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// to - from, 0 if CLOCK_REALTIME stepped back in between
+inline uint64_t elapsed_ns(uint64_t from, uint64_t to) {
+  return to > from ? to - from : 0;
+}
+
+inline uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Arbitration order of a frame, lower wins on the bus. These are the bits
+// after SOF that take part in arbitration: id[10:0], RTR, IDE for a standard
+// frame and id[28:18], SRR, IDE, id[17:0], RTR for an extended one, MSB
+// first, so a standard data frame beats a remote frame with the same id and
+// both beat an extended frame with the same base id. The next bit, r0/r1
+// dominant or FDF recessive, lets a classic data frame win over a CAN FD
+// frame (RRS, always dominant, in place of RTR) with the same id.
+inline uint64_t can_arbitration_key(canid_t can_id, bool fd = false) {
+  uint64_t rtr = !fd && (can_id & CAN_RTR_FLAG) ? 1 : 0;
+  uint64_t key;
+  if (can_id & CAN_EFF_FLAG) {
+    uint64_t id = can_id & CAN_EFF_MASK;
+    key = (id >> 18) << 21 | 1u << 20 | 1u << 19 | (id & 0x3FFFF) << 1 | rtr;
+  } else {
+    key = (uint64_t)(can_id & CAN_SFF_MASK) << 21 | rtr << 20;
+  }
+  return key << 1 | fd;
+}
+
+// Counters are single writer (the queue's strand) and may be read from any
+// thread.
+struct SerTxStats {
+  MetricCounter frames;     // frames accepted into the queue
+  MetricCounter drops;      // frames dropped because the queue was full
+  MetricCounter writes;     // gather writes completed
+  MetricCounter written;    // frames written to the serial port
+  MetricCounter bytes;      // serial bytes written
+  MetricCounter errors;     // write errors
+  MetricCounter paced;      // writes held back until the line drained
+  MetricCounter wire_bits;  // CAN bit times written, trailer included
+  MetricCounter depth;      // frames currently queued, including in flight
+  MetricCounter max_depth;  // high water mark of depth
+
+  // average frames per write
+  double coalescing() const {
+    uint64_t n = writes;
+    return n ? (double)written / n : 0.0;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &os, const SerTxStats &s) {
+  return os << "frames " << s.frames << ", drops " << s.drops << ", writes "
+            << s.writes << ", coalescing " << s.coalescing() << ", paced "
+            << s.paced << ", depth " << s.depth << ", max_depth "
+            << s.max_depth << ", bytes " << s.bytes << ", errors "
+            << s.errors;
+}
+
+// Where a frame spends its time between the CAN socket and the serial port,
+// all CLOCK_REALTIME so that the kernel rx timestamp can be compared.
+struct SerTxLatency {
+  LatencyHistogram socket;  // kernel rx timestamp -> push
+  LatencyHistogram encode;  // push -> encoded
+  LatencyHistogram queue;   // encoded -> handed to the serial port
+  LatencyHistogram write;   // handed to the serial port -> write complete
+  LatencyHistogram total;   // kernel rx timestamp -> write complete
+};
+
+// Outbound scheduler in front of a serial port. Encoded frames wait in a
+// preallocated priority queue ordered like CAN arbitration (lowest key first,
+// arrival order among equal keys), so a burst of low priority traffic cannot
+// hold back a high priority frame for longer than a real bus would.
+//
+// Writes are paced to the CAN bitrate: the exact stuffed length of every
+// frame plus the trailer gives its wire time, and new frames are only handed
+// to the serial driver while less than lead_bits of wire time is still
+// pending there. Everything beyond that stays in the priority queue where a
+// later, more urgent frame can overtake it, instead of in the FIFO of the
+// driver and the CH343. At most one write is outstanding; it carries every
+// frame that fits in the lead, each followed by the shared can_trailer.
+// Not thread safe, use it from one io_context thread (or strand).
+template <typename AsyncWriteStream>
+class SerTxQueue {
+ public:
+  // two frames of the longest kind in flight keep the line busy between
+  // writes without giving away the order of more than that
+  static constexpr std::size_t DefaultLeadBits =
+      2 * (CanMaxSymbols + CanTrailerBits);
+  // ids with their own latency histogram, the rest share one under
+  // CAN_ERR_FLAG
+  static constexpr std::size_t MaxLatencyIds = 1024;
+
+  // the frame is a can_frame in a canfd_frame when !fd
+  using WriteHandler = std::function<void(const canfd_frame &, bool fd)>;
+  using IdLatency = std::map<canid_t, LatencyHistogram>;
+
+  SerTxQueue(AsyncWriteStream &stream, std::size_t capacity,
+             uint32_t can_bitrate, std::size_t lead_bits = DefaultLeadBits)
+      : stream_(stream),
+        timer_(stream.get_executor()),
+        bit_ns_(1e9 / can_bitrate),
+        lead_ns_((uint64_t)(lead_bits * 1e9 / can_bitrate)),
+        slots_(capacity),
+        frames_(capacity),
+        fd_(capacity),
+        sizes_(capacity),
+        stamps_(capacity),
+        encoded_ns_(capacity),
+        sent_ns_(capacity) {
+    heap_.reserve(capacity);
+    free_.reserve(capacity);
+    for (std::size_t i = 0; i < capacity; i++) {
+      free_.push_back(capacity - 1 - i);
+    }
+    in_flight_.reserve(capacity);
+    gather_.reserve(2 * capacity);
+  }
+
+  // handler is called for every frame as it is handed to the serial port,
+  // i.e. in wire order
+  void on_write(WriteHandler handler) { write_handler_ = std::move(handler); }
+
+  // encode and queue one frame, false if the queue is full and it was
+  // dropped. rx_ns is the CLOCK_REALTIME receive timestamp of the frame, 0
+  // if unknown.
+  bool push(const can_frame &frame, uint64_t rx_ns = 0) {
+    return enqueue(frame.can_id, false, rx_ns, [this, &frame](std::size_t slot) {
+      std::memcpy(&frames_[slot], &frame, sizeof(frame));
+      return can2ser(frame, slots_[slot].data());
+    });
+  }
+
+  // CAN FD frame, sent at the nominal bitrate
+  bool push(const canfd_frame &frame, uint64_t rx_ns = 0) {
+    return enqueue(frame.can_id, true, rx_ns, [this, &frame](std::size_t slot) {
+      frames_[slot] = frame;
+      return canfd2ser(frame, slots_[slot]);
+    });
+  }
+
+  const SerTxStats &stats() const { return stats_; }
+  const SerTxLatency &latency() const { return latency_; }
+  std::size_t capacity() const { return slots_.size(); }
+
+  // encoded -> handed to the serial port, per can_id. Unlike stats() and
+  // latency() only for the queue's own strand.
+  const IdLatency &id_latency() const { return id_latency_; }
+
+  void print_id_latency(std::ostream &os) const {
+    for (const auto &it : id_latency_) {
+      const LatencyHistogram &h = it.second;
+      if (it.first == CAN_ERR_FLAG) {
+        os << "  other";
+      } else {
+        bool eff = it.first & CAN_EFF_FLAG;
+        os << "  " << std::hex << std::uppercase << std::setfill('0')
+           << std::setw(eff ? 8 : 3)
+           << (it.first & (eff ? CAN_EFF_MASK : CAN_SFF_MASK)) << std::dec
+           << std::nouppercase << std::setfill(' ')
+           << ((it.first & CAN_RTR_FLAG) ? " R" : "");
+      }
+      os << ": count " << h.count() << ", p50 " << h.percentile(0.5) / 1e3
+         << " us, p99 " << h.percentile(0.99) / 1e3 << " us, p99.9 "
+         << h.percentile(0.999) / 1e3 << " us, max " << h.max() / 1e3
+         << " us\n";
+    }
+  }
+
+ private:
+  struct Entry {
+    uint64_t key;
+    uint64_t seq;
+    std::size_t slot;
+
+    bool operator>(const Entry &other) const {
+      return key != other.key ? key > other.key : seq > other.seq;
+    }
+  };
+
+  // encode(slot) fills frames_[slot] and slots_[slot], returns the symbols
+  template <typename Encode>
+  bool enqueue(canid_t can_id, bool fd, uint64_t rx_ns, Encode &&encode) {
+    if (free_.empty()) {
+      stats_.drops++;
+      return false;
+    }
+    uint64_t push_ns = realtime_ns();
+    if (rx_ns != 0 && push_ns > rx_ns) {
+      latency_.socket.record(push_ns - rx_ns);
+    }
+    std::size_t slot = free_.back();
+    free_.pop_back();
+    sizes_[slot] = encode(slot);
+    fd_[slot] = fd;
+    stamps_[slot] = rx_ns;
+    encoded_ns_[slot] = realtime_ns();
+    latency_.encode.record(elapsed_ns(push_ns, encoded_ns_[slot]));
+    heap_.push_back({can_arbitration_key(can_id, fd), seq_++, slot});
+    std::push_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+    stats_.frames++;
+    update_depth();
+    start_write();
+    return true;
+  }
+
+  void update_depth() {
+    stats_.depth = heap_.size() + in_flight_.size();
+    stats_.max_depth.max(stats_.depth);
+  }
+
+  // CAN bit times of a stuffed frame and its trailer
+  std::size_t wire_bits(std::size_t slot) const {
+    return sizes_[slot] + CanTrailerBits;
+  }
+
+  void record_latency(canid_t can_id, uint64_t ns) {
+    canid_t id = can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_EFF_MASK);
+    auto it = id_latency_.find(id);
+    if (it == id_latency_.end()) {
+      if (id_latency_.size() >= MaxLatencyIds) {
+        id = CAN_ERR_FLAG;
+      }
+      it = id_latency_.try_emplace(id).first;
+    }
+    it->second.record(ns);
+  }
+
+  void start_write() {
+    if (!in_flight_.empty() || heap_.empty() || timer_armed_) {
+      return;
+    }
+    uint64_t now = monotonic_ns();
+    uint64_t sent_ns = realtime_ns();
+    uint64_t backlog = drain_ns_ > now ? drain_ns_ - now : 0;
+    if (backlog >= lead_ns_) {
+      // the driver still holds enough, decide later
+      stats_.paced++;
+      timer_armed_ = true;
+      timer_.expires_after(std::chrono::nanoseconds(backlog - lead_ns_));
+      timer_.async_wait([this](const asio::error_code &ec) {
+        timer_armed_ = false;
+        if (ec) {
+          std::cerr << "Timer error: " << ec.message() << std::endl;
+          return;
+        }
+        start_write();
+      });
+      return;
+    }
+    gather_.clear();
+    while (!heap_.empty() && (in_flight_.empty() || backlog < lead_ns_)) {
+      std::pop_heap(heap_.begin(), heap_.end(), std::greater<Entry>());
+      std::size_t slot = heap_.back().slot;
+      heap_.pop_back();
+      in_flight_.push_back(slot);
+      gather_.push_back(asio::buffer(slots_[slot], sizes_[slot]));
+      gather_.push_back(asio::buffer(can_trailer));
+      backlog += (uint64_t)(wire_bits(slot) * bit_ns_);
+      stats_.wire_bits += wire_bits(slot);
+      sent_ns_[slot] = sent_ns;
+      uint64_t queued = elapsed_ns(encoded_ns_[slot], sent_ns);
+      latency_.queue.record(queued);
+      record_latency(frames_[slot].can_id, queued);
+      if (write_handler_) {
+        write_handler_(frames_[slot], fd_[slot]);
+      }
+    }
+    drain_ns_ = now + backlog;
+    asio::async_write(
+        stream_, gather_,
+        [this](const asio::error_code &ec, std::size_t bytes_transferred) {
+          if (ec) {
+            stats_.errors++;
+            std::cerr << "Write error: " << ec.message() << std::endl;
+          }
+          uint64_t now = realtime_ns();
+          for (std::size_t slot : in_flight_) {
+            latency_.write.record(elapsed_ns(sent_ns_[slot], now));
+            uint64_t rx_ns = stamps_[slot];
+            if (rx_ns != 0 && now > rx_ns) {
+              latency_.total.record(now - rx_ns);
+            }
+            free_.push_back(slot);
+          }
+          stats_.writes++;
+          stats_.written += in_flight_.size();
+          stats_.bytes += bytes_transferred;
+          in_flight_.clear();
+          update_depth();
+          start_write();
+        });
+  }
+
+  AsyncWriteStream &stream_;
+  asio::steady_timer timer_;
+  bool timer_armed_ = false;
+  double bit_ns_;
+  uint64_t lead_ns_;
+  uint64_t drain_ns_ = 0;  // CLOCK_MONOTONIC when the written frames are out
+  std::vector<CanFdSerBuffer> slots_;
+  std::vector<canfd_frame> frames_;  // a can_frame when !fd_
+  std::vector<uint8_t> fd_;
+  std::vector<std::size_t> sizes_;
+  std::vector<uint64_t> stamps_;      // kernel rx timestamp
+  std::vector<uint64_t> encoded_ns_;  // can2ser done
+  std::vector<uint64_t> sent_ns_;     // handed to the serial port
+  std::vector<Entry> heap_;            // queued slots, min heap on Entry
+  std::vector<std::size_t> free_;      // unused slots
+  std::vector<std::size_t> in_flight_;  // slots owned by the outstanding write
+  std::vector<asio::const_buffer> gather_;
+  uint64_t seq_ = 0;
+  WriteHandler write_handler_;
+  IdLatency id_latency_;
+  SerTxStats stats_;
+  SerTxLatency latency_;
+};
+
+}  // namespace ch343
+
+#endif  // CH343_SER_TX_QUEUE_HPP
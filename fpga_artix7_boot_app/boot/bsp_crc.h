@@ -3,7 +3,19 @@
 
 #include <stdint.h>
 
+// bytes bsp_crc32 takes per step: 8 (slice-by-8, 8 KiB of tables), 4
+// (4 KiB) or 1 (the 1 KiB table only) for RAM limited builds
+#ifndef BSP_CRC_SLICES
+#define BSP_CRC_SLICES 8
+#endif
+
+#if BSP_CRC_SLICES != 1 && BSP_CRC_SLICES != 4 && BSP_CRC_SLICES != 8
+#error "BSP_CRC_SLICES must be 1, 4 or 8"
+#endif
+
+// zlib.crc32 compatible, crc_init is the crc of the data before
 uint32_t bsp_crc32(const uint8_t *data, uint32_t len, uint32_t crc_init);
+// crc of A followed by B from crc1 of A, crc2 of B and the length of B
+uint32_t bsp_crc32_combine(uint32_t crc1, uint32_t crc2, uint32_t len2);
 
 #endif // BSP_CRC_H
-
@@ -0,0 +1,76 @@
+#include "bsp_lz.h"
+
+#include <string.h>
+
+#define LZ_MASK (BSP_LZ_WINDOW - 1)
+
+enum {
+  LZ_TOKEN = 0,
+  LZ_LITERAL,
+  LZ_MATCH_LO,
+  LZ_MATCH_HI,
+  LZ_MATCH_EXT,
+  LZ_COPY,
+};
+
+void bsp_lz_init(bsp_lz_t *lz) { memset(lz, 0, sizeof(*lz)); }
+
+int bsp_lz_decode(bsp_lz_t *lz, const uint8_t *in, uint32_t in_len,
+                  uint32_t *in_used, uint8_t *out, uint32_t out_len) {
+  uint32_t i = 0;
+  uint32_t o = 0;
+  int ret = 0;
+  while (o < out_len) {
+    if (lz->state == LZ_COPY) {
+      while (lz->len > 0 && o < out_len) {
+        uint8_t c = lz->window[(lz->pos - lz->dist) & LZ_MASK];
+        lz->window[lz->pos++ & LZ_MASK] = c;
+        out[o++] = c;
+        lz->len--;
+      }
+      if (lz->len == 0) {
+        lz->state = LZ_TOKEN;
+      }
+      continue;
+    }
+    if (lz->state == LZ_TOKEN && lz->bits > 0) {
+      lz->state = lz->flags & 1 ? LZ_LITERAL : LZ_MATCH_LO;
+      lz->flags >>= 1;
+      lz->bits--;
+    }
+    if (i == in_len) {
+      break;
+    }
+    uint8_t c = in[i++];
+    switch (lz->state) {
+      case LZ_TOKEN:
+        lz->flags = c;
+        lz->bits = 8;
+        break;
+      case LZ_LITERAL:
+        lz->window[lz->pos++ & LZ_MASK] = c;
+        out[o++] = c;
+        lz->state = LZ_TOKEN;
+        break;
+      case LZ_MATCH_LO:
+        lz->dist = c;
+        lz->state = LZ_MATCH_HI;
+        break;
+      case LZ_MATCH_HI:
+        lz->dist = (lz->dist | (c & 0x0F) << 8) + 1;
+        lz->len = (c >> 4) + 3;
+        lz->state = (c >> 4) == 15 ? LZ_MATCH_EXT : LZ_COPY;
+        break;
+      case LZ_MATCH_EXT:
+        lz->len = 18 + c;
+        lz->state = LZ_COPY;
+        break;
+    }
+    if (lz->state == LZ_COPY && lz->dist > lz->pos) {
+      ret = BSP_LZ_ERROR;
+      break;
+    }
+  }
+  *in_used = i;
+  return ret < 0 ? ret : (int)o;
+}
@@ -0,0 +1,34 @@
+#ifndef BSP_LZ_H
+#define BSP_LZ_H
+
+#include <stdint.h>
+
+// LZSS decoder for images compressed by uptool.py lz_compress(). Streaming:
+// input and output can be split anywhere, the state carries over between
+// calls. No allocation, the history window is the only buffer.
+//
+// stream: groups of a flag byte and 8 tokens, flag bits LSB first
+//   1  literal, 1 byte
+//   0  match, 2 bytes b0 b1: distance (b0 | (b1 & 0x0F) << 8) + 1,
+//      length (b1 >> 4) + 3; b1 >> 4 == 15 adds a byte e, length 18 + e
+
+#define BSP_LZ_WINDOW 4096  // 12 bit distance
+#define BSP_LZ_ERROR (-1)   // match before the start of the output
+
+typedef struct {
+  uint8_t window[BSP_LZ_WINDOW];
+  uint32_t pos;  // bytes decoded
+  uint32_t dist;
+  uint32_t len;  // of the match being copied
+  uint8_t state;
+  uint8_t flags;
+  uint8_t bits;  // flag bits left
+} bsp_lz_t;
+
+void bsp_lz_init(bsp_lz_t *lz);
+// decodes from in until it is used up or out_len bytes are written; returns
+// the bytes written or BSP_LZ_ERROR, *in_used the input bytes consumed
+int bsp_lz_decode(bsp_lz_t *lz, const uint8_t *in, uint32_t in_len,
+                  uint32_t *in_used, uint8_t *out, uint32_t out_len);
+
+#endif  // BSP_LZ_H
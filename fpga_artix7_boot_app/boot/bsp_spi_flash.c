@@ -1,6 +1,9 @@
 #include "bsp_spi_flash.h"
 
+#include <stddef.h>
+
 #include "bsp_spi.h"
+#include "xparameters.h"
 
 // C:\Xilinx\Vitis\2023.2\data\embeddedsw\XilinxProcessorIPLib\drivers\spi_v4_11\examples\xspi_numonyx_flash_quad_example.c
 
@@ -14,6 +17,8 @@
 #define COMMAND_QUAD_IO_READ 0xEB   /* Quad IO Fast Read */
 #define COMMAND_WRITE_ENABLE 0x06   /* Write Enable command */
 #define COMMAND_SECTOR_ERASE 0xD8   /* Sector Erase command */
+#define COMMAND_HALF_SECTOR_ERASE 0x52  /* 32KB Subsector Erase command */
+#define COMMAND_SUBSECTOR_ERASE 0x20    /* 4KB Subsector Erase command */
 #define COMMAND_BULK_ERASE 0xC7     /* Bulk Erase command */
 #define COMMAND_STATUSREG_READ 0x05 /* Status read command */
 
@@ -31,6 +36,20 @@
 #define DUAL_IO_READ_DUMMY_BYTES 2
 #define QUAD_IO_READ_DUMMY_BYTES 5
 
+// burst reads use the fast read matching the data lines the AXI Quad SPI
+// core is built for (C_SPI_MODE 0 standard, 1 dual, 2 quad)
+#if defined(XPAR_XSPI_0_SPI_MODE) && XPAR_XSPI_0_SPI_MODE == 2
+#define BURST_READ_COMMAND COMMAND_QUAD_READ
+#define BURST_READ_DUMMY_BYTES QUAD_READ_DUMMY_BYTES
+#elif defined(XPAR_XSPI_0_SPI_MODE) && XPAR_XSPI_0_SPI_MODE == 1
+#define BURST_READ_COMMAND COMMAND_DUAL_READ
+#define BURST_READ_DUMMY_BYTES DUAL_READ_DUMMY_BYTES
+#else
+#define BURST_READ_COMMAND COMMAND_RANDOM_READ
+#define BURST_READ_DUMMY_BYTES 0
+#endif
+#define BURST_READ_HEADER_BYTES (FLASH_RW_EXTRA_BYTES + BURST_READ_DUMMY_BYTES)
+
 volatile static bool TransferInProgress;
 static int ErrorCount;
 
@@ -41,7 +60,8 @@ enum {
   SPI_FLASH_ERASING = 4,
   SPI_FLASH_WRITING = 8,
   SPI_FLASH_READING = 16,
-  SPI_FLASH_ERROR = 32
+  SPI_FLASH_ERROR = 32,
+  SPI_FLASH_POLLING = 128
 };
 
 typedef union {
@@ -53,6 +73,7 @@ typedef union {
     uint32_t reading : 1;
     uint32_t busy : 1;
     uint32_t error : 1;
+    uint32_t polling : 1;  // program/erase issued, waiting for WIP to clear
   };
   uint32_t value;
 } spi_flash_status_t;
@@ -64,6 +85,8 @@ typedef struct {
   uint32_t byte_count;
   uint8_t *rx_buf;
   uint8_t *tx_buf;
+  bool status_read;  // a status register read is in flight
+  uint8_t *burst;    // buffer of a burst read not issued yet
 } spi_flash_t;
 
 static spi_flash_t spi_flash;
@@ -116,23 +139,47 @@ int bsp_spi_flash_status_reset(void) {
   return 0;
 }
 
+// erases addr .. addr + len widened to 4K boundaries
 int bsp_spi_flash_erase(uint32_t addr, uint32_t len) {
   if (spi_flash.status.value != SPI_FLASH_READY) {
     return -1;
   }
+  uint32_t end = (addr + len + SUBSECTOR_SIZE - 1) & ~(SUBSECTOR_SIZE - 1);
+  addr &= ~(SUBSECTOR_SIZE - 1);
+  if (end <= addr) {
+    return 0;
+  }
   spi_flash.status.value = SPI_FLASH_WRITE_ENABLING | SPI_FLASH_ERASING;
   spi_flash.addr = addr;
-  spi_flash.byte_count = len;
+  spi_flash.byte_count = end - addr;
   return 0;
 }
 
+// the largest erase that starts at addr and ends within len bytes. Typical
+// times are 150 ms for 64K, 100 ms for 32K and 50 ms for 4K, a bigger block
+// is always faster than the smaller ones it covers, so taking the largest
+// aligned one each step gives the fewest and fastest erases for the range
+static uint8_t erase_command(uint32_t addr, uint32_t len, uint32_t *size) {
+  if (addr % SECTOR_SIZE == 0 && len >= SECTOR_SIZE) {
+    *size = SECTOR_SIZE;
+    return COMMAND_SECTOR_ERASE;
+  }
+  if (addr % HALF_SECTOR_SIZE == 0 && len >= HALF_SECTOR_SIZE) {
+    *size = HALF_SECTOR_SIZE;
+    return COMMAND_HALF_SECTOR_ERASE;
+  }
+  *size = SUBSECTOR_SIZE;
+  return COMMAND_SUBSECTOR_ERASE;
+}
+
 int bsp_spi_flash_write(uint32_t addr, uint8_t *data, uint32_t len) {
   if (spi_flash.status.value != SPI_FLASH_READY) {
     return -1;
   }
   spi_flash.status.value = SPI_FLASH_WRITE_ENABLING | SPI_FLASH_WRITING;
   spi_flash.addr = addr;
-  spi_flash.byte_count = len;
+  // one page per call, that is all tx_buf holds
+  spi_flash.byte_count = len < PAGE_SIZE ? len : PAGE_SIZE;
   // if data addr is not spi_flash.tx_buf addr + FLASH_RW_EXTRA_BYTES, copy data
   if (data != spi_flash.tx_buf + FLASH_RW_EXTRA_BYTES) {
     for (int i = 0; i < PAGE_SIZE; i++) {
@@ -152,7 +199,45 @@ int bsp_spi_flash_read(uint32_t addr, uint32_t len) {
   return 0;
 }
 
+int bsp_spi_flash_read_burst(uint32_t addr, uint8_t *buf, uint32_t len) {
+  if (spi_flash.status.value != SPI_FLASH_READY) {
+    return -1;
+  }
+  spi_flash.status.value = SPI_FLASH_READING;
+  spi_flash.addr = addr;
+  spi_flash.byte_count = len;
+  spi_flash.burst = buf;
+  return 0;
+}
+
+// the flash ignores commands while a program or erase is in progress, read
+// the status register until WIP clears before the next one
+static int flash_poll(void) {
+  if (spi_flash.status_read &&
+      !(spi_flash.rx_buf[1] & FLASH_SR_IS_READY_MASK)) {
+    spi_flash.status_read = false;
+    spi_flash.status.polling = 0;
+    // the write enable latch is cleared after every program/erase
+    if (spi_flash.status.erasing || spi_flash.status.writing) {
+      spi_flash.status.write_enabling = 1;
+    }
+    return 0;
+  }
+  spi_flash.tx_buf[0] = COMMAND_STATUSREG_READ;
+  spi_flash.tx_buf[1] = 0xFF;
+  spi_flash.status_read = true;
+  TransferInProgress = true;
+  int Status = bsp_spi_transfer(spi_flash.id, spi_flash.tx_buf,
+                                spi_flash.rx_buf, STATUS_READ_BYTES);
+  spi_flash.status.ready = 0;
+  return Status != 0 ? -1 : 0;
+}
+
 int bsp_spi_flash_process(void) {
+  if (spi_flash.status.ready && spi_flash.status.polling) {
+    return flash_poll();
+  }
+
   if (spi_flash.status.write_enabling) {
     spi_flash.tx_buf[0] = COMMAND_WRITE_ENABLE;
     TransferInProgress = true;
@@ -167,22 +252,21 @@ int bsp_spi_flash_process(void) {
   }
 
   if (spi_flash.status.ready && spi_flash.status.erasing) {
-    int sector_number = spi_flash.byte_count % SECTOR_SIZE == 0
-                            ? spi_flash.byte_count / SECTOR_SIZE
-                            : spi_flash.byte_count / SECTOR_SIZE + 1;
-    if (sector_number > 0) {
-      spi_flash.tx_buf[0] = COMMAND_SECTOR_ERASE;
+    if (spi_flash.byte_count > 0) {
+      uint32_t size;
+      spi_flash.tx_buf[0] =
+          erase_command(spi_flash.addr, spi_flash.byte_count, &size);
       spi_flash.tx_buf[1] = (spi_flash.addr >> 16) & 0xFF;
       spi_flash.tx_buf[2] = (spi_flash.addr >> 8) & 0xFF;
       spi_flash.tx_buf[3] = spi_flash.addr & 0xFF;
       TransferInProgress = true;
       int Status = bsp_spi_transfer(spi_flash.id, spi_flash.tx_buf,
                                     spi_flash.rx_buf, SECTOR_ERASE_BYTES);
-      spi_flash.addr += SECTOR_SIZE;
-      spi_flash.byte_count = spi_flash.byte_count > SECTOR_SIZE
-                                 ? spi_flash.byte_count - SECTOR_SIZE
-                                 : 0;
+      spi_flash.addr += size;
+      spi_flash.byte_count =
+          spi_flash.byte_count > size ? spi_flash.byte_count - size : 0;
       spi_flash.status.erasing = spi_flash.byte_count > 0;
+      spi_flash.status.polling = 1;
       spi_flash.status.ready = 0;
       if (Status != 0) {
         return -1;
@@ -209,6 +293,7 @@ int bsp_spi_flash_process(void) {
                                  ? spi_flash.byte_count - PAGE_SIZE
                                  : 0;
       spi_flash.status.writing = spi_flash.byte_count > 0;
+      spi_flash.status.polling = 1;
       spi_flash.status.ready = 0;
       if (Status != 0) {
         return -1;
@@ -217,6 +302,28 @@ int bsp_spi_flash_process(void) {
     }
   }
 
+  if (spi_flash.status.reading && spi_flash.burst != NULL) {
+    // in place, the command goes out of the bytes the data lands behind
+    uint8_t *buf =
+        spi_flash.burst + FLASH_BURST_EXTRA_BYTES - BURST_READ_HEADER_BYTES;
+    buf[0] = BURST_READ_COMMAND;
+    buf[1] = (spi_flash.addr >> 16) & 0xFF;
+    buf[2] = (spi_flash.addr >> 8) & 0xFF;
+    buf[3] = spi_flash.addr & 0xFF;
+    TransferInProgress = true;
+    int Status =
+        bsp_spi_transfer(spi_flash.id, buf, buf,
+                         BURST_READ_HEADER_BYTES + spi_flash.byte_count);
+    spi_flash.burst = NULL;
+    spi_flash.byte_count = 0;
+    spi_flash.status.reading = 0;
+    spi_flash.status.ready = 0;
+    if (Status != 0) {
+      return -1;
+    }
+    return 0;
+  }
+
   if (spi_flash.status.reading) {
     int page_number = spi_flash.byte_count % PAGE_SIZE == 0
                           ? spi_flash.byte_count / PAGE_SIZE
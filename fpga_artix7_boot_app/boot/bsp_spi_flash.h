@@ -11,11 +11,20 @@
 #define FLASH_RW_EXTRA_BYTES 4 /* Read/Write extra bytes */
 #define PAGE_SIZE 256
 #define SECTOR_SIZE 65536
+#define HALF_SECTOR_SIZE 32768
+#define SUBSECTOR_SIZE 4096  // smallest erase
+// command, address and dummy bytes in front of the data of a burst read,
+// enough for every read mode
+#define FLASH_BURST_EXTRA_BYTES 8
 
 int bsp_spi_flash_init(spi_id_t id, uint8_t *rx_buf, uint8_t *tx_buf);
+// 64K, 32K and 4K erases, the fewest that cover the range
 int bsp_spi_flash_erase(uint32_t addr, uint32_t len);
 int bsp_spi_flash_write(uint32_t addr, uint8_t *data, uint32_t len);
 int bsp_spi_flash_read(uint32_t addr, uint32_t len);
+// len bytes in one transfer to buf + FLASH_BURST_EXTRA_BYTES, the bytes in
+// front are overwritten
+int bsp_spi_flash_read_burst(uint32_t addr, uint8_t *buf, uint32_t len);
 int bsp_spi_flash_process(void);
 
 bool bsp_spi_flash_is_busy(void);
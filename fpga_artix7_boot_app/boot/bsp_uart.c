@@ -4,12 +4,31 @@
 
 #include "xil_exception.h"
 #include "xinterrupt_wrap.h"
+#if BSP_UART_16550
+#include "xuartns550.h"
+#else
 #include "xuartlite.h"
+#endif
+
+// the core specific parts are the instance, init, send / receive and the
+// baud rate; reads, writes and the callbacks work the same on both
+#if BSP_UART_16550
+typedef XUartNs550 uart_core_t;
+#define UART_SEND XUartNs550_Send
+#define UART_RECV XUartNs550_Recv
+#else
+typedef XUartLite uart_core_t;
+#define UART_SEND XUartLite_Send
+#define UART_RECV XUartLite_Recv
+#endif
 
 typedef struct {
-  XUartLite instance;
+  uart_core_t instance;  // first, the isr gets it as the uart_t
   bool running;
+  uint32_t baud;
+  uint32_t clock_hz;  // 16550 input clock, the divisor is derived from it
   uint8_t *rx_buf;
+  uint8_t *rx_ptr;  // rx_buf or the buffer of bsp_uart_read_to
   uint8_t *tx_buf;
   int rx_size;
   int tx_size;
@@ -36,6 +55,45 @@ int bsp_uart_register_rx_callback(uart_id_t id, uart_callback_t callback) {
   return -2;
 }
 
+#if BSP_UART_16550
+// a receive timeout only reports the bytes so far, the receive goes on
+static void uart_isr_handler(void *CallBackRef, u32 Event,
+                             unsigned int EventData) {
+  uart_t *u = (uart_t *)CallBackRef;
+  if (Event == XUN_EVENT_RECV_DATA) {
+    u->rx_count = EventData;
+  } else if (Event == XUN_EVENT_SENT_DATA) {
+    u->tx_count = EventData;
+  }
+}
+
+static int uart_core_init(uart_t *u, uint32_t base_addr) {
+  XUartNs550_Config *cfg = XUartNs550_LookupConfig(base_addr);
+  if (cfg == NULL) {
+    return -2;
+  }
+  int status = XUartNs550_Initialize(&u->instance, base_addr);
+  if (status != XST_SUCCESS) {
+    return -3;
+  }
+  status = XSetupInterruptSystem(
+      &u->instance, (XInterruptHandler)XUartNs550_InterruptHandler,
+      cfg->IntrId, cfg->IntrParent, XINTERRUPT_DEFAULT_PRIORITY);
+  if (status != XST_SUCCESS) {
+    return -4;
+  }
+  // the divisor survives a jump to the bootloader, set it every time
+  u->clock_hz = cfg->InputClockHz;
+  if (XUartNs550_SetBaudRate(&u->instance, BSP_UART_BAUD) != XST_SUCCESS) {
+    return -5;
+  }
+  u->baud = BSP_UART_BAUD;
+  XUartNs550_SetHandler(&u->instance, uart_isr_handler, &u->instance);
+  XUartNs550_SetOptions(&u->instance,
+                        XUN_OPTION_DATA_INTR | XUN_OPTION_FIFOS_ENABLE);
+  return 0;
+}
+#else
 static void uart_rx_isr_handler(void *CallBackRef, unsigned int EventData) {
   uart_t *u = (uart_t *)CallBackRef;
   u->rx_count = EventData;
@@ -46,16 +104,7 @@ static void uart_tx_isr_handler(void *CallBackRef, unsigned int EventData) {
   u->tx_count = EventData;
 }
 
-int bsp_uart_init(uart_id_t id, uint32_t base_addr, uint8_t *rx_buf,
-                  uint32_t rx_size, uint8_t *tx_buf, uint32_t tx_size) {
-  if (id >= BSP_UARTNUM) {
-    return -1;
-  }
-  uart_t *u = &uart[id];
-  u->rx_buf = rx_buf;
-  u->tx_buf = tx_buf;
-  u->rx_size = rx_size;
-  u->tx_size = tx_size;
+static int uart_core_init(uart_t *u, uint32_t base_addr) {
   XUartLite_Config *cfg = XUartLite_LookupConfig(base_addr);
   if (cfg == NULL) {
     return -2;
@@ -70,9 +119,29 @@ int bsp_uart_init(uart_id_t id, uint32_t base_addr, uint8_t *rx_buf,
   if (status != XST_SUCCESS) {
     return -4;
   }
+  u->baud = cfg->BaudRate;
   XUartLite_SetRecvHandler(&u->instance, uart_rx_isr_handler, &u->instance);
   XUartLite_SetSendHandler(&u->instance, uart_tx_isr_handler, &u->instance);
   XUartLite_EnableInterrupt(&u->instance);
+  return 0;
+}
+#endif
+
+int bsp_uart_init(uart_id_t id, uint32_t base_addr, uint8_t *rx_buf,
+                  uint32_t rx_size, uint8_t *tx_buf, uint32_t tx_size) {
+  if (id >= BSP_UARTNUM) {
+    return -1;
+  }
+  uart_t *u = &uart[id];
+  u->rx_buf = rx_buf;
+  u->rx_ptr = rx_buf;
+  u->tx_buf = tx_buf;
+  u->rx_size = rx_size;
+  u->tx_size = tx_size;
+  int status = uart_core_init(u, base_addr);
+  if (status != 0) {
+    return status;
+  }
   for (int i = 0; i < MAX_UART_CALLBACKS; i++) {
     u->callbacks[i] = NULL;
   }
@@ -95,7 +164,7 @@ int bsp_uart_write(uart_id_t id, const uint8_t *data, uint32_t size) {
   if (u->running) {
     u->tx_count = 0;
     u->tx_expected = size;
-    XUartLite_Send(&u->instance, data, size);
+    UART_SEND(&u->instance, (uint8_t *)data, size);
     return 0;
   }
   return -2;
@@ -110,6 +179,14 @@ bool bsp_uart_tx_done(uart_id_t id) {
 }
 
 int bsp_uart_read(uart_id_t id, uint32_t size) {
+  if (id >= BSP_UARTNUM) {
+    return -1;
+  }
+  return bsp_uart_read_to(id, uart[id].rx_buf, size);
+}
+
+// receive into buf instead of rx_buf, the rx callback gets buf
+int bsp_uart_read_to(uart_id_t id, uint8_t *buf, uint32_t size) {
   if (id >= BSP_UARTNUM) {
     return -1;
   }
@@ -117,7 +194,8 @@ int bsp_uart_read(uart_id_t id, uint32_t size) {
   if (u->running) {
     u->rx_count = 0;
     u->rx_expected = size;
-    XUartLite_Recv(&u->instance, u->rx_buf, size);
+    u->rx_ptr = buf;
+    UART_RECV(&u->instance, buf, size);
     return 0;
   }
   return -2;
@@ -131,6 +209,61 @@ bool bsp_uart_rx_done(uart_id_t id) {
   return u->rx_count == u->rx_expected;
 }
 
+// the receive handler only reports a complete read, the driver counts down
+// as the bytes come in
+uint32_t bsp_uart_rx_partial(uart_id_t id) {
+  if (id >= BSP_UARTNUM) {
+    return 0;
+  }
+  uart_t *u = &uart[id];
+  return u->instance.ReceiveBuffer.RequestedBytes -
+         u->instance.ReceiveBuffer.RemainingBytes;
+}
+
+uint32_t bsp_uart_get_baud(uart_id_t id) {
+  if (id >= BSP_UARTNUM) {
+    return 0;
+  }
+  return uart[id].baud;
+}
+
+// the 16550 divides its clock by 16 * divisor, XUartNs550_SetBaudRate()
+// takes a rate within 3%; the UART Lite only does its own
+bool bsp_uart_baud_ok(uart_id_t id, uint32_t baud) {
+  if (id >= BSP_UARTNUM || baud == 0) {
+    return false;
+  }
+  uart_t *u = &uart[id];
+#if BSP_UART_16550
+  uint32_t divisor = (u->clock_hz + baud * 8) / (baud * 16);
+  if (divisor == 0 || divisor > 0xFFFF) {
+    return false;
+  }
+  uint32_t actual = u->clock_hz / (divisor * 16);
+  uint32_t error = actual > baud ? actual - baud : baud - actual;
+  return error * 100 <= baud * 3;
+#else
+  return baud == u->baud;
+#endif
+}
+
+int bsp_uart_set_baud(uart_id_t id, uint32_t baud) {
+  if (id >= BSP_UARTNUM) {
+    return -1;
+  }
+  uart_t *u = &uart[id];
+  if (!bsp_uart_baud_ok(id, baud)) {
+    return -2;
+  }
+#if BSP_UART_16550
+  if (XUartNs550_SetBaudRate(&u->instance, baud) != XST_SUCCESS) {
+    return -3;
+  }
+#endif
+  u->baud = baud;
+  return 0;
+}
+
 int bsp_uart_flush(uart_id_t id) {
   if (id >= BSP_UARTNUM) {
     return -1;
@@ -151,7 +284,7 @@ void bsp_uart_process(void) {
       if (u->rx_count == u->rx_expected) {
         for (int j = 0; j < MAX_UART_CALLBACKS; j++) {
           if (u->callbacks[j] != NULL) {
-            u->callbacks[j](u->rx_buf, u->rx_count);
+            u->callbacks[j](u->rx_ptr, u->rx_count);
             u->rx_count = 0;
           }
         }
@@ -4,6 +4,22 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "xparameters.h"
+
+// The core behind bsp_uart. The UART Lite runs at the baud rate it was built
+// with; an AXI UART 16550, used when the design has no UART Lite, starts at
+// BSP_UART_BAUD and can be switched at run time.
+#if defined(XPAR_XUARTNS550_0_BASEADDR) && !defined(XPAR_XUARTLITE_0_BASEADDR)
+#define BSP_UART_16550 1
+#define BSP_UART0_BASEADDR XPAR_XUARTNS550_0_BASEADDR
+#else
+#define BSP_UART_16550 0
+#define BSP_UART0_BASEADDR XPAR_XUARTLITE_0_BASEADDR
+#endif
+#ifndef BSP_UART_BAUD
+#define BSP_UART_BAUD 115200
+#endif
+
 typedef enum { BSP_UART0 = 0, BSP_UARTNUM } uart_id_t;
 #define MAX_UART_CALLBACKS 2
 typedef void (*uart_callback_t)(uint8_t *data, uint32_t size);
@@ -11,9 +27,16 @@ int bsp_uart_init(uart_id_t id, uint32_t base_addr, uint8_t *rx_buf,
                   uint32_t rx_size, uint8_t *tx_buf, uint32_t tx_size);
 int bsp_uart_write(uart_id_t id, const uint8_t *data, uint32_t size);
 int bsp_uart_read(uart_id_t id, uint32_t size);
+int bsp_uart_read_to(uart_id_t id, uint8_t *buf, uint32_t size);
 bool bsp_uart_tx_done(uart_id_t id);
 bool bsp_uart_rx_done(uart_id_t id);
+// bytes of the current read received so far
+uint32_t bsp_uart_rx_partial(uart_id_t id);
 int bsp_uart_register_rx_callback(uart_id_t id, uart_callback_t callback);
+uint32_t bsp_uart_get_baud(uart_id_t id);
+bool bsp_uart_baud_ok(uart_id_t id, uint32_t baud);
+// changes the rate right away, bytes on the line are lost
+int bsp_uart_set_baud(uart_id_t id, uint32_t baud);
 void bsp_uart_process(void);
 
 #endif  // BSP_UART_H
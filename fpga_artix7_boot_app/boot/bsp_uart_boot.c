@@ -4,6 +4,7 @@
 
 #include "bsp_cpu.h"
 #include "bsp_crc.h"
+#include "bsp_lz.h"
 #include "bsp_spi_flash.h"
 #include "bsp_timer.h"
 #include "bsp_uart.h"
@@ -19,6 +20,37 @@
 #define NEXT_LEN_CMD (16)
 #define NEXT_LEN_DATA (16 + 256)
 
+// pages the sliding window write buffers ahead of the one being programmed,
+// uptool.py WINDOW_SLOTS must match
+#define BOOT_WINDOW_SLOTS 4
+
+// a window read that got part of a packet and then nothing for this long is
+// dropped and started again: a byte lost on the line would otherwise leave
+// every later read straddling two packets. The sender goes quiet for longer
+// than this before it retransmits after a stall, uptool.py WINDOW_IDLE
+#define BOOT_WINDOW_IDLE_MS 50
+
+// self check copies the app to ram in bursts of this many bytes, each is
+// checked while the next one is read
+#define BOOT_BURST_SIZE 4096
+
+// first 4 bytes of a BOOT_WINDOW_LZ image, uptool.py LZ_MAGIC
+#define BOOT_LZ_MAGIC 0x315A4C42  // "BLZ1"
+
+// code0 of the ack BOOT_ERASE sends once the range is erased, code1 the
+// length, uptool.py ERASE_DONE
+#define BOOT_ERASE_DONE 0x454E4F44  // "DONE"
+
+// BOOT_BAUD baud: after the echo {BOOT_BAUD_OK, baud} is acked at the old
+// rate and the UART switches once it is out, or {BOOT_BAUD_NAK, current rate}
+// if the UART can not do baud. The first packet at the new rate has to come
+// with a good crc within BOOT_BAUD_TRIAL_MS, otherwise the old rate is back
+// and reception restarts at the end of that time. Asking for the current
+// rate only acks, the host confirms a switch that way. uptool.py BAUD_*
+#define BOOT_BAUD_OK 0x4B4F4442   // "BDOK"
+#define BOOT_BAUD_NAK 0x4B414E42  // "BNAK"
+#define BOOT_BAUD_TRIAL_MS 500
+
 #define IS_BOOT 0xB0000000
 #define IS_APP 0xB0000001
 
@@ -36,6 +68,10 @@ typedef enum {
   BOOT_READ,
   BOOT_JUMP,
   BOOT_INFO,
+  BOOT_WINDOW,
+  BOOT_SECTOR_CRC,
+  BOOT_WINDOW_LZ,
+  BOOT_BAUD,
   BOOT_STATUS_NUM
 } boot_status_t;
 
@@ -52,6 +88,9 @@ void boot_status_write(void);
 void boot_status_read(void);
 void boot_status_jump(void);
 void boot_status_info(void);
+void boot_status_window(void);
+void boot_status_sector_crc(void);
+void boot_status_baud(void);
 typedef void (*boot_status_func_t)(void);
 
 typedef struct {
@@ -61,6 +100,68 @@ typedef struct {
   uint32_t len;
 } boot_header_t;
 
+// Sliding window write. BOOT_WINDOW addr len starts it, then every data
+// packet is a page: header {crc, BOOT_WINDOW, addr, seq} + 256 bytes, seq
+// counting pages from addr. The UART receives into a pool of buffers while
+// the flash programs, pages may arrive out of order within the window. Acks
+// are cumulative and coalesced: {next | done << 16, sack}, next the first
+// page not received, done the pages programmed, bit i of sack page
+// next + 1 + i received. The sender may have pages below
+// done + BOOT_WINDOW_SLOTS outstanding.
+typedef struct {
+  bool lz;  // started by BOOT_WINDOW_LZ, the pages carry a compressed image
+  bool receiving;
+  bool programming;
+  bool ack_pending;
+  uint32_t base;
+  uint32_t pages;
+  uint32_t next;
+  uint32_t done;
+  uint8_t *slot[BOOT_WINDOW_SLOTS];  // page seq at seq % BOOT_WINDOW_SLOTS
+  uint8_t *rx;                       // buffer the UART receives into
+  uint32_t rx_partial;               // bytes of the read in rx, last seen
+  uint32_t rx_since;                 // ms, rx_partial changed
+  uint32_t dups;                     // pages received twice or out of window
+  uint32_t errors;                   // pages with a bad crc, addr or seq
+  uint32_t resyncs;                  // partial reads dropped
+} boot_window_t;
+
+// Compressed image of a BOOT_WINDOW_LZ window: {magic, raw_len, raw_crc,
+// lz_crc} and the bsp_lz stream, the window pages are decoded in order into
+// flash pages from the window base on, the last one zero padded. done counts
+// the window pages decoded. Both crcs are calculated while decoding and sent
+// in an ack {raw crc, lz crc} before the last window ack.
+typedef struct {
+  bsp_lz_t dec;
+  uint8_t page[PAGE_SIZE];  // next flash page, decoded into
+  uint32_t fill;            // bytes in page
+  uint32_t programmed;      // flash pages
+  uint32_t in_pos;          // in the window page being decoded
+  uint32_t in_left;         // image bytes not decoded yet, padding excluded
+  uint32_t raw_len;
+  uint32_t raw_left;  // bytes still to decode, 0 after an error
+  uint32_t raw_crc;   // calculated
+  uint32_t lz_crc;
+  uint32_t raw_crc_expected;
+  uint32_t lz_crc_expected;
+  bool error;
+  bool reported;
+} boot_lz_t;
+
+typedef enum {
+  BAUD_ACK = 0,   // ack the request once the echo is out
+  BAUD_SWITCH,    // BOOT_BAUD_OK is being sent
+  BAUD_TRIAL,     // switched, waiting for the first packet
+  BAUD_FALLBACK,  // back at the old rate, restart reception at the deadline
+  BAUD_DONE
+} boot_baud_stage_t;
+
+typedef struct {
+  boot_baud_stage_t stage;
+  uint32_t old;    // rate to fall back to
+  uint32_t since;  // ms, tx last busy (BAUD_SWITCH) or the switch
+} boot_baud_t;
+
 typedef struct {
   boot_header_t header;  // cmd or data header
   boot_status_t status;
@@ -74,15 +175,31 @@ typedef struct {
   bool is_app;  // true: app, false: boot
   bool is_reading;
   bool is_check_ok;
+  bool is_flashing;  // erase/write of the current command issued
   uint32_t check_cnt;
   uint32_t app_crc;
   uint32_t app_version;
   uint32_t app_addr;
   uint32_t app_len;
   uint32_t app_crc_cal;
+  uint32_t copy_issued;   // self check: app bytes read or being read
+  uint32_t copy_checked;  // copied to ram and in app_crc_cal
+  bool copy_pending;      // a burst is read and not checked yet
+  uint32_t crc_addr;  // BOOT_SECTOR_CRC: next flash address to read
+  uint32_t crc_end;
+  uint32_t crc_value;  // of the sector being read
+  bool crc_sector_done;
+  boot_window_t window;
+  boot_baud_t baud;
 } boot_t;
 
 static boot_t uboot;
+// one more than the slots, there is always a free one to receive into
+static uint8_t window_buf[BOOT_WINDOW_SLOTS + 1][NEXT_LEN_DATA]
+    __attribute__((aligned(4)));
+static boot_lz_t window_lz;
+static uint8_t burst_buf[2][FLASH_BURST_EXTRA_BYTES + BOOT_BURST_SIZE]
+    __attribute__((aligned(4)));
 
 static void uart_ack(uint32_t cmd, uint32_t code0, uint32_t code1) {
   *(uint32_t *)(uboot.uart_tx_buf + 4) = 0xFFFFFFFF - cmd;
@@ -93,21 +210,233 @@ static void uart_ack(uint32_t cmd, uint32_t code0, uint32_t code1) {
   bsp_uart_write(uboot.id, uboot.uart_tx_buf, 16);
 }
 
+static uint8_t *window_free_buf(void) {
+  boot_window_t *w = &uboot.window;
+  for (int i = 0; i < BOOT_WINDOW_SLOTS + 1; i++) {
+    bool used = window_buf[i] == w->rx;
+    for (int j = 0; j < BOOT_WINDOW_SLOTS && !used; j++) {
+      used = window_buf[i] == w->slot[j];
+    }
+    if (!used) {
+      return window_buf[i];
+    }
+  }
+  return NULL;
+}
+
+static void window_start(uint32_t addr, uint32_t len, bool lz) {
+  boot_window_t *w = &uboot.window;
+  memset(w, 0, sizeof(*w));
+  if (lz) {
+    memset(&window_lz, 0, sizeof(window_lz));
+    bsp_lz_init(&window_lz.dec);
+    window_lz.in_left = len;
+  }
+  w->lz = lz && len >= 16;  // else refused like any bad window
+  w->base = addr;
+  w->pages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+  w->rx = window_buf[0];
+  w->receiving = w->pages > 0 && w->pages <= 0xFFFF && (!lz || len >= 16);
+}
+
+static bool window_lz_idle(void) {
+  boot_window_t *w = &uboot.window;
+  return w->done == w->pages && !w->programming && window_lz.fill == 0 &&
+         window_lz.raw_left == 0;
+}
+
+static void window_ack(void) {
+  boot_window_t *w = &uboot.window;
+  uint32_t sack = 0;
+  for (uint32_t i = 0; i < 32; i++) {
+    uint32_t seq = w->next + 1 + i;
+    if (seq >= w->done + BOOT_WINDOW_SLOTS) {
+      break;
+    }
+    if (w->slot[seq % BOOT_WINDOW_SLOTS] != NULL) {
+      sack |= 1u << i;
+    }
+  }
+  // a compressed window is done once the last page is decoded and programmed
+  uint32_t done = w->done;
+  if (w->lz && done == w->pages && !window_lz_idle()) {
+    done--;
+  }
+  uart_ack(BOOT_WINDOW, w->next | done << 16, sack);
+  w->ack_pending = false;
+}
+
+// a data packet arrived in w->rx, its crc is checked
+static void window_rx(boot_header_t *header) {
+  boot_window_t *w = &uboot.window;
+  uint32_t seq = header->len;
+  w->ack_pending = true;
+  if (seq >= w->pages || header->addr != w->base + seq * PAGE_SIZE) {
+    w->errors++;
+    return;
+  }
+  if (seq < w->next || seq >= w->done + BOOT_WINDOW_SLOTS ||
+      w->slot[seq % BOOT_WINDOW_SLOTS] != NULL) {
+    w->dups++;
+    return;
+  }
+  w->slot[seq % BOOT_WINDOW_SLOTS] = w->rx;
+  w->rx = window_free_buf();
+  while (w->next < w->done + BOOT_WINDOW_SLOTS && w->next < w->pages &&
+         w->slot[w->next % BOOT_WINDOW_SLOTS] != NULL) {
+    w->next++;
+  }
+  if (w->next == w->pages) {
+    w->receiving = false;
+    uboot.next_len = NEXT_LEN_CMD;
+  }
+}
+
+static void window_lz_header(const uint8_t *data) {
+  boot_lz_t *lz = &window_lz;
+  uint32_t header[4];
+  memcpy(header, data, sizeof(header));
+  lz->raw_len = header[1];
+  lz->raw_crc_expected = header[2];
+  lz->lz_crc_expected = header[3];
+  lz->error = header[0] != BOOT_LZ_MAGIC;
+  lz->raw_left = lz->error ? 0 : lz->raw_len;
+  lz->in_pos = sizeof(header);
+  lz->in_left -= sizeof(header);
+}
+
+// decode the next window page into the page buffer, program it once full;
+// the flash driver copies the page, decoding goes on while it programs
+static void window_lz_step(void) {
+  boot_window_t *w = &uboot.window;
+  boot_lz_t *lz = &window_lz;
+  if (w->programming && !bsp_spi_flash_is_busy()) {
+    w->programming = false;
+    lz->programmed++;
+  }
+  if (lz->fill == PAGE_SIZE || (lz->fill > 0 && lz->raw_left == 0)) {
+    if (!w->programming && !bsp_spi_flash_is_busy()) {
+      memset(lz->page + lz->fill, 0, PAGE_SIZE - lz->fill);
+      bsp_spi_flash_write(w->base + lz->programmed * PAGE_SIZE, lz->page,
+                          PAGE_SIZE);
+      w->programming = true;
+      lz->fill = 0;
+    }
+    return;
+  }
+  uint8_t **slot = &w->slot[w->done % BOOT_WINDOW_SLOTS];
+  uint8_t *in = NULL;
+  uint32_t in_len = 0;
+  if (w->done < w->next) {
+    if (w->done == 0 && lz->in_pos == 0) {
+      window_lz_header(*slot + 16);
+    }
+    in = *slot + 16 + lz->in_pos;
+    in_len = PAGE_SIZE - lz->in_pos;
+    in_len = in_len < lz->in_left ? in_len : lz->in_left;
+  }
+  uint32_t used = in_len;
+  if (lz->raw_left > 0) {
+    uint32_t space = PAGE_SIZE - lz->fill;
+    int ret = bsp_lz_decode(&lz->dec, in, in_len, &used, lz->page + lz->fill,
+                            space < lz->raw_left ? space : lz->raw_left);
+    if (ret > 0) {
+      lz->raw_crc = bsp_crc32(lz->page + lz->fill, ret, lz->raw_crc);
+      lz->fill += ret;
+      lz->raw_left -= ret;
+    } else if (ret < 0 || (in == NULL && lz->in_left == 0)) {
+      // bad match or the stream ended early, the crcs tell the sender
+      lz->error = true;
+      lz->raw_left = 0;
+      used = in_len;
+    }
+  }
+  if (in == NULL) {
+    return;
+  }
+  lz->lz_crc = bsp_crc32(in, used, lz->lz_crc);
+  lz->in_pos += used;
+  lz->in_left -= used;
+  if (lz->in_pos == PAGE_SIZE || lz->in_left == 0) {
+    *slot = NULL;
+    lz->in_pos = 0;
+    w->done++;
+    w->ack_pending = true;
+  }
+}
+
+static void baud_trial_end(bool ok) {
+  boot_baud_t *b = &uboot.baud;
+  if (ok) {
+    b->stage = BAUD_DONE;
+    return;
+  }
+  // the rest of the packet may still come in, garbled at the old rate
+  bsp_uart_set_baud(uboot.id, b->old);
+  b->stage = BAUD_FALLBACK;
+}
+
 static void uart_rx_callback(uint8_t *data, uint32_t size) {
+  if (uboot.window.receiving && size == NEXT_LEN_DATA) {
+    boot_header_t *header = (boot_header_t *)data;
+    if (bsp_crc32(data + 4, size - 4, 0) != header->crc) {
+      uboot.window.errors++;
+      uboot.window.ack_pending = true;
+    } else if (header->cmd == BOOT_WINDOW) {
+      window_rx(header);
+    } else {
+      // any other command ends the window, handled below
+      uboot.window.receiving = false;
+    }
+    if (uboot.window.receiving || header->cmd == BOOT_WINDOW) {
+      bsp_uart_read_to(uboot.id, uboot.window.rx,
+                       uboot.window.receiving ? NEXT_LEN_DATA : NEXT_LEN_CMD);
+      return;
+    }
+  }
   if (size < 16 || size % 16 != 0) {
     return;
   }
   boot_header_t *header = (boot_header_t *)data;
-  if (header->cmd <= BOOT_STATUS_NUM) {
+  // the first packet at a new baud rate decides whether it is kept
+  if (uboot.baud.stage == BAUD_TRIAL) {
+    baud_trial_end(header->cmd < BOOT_STATUS_NUM &&
+                   bsp_crc32(data + 4, size - 4, 0) == header->crc);
+  }
+  if (header->cmd < BOOT_STATUS_NUM) {
     uint32_t crc0 = bsp_crc32(data + 4, size - 4, 0);
     uint32_t crc1 = *(uint32_t *)data;
     if (crc0 == crc1) {
       memcpy(&uboot.header, header, sizeof(boot_header_t));
+      // a packet that ended a window is still in a window buffer
+      if (data != uboot.uart_rx_buf) {
+        memcpy(uboot.uart_rx_buf, data, size);
+      }
       uboot.status = header->cmd;
+      uboot.is_flashing = false;
       if (header->cmd == BOOT_NEXT_SET) {
         uboot.next_len = header->len;
       }
       uart_ack(header->cmd, header->addr, header->len);
+      if (header->cmd == BOOT_SECTOR_CRC) {
+        uboot.crc_addr = header->addr;
+        uboot.crc_end = header->addr + header->len;
+        uboot.crc_value = 0;
+        uboot.crc_sector_done = false;
+        uboot.is_reading = false;
+      }
+      if (header->cmd == BOOT_BAUD) {
+        uboot.baud.stage = BAUD_ACK;
+      }
+      if (header->cmd == BOOT_WINDOW || header->cmd == BOOT_WINDOW_LZ) {
+        window_start(header->addr, header->len,
+                     header->cmd == BOOT_WINDOW_LZ);
+        if (uboot.window.receiving) {
+          uboot.next_len = NEXT_LEN_DATA;
+          bsp_uart_read_to(uboot.id, uboot.window.rx, NEXT_LEN_DATA);
+          return;
+        }
+      }
     }
   }
   bsp_uart_read(uboot.id,
@@ -128,6 +457,10 @@ void boot_status_func_init(void) {
   uboot.status_func[BOOT_READ] = boot_status_read;
   uboot.status_func[BOOT_JUMP] = boot_status_jump;
   uboot.status_func[BOOT_INFO] = boot_status_info;
+  uboot.status_func[BOOT_WINDOW] = boot_status_window;
+  uboot.status_func[BOOT_SECTOR_CRC] = boot_status_sector_crc;
+  uboot.status_func[BOOT_WINDOW_LZ] = boot_status_window;
+  uboot.status_func[BOOT_BAUD] = boot_status_baud;
 }
 
 int bsp_uart_boot_init(uart_id_t id, uint8_t *uart_rx_buf, uint8_t *uart_tx_buf,
@@ -145,8 +478,7 @@ int bsp_uart_boot_init(uart_id_t id, uint8_t *uart_rx_buf, uint8_t *uart_tx_buf,
 void bsp_uart_boot_process() { uboot.status_func[uboot.status](); }
 
 void boot_status_unknown(void) {
-  uint32_t addr = 0;
-  uint32_t value = *(uint32_t *)addr;
+  uint32_t value = *(uint32_t *)ISR_RAM_ADDR;
   if (value == IS_APP) {
     UB_PRINTF("IS_APP\n");
     uboot.is_app = true;
@@ -163,11 +495,61 @@ void boot_status_unknown(void) {
   uboot.is_app = true;
 }
 
+// burst n is read into burst_buf[n % 2]; once it is in, burst n + 1 goes
+// out and burst n is copied and crc checked while the flash sends
+static void self_check_copy(void) {
+  if (uboot.is_reading && !bsp_spi_flash_is_busy()) {
+    uboot.is_reading = false;
+    uboot.copy_pending = true;
+  }
+  if (!uboot.is_reading && uboot.copy_issued < uboot.app_len &&
+      !bsp_spi_flash_is_busy()) {
+    uint32_t len = uboot.app_len - uboot.copy_issued;
+    len = len < BOOT_BURST_SIZE ? len : BOOT_BURST_SIZE;
+    bsp_spi_flash_read_burst(
+        uboot.app_addr + uboot.copy_issued,
+        burst_buf[(uboot.copy_issued / BOOT_BURST_SIZE) % 2], len);
+    uboot.copy_issued += len;
+    uboot.is_reading = true;
+  }
+  if (uboot.copy_pending) {
+    uint32_t len = uboot.app_len - uboot.copy_checked;
+    len = len < BOOT_BURST_SIZE ? len : BOOT_BURST_SIZE;
+    uint8_t *ram = (uint8_t *)APP_RAM_ADDR + uboot.copy_checked;
+    memcpy(ram,
+           burst_buf[(uboot.copy_checked / BOOT_BURST_SIZE) % 2] +
+               FLASH_BURST_EXTRA_BYTES,
+           len);
+    uboot.app_crc_cal = bsp_crc32(ram, len, uboot.app_crc_cal);
+    uboot.copy_checked += len;
+    uboot.copy_pending = false;
+  }
+  if (uboot.copy_checked < uboot.app_len) {
+    return;
+  }
+  if (uboot.app_crc == uboot.app_crc_cal) {
+    // uboot.status = BOOT_ENTER_APP;
+    uboot.status = BOOT_READY;
+    uboot.is_check_ok = true;
+    UB_PRINTF("app_crc check ok, enter app\n");
+  } else {
+    uboot.status = BOOT_SAVE_BRICK;
+    uboot.is_check_ok = false;
+    UB_PRINTF("ERROR: app_crc: 0x%08X != 0x%08X\n", uboot.app_crc,
+              uboot.app_crc_cal);
+  }
+  uboot.check_cnt = 0;
+  uboot.is_reading = false;
+}
+
 void boot_status_self_check(void) {
   // copy app from flash to ram
 
   if (uboot.is_reading && (uboot.check_cnt == 1) && !bsp_spi_flash_is_busy()) {
     uint32_t *ptr = (uint32_t *)(uboot.flash_rx_buf + FLASH_RW_EXTRA_BYTES);
+    // a failed check starts over from the info read next time
+    uboot.is_reading = false;
+    uboot.check_cnt = 0;
     // memcpy(uboot.uart_rx_buf, uboot.flash_rx_buf + FLASH_RW_EXTRA_BYTES, 256);
     // uint32_t *ptr = (uint32_t *)(uboot.uart_rx_buf);
     uboot.app_crc = ptr[0];
@@ -198,60 +580,24 @@ void boot_status_self_check(void) {
       return;
     }
     memcpy((void *)ISR_TEMP_RAM_ADDR, (void *)(&ptr[8]), APP_ISR_SIZE);
-    uboot.is_reading = false;
+    uboot.check_cnt = 1;
     // UB_PRINTF(
     //     "app_crc: 0x%08X, app_version: 0x%08X, app_addr: 0x%08X, "
     //     "app_len: %d, app_crc_cal: 0x%08X\n",
     //     uboot.app_crc, uboot.app_version, uboot.app_addr, uboot.app_len,
     //     uboot.app_crc_cal);
-  } else if (uboot.is_reading && (uboot.check_cnt > 1) &&
-             !bsp_spi_flash_is_busy()) {
-    // memcpy(uboot.uart_rx_buf, uboot.flash_rx_buf + FLASH_RW_EXTRA_BYTES,
-    // 256); uint32_t *ptr = (uint32_t *)(uboot.uart_rx_buf);
-    uint32_t *ptr = (uint32_t *)(uboot.flash_rx_buf + FLASH_RW_EXTRA_BYTES);
-    int remain_len = uboot.app_len - 256 * (uboot.check_cnt - 1);
-    uint32_t current_len = remain_len < 0 ? (256 + remain_len) : 256;
-    remain_len = remain_len < 0 ? 0 : remain_len;
-    // uboot.app_crc_cal =
-    //     bsp_crc32((uint8_t *)ptr, current_len, uboot.app_crc_cal);
-    // memcpy((void *)APP_RAM_ADDR, (void *)ptr, current_len);
-    uint32_t ram_addr = APP_RAM_ADDR + 256 * (uboot.check_cnt - 2);
-    memcpy((void *)ram_addr, (void *)ptr, current_len);
-    uboot.app_crc_cal =
-        bsp_crc32((uint8_t *)ram_addr, current_len, uboot.app_crc_cal);
-    // UB_PRINTF(
-    //     "uboot.check_cnt: %d, app_addr: 0x%08X, current_len: %d, remain_len:
-    //     "
-    //     "%d, uboot.app_crc_cal: 0x%08X\n",
-    //     uboot.check_cnt, uboot.app_addr, current_len, remain_len,
-    //     uboot.app_crc_cal);
-    if (remain_len == 0) {
-      if (uboot.app_crc == uboot.app_crc_cal) {
-        // uboot.status = BOOT_ENTER_APP;
-        uboot.status = BOOT_READY;
-        uboot.is_check_ok = true;
-        uboot.check_cnt = 0;
-        UB_PRINTF("app_crc check ok, enter app\n");
-      } else {
-        uboot.status = BOOT_SAVE_BRICK;
-        uboot.is_check_ok = false;
-        uboot.check_cnt = 0;
-        UB_PRINTF("ERROR: app_crc: 0x%08X != 0x%08X\n", uboot.app_crc,
-                  uboot.app_crc_cal);
-      }
-      uboot.is_reading = false;
-      return;
-    }
-    uboot.app_addr += current_len;
-    uboot.is_reading = false;
+    uboot.copy_issued = 0;
+    uboot.copy_checked = 0;
+    uboot.copy_pending = false;
+  } else if (uboot.check_cnt > 1) {
+    self_check_copy();
+    return;
   }
 
   if ((!uboot.is_reading) && (!bsp_spi_flash_is_busy())) {
-    uboot.is_reading = true;
     if (uboot.check_cnt == 0) {
+      uboot.is_reading = true;
       bsp_spi_flash_read(APP_INFO_FLASH_ADDR, APP_ISR_SIZE + 32);
-    } else {
-      bsp_spi_flash_read(uboot.app_addr, 256);
     }
     uboot.check_cnt += 1;
   }
@@ -297,26 +643,38 @@ void boot_status_next_set(void) {
 }
 
 void boot_status_erase(void) {
+  if (!uboot.is_flashing) {
+    if (!bsp_spi_flash_is_busy()) {
+      bsp_spi_flash_erase(uboot.header.addr, uboot.header.len);
+      uboot.is_flashing = true;
+    }
+    return;
+  }
   if (bsp_uart_tx_done(uboot.id) && !bsp_spi_flash_is_busy()) {
     UB_PRINTF("erase done: 0x%08x, len: %d\n", uboot.header.addr,
               uboot.header.len);
+    // the host waits for this instead of sleeping through the erase
+    uart_ack(BOOT_ERASE, BOOT_ERASE_DONE, uboot.header.len);
+    uboot.is_flashing = false;
     uboot.status = BOOT_READY;
   }
-  if (!bsp_spi_flash_is_busy()) {
-    bsp_spi_flash_erase(uboot.header.addr, uboot.header.len);
-  }
 }
 
 void boot_status_write(void) {
+  if (!uboot.is_flashing) {
+    if (!bsp_spi_flash_is_busy()) {
+      bsp_spi_flash_write(uboot.header.addr, uboot.uart_rx_buf + 16,
+                          uboot.header.len);
+      uboot.is_flashing = true;
+    }
+    return;
+  }
   if (bsp_uart_tx_done(uboot.id) && !bsp_spi_flash_is_busy()) {
     UB_PRINTF("write done: 0x%08x, len: %d\n", uboot.header.addr,
               uboot.header.len);
+    uboot.is_flashing = false;
     uboot.status = BOOT_READY;
   }
-  if (!bsp_spi_flash_is_busy()) {
-    bsp_spi_flash_write(uboot.header.addr, uboot.uart_rx_buf + 16,
-                        uboot.header.len);
-  }
 }
 
 void boot_status_read(void) {
@@ -371,4 +729,162 @@ void boot_status_info(void) {
     UB_PRINTF("current: %s\n", uboot.is_app ? "app" : "boot");
     uboot.status = BOOT_READY;
   }
-}
\ No newline at end of file
+}
+
+// drop a partial read once the line is quiet, the next byte starts a packet
+static void window_resync(void) {
+  boot_window_t *w = &uboot.window;
+  uint32_t now = (uint32_t)bsp_uptime_ms();
+  uint32_t partial = bsp_uart_rx_partial(uboot.id);
+  if (partial != w->rx_partial) {
+    w->rx_partial = partial;
+    w->rx_since = now;
+    return;
+  }
+  if (partial == 0 || bsp_uart_rx_done(uboot.id) ||
+      now - w->rx_since < BOOT_WINDOW_IDLE_MS) {
+    return;
+  }
+  bsp_uart_read_to(uboot.id, w->rx, NEXT_LEN_DATA);
+  w->rx_partial = 0;
+  w->resyncs++;
+  w->ack_pending = true;
+}
+
+void boot_status_window(void) {
+  boot_window_t *w = &uboot.window;
+  if (w->receiving) {
+    window_resync();
+  }
+  if (w->lz) {
+    window_lz_step();
+  } else {
+    if (w->programming && !bsp_spi_flash_is_busy()) {
+      w->programming = false;
+      w->done++;
+      w->ack_pending = true;
+    }
+    // the page is copied to the flash buffer, its slot is free right away
+    uint8_t **slot = &w->slot[w->done % BOOT_WINDOW_SLOTS];
+    if (!w->programming && w->done < w->next && !bsp_spi_flash_is_busy()) {
+      bsp_spi_flash_write(w->base + w->done * PAGE_SIZE, *slot + 16,
+                          PAGE_SIZE);
+      *slot = NULL;
+      w->programming = true;
+    }
+  }
+  if (!bsp_uart_tx_done(uboot.id)) {
+    return;
+  }
+  if (!w->receiving && (w->lz ? window_lz_idle() : !w->programming)) {
+    if (w->lz && !window_lz.reported) {
+      uart_ack(BOOT_WINDOW_LZ, window_lz.raw_crc, window_lz.lz_crc);
+      window_lz.reported = true;
+      return;
+    }
+    if (w->lz) {
+      UB_PRINTF("lz: %d bytes to %d pages, %s\n", window_lz.raw_len,
+                window_lz.programmed,
+                window_lz.raw_crc == window_lz.raw_crc_expected &&
+                        window_lz.lz_crc == window_lz.lz_crc_expected
+                    ? "crc ok"
+                    : "crc error");
+    }
+    // before the last ack, the sender moves on once it has it
+    UB_PRINTF("window done: 0x%08x, pages: %d/%d, dups: %d, errors: %d, "
+              "resyncs: %d\n",
+              w->base, w->done, w->pages, w->dups, w->errors, w->resyncs);
+    window_ack();
+    uboot.status = BOOT_READY;
+    return;
+  }
+  if (w->ack_pending) {
+    window_ack();
+  }
+}
+
+// BOOT_SECTOR_CRC addr len: bsp_crc32 of every SECTOR_SIZE block of the
+// range, each sent as an ack {sector addr, crc} once it is read, so the host
+// only has to erase and write the sectors that differ
+void boot_status_sector_crc(void) {
+  if (uboot.crc_sector_done) {
+    if (bsp_uart_tx_done(uboot.id)) {
+      uart_ack(BOOT_SECTOR_CRC, (uboot.crc_addr - 1) & ~(SECTOR_SIZE - 1),
+               uboot.crc_value);
+      uboot.crc_value = 0;
+      uboot.crc_sector_done = false;
+    }
+    return;
+  }
+  if (uboot.is_reading) {
+    if (bsp_spi_flash_is_busy()) {
+      return;
+    }
+    uboot.crc_value =
+        bsp_crc32(uboot.flash_rx_buf + FLASH_RW_EXTRA_BYTES, PAGE_SIZE,
+                  uboot.crc_value);
+    uboot.is_reading = false;
+    uboot.crc_addr += PAGE_SIZE;
+    uboot.crc_sector_done =
+        uboot.crc_addr % SECTOR_SIZE == 0 || uboot.crc_addr >= uboot.crc_end;
+    return;
+  }
+  if (uboot.crc_addr >= uboot.crc_end) {
+    uboot.status = BOOT_READY;
+    return;
+  }
+  if (!bsp_spi_flash_is_busy()) {
+    bsp_spi_flash_read(uboot.crc_addr, PAGE_SIZE);
+    uboot.is_reading = true;
+  }
+}
+
+void boot_status_baud(void) {
+  boot_baud_t *b = &uboot.baud;
+  uint32_t now = (uint32_t)bsp_uptime_ms();
+  uint32_t baud = uboot.header.addr;
+  if (b->stage == BAUD_TRIAL || b->stage == BAUD_FALLBACK) {
+    if (now - b->since < BOOT_BAUD_TRIAL_MS) {
+      return;
+    }
+    if (b->stage == BAUD_TRIAL) {
+      baud_trial_end(false);
+    }
+    // the host is quiet by now, drop what came in half way
+    bsp_uart_read(uboot.id, NEXT_LEN_CMD);
+    UB_PRINTF("baud: fallback to %d\n", bsp_uart_get_baud(uboot.id));
+    b->stage = BAUD_DONE;
+    uboot.status = BOOT_READY;
+    return;
+  }
+  if (!bsp_uart_tx_done(uboot.id)) {
+    b->since = now;
+    return;
+  }
+  if (b->stage == BAUD_SWITCH) {
+    // tx done is the FIFO running empty, the last byte is still on the line
+    if (now - b->since < 2) {
+      return;
+    }
+    b->old = bsp_uart_get_baud(uboot.id);
+    bsp_uart_set_baud(uboot.id, baud);
+    b->stage = BAUD_TRIAL;
+    b->since = now;
+    return;
+  }
+  if (b->stage != BAUD_ACK) {
+    return;
+  }
+  uint32_t current = bsp_uart_get_baud(uboot.id);
+  if (baud == current || !bsp_uart_baud_ok(uboot.id, baud)) {
+    UB_PRINTF("baud: %d\n", current);
+    uart_ack(BOOT_BAUD, baud == current ? BOOT_BAUD_OK : BOOT_BAUD_NAK,
+             current);
+    b->stage = BAUD_DONE;
+    uboot.status = BOOT_READY;
+    return;
+  }
+  uart_ack(BOOT_BAUD, BOOT_BAUD_OK, baud);
+  b->stage = BAUD_SWITCH;
+  b->since = now;
+}
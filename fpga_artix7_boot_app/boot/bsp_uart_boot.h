@@ -14,9 +14,14 @@
 #define APP_ISR_FLASH_ADDR 0x003F0020
 #define APP_ISR_SIZE 0x50
 #define APP_FLASH_ADDR 0x00400000
-#define ISR_RAM_ADDR 0x00000000
-#define ISR_TEMP_RAM_ADDR 0x0000FFB0
-#define APP_RAM_ADDR 0x00010000
+// local memory starts at 0 on the MicroBlaze, the host simulator (sim/) maps
+// it somewhere else
+#ifndef BOOT_RAM_BASE
+#define BOOT_RAM_BASE 0
+#endif
+#define ISR_RAM_ADDR (BOOT_RAM_BASE + 0x00000000)
+#define ISR_TEMP_RAM_ADDR (BOOT_RAM_BASE + 0x0000FFB0)
+#define APP_RAM_ADDR (BOOT_RAM_BASE + 0x00010000)
 
 int bsp_uart_boot_init(uart_id_t id, uint8_t *uart_rx_buf, uint8_t *uart_tx_buf,
                        uint8_t *flash_rx_buf, uint8_t *flash_tx_buf);
@@ -15,7 +15,7 @@ uint8_t flash0_tx_buf[256 + 4];
 int main(void) {
   bsp_timer_init(BSP_TIMER0, XPAR_AXI_TIMER_0_BASEADDR, 1, true);
 
-  bsp_uart_init(BSP_UART0, XPAR_XUARTLITE_0_BASEADDR, uart0_rx_buf,
+  bsp_uart_init(BSP_UART0, BSP_UART0_BASEADDR, uart0_rx_buf,
                 UART_BUF_SIZE, uart0_tx_buf, UART_BUF_SIZE);
   bsp_uart_read(BSP_UART0, 16);
 
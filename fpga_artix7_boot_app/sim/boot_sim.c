@@ -0,0 +1,818 @@
+// Host build of the bootloader, to run uptool.py without the board. The boot/
+// sources are compiled as they are (state machine, flash driver, crc, lz);
+// this file stands in for the Xilinx side: bsp_uart is a pty throttled to the
+// baud rate, bsp_spi an MT25QL128 with the datasheet program and erase times,
+// bsp_timer the host clock, and bsp_cpu_reset restarts the bootloader or,
+// after BOOT_JUMP, ends the run. What the MicroBlaze spends on the FIFO of
+// each SPI byte, on bsp_crc32 and on a main loop pass is spun off on the host
+// clock (CPU_*), so the self-check and boot to app times are the board's.
+//
+// boot_sim [-b baud] [-u lite|16550] [-f flash.bin] [-t typ|max] [-d n] [-q]
+//   -b baud     UART baud rate, default 115200
+//   -u core     UART Lite (default), fixed at -b, or a 16550 that starts at
+//               -b and takes BOOT_BAUD; bytes are garbled while the host's
+//               termios rate differs from the UART's
+//   -f file     flash image, loaded at start if it exists and written back
+//               at the end; default an erased flash that is thrown away
+//   -t typ|max  page program and erase times, datasheet typical (default)
+//               or maximum
+//   -d n        lose every n-th byte from the host, an overrun or framing
+//               error on the line; default 0, none
+//   -q          debug text (xil_printf) to stderr instead of the UART
+//
+// The pty name is printed on stdout. The bootloader powers up when the host
+// opens the pty and the run ends when the host closes it, on the jump to the
+// app, or on SIGINT/SIGTERM; the UART and flash counters go to stderr, and on
+// the jump the time from the app info read to it and from power on.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bsp_cpu.h"
+#include "bsp_spi.h"
+#include "bsp_spi_flash.h"
+#include "bsp_timer.h"
+#include "bsp_uart.h"
+#include "bsp_uart_boot.h"
+#include "xil_printf.h"
+#include "xparameters.h"
+
+// first word of the bootloader's vectors, "imm 0" (IS_BOOT in
+// bsp_uart_boot.c); the app's start with "imm 1"
+#define RESET_VECTOR_BOOT 0xB0000000
+// boot BRAM and app RAM are 64K each, an app_len past them should not take
+// the simulator down
+#define RAM_SIZE 0x1000000
+
+#define UART_FIFO_SIZE 16  // UART Lite tx FIFO depth
+// 16550 xin from a 14.7456 MHz oscillator, the standard rates up to 921600
+// divide evenly
+#define UART_16550_CLOCK_HZ 14745600
+#define UART_QUEUE_SIZE 65536
+
+#define FLASH_SIZE (16 << 20)
+#define FLASH_PAGE_SIZE 256
+#define FLASH_ID 0x18BA20  // Micron, 3V, 128 Mbit, as read by 0x9F
+#define SPI_SCK_HZ 25000000.0
+#define SPI_SETUP_S 2e-6  // XSpi_Transfer start to the done interrupt
+
+// MicroBlaze at 100 MHz: the XSpi interrupt moving a byte through the FIFO,
+// bsp_crc32 per byte, one pass of the main loop
+#define CPU_SPI_BYTE_S 0.16e-6
+#define CPU_CRC_BYTE_S 0.08e-6
+#define CPU_LOOP_S 1e-6
+
+// MT25QL128 program / erase times, typical and maximum
+typedef struct {
+  double page_program;
+  double erase_4k;
+  double erase_32k;
+  double erase_64k;
+} flash_timing_t;
+
+static const flash_timing_t flash_timing_typ = {0.12e-3, 0.05, 0.1, 0.15};
+static const flash_timing_t flash_timing_max = {1.8e-3, 0.4, 1.0, 1.0};
+
+typedef struct {
+  uint8_t data;
+  double arrival;  // the stop bit is on the line
+} uart_byte_t;
+
+typedef struct {
+  uint32_t baud;
+  uint32_t baud_reset;  // after bsp_uart_init, -b
+  bool is_16550;
+  double byte_s;  // 10 bits at the baud rate
+  uart_byte_t queue[UART_QUEUE_SIZE];  // written by the host, not read yet
+  uint32_t head;
+  uint32_t tail;
+  double line_in;   // arrival of the last queued byte
+  double line_out;  // the tx line is busy until
+  uint8_t *rx_buf;
+  uint8_t *rx_ptr;
+  uint32_t rx_received;
+  uint32_t rx_count;
+  uint32_t rx_expected;
+  const uint8_t *tx_data;
+  uint32_t tx_sent;
+  uint32_t tx_count;
+  uint32_t tx_expected;
+  uart_callback_t callbacks[MAX_UART_CALLBACKS];
+  bool debug_stderr;
+  uint64_t rx_bytes;
+  uint64_t tx_bytes;
+  uint64_t garbled;  // bytes sent or received at the wrong rate
+  uint32_t drop_every;  // -d
+  uint32_t drop_count;  // bytes since the last one dropped
+  uint64_t dropped;
+} sim_uart_t;
+
+typedef struct {
+  uint8_t *mem;
+  const flash_timing_t *timing;
+  bool wel;
+  double busy_until;
+  double busy_total;
+  bool transfer_pending;
+  double transfer_done;
+  uint32_t transfer_size;
+  spi_callback_t callbacks[MAX_SPI_CALLBACKS];
+  uint64_t page_programs;
+  uint64_t erases[3];  // 4K, 32K, 64K
+  uint64_t read_bytes;
+  uint64_t ignored;  // commands sent while busy or without write enable
+  double self_check_start;  // last read of the app info, uptime
+} sim_flash_t;
+
+static sim_uart_t sim_uart;
+static sim_flash_t sim_flash;
+static int pty_fd = -1;
+static double t_power_on;
+static jmp_buf reset_jmp;
+static uint8_t boot_vectors[APP_ISR_SIZE];
+static volatile sig_atomic_t stop_requested;
+// bumped by every stand-in that moves data or is handed work; a main loop
+// pass that leaves it alone found nothing to do
+static uint64_t sim_work;
+
+#define UART_BUF_SIZE (256 + 16)
+uint8_t uart0_rx_buf[UART_BUF_SIZE];
+uint8_t uart0_tx_buf[UART_BUF_SIZE];
+uint8_t flash0_rx_buf[256 + 4 + 4];
+uint8_t flash0_tx_buf[256 + 4];
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double uptime_s(void) { return now_s() - t_power_on; }
+
+// the board's CPU is busy for s
+static void cpu_busy(double s) {
+  double until = now_s() + s;
+  while (now_s() < until) {
+  }
+}
+
+// ---- bsp_uart, UART Lite or 16550 behind a pty
+
+// the rate the host set on its end, 0 if it is not a standard one
+static uint32_t host_baud(void) {
+  static const struct {
+    speed_t speed;
+    uint32_t baud;
+  } rates[] = {{B9600, 9600},       {B19200, 19200},     {B38400, 38400},
+               {B57600, 57600},     {B115200, 115200},   {B230400, 230400},
+               {B460800, 460800},   {B500000, 500000},   {B576000, 576000},
+               {B921600, 921600},   {B1000000, 1000000}, {B1152000, 1152000},
+               {B1500000, 1500000}, {B2000000, 2000000}, {B2500000, 2500000},
+               {B3000000, 3000000}, {B3500000, 3500000}, {B4000000, 4000000}};
+  struct termios tio;
+  if (tcgetattr(pty_fd, &tio) != 0) {
+    return 0;
+  }
+  speed_t speed = cfgetospeed(&tio);
+  for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+    if (rates[i].speed == speed) {
+      return rates[i].baud;
+    }
+  }
+  return 0;
+}
+
+// both ends at different rates: what arrives is not what was sent
+static bool line_garbled(void) {
+  uint32_t host = host_baud();
+  return host != 0 && host != sim_uart.baud;
+}
+
+// what the UART Lite and its interrupt do: bytes that arrived go to the
+// posted receive buffer, the tx FIFO is refilled. Received bytes wait in the
+// queue while no receive is posted, a rx FIFO overrun would be down to the
+// host's scheduling more than to the bootloader, it is not modelled
+static void uart_isr(void) {
+  sim_uart_t *u = &sim_uart;
+  double now = now_s();
+  bool garbled = line_garbled();
+  while (u->tail - u->head < UART_QUEUE_SIZE) {
+    uint8_t buf[512];
+    uint32_t room = UART_QUEUE_SIZE - (u->tail - u->head);
+    ssize_t n = read(pty_fd, buf, room < sizeof(buf) ? room : sizeof(buf));
+    if (n < 0 && errno == EIO) {
+      stop_requested = 1;  // the host closed the pty
+    }
+    if (n <= 0) {
+      break;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+      if (u->drop_every != 0 && ++u->drop_count == u->drop_every) {
+        u->drop_count = 0;
+        u->dropped++;
+        continue;
+      }
+      u->line_in = (u->line_in > now ? u->line_in : now) + u->byte_s;
+      uart_byte_t *b = &u->queue[u->tail++ % UART_QUEUE_SIZE];
+      b->data = garbled ? buf[i] ^ 0x5A : buf[i];
+      b->arrival = u->line_in;
+      u->garbled += garbled;
+    }
+  }
+  for (; u->head != u->tail && u->rx_received < u->rx_expected; u->head++) {
+    uart_byte_t *b = &u->queue[u->head % UART_QUEUE_SIZE];
+    if (b->arrival > now) {
+      break;
+    }
+    u->rx_ptr[u->rx_received++] = b->data;
+    u->rx_bytes++;
+    sim_work++;
+    // like the receive handler, the count is only reported when complete
+    if (u->rx_received == u->rx_expected) {
+      u->rx_count = u->rx_expected;
+    }
+  }
+
+  while (u->tx_data != NULL && u->tx_sent < u->tx_expected &&
+         u->line_out - now < UART_FIFO_SIZE * u->byte_s) {
+    uint8_t c = u->tx_data[u->tx_sent] ^ (garbled ? 0x5A : 0);
+    if (write(pty_fd, &c, 1) != 1) {
+      break;
+    }
+    u->garbled += garbled;
+    u->line_out = (u->line_out > now ? u->line_out : now) + u->byte_s;
+    u->tx_sent++;
+    u->tx_bytes++;
+    sim_work++;
+  }
+  if (u->tx_data != NULL && u->tx_sent == u->tx_expected &&
+      u->line_out <= now) {
+    u->tx_count = u->tx_expected;
+  }
+}
+
+int bsp_uart_init(uart_id_t id, uint32_t base_addr, uint8_t *rx_buf,
+                  uint32_t rx_size, uint8_t *tx_buf, uint32_t tx_size) {
+  (void)base_addr;
+  (void)tx_buf;
+  (void)tx_size;
+  if (id >= BSP_UARTNUM) {
+    return -1;
+  }
+  sim_uart_t *u = &sim_uart;
+  // the 16550 is set to its start rate, the bootloader may come from a switch
+  u->baud = u->baud_reset;
+  u->byte_s = 10.0 / u->baud;
+  u->rx_buf = rx_buf;
+  u->rx_ptr = rx_buf;
+  for (int i = 0; i < MAX_UART_CALLBACKS; i++) {
+    u->callbacks[i] = NULL;
+  }
+  memset(rx_buf, 0, rx_size);
+  u->rx_received = 0;
+  u->rx_count = 0;
+  u->tx_count = 0;
+  u->rx_expected = 1;
+  u->tx_expected = 1;
+  u->tx_data = NULL;
+  u->tx_sent = 0;
+  return 0;
+}
+
+int bsp_uart_write(uart_id_t id, const uint8_t *data, uint32_t size) {
+  if (id >= BSP_UARTNUM) {
+    return -1;
+  }
+  sim_work++;
+  sim_uart.tx_data = data;
+  sim_uart.tx_sent = 0;
+  sim_uart.tx_count = 0;
+  sim_uart.tx_expected = size;
+  return 0;
+}
+
+bool bsp_uart_tx_done(uart_id_t id) {
+  return id < BSP_UARTNUM && sim_uart.tx_count == sim_uart.tx_expected;
+}
+
+int bsp_uart_read(uart_id_t id, uint32_t size) {
+  if (id >= BSP_UARTNUM) {
+    return -1;
+  }
+  return bsp_uart_read_to(id, sim_uart.rx_buf, size);
+}
+
+int bsp_uart_read_to(uart_id_t id, uint8_t *buf, uint32_t size) {
+  if (id >= BSP_UARTNUM) {
+    return -1;
+  }
+  sim_work++;
+  sim_uart.rx_received = 0;
+  sim_uart.rx_count = 0;
+  sim_uart.rx_expected = size;
+  sim_uart.rx_ptr = buf;
+  return 0;
+}
+
+bool bsp_uart_rx_done(uart_id_t id) {
+  return id < BSP_UARTNUM && sim_uart.rx_count == sim_uart.rx_expected;
+}
+
+uint32_t bsp_uart_rx_partial(uart_id_t id) {
+  return id < BSP_UARTNUM ? sim_uart.rx_received : 0;
+}
+
+int bsp_uart_register_rx_callback(uart_id_t id, uart_callback_t callback) {
+  if (id >= BSP_UARTNUM) {
+    return -1;
+  }
+  for (int i = 0; i < MAX_UART_CALLBACKS; i++) {
+    if (sim_uart.callbacks[i] == NULL) {
+      sim_uart.callbacks[i] = callback;
+      return 0;
+    }
+  }
+  return -2;
+}
+
+uint32_t bsp_uart_get_baud(uart_id_t id) {
+  return id < BSP_UARTNUM ? sim_uart.baud : 0;
+}
+
+// as bsp_uart.c: 16550 divisor within 3%, the UART Lite only at its rate
+bool bsp_uart_baud_ok(uart_id_t id, uint32_t baud) {
+  if (id >= BSP_UARTNUM || baud == 0) {
+    return false;
+  }
+  if (!sim_uart.is_16550) {
+    return baud == sim_uart.baud;
+  }
+  uint32_t divisor = (UART_16550_CLOCK_HZ + baud * 8) / (baud * 16);
+  if (divisor == 0 || divisor > 0xFFFF) {
+    return false;
+  }
+  uint32_t actual = UART_16550_CLOCK_HZ / (divisor * 16);
+  uint32_t error = actual > baud ? actual - baud : baud - actual;
+  return error * 100 <= baud * 3;
+}
+
+int bsp_uart_set_baud(uart_id_t id, uint32_t baud) {
+  if (id >= BSP_UARTNUM) {
+    return -1;
+  }
+  if (!bsp_uart_baud_ok(id, baud)) {
+    return -2;
+  }
+  sim_uart.baud = baud;
+  sim_uart.byte_s = 10.0 / baud;
+  return 0;
+}
+
+void bsp_uart_process(void) {
+  sim_uart_t *u = &sim_uart;
+  uart_isr();
+  if (u->rx_count == u->rx_expected) {
+    for (int j = 0; j < MAX_UART_CALLBACKS; j++) {
+      if (u->callbacks[j] != NULL) {
+        sim_work++;
+        u->callbacks[j](u->rx_ptr, u->rx_count);
+        u->rx_count = 0;
+      }
+    }
+  }
+}
+
+// outbyte() polls the UART Lite, the caller waits until all but the last
+// FIFO full is on the line; the interrupt keeps receiving meanwhile
+void xil_printf(const char *fmt, ...) {
+  char s[256];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(s, sizeof(s), fmt, ap);
+  va_end(ap);
+  if (n <= 0) {
+    return;
+  }
+  n = n < (int)sizeof(s) ? n : (int)sizeof(s) - 1;
+  sim_uart_t *u = &sim_uart;
+  sim_work++;
+  if (u->debug_stderr) {
+    fprintf(stderr, "[%10.3f] %s", uptime_s() * 1000, s);
+    return;
+  }
+  if (line_garbled()) {
+    for (int i = 0; i < n; i++) {
+      s[i] ^= 0x5A;
+    }
+    u->garbled += n;
+  }
+  double now = now_s();
+  u->line_out = (u->line_out > now ? u->line_out : now) + n * u->byte_s;
+  u->tx_bytes += n;
+  (void)!write(pty_fd, s, n);
+  while (u->line_out - now_s() > UART_FIFO_SIZE * u->byte_s) {
+    uart_isr();
+  }
+}
+
+// ---- bsp_spi, MT25QL128 on the AXI Quad SPI
+
+static uint32_t flash_addr(const uint8_t *tx) {
+  return (tx[1] << 16 | tx[2] << 8 | tx[3]) % FLASH_SIZE;
+}
+
+static void flash_erase(uint32_t addr, uint32_t size, double t, int kind) {
+  memset(sim_flash.mem + (addr & ~(size - 1)), 0xFF, size);
+  sim_flash.busy_until = now_s() + t;
+  sim_flash.busy_total += t;
+  sim_flash.erases[kind]++;
+}
+
+// the flash side of one transfer; returns the data lines of the read
+static int flash_command(const uint8_t *tx, uint8_t *rx, uint32_t size) {
+  static uint8_t tx_copy[FLASH_BURST_EXTRA_BYTES + 4096];
+  sim_flash_t *f = &sim_flash;
+  const flash_timing_t *t = f->timing;
+  bool busy = now_s() < f->busy_until;
+  // bursts transfer in place, take the command before rx overwrites it
+  size = size < sizeof(tx_copy) ? size : sizeof(tx_copy);
+  memcpy(tx_copy, tx, size);
+  tx = tx_copy;
+  uint8_t cmd = tx[0];
+  memset(rx, 0xFF, size);
+  if (busy && cmd != 0x05) {
+    f->ignored++;  // only the status register answers while busy
+    return 1;
+  }
+  bool write = cmd == 0x02 || cmd == 0x20 || cmd == 0x52 || cmd == 0xD8;
+  if (write && (!f->wel || size < 4)) {
+    f->ignored++;
+    return 1;
+  }
+  uint32_t addr = size >= 4 ? flash_addr(tx) : 0;
+  switch (cmd) {
+    case 0x05:  // read status register: WIP, WEL
+      for (uint32_t i = 1; i < size; i++) {
+        rx[i] = (busy ? 0x01 : 0) | (f->wel ? 0x02 : 0);
+      }
+      break;
+    case 0x06:
+      f->wel = true;
+      break;
+    case 0x04:
+      f->wel = false;
+      break;
+    case 0x9F:
+      for (uint32_t i = 1; i < size && i < 4; i++) {
+        rx[i] = FLASH_ID >> (8 * (i - 1));
+      }
+      break;
+    case 0x02:  // page program, wraps inside the page, can only clear bits
+      for (uint32_t i = 4; i < size; i++) {
+        uint32_t a = (addr & ~(FLASH_PAGE_SIZE - 1)) |
+                     ((addr + i - 4) & (FLASH_PAGE_SIZE - 1));
+        f->mem[a] &= tx[i];
+      }
+      f->busy_until = now_s() + t->page_program;
+      f->busy_total += t->page_program;
+      f->page_programs++;
+      break;
+    case 0x20:
+      flash_erase(addr, 0x1000, t->erase_4k, 0);
+      break;
+    case 0x52:
+      flash_erase(addr, 0x8000, t->erase_32k, 1);
+      break;
+    case 0xD8:
+      flash_erase(addr, 0x10000, t->erase_64k, 2);
+      break;
+    case 0x03:
+    case 0x3B:
+    case 0x6B: {
+      // fast reads send dummy bytes after the address, 8 clocks for dual
+      // output, 8 for quad on 4 lines = 4 bytes of the transfer
+      uint32_t header = cmd == 0x03 ? 4 : cmd == 0x3B ? 6 : 8;
+      if (addr == APP_INFO_FLASH_ADDR) {
+        f->self_check_start = uptime_s();
+      }
+      for (uint32_t i = header; i < size; i++) {
+        rx[i] = f->mem[(addr + i - header) % FLASH_SIZE];
+      }
+      f->read_bytes += size > header ? size - header : 0;
+      return cmd == 0x03 ? 1 : cmd == 0x3B ? 2 : 4;
+    }
+    default:
+      f->ignored++;
+      break;
+  }
+  if (write) {
+    f->wel = false;
+  }
+  return 1;
+}
+
+int bsp_spi_init(spi_id_t id, uint32_t base_addr) {
+  (void)base_addr;
+  if (id >= BSP_SPINUM) {
+    return -1;
+  }
+  sim_flash.transfer_pending = false;
+  for (int i = 0; i < MAX_SPI_CALLBACKS; i++) {
+    sim_flash.callbacks[i] = NULL;
+  }
+  return 0;
+}
+
+int bsp_spi_register_callback(spi_id_t id, spi_callback_t callback) {
+  if (id >= BSP_SPINUM) {
+    return -1;
+  }
+  for (int i = 0; i < MAX_SPI_CALLBACKS; i++) {
+    if (sim_flash.callbacks[i] == NULL) {
+      sim_flash.callbacks[i] = callback;
+      return 0;
+    }
+  }
+  return -2;
+}
+
+int bsp_spi_transfer(spi_id_t id, uint8_t *tx_buf, uint8_t *rx_buf,
+                     uint32_t size) {
+  if (id >= BSP_SPINUM) {
+    return -1;
+  }
+  if (sim_flash.transfer_pending) {
+    return -2;  // XST_DEVICE_BUSY
+  }
+  sim_work++;
+  int lines = flash_command(tx_buf, rx_buf, size);
+  // command and address on one line, the data of dual/quad reads on more
+  uint32_t header = size < 4 ? size : 4;
+  double wire = (header + (double)(size - header) / lines) * 8 / SPI_SCK_HZ;
+  sim_flash.transfer_pending = true;
+  sim_flash.transfer_done = now_s() + SPI_SETUP_S + wire;
+  sim_flash.transfer_size = size;
+  // the driver feeds and drains the FIFO while the bytes are on the wire
+  cpu_busy(size * CPU_SPI_BYTE_S);
+  return 0;
+}
+
+int bsp_spi_process(void) {
+  sim_flash_t *f = &sim_flash;
+  if (f->transfer_pending && now_s() >= f->transfer_done) {
+    f->transfer_pending = false;
+    sim_work++;
+    for (int i = 0; i < MAX_SPI_CALLBACKS; i++) {
+      if (f->callbacks[i] != NULL) {
+        f->callbacks[i](BSP_SPI_TRANSFER_DONE, f->transfer_size);
+      }
+    }
+  }
+  return 0;
+}
+
+// ---- bsp_crc32 (linked with --wrap), bsp_timer, bsp_cpu
+
+uint32_t __real_bsp_crc32(const uint8_t *data, uint32_t len,
+                          uint32_t crc_init);
+
+uint32_t __wrap_bsp_crc32(const uint8_t *data, uint32_t len,
+                          uint32_t crc_init) {
+  sim_work++;
+  cpu_busy(len * CPU_CRC_BYTE_S);
+  return __real_bsp_crc32(data, len, crc_init);
+}
+
+int bsp_timer_init(timer_id_t timer_id, uint32_t base_addr, float period_ms,
+                   bool auto_start) {
+  (void)base_addr;
+  (void)period_ms;
+  (void)auto_start;
+  return timer_id < BSP_TIMERNUM ? 0 : -1;
+}
+
+uint64_t bsp_uptime_ms(void) { return (uint64_t)(uptime_s() * 1000); }
+
+// boot_status_jump() swaps the app's vectors in before the reset
+void bsp_cpu_reset(void) {
+  bool app = memcmp((void *)ISR_RAM_ADDR, boot_vectors, APP_ISR_SIZE) != 0;
+  fprintf(stderr, "[%10.3f] reset, %s 0x%08X\n", uptime_s() * 1000,
+          app ? "jump to app, reset vector" : "restart bootloader",
+          *(uint32_t *)ISR_RAM_ADDR);
+  if (app) {
+    double t = uptime_s();
+    fprintf(stderr, "self-check %.3f ms, boot to app %.3f ms\n",
+            (t - sim_flash.self_check_start) * 1000, t * 1000);
+  }
+  longjmp(reset_jmp, app ? 2 : 1);
+}
+
+// ----
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop_requested = 1;
+}
+
+static int open_pty(void) {
+  int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+    perror("pty");
+    return -1;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  // open and close the slave once, the master then reports POLLHUP until
+  // the host opens it
+  int slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+  if (slave >= 0) {
+    close(slave);
+  }
+  return fd;
+}
+
+static bool wait_host(int fd) {
+  while (!stop_requested) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) >= 0 && !(pfd.revents & POLLHUP)) {
+      return true;
+    }
+    usleep(10000);
+  }
+  return false;
+}
+
+static bool flash_load(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return errno == ENOENT;
+  }
+  size_t n = fread(sim_flash.mem, 1, FLASH_SIZE, f);
+  fclose(f);
+  fprintf(stderr, "flash: %zu bytes from %s\n", n, path);
+  return true;
+}
+
+static void flash_save(const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL || fwrite(sim_flash.mem, 1, FLASH_SIZE, f) != FLASH_SIZE) {
+    fprintf(stderr, "failed to write %s\n", path);
+  }
+  if (f != NULL) {
+    fclose(f);
+  }
+}
+
+static void print_stats(void) {
+  sim_uart_t *u = &sim_uart;
+  sim_flash_t *f = &sim_flash;
+  double t = uptime_s();
+  fprintf(stderr,
+          "%.3f s, uart rx %llu bytes (%.0f B/s), tx %llu bytes, garbled "
+          "%llu, dropped %llu, %u baud at the end\n",
+          t, (unsigned long long)u->rx_bytes, u->rx_bytes / t,
+          (unsigned long long)u->tx_bytes, (unsigned long long)u->garbled,
+          (unsigned long long)u->dropped, u->baud);
+  fprintf(stderr,
+          "flash: %llu page programs, erases 4K %llu 32K %llu 64K %llu, busy "
+          "%.3f s, read %llu bytes, ignored commands %llu\n",
+          (unsigned long long)f->page_programs,
+          (unsigned long long)f->erases[0], (unsigned long long)f->erases[1],
+          (unsigned long long)f->erases[2], f->busy_total,
+          (unsigned long long)f->read_bytes, (unsigned long long)f->ignored);
+}
+
+// boot/main.c
+static void boot_main(void) {
+  bsp_timer_init(BSP_TIMER0, 0, 1, true);
+
+  bsp_uart_init(BSP_UART0, 0, uart0_rx_buf, UART_BUF_SIZE, uart0_tx_buf,
+                UART_BUF_SIZE);
+  bsp_uart_read(BSP_UART0, 16);
+
+  bsp_spi_init(BSP_SPI0, 0);
+  bsp_spi_flash_init(BSP_SPI0, flash0_rx_buf, flash0_tx_buf);
+
+  bsp_uart_boot_init(BSP_UART0, uart0_rx_buf, uart0_tx_buf, flash0_rx_buf,
+                     flash0_tx_buf);
+
+  while (!stop_requested) {
+    uint64_t work = sim_work;
+    bsp_uart_process();
+    bsp_spi_process();
+    bsp_spi_flash_process();
+    bsp_uart_boot_process();
+    // nothing on the wires and the pass did nothing, so the bootloader only
+    // waits for the host or a timeout: wait with it instead of spinning. A
+    // pass that did something may have queued the next step (the next page
+    // read of BOOT_SECTOR_CRC), which must not wait for the poll
+    if (sim_work == work && sim_uart.head == sim_uart.tail &&
+        bsp_uart_tx_done(BSP_UART0) && !sim_flash.transfer_pending) {
+      struct pollfd pfd = {pty_fd, POLLIN, 0};
+      poll(&pfd, 1, 1);
+    } else {
+      cpu_busy(CPU_LOOP_S);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long baud = 115200;
+  // kept over the longjmp of bsp_cpu_reset
+  const char *volatile flash_path = NULL;
+  sim_flash.timing = &flash_timing_typ;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+      baud = strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "16550") == 0) {
+        sim_uart.is_16550 = true;
+      } else if (strcmp(argv[i], "lite") != 0) {
+        baud = 0;
+        break;
+      }
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      flash_path = argv[++i];
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "max") == 0) {
+        sim_flash.timing = &flash_timing_max;
+      } else if (strcmp(argv[i], "typ") != 0) {
+        baud = 0;
+        break;
+      }
+    } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+      sim_uart.drop_every = strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "-q") == 0) {
+      sim_uart.debug_stderr = true;
+    } else {
+      baud = 0;
+      break;
+    }
+  }
+  if (baud == 0) {
+    fprintf(stderr,
+            "usage: %s [-b baud] [-u lite|16550] [-f flash.bin] [-t typ|max] "
+            "[-d n] [-q]\n",
+            argv[0]);
+    return -1;
+  }
+  sim_uart.baud_reset = baud;
+
+  // the bootloader addresses its RAM directly, see BOOT_RAM_BASE
+  void *ram = mmap((void *)ISR_RAM_ADDR, RAM_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (ram != (void *)ISR_RAM_ADDR) {
+    fprintf(stderr, "failed to map the RAM at %p\n", (void *)ISR_RAM_ADDR);
+    return -1;
+  }
+  *(uint32_t *)ram = RESET_VECTOR_BOOT;
+  memcpy(boot_vectors, ram, APP_ISR_SIZE);
+
+  sim_flash.mem = malloc(FLASH_SIZE);
+  if (sim_flash.mem == NULL) {
+    return -1;
+  }
+  memset(sim_flash.mem, 0xFF, FLASH_SIZE);
+  if (flash_path != NULL && !flash_load(flash_path)) {
+    fprintf(stderr, "failed to read %s: %s\n", flash_path, strerror(errno));
+    return -1;
+  }
+
+  pty_fd = open_pty();
+  if (pty_fd < 0) {
+    return -1;
+  }
+  printf("%s\n", ptsname(pty_fd));
+  fflush(stdout);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  if (wait_host(pty_fd)) {
+    t_power_on = now_s();
+    if (setjmp(reset_jmp) != 2) {
+      boot_main();
+    }
+  }
+
+  print_stats();
+  if (flash_path != NULL) {
+    flash_save(flash_path);
+  }
+  close(pty_fd);
+  return 0;
+}
@@ -0,0 +1,155 @@
+// bsp_crc32 and bsp_crc32_combine against zlib: every length 0..4096 at
+// every offset 0..7 from a word boundary, from crc_init 0 and from a running
+// crc, and combine for every len2 0..4096 plus large ones. Built once per
+// BSP_CRC_SLICES (crc_test_1/4/8), then bytes per second next to zlib's.
+//
+// crc_test_N [bench_mb]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "bsp_crc.h"
+
+#define MAX_LEN 4096
+#define MAX_OFFSET 8
+
+static int failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond) && failures++ < 16) {                                   \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+    }                                                                   \
+  } while (0)
+
+static uint32_t rng_state = 0x6C078965;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint8_t buf[MAX_LEN + MAX_OFFSET] __attribute__((aligned(8)));
+
+static void test_crc32(void) {
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = (uint8_t)rng();
+  }
+  int calls = 0;
+  for (uint32_t offset = 0; offset < MAX_OFFSET; offset++) {
+    const uint8_t *data = buf + offset;
+    for (uint32_t len = 0; len <= MAX_LEN; len++) {
+      uint32_t want = (uint32_t)crc32(0, data, len);
+      uint32_t got = bsp_crc32(data, len, 0);
+      if (got != want && failures++ < 16) {
+        fprintf(stderr, "offset %u len %u: %08X, zlib %08X\n", offset, len,
+                got, want);
+      }
+      // continued from the crc of what came before
+      uint32_t init = (uint32_t)crc32(0, buf, offset + 1);
+      CHECK(bsp_crc32(data, len, init) == (uint32_t)crc32(init, data, len));
+      calls += 2;
+    }
+  }
+  // split anywhere, chained
+  for (uint32_t split = 0; split <= MAX_LEN; split++) {
+    uint32_t a = bsp_crc32(buf, split, 0);
+    CHECK(bsp_crc32(buf + split, MAX_LEN - split, a) ==
+          (uint32_t)crc32(0, buf, MAX_LEN));
+  }
+  printf("crc32: %d lengths x offsets, %d splits\n", calls, MAX_LEN + 1);
+}
+
+static void test_combine(void) {
+  int n = 0;
+  for (uint32_t len2 = 0; len2 <= MAX_LEN; len2++) {
+    uint32_t crc1 = rng();
+    uint32_t crc2 = rng();
+    CHECK(bsp_crc32_combine(crc1, crc2, len2) ==
+          (uint32_t)crc32_combine(crc1, crc2, len2));
+    n++;
+  }
+  // every power of two and its neighbours, random ones up to 4 GiB
+  for (int bit = 0; bit < 32; bit++) {
+    for (int d = -1; d <= 1; d++) {
+      uint32_t len2 = (1u << bit) + d;
+      uint32_t crc1 = rng();
+      uint32_t crc2 = rng();
+      CHECK(bsp_crc32_combine(crc1, crc2, len2) ==
+            (uint32_t)crc32_combine(crc1, crc2, (z_off_t)len2));
+      n++;
+    }
+  }
+  for (int i = 0; i < 10000; i++) {
+    uint32_t len2 = rng();
+    uint32_t crc1 = rng();
+    uint32_t crc2 = rng();
+    CHECK(bsp_crc32_combine(crc1, crc2, len2) ==
+          (uint32_t)crc32_combine(crc1, crc2, (z_off_t)len2));
+    n++;
+  }
+  // on real data: the two halves give the whole
+  for (uint32_t split = 0; split <= MAX_LEN; split += 7) {
+    uint32_t a = bsp_crc32(buf, split, 0);
+    uint32_t b = bsp_crc32(buf + split, MAX_LEN - split, 0);
+    CHECK(bsp_crc32_combine(a, b, MAX_LEN - split) ==
+          (uint32_t)crc32(0, buf, MAX_LEN));
+    n++;
+  }
+  printf("combine: %d cases\n", n);
+}
+
+// a page (the window and sector crc unit) and a 64 KiB burst, from an odd
+// address too
+static void bench(int mb) {
+  static const uint32_t sizes[] = {256, 4096, 65536};
+  uint8_t *data = malloc(65536 + 8);
+  for (uint32_t i = 0; i < 65536 + 8; i++) {
+    data[i] = (uint8_t)rng();
+  }
+  uint32_t sink = 0;
+  for (int s = 0; s < 3; s++) {
+    for (int offset = 0; offset < 2; offset++) {
+      uint32_t size = sizes[s];
+      const uint8_t *p = data + offset;
+      uint64_t total = (uint64_t)mb << 20;
+      uint64_t rounds = total / size;
+      double t0 = now_s();
+      for (uint64_t r = 0; r < rounds; r++) {
+        sink += bsp_crc32(p, size, sink);
+      }
+      double t1 = now_s();
+      for (uint64_t r = 0; r < rounds; r++) {
+        sink += (uint32_t)crc32(sink, p, size);
+      }
+      double t2 = now_s();
+      printf("%5u bytes%s: bsp_crc32 %7.1f MB/s, zlib %7.1f MB/s\n", size,
+             offset ? " odd " : "     ", total / (t1 - t0) / 1e6,
+             total / (t2 - t1) / 1e6);
+    }
+  }
+  free(data);
+  if (sink == 0x12345678) {
+    printf("\n");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int mb = argc > 1 ? (int)strtoul(argv[1], NULL, 0) : 64;
+  printf("BSP_CRC_SLICES %d\n", BSP_CRC_SLICES);
+  test_crc32();
+  test_combine();
+  bench(mb);
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
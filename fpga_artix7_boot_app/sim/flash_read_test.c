@@ -0,0 +1,168 @@
+// bsp_spi_flash_read_burst() against a stand-in for bsp_spi: the transfer
+// decodes the read command, checks it is the one of XPAR_XSPI_0_SPI_MODE and
+// answers with the flash contents behind its command, address and dummy
+// bytes; the done callback comes from bsp_spi_process() like the interrupt
+// would. Random addresses and lengths up to 8 KiB have to read back in one
+// transfer, with nothing written in front of buf or past the data, and a
+// second read while one is in flight has to be refused.
+//
+// flash_read_test [rounds]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsp_spi_flash.h"
+#include "xparameters.h"
+
+#define FLASH_SIZE (16u << 20)  // MT25QL128, 24 bit addresses
+#define MAX_LEN 8192
+#define CANARY 0xA5
+#define GUARD 64
+
+#if XPAR_XSPI_0_SPI_MODE == 2
+#define EXPECTED_COMMAND 0x6B
+#define EXPECTED_HEADER 8
+#elif XPAR_XSPI_0_SPI_MODE == 1
+#define EXPECTED_COMMAND 0x3B
+#define EXPECTED_HEADER 6
+#else
+#define EXPECTED_COMMAND 0x03
+#define EXPECTED_HEADER 4
+#endif
+
+static int failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond) && failures++ < 16) {                                   \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+    }                                                                   \
+  } while (0)
+
+static uint32_t rng_state = 0x2468ACE1;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+// what the flash holds at addr, no two neighbouring pages alike
+static uint8_t flash_byte(uint32_t addr) {
+  uint32_t x = addr * 2654435761u;
+  return (uint8_t)(x >> 24 ^ addr);
+}
+
+static spi_callback_t spi_callback;
+static uint32_t pending;  // size of the transfer waiting for its callback
+static int transfers;
+static int reads;
+
+int bsp_spi_register_callback(spi_id_t id, spi_callback_t callback) {
+  (void)id;
+  spi_callback = callback;
+  return 0;
+}
+
+int bsp_spi_transfer(spi_id_t id, uint8_t *tx_buf, uint8_t *rx_buf,
+                     uint32_t size) {
+  (void)id;
+  CHECK(pending == 0);
+  transfers++;
+  pending = size;
+  uint8_t command = tx_buf[0];
+  uint32_t header;
+  switch (command) {
+    case 0x03:
+      header = 4;
+      break;
+    case 0x3B:
+      header = 6;
+      break;
+    case 0x6B:
+      header = 8;
+      break;
+    default:
+      // read id and the like, nothing to answer
+      return 0;
+  }
+  reads++;
+  CHECK(command == EXPECTED_COMMAND);
+  CHECK(size >= header);
+  uint32_t addr = (uint32_t)tx_buf[1] << 16 | tx_buf[2] << 8 | tx_buf[3];
+  // tx_buf and rx_buf may be the same, the header is read first
+  for (uint32_t i = 0; i < header; i++) {
+    rx_buf[i] = 0xFF;
+  }
+  for (uint32_t i = header; i < size; i++) {
+    rx_buf[i] = flash_byte((addr + i - header) % FLASH_SIZE);
+  }
+  return 0;
+}
+
+int bsp_spi_process(void) {
+  if (pending > 0) {
+    uint32_t size = pending;
+    pending = 0;
+    spi_callback(BSP_SPI_TRANSFER_DONE, size);
+  }
+  return 0;
+}
+
+static uint8_t spi_rx_buf[PAGE_SIZE + FLASH_RW_EXTRA_BYTES];
+static uint8_t spi_tx_buf[PAGE_SIZE + FLASH_RW_EXTRA_BYTES];
+static uint8_t buf[GUARD + FLASH_BURST_EXTRA_BYTES + MAX_LEN + GUARD];
+
+// until the flash is ready again, a bounded number of passes
+static void run(void) {
+  for (int i = 0; i < 16 && bsp_spi_flash_is_busy(); i++) {
+    bsp_spi_flash_process();
+    bsp_spi_process();
+  }
+  CHECK(!bsp_spi_flash_is_busy());
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+
+  bsp_spi_flash_init(BSP_SPI0, spi_rx_buf, spi_tx_buf);
+  // the id read of init
+  bsp_spi_process();
+  CHECK(!bsp_spi_flash_is_busy());
+
+  uint8_t *data = buf + GUARD;
+  int mismatch = 0;
+  for (int r = 0; r < rounds; r++) {
+    // the ends first, then anywhere
+    uint32_t len = r == 0 ? 1 : r == 1 ? MAX_LEN : 1 + rng() % MAX_LEN;
+    uint32_t addr = r < 2 ? (r == 0 ? 0 : FLASH_SIZE - len)
+                          : rng() % (FLASH_SIZE - len + 1);
+    memset(buf, CANARY, sizeof(buf));
+    int before = transfers;
+    int reads_before = reads;
+    CHECK(bsp_spi_flash_read_burst(addr, data, len) == 0);
+    CHECK(bsp_spi_flash_is_busy());
+    CHECK(bsp_spi_flash_read_burst(addr, data, len) == -1);
+    run();
+    CHECK(transfers - before == 1);
+    CHECK(reads - reads_before == 1);
+    for (uint32_t i = 0; i < len; i++) {
+      if (data[FLASH_BURST_EXTRA_BYTES + i] != flash_byte(addr + i)) {
+        mismatch++;
+        break;
+      }
+    }
+    for (int i = 0; i < GUARD; i++) {
+      CHECK(buf[i] == CANARY);
+      CHECK(data[FLASH_BURST_EXTRA_BYTES + len + i] == CANARY);
+    }
+  }
+  CHECK(mismatch == 0);
+  CHECK(bsp_spi_flash_error_count() == 0);
+
+  printf("spi mode %d: %d burst reads, %d transfers, mismatch: %d\n",
+         XPAR_XSPI_0_SPI_MODE, rounds, transfers, mismatch);
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
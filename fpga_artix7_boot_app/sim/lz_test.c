@@ -0,0 +1,202 @@
+// bsp_lz_decode() on streams from uptool.py lz_compress(), see lz_test.py
+// which feeds them on stdin: {u32 raw_len, u32 lz_len, raw, lz} per case,
+// little endian. Each stream is decoded in one call, then with input and
+// output split at random points and a byte at a time; the output has to be
+// the raw data and all of the stream used. Then broken streams: cut short,
+// bits flipped, a match before the start. Those must stay inside the output
+// buffer and decode the same whatever the splits.
+//
+// lz_test [rounds] < cases
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsp_lz.h"
+
+#define CANARY 0xA5
+#define GUARD 64
+
+static int failures;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond) && failures++ < 16) {                                   \
+      fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+    }                                                                   \
+  } while (0)
+
+static uint32_t rng_state = 0x1234ABCD;
+
+static uint32_t rng(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static bsp_lz_t lz;
+
+typedef struct {
+  int ret;        // bytes decoded, or BSP_LZ_ERROR
+  uint32_t used;  // input consumed up to the end or the error
+} result_t;
+
+// chunk sizes: 0 one call with everything, 1 a byte at a time, else random
+// up to max_in / max_out; out has GUARD canary bytes past out_len
+static result_t decode(const uint8_t *in, uint32_t in_len, uint8_t *out,
+                       uint32_t out_len, uint32_t max_in, uint32_t max_out) {
+  result_t r = {0, 0};
+  memset(out, 0, out_len);
+  memset(out + out_len, CANARY, GUARD);
+  bsp_lz_init(&lz);
+  uint32_t o = 0;
+  for (;;) {
+    uint32_t in_n = in_len - r.used;
+    uint32_t out_n = out_len - o;
+    if (max_in > 0) {
+      uint32_t n = max_in == 1 ? 1 : rng() % (max_in + 1);
+      in_n = n < in_n ? n : in_n;
+    }
+    if (max_out > 0) {
+      uint32_t n = max_out == 1 ? 1 : 1 + rng() % max_out;
+      out_n = n < out_n ? n : out_n;
+    }
+    uint32_t used = 0;
+    int ret = bsp_lz_decode(&lz, in + r.used, in_n, &used, out + o, out_n);
+    CHECK(used <= in_n);
+    r.used += used;
+    if (ret < 0) {
+      r.ret = ret;
+      break;
+    }
+    CHECK((uint32_t)ret <= out_n);
+    o += ret;
+    // done: output full, or input used up with nothing left to copy
+    if (o == out_len || (r.used == in_len && ret < (int)out_n)) {
+      r.ret = (int)o;
+      break;
+    }
+  }
+  for (int i = 0; i < GUARD; i++) {
+    CHECK(out[out_len + i] == CANARY);
+  }
+  return r;
+}
+
+static void check_stream(const uint8_t *raw, uint32_t raw_len,
+                         const uint8_t *stream, uint32_t lz_len,
+                         uint8_t *out, int rounds) {
+  static const uint32_t splits[][2] = {{0, 0}, {1, 1}, {1, 0}, {0, 1}};
+  for (int s = 0; s < 4 + rounds; s++) {
+    uint32_t max_in = s < 4 ? splits[s][0] : 1 + rng() % (s % 2 ? 16 : 600);
+    uint32_t max_out = s < 4 ? splits[s][1] : 1 + rng() % (s % 3 ? 16 : 600);
+    if (s < 4 && (max_in == 1 || max_out == 1) && raw_len > 65536) {
+      continue;  // a byte at a time only for the small ones
+    }
+    result_t r = decode(stream, lz_len, out, raw_len, max_in, max_out);
+    if ((r.ret != (int)raw_len || r.used != lz_len ||
+         memcmp(out, raw, raw_len) != 0) &&
+        failures++ < 16) {
+      fprintf(stderr, "%u -> %u bytes, splits %u/%u: ret %d, used %u\n",
+              raw_len, lz_len, max_in, max_out, r.ret, r.used);
+    }
+  }
+}
+
+// the same output and error for any split, never past out_len
+static void check_broken(const uint8_t *raw, uint32_t raw_len,
+                         const uint8_t *stream, uint32_t lz_len, uint8_t *out,
+                         uint8_t *ref) {
+  result_t one = decode(stream, lz_len, ref, raw_len, 0, 0);
+  result_t split = decode(stream, lz_len, out, raw_len,
+                          1 + rng() % 64, 1 + rng() % 64);
+  CHECK(one.ret == split.ret && one.used == split.used);
+  if (one.ret > 0) {
+    CHECK(memcmp(out, ref, one.ret) == 0);
+  }
+  (void)raw;
+}
+
+static uint8_t *read_all(uint32_t len) {
+  uint8_t *p = malloc(len + 1);
+  if (p == NULL || fread(p, 1, len, stdin) != len) {
+    free(p);
+    return NULL;
+  }
+  return p;
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = argc > 1 ? (int)strtoul(argv[1], NULL, 0) : 20;
+  int cases = 0;
+  uint64_t raw_total = 0;
+  uint64_t lz_total = 0;
+  uint32_t hdr[2];
+  while (fread(hdr, sizeof(hdr), 1, stdin) == 1) {
+    uint32_t raw_len = hdr[0];
+    uint32_t lz_len = hdr[1];
+    uint8_t *raw = read_all(raw_len);
+    uint8_t *stream = read_all(lz_len);
+    uint8_t *out = malloc(raw_len + GUARD);
+    uint8_t *ref = malloc(raw_len + GUARD);
+    uint8_t *broken = malloc(lz_len + 1);
+    if (raw == NULL || stream == NULL || out == NULL || ref == NULL ||
+        broken == NULL) {
+      fprintf(stderr, "short input at case %d\n", cases);
+      return 1;
+    }
+    check_stream(raw, raw_len, stream, lz_len, out, rounds);
+
+    // cut short: a prefix of the data, all of the input used
+    if (lz_len > 0) {
+      uint32_t cut = rng() % lz_len;
+      result_t r = decode(stream, cut, out, raw_len, 1 + rng() % 64, 0);
+      CHECK(r.ret >= 0 && r.ret < (int)raw_len + (raw_len == 0));
+      CHECK(r.used == cut);
+      CHECK(r.ret < 0 || memcmp(out, raw, r.ret) == 0);
+    }
+    // bits flipped, the crcs of the image catch what decodes
+    for (int i = 0; i < rounds && lz_len > 0; i++) {
+      memcpy(broken, stream, lz_len);
+      for (int k = 1 + rng() % 3; k > 0; k--) {
+        broken[rng() % lz_len] ^= 1u << (rng() % 8);
+      }
+      check_broken(raw, raw_len, broken, lz_len, out, ref);
+    }
+    cases++;
+    raw_total += raw_len;
+    lz_total += lz_len;
+    free(raw);
+    free(stream);
+    free(out);
+    free(ref);
+    free(broken);
+  }
+
+  // a match reaching before the start, at the start and after literals
+  static const uint8_t before_start[][6] = {
+      {0x00, 0x00, 0x00},              // distance 1 at 0
+      {0x03, 'a', 'b', 0x02, 0x00},    // distance 3 at 2
+      {0x01, 'a', 0xFF, 0xFF, 0x10},   // distance 4096, extended length
+  };
+  static const uint32_t before_len[] = {3, 5, 5};
+  for (int i = 0; i < 3; i++) {
+    uint8_t buf[64 + GUARD];
+    result_t one = decode(before_start[i], before_len[i], buf, 64, 0, 0);
+    result_t split = decode(before_start[i], before_len[i], buf, 64, 1, 1);
+    CHECK(one.ret == BSP_LZ_ERROR && split.ret == BSP_LZ_ERROR);
+    CHECK(one.used == before_len[i] && split.used == before_len[i]);
+  }
+  // the same match once far enough in decodes
+  static const uint8_t ok_stream[] = {0x07, 'a', 'b', 'c', 0x02, 0x00};
+  uint8_t buf[64 + GUARD];
+  result_t r = decode(ok_stream, sizeof(ok_stream), buf, 6, 0, 0);
+  CHECK(r.ret == 6 && memcmp(buf, "abcabc", 6) == 0);
+
+  CHECK(cases > 0);
+  printf("%d streams, %llu -> %llu bytes, %d random splits each\n", cases,
+         (unsigned long long)raw_total, (unsigned long long)lz_total, rounds);
+  printf("%s\n", failures ? "FAILED" : "ok");
+  return failures ? 1 : 0;
+}
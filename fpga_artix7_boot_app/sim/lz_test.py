@@ -0,0 +1,75 @@
+# uptool.py lz_compress() output through bsp_lz_decode(): builds the cases,
+# compresses them with uptool.py and pipes them to lz_test (lz_test.c)
+#
+# python3 lz_test.py path/to/lz_test [rounds]
+import os
+import random
+import struct
+import subprocess
+import sys
+import types
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+sys.path.insert(0, ROOT)
+try:
+    import serial_asyncio  # noqa: F401
+except ImportError:
+    # only the serial port needs it, not the compressor
+    sys.modules['serial_asyncio'] = types.ModuleType('serial_asyncio')
+import uptool  # noqa: E402
+
+
+def cases():
+    rnd = random.Random(1)
+    yield b''
+    yield b'a'
+    yield b'ab'
+    yield b'abc'
+    yield b'abcabc'
+    # runs: every match length up to the extended ones and past them
+    for n in (3, 4, 17, 18, 19, 272, 273, 274, 1000, 70000):
+        yield b'\0' * n
+    # incompressible
+    for n in (1, 7, 8, 9, 255, 4096, 65536):
+        yield rnd.randbytes(n)
+    # distances at and past the window
+    for period in (4095, 4096, 4097):
+        block = rnd.randbytes(period)
+        yield block * 3 + block[:100]
+    # short repeats with noise, many flag groups of mixed tokens
+    data = bytearray()
+    while len(data) < 50000:
+        if rnd.random() < 0.3:
+            data += rnd.randbytes(rnd.randint(1, 5))
+        else:
+            back = rnd.randint(1, min(len(data), 4096)) if data else 0
+            n = rnd.randint(3, 300)
+            for _ in range(n):
+                data.append(data[-back] if back else 0)
+    yield bytes(data)
+    # what the tool sends in practice: code and text
+    sources = b''
+    for name in sorted(os.listdir(os.path.join(ROOT, 'boot'))):
+        with open(os.path.join(ROOT, 'boot', name), 'rb') as f:
+            sources += f.read()
+    yield sources
+    with open(os.path.join(ROOT, 'uptool.py'), 'rb') as f:
+        yield f.read()
+    with open(os.path.join(ROOT, 'design_1_wrapper.xsa'), 'rb') as f:
+        yield f.read()
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(f'usage: {sys.argv[0]} lz_test [rounds]')
+        return 2
+    stdin = bytearray()
+    for raw in cases():
+        stream = uptool.lz_compress(raw)
+        stdin += struct.pack('<II', len(raw), len(stream)) + raw + stream
+    return subprocess.run(sys.argv[1:], input=bytes(stdin)).returncode
+
+
+if __name__ == '__main__':
+    sys.exit(main())
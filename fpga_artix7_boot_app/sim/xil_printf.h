@@ -0,0 +1,7 @@
+#ifndef XIL_PRINTF_H
+#define XIL_PRINTF_H
+
+// the host build's xil_printf, in boot_sim.c
+void xil_printf(const char *fmt, ...);
+
+#endif  // XIL_PRINTF_H
@@ -0,0 +1,10 @@
+#ifndef XPARAMETERS_H
+#define XPARAMETERS_H
+
+// the parts of the generated xparameters.h the boot/ sources use, set by
+// CMakeLists.txt
+#ifndef XPAR_XSPI_0_SPI_MODE
+#define XPAR_XSPI_0_SPI_MODE 0
+#endif
+
+#endif  // XPARAMETERS_H
@@ -15,6 +15,27 @@ APP_INFO_SIZE = 16
 APP_INFO_OFFSET = -SECTOR_SIZE
 APP_ISR_INFO_SIZE = 16
 APP_ISR_SIZE = 0x50
+# pages the bootloader buffers ahead of the one being programmed,
+# BOOT_WINDOW_SLOTS in bsp_uart_boot.c
+WINDOW_SLOTS = 4
+# a partial page the bootloader got nothing more of for this long is dropped,
+# BOOT_WINDOW_IDLE_MS in bsp_uart_boot.c
+WINDOW_IDLE = 0.05
+# compressed image, bsp_lz.h and window_lz_header() in bsp_uart_boot.c
+LZ_MAGIC = 0x315A4C42  # "BLZ1"
+LZ_WINDOW = 4096
+LZ_MAX_LEN = 18 + 255
+# code0 of the ack BOOT_ERASE sends when the range is erased,
+# BOOT_ERASE_DONE in bsp_uart_boot.c
+ERASE_DONE = 0x454E4F44  # "DONE"
+# erase sizes of the flash and their typical / maximum time in s (MT25QL128),
+# the bootloader picks them like erase_plan()
+ERASE_TIMES = {SECTOR_SIZE: (0.15, 1), 32768: (0.1, 1), 4096: (0.05, 0.4)}
+# BOOT_BAUD answers and the time the bootloader waits for the first packet
+# at a new rate before it falls back, BOOT_BAUD_* in bsp_uart_boot.c
+BAUD_OK = 0x4B4F4442  # "BDOK"
+BAUD_NAK = 0x4B414E42  # "BNAK"
+BAUD_TRIAL = 0.5
 
 objcopy = r'C:\Xilinx\Vitis\2023.2\gnu\microblaze\nt\bin\mb-objcopy.exe'
 elf = r'C:\z\ws_vivado\fpga_boot_app\bs_vitis_embedded\app\build\app.elf'
@@ -39,7 +60,11 @@ class BootStatus(Enum):
     BOOT_READ = 10
     BOOT_JUMP = 11
     BOOT_INFO = 12
-    BOOT_STATUS_NUM = 13
+    BOOT_WINDOW = 13
+    BOOT_SECTOR_CRC = 14
+    BOOT_WINDOW_LZ = 15
+    BOOT_BAUD = 16
+    BOOT_STATUS_NUM = 17
 
 
 def send_cmd(writer, cmd, addr, size):
@@ -70,6 +95,23 @@ def ack_check(data, cmd, addr, size):
     return True
 
 
+def ack_parse(buf, cmd):
+    # complete, crc checked acks of cmd in buf, debug text in between is
+    # skipped; returns [(code0, code1)] and the unparsed rest
+    acks = []
+    pos = 0
+    want = (0xFFFFFFFF - cmd).to_bytes(4, 'little')
+    while len(buf) - pos >= 16:
+        if buf[pos+4:pos+8] == want and \
+                zlib.crc32(buf[pos+4:pos+16]).to_bytes(4, 'little') == buf[pos:pos+4]:
+            acks.append((int.from_bytes(buf[pos+8:pos+12], 'little'),
+                         int.from_bytes(buf[pos+12:pos+16], 'little')))
+            pos += 16
+        else:
+            pos += 1
+    return acks, buf[pos:]
+
+
 def sys_exit(running, task_read, task_write, writer):
     running = False
     time.sleep(0.2)
@@ -88,14 +130,21 @@ def parse_args():
         '--output', '-o', help='output file name')
     parser.add_argument('--serial', '-s', help='serial port')
     parser.add_argument('--baud', '-b', default=115200, help='baud rate')
+    parser.add_argument('--fast-baud', '-f', type=int, default=0,
+                        help='install/write/read: switch the bootloader to this baud rate first, '
+                        'back to --baud if it can not')
     parser.add_argument('--addr', '-a', default='0',
                         help='address to read/write/erase')
     parser.add_argument('--size', '-z', default='0',
                         help='size to read/write/erase')
     parser.add_argument('--version', '-v', default='0.0.1',
                         help='version of app')
+    parser.add_argument('--delta', '-d', action='store_true',
+                        help='write/update: only erase and write the sectors that changed')
+    parser.add_argument('--no-lz', '-n', action='store_true',
+                        help='write the app uncompressed')
     parser.add_argument(
-        '--cmd', '-c', help='cmd listen/save_brick/reset/enter_boot/enter_app/next/erase/write/write_only/read/check/jump/info/elf2bin/update')
+        '--cmd', '-c', help='cmd listen/save_brick/reset/enter_boot/enter_app/next/erase/write/write_only/install/read/check/jump/info/elf2bin/update/sector_crc/baud')
     return parser.parse_args()
 
 
@@ -156,30 +205,63 @@ def parse_addr_size(args):
 
 
 async def erase_func(args, r_queue, writer, addr, size):
-    loop_cnt = 1
     if args.input:
-        filesize = os.path.getsize(args.input)
-        app_size = filesize - APP_BIN_OFFSET
-        sectors = ceil(app_size / SECTOR_SIZE) + 1
-        loop_cnt = sectors
-        addr = addr - SECTOR_SIZE
-        size = sectors * SECTOR_SIZE
-        print(
-            f'app size {app_size}, isr size {APP_ISR_SIZE}, erase size {size}, sectors {sectors}')
+        # the info page in front of the app and the app itself, up to the end of its last sector if that is quicker
+        app_size = os.path.getsize(args.input) - APP_BIN_OFFSET
+        size = min((ceil(app_size / b) * b for b in ERASE_TIMES),
+                   key=lambda n: (erase_time(addr, n), n))
+        print(f'app size {app_size}, isr size {APP_ISR_SIZE}, erase size '
+              f'{size + 4096}')
+        if await erase_range(r_queue, writer, addr - SECTOR_SIZE, 4096):
+            await erase_range(r_queue, writer, addr, size)
+        return
+    await erase_range(r_queue, writer, addr, size if size else SECTOR_SIZE)
+
+
+def erase_plan(addr, size):
+    # erase sizes the bootloader uses for addr .. addr + size, widened to 4K
+    # boundaries: the largest aligned block that fits, bsp_spi_flash.c
+    end = (addr + size + 4095) & ~4095
+    addr &= ~4095
+    plan = []
+    while addr < end:
+        block = next(b for b in ERASE_TIMES
+                     if (addr % b == 0 and end - addr >= b) or b == 4096)
+        plan.append(block)
+        addr += block
+    return plan
+
+
+def erase_time(addr, size):
+    return sum(ERASE_TIMES[b][0] for b in erase_plan(addr, size))
+
+
+async def erase_range(r_queue, writer, addr, size):
+    # one BOOT_ERASE for the range, waits for the bootloader to report it
+    # erased; the deadline is the worst case erase time of the plan
+    cmd = BootStatus.BOOT_ERASE.value
+    plan = erase_plan(addr, size)
+    timeout = sum(ERASE_TIMES[b][1] for b in plan) + 1
     while r_queue.qsize() > 0:
         await r_queue.get()
-    last_size = r_queue.qsize()
-    for i in range(loop_cnt):
-        send_cmd(writer, BootStatus.BOOT_ERASE.value,
-                 addr + i * SECTOR_SIZE, SECTOR_SIZE)
-        while r_queue.qsize() == last_size:
-            await asyncio.sleep(0.01)
-        while r_queue.qsize() > 0:
-            data = await r_queue.get()
-            ack_check(data, BootStatus.BOOT_ERASE.value,
-                      addr + i * SECTOR_SIZE, SECTOR_SIZE)
-        last_size = r_queue.qsize()
-        await asyncio.sleep(0.5)
+    t0 = time.time()
+    send_cmd(writer, cmd, addr, size)
+    buf = b''
+    done = False
+    while not done:
+        left = t0 + timeout - time.time()
+        try:
+            buf += await asyncio.wait_for(r_queue.get(), max(left, 0.01))
+        except asyncio.TimeoutError:
+            print(f'\033[31merase timeout {addr:#x} {size}\033[0m')
+            return False
+        acks, buf = ack_parse(buf, cmd)
+        done = (ERASE_DONE, size) in acks
+    mix = ', '.join(f'{plan.count(b)}x{b // 1024}K'
+                    for b in ERASE_TIMES if b in plan)
+    print(f'erase {addr:#x} {size}: {mix} in {time.time() - t0:.3f} s '
+          f'(typ {erase_time(addr, size):.2f} s)')
+    return True
 
 
 async def next_func(r_queue, writer, size):
@@ -214,53 +296,200 @@ async def next_re_func(r_queue, writer, size):
     ack_check(data, BootStatus.BOOT_NEXT_SET.value, 0, size)
 
 
-async def write_func(args, w_queue, r_queue):
-    addr, size = parse_addr_size(args)
-    filesize = os.path.getsize(args.input)
-    loop_cnt = ceil((filesize - APP_BIN_OFFSET) / PAGE_SIZE)
+def lz_compress(data):
+    # LZSS stream for bsp_lz_decode(): flag byte per 8 tokens, LSB first,
+    # 1 literal, 0 match of 3..LZ_MAX_LEN bytes up to LZ_WINDOW back;
+    # greedy with hash chains on 3 byte prefixes
+    out = bytearray()
+    n = len(data)
+    head = {}
+    prev = [-1] * n
+    flag_pos = 0
+    bit = 8
+    i = 0
+    while i < n:
+        if bit == 8:
+            flag_pos = len(out)
+            out.append(0)
+            bit = 0
+        best_len = best_dist = 0
+        limit = min(LZ_MAX_LEN, n - i)
+        if limit >= 3:
+            cand = head.get(data[i:i + 3], -1)
+            depth = 32
+            while cand >= 0 and i - cand <= LZ_WINDOW and depth > 0:
+                length = 3
+                while length < limit and data[cand + length] == data[i + length]:
+                    length += 1
+                if length > best_len:
+                    best_len, best_dist = length, i - cand
+                    if length == limit:
+                        break
+                cand = prev[cand]
+                depth -= 1
+        step = best_len if best_len >= 3 else 1
+        for j in range(i, min(i + step, n - 2)):
+            key = data[j:j + 3]
+            prev[j] = head.get(key, -1)
+            head[key] = j
+        if best_len >= 3:
+            d = best_dist - 1
+            if best_len >= 18:
+                out += bytes((d & 0xFF, d >> 8 | 0xF0, best_len - 18))
+            else:
+                out += bytes((d & 0xFF, d >> 8 | (best_len - 3) << 4))
+        else:
+            out[flag_pos] |= 1 << bit
+            out.append(data[i])
+        i += step
+        bit += 1
+    return bytes(out)
+
+
+def lz_image(data):
+    # {magic, raw_len, raw_crc, lz_crc} + stream, see boot_lz_t
+    stream = lz_compress(data)
+    return LZ_MAGIC.to_bytes(4, 'little') + len(data).to_bytes(4, 'little') + \
+        zlib.crc32(data).to_bytes(4, 'little') + \
+        zlib.crc32(stream).to_bytes(4, 'little') + stream
+
+
+def window_packet(addr, seq, page):
+    data = BootStatus.BOOT_WINDOW.value.to_bytes(4, 'little') + \
+        addr.to_bytes(4, 'little') + seq.to_bytes(4, 'little') + page
+    return zlib.crc32(data).to_bytes(4, 'little') + data
+
+
+async def window_func(args, r_queue, writer, addr, data, lz=False):
+    # sliding window write of data to addr, up to WINDOW_SLOTS pages ahead
+    # of the one being programmed, see boot_window_t in bsp_uart_boot.c;
+    # lz: data is an lz_image() the bootloader decompresses into flash
+    start = BootStatus.BOOT_WINDOW_LZ.value if lz else BootStatus.BOOT_WINDOW.value
+    size = len(data)
+    data += b'\0' * (-len(data) % PAGE_SIZE)
+    pages = len(data) // PAGE_SIZE
+    cmd = BootStatus.BOOT_WINDOW.value
+    # a page with its ack on the wire and programmed, for the whole window;
+    # at the rate the port runs at now, -f may have switched it
+    baud = writer.transport.serial.baudrate
+    page_time = (16 + PAGE_SIZE + 16) * 10 / baud + 0.001
+    rto = 2 * WINDOW_SLOTS * page_time + 0.1
+
+    def send(seq):
+        writer.write(window_packet(addr + seq * PAGE_SIZE, seq,
+                                   data[seq * PAGE_SIZE:(seq + 1) * PAGE_SIZE]))
+        sent_time[seq] = time.time()
+
     while r_queue.qsize() > 0:
         await r_queue.get()
-    last_size = r_queue.qsize()
-    version = int(args.version.split('.')[0]) << 24 | int(
-        args.version.split('.')[1]) << 16 | int(args.version.split('.')[2])
-    # write app
-    app_data = b''
-    isr_data = b''
-    app_crc = 0
-    app_addr = addr
-    app_len = 0
+    buf = b''
+    for retry in range(5):
+        send_cmd(writer, start, addr, size)
+        try:
+            while True:
+                buf += await asyncio.wait_for(r_queue.get(), 0.5)
+                acks, buf = ack_parse(buf, start)
+                if (addr, size) in acks:
+                    break
+            break
+        except asyncio.TimeoutError:
+            pass
+    else:
+        print(f'\033[31mwindow start timeout\033[0m')
+        return False
+    t0 = time.time()
+    next_seq = done = sent = retransmits = 0
+    sack = 0
+    sent_time = {}
+    last_progress = last_pause = t0
+    received_all = buf
+    while done < pages:
+        while sent < min(pages, done + WINDOW_SLOTS):
+            send(sent)
+            sent += 1
+        try:
+            # wake up in time for the retransmits below
+            chunk = await asyncio.wait_for(r_queue.get(),
+                                           WINDOW_SLOTS * page_time)
+            buf += chunk
+            if lz:
+                received_all += chunk
+        except asyncio.TimeoutError:
+            pass
+        acks, buf = ack_parse(buf, cmd)
+        now = time.time()
+        if acks:
+            code0, sack = acks[-1]
+            if (code0 & 0xFFFF, code0 >> 16) != (next_seq, done):
+                last_progress = now
+            next_seq, done = code0 & 0xFFFF, code0 >> 16
+        if now - last_progress > 10 * rto:
+            print(f'\033[31mwindow timeout at page {done}/{pages}\033[0m')
+            return False
+        # stalled: a lost byte may have the bootloader's read straddling two
+        # packets, it drops it after WINDOW_IDLE of silence; what was written
+        # last has to get out first
+        if now - max(last_progress, last_pause) > rto:
+            await asyncio.sleep(WINDOW_SLOTS * page_time + 2 * WINDOW_IDLE)
+            last_pause = now = time.time()
+        # selective retransmit: holes below a page the bootloader already
+        # has, or pages without an ack for rto; never twice within a window
+        received = [next_seq + 1 + i for i in range(32) if sack >> i & 1]
+        highest = max(received, default=next_seq)
+        for seq in range(next_seq, sent):
+            if seq in received:
+                continue
+            age = now - sent_time[seq]
+            if (seq < highest and age > WINDOW_SLOTS * page_time) or age > rto:
+                send(seq)
+                retransmits += 1
+        print(f'window {done}/{pages}', end='\r')
+    t1 = time.time()
+    print(f'window write {pages} pages in {t1 - t0:.3f} s, '
+          f'{len(data) / (t1 - t0):.0f} B/s, retransmits {retransmits}')
+    if lz:
+        # {raw crc, lz crc} as decoded, sent before the last window ack
+        results, _ = ack_parse(received_all, start)
+        expected = (int.from_bytes(data[8:12], 'little'),
+                    int.from_bytes(data[12:16], 'little'))
+        if expected not in results:
+            print(f'\033[31mlz crc error {results}\033[0m')
+            return False
+    return True
+
+
+async def image_func(args, r_queue, writer, addr, data):
+    # window write, compressed unless --no-lz or it does not get smaller
+    if not args.no_lz:
+        t0 = time.time()
+        image = lz_image(data)
+        if len(image) < len(data):
+            print(f'lz {len(data)} -> {len(image)} bytes '
+                  f'({time.time() - t0:.2f} s)')
+            t0 = time.time()
+            if not await window_func(args, r_queue, writer, addr, image, True):
+                return False
+            print(f'lz write {len(data)} bytes in {time.time() - t0:.3f} s, '
+                  f'{len(data) / (time.time() - t0):.0f} B/s')
+            return True
+    return await window_func(args, r_queue, writer, addr, data)
+
+
+def read_app(args):
+    # isr vectors and app of the input file
     with open(args.input, 'rb') as file:
         data0 = file.read(APP_BIN_OFFSET)
         isr_data = data0[:APP_ISR_SIZE]
-        for i in range(loop_cnt):
-            size = 272
-            data = BootStatus.BOOT_WRITE.value.to_bytes(
-                4, 'little') + addr.to_bytes(4, 'little') + size.to_bytes(4, 'little')
-            temp = file.read(PAGE_SIZE)
-            app_data += temp
-            app_len += len(temp)
-            data += temp
-            if i > 0 and i == loop_cnt - 1:
-                remain = filesize - APP_BIN_OFFSET - i * PAGE_SIZE
-                data += b'\0' * (PAGE_SIZE - remain)
-                print(
-                    f'last loop, remain {remain}, padding {PAGE_SIZE-remain} bytes')
-            crc = zlib.crc32(data).to_bytes(4, 'little')
-            data = crc + data
-            await w_queue.put(data)
-            print(f'write {i+1}/{loop_cnt}')
-            while r_queue.qsize() == last_size:
-                await asyncio.sleep(0.01)
-            while r_queue.qsize() > 0:
-                data = await r_queue.get()
-                ack_check(data, BootStatus.BOOT_WRITE.value, addr, size)
-            last_size = r_queue.qsize()
-            addr += PAGE_SIZE
-    # write app_info, app_isr_info and isr
-    print(f'write app_info, app_isr_info and isr, addr {app_addr}')
-    size = 272
-    data = BootStatus.BOOT_WRITE.value.to_bytes(
-        4, 'little') + (app_addr - SECTOR_SIZE).to_bytes(4, 'little') + size.to_bytes(4, 'little')
+        app_data = file.read()
+    return isr_data, app_data
+
+
+def info_page(args, app_addr, app_data, isr_data):
+    # page at app_addr - SECTOR_SIZE: app_info, app_isr_info and isr
+    version = int(args.version.split('.')[0]) << 24 | int(
+        args.version.split('.')[1]) << 16 | int(args.version.split('.')[2])
+    app_len = len(app_data)
+    data = b''
     # app_info
     app_info = b''
     app_info += version.to_bytes(4, 'little')
@@ -282,6 +511,34 @@ async def write_func(args, w_queue, r_queue):
     # isr
     data += isr_data
     data += b'\0' * (PAGE_SIZE - APP_ISR_SIZE - 32)
+    return data
+
+
+async def write_func(args, w_queue, r_queue, writer):
+    addr, size = parse_addr_size(args)
+    # write app, pipelined, the bootloader programs while the next pages
+    # are on the wire
+    app_addr = addr
+    isr_data, app_data = read_app(args)
+    print(f'write {ceil(len(app_data) / PAGE_SIZE)} pages, addr {app_addr:#x}')
+    if not await image_func(args, r_queue, writer, app_addr, app_data):
+        return
+    await info_write_func(w_queue, r_queue, writer, app_addr,
+                          info_page(args, app_addr, app_data, isr_data))
+
+
+async def info_write_func(w_queue, r_queue, writer, app_addr, page):
+    await next_func(r_queue, writer, 272)
+    while r_queue.qsize() > 0:
+        await r_queue.get()
+    last_size = r_queue.qsize()
+    # write app_info, app_isr_info and isr
+    print(f'write app_info, app_isr_info and isr, addr {app_addr}')
+    addr = app_addr - SECTOR_SIZE
+    size = 272
+    data = BootStatus.BOOT_WRITE.value.to_bytes(
+        4, 'little') + addr.to_bytes(4, 'little') + size.to_bytes(4, 'little')
+    data += page
     data_crc = zlib.crc32(data).to_bytes(4, 'little')
     data = data_crc + data
     await w_queue.put(data)
@@ -293,6 +550,83 @@ async def write_func(args, w_queue, r_queue):
             ack_check(data, BootStatus.BOOT_WRITE.value, addr, size)
     # last_size = r_queue.qsize()
     print(f'write app_info, app_isr_info and isr end')
+    # back to 16 byte commands, only after the 272 byte write above
+    await next_re_func(r_queue, writer, 16)
+
+
+async def sector_crc_func(r_queue, writer, addr, count):
+    # crc32 of count sectors from addr as the bootloader reads them, None
+    # for a sector whose ack did not arrive
+    cmd = BootStatus.BOOT_SECTOR_CRC.value
+    while r_queue.qsize() > 0:
+        await r_queue.get()
+    send_cmd(writer, cmd, addr, count * SECTOR_SIZE)
+    crcs = [None] * count
+    echo = True
+    buf = b''
+    while None in crcs:
+        try:
+            buf += await asyncio.wait_for(r_queue.get(), 1)
+        except asyncio.TimeoutError:
+            print(f'\033[31msector crc timeout\033[0m')
+            break
+        acks, buf = ack_parse(buf, cmd)
+        for code0, code1 in acks:
+            if echo and (code0, code1) == (addr, count * SECTOR_SIZE):
+                echo = False
+                continue
+            i = (code0 - addr) // SECTOR_SIZE
+            if code0 % SECTOR_SIZE == 0 and 0 <= i < count:
+                crcs[i] = code1
+    return crcs
+
+
+def sector_runs(sectors):
+    # [(first, count)] of consecutive sector numbers
+    runs = []
+    for i in sectors:
+        if runs and runs[-1][0] + runs[-1][1] == i:
+            runs[-1] = (runs[-1][0], runs[-1][1] + 1)
+        else:
+            runs.append((i, 1))
+    return runs
+
+
+async def delta_func(args, w_queue, r_queue, writer):
+    # erase and write only the sectors whose crc32 differs from the image;
+    # the info sector is erased first and written last, so an interrupted
+    # update fails the check like a full write does
+    app_addr, size = parse_addr_size(args)
+    isr_data, app_data = read_app(args)
+    info = info_page(args, app_addr, app_data, isr_data)
+    # flash as a full write leaves it: pages zero padded, the rest erased
+    image = app_data + b'\0' * (-len(app_data) % PAGE_SIZE)
+    image += b'\xff' * (-len(image) % SECTOR_SIZE)
+    sectors = len(image) // SECTOR_SIZE
+    image = info + b'\xff' * (SECTOR_SIZE - len(info)) + image
+    info_addr = app_addr - SECTOR_SIZE
+    t0 = time.time()
+    crcs = await sector_crc_func(r_queue, writer, info_addr, sectors + 1)
+    changed = [i for i in range(sectors + 1) if crcs[i] !=
+               zlib.crc32(image[i * SECTOR_SIZE:(i + 1) * SECTOR_SIZE])]
+    print(f'sector crc {sectors + 1} sectors in {time.time() - t0:.3f} s, '
+          f'{len(changed)} changed')
+    if not changed:
+        print('flash is up to date')
+        return
+    await erase_range(r_queue, writer, info_addr, SECTOR_SIZE)
+    for first, count in sector_runs([i for i in changed if i > 0]):
+        await erase_range(r_queue, writer, info_addr + first * SECTOR_SIZE,
+                          count * SECTOR_SIZE)
+        start = (first - 1) * SECTOR_SIZE
+        data = app_data[start:start + count * SECTOR_SIZE]
+        print(f'write sectors {first - 1}..{first + count - 2}, '
+              f'addr {app_addr + start:#x}')
+        if not await image_func(args, r_queue, writer, app_addr + start, data):
+            return
+    await info_write_func(w_queue, r_queue, writer, app_addr, info)
+    print(f'delta write {len(changed)}/{sectors + 1} sectors in '
+          f'{time.time() - t0:.3f} s')
 
 
 async def read_func(args, r_queue, writer, addr, size):
@@ -335,6 +669,9 @@ async def info_func(args, r_queue, writer):
 
 
 async def check_func(args, r_queue, writer):
+    # the rest of an earlier ack would shift the text below
+    while r_queue.qsize() > 0:
+        await r_queue.get()
     send_cmd(writer, BootStatus.BOOT_CHECK.value, 0, 0)
     timeout = 1
     last_size = r_queue.qsize()
@@ -351,9 +688,10 @@ async def check_func(args, r_queue, writer):
         print(f'check timeout, no response')
         return False
     data = data[16:]
-    print(f'read data size: {len(data)}\n{data.decode()}')
+    text = data.decode(errors='replace')
+    print(f'read data size: {len(data)}\n{text}')
     # contain ok or ERROR
-    if 'ok' in data.decode():
+    if 'ok' in text:
         return True
     else:
         return False
@@ -411,6 +749,96 @@ async def enter_boot(args, r_queue, writer):
             print('failed: can not jump to boot')
 
 
+async def baud_wait(r_queue, timeout):
+    # the BOOT_BAUD answer (code0, code1), None if it does not come in time
+    cmd = BootStatus.BOOT_BAUD.value
+    t_end = time.time() + timeout
+    buf = b''
+    while True:
+        try:
+            buf += await asyncio.wait_for(r_queue.get(),
+                                          max(t_end - time.time(), 0.01))
+        except asyncio.TimeoutError:
+            return None
+        acks, buf = ack_parse(buf, cmd)
+        for code0, code1 in acks:
+            if code0 in (BAUD_OK, BAUD_NAK):
+                return code0, code1
+
+
+async def baud_func(args, r_queue, writer, baud):
+    # switch both ends to baud: request at the current rate, then confirm with
+    # a request for the new rate at the new rate; falls back to the current
+    # one if the bootloader refuses or the confirmation gets lost
+    serial = writer.transport.serial
+    old = serial.baudrate
+    if baud == old:
+        return True
+    while r_queue.qsize() > 0:
+        await r_queue.get()
+    send_cmd(writer, BootStatus.BOOT_BAUD.value, baud, 0)
+    answer = await baud_wait(r_queue, 0.5)
+    if answer is None or answer[0] != BAUD_OK:
+        reason = 'no answer' if answer is None else f'bootloader at {answer[1]}'
+        print(f'\033[31mbaud {baud} refused, {reason}, stay at {old}\033[0m')
+        return False
+    # the bootloader switches once the answer is out
+    await asyncio.sleep(0.01)
+    t_switch = time.time()
+    try:
+        serial.baudrate = baud
+        send_cmd(writer, BootStatus.BOOT_BAUD.value, baud, 0)
+        answer = await baud_wait(r_queue, 0.2)
+    except (ValueError, OSError) as e:
+        print(f'\033[31mbaud {baud}: {e}\033[0m')
+        answer = None
+    if answer == (BAUD_OK, baud):
+        print(f'baud {old} -> {baud}')
+        return True
+    # the bootloader drops back by itself, wait for that
+    serial.baudrate = old
+    await asyncio.sleep(max(t_switch + BAUD_TRIAL + 0.1 - time.time(), 0))
+    while r_queue.qsize() > 0:
+        await r_queue.get()
+    print(f'\033[31mbaud {baud} not confirmed, back to {old}\033[0m')
+    return False
+
+
+async def fast_baud_func(args, r_queue, writer):
+    # --fast-baud for the commands that move the data, False if not switched
+    return args.fast_baud != 0 and await baud_func(args, r_queue, writer,
+                                                    args.fast_baud)
+
+
+async def install_func(args, w_queue, r_queue, writer):
+    # erase and write (or delta write) the app, check it and jump to it, the
+    # bootloader has to be running already
+    addr, size = parse_addr_size(args)
+    # once ready the bootloader goes for the app unless told to stay
+    await save_brick(args, r_queue, writer)
+    t0 = time.time()
+    fast = await fast_baud_func(args, r_queue, writer)
+    if args.delta:
+        await delta_func(args, w_queue, r_queue, writer)
+    else:
+        await erase_func(args, r_queue, writer, addr, size)
+        await write_func(args, w_queue, r_queue, writer)
+    check_result = await check_func(args, r_queue, writer)
+    t = time.time() - t0
+    app_size = os.path.getsize(args.input) - APP_BIN_OFFSET
+    print(f'update {app_size} bytes in {t:.3f} s, {app_size / t:.0f} B/s, '
+          f'check {"ok" if check_result else "failed"}')
+    if check_result:
+        print('check ok, jump to app')
+        await jump_func(args, r_queue, writer)
+        # the app sets its UART up itself
+        if fast:
+            writer.transport.serial.baudrate = int(args.baud)
+    elif fast:
+        await baud_func(args, r_queue, writer, int(args.baud))
+    return check_result
+
+
 async def cmd_handler(running, r_queue, w_queue, args, task_read, task_write, writer):
     while running:
         if args.cmd == 'listen':
@@ -435,18 +863,32 @@ async def cmd_handler(running, r_queue, w_queue, args, task_read, task_write, wr
             await erase_func(args, r_queue, writer, addr, size)
         elif args.cmd == 'write':
             addr, size = parse_addr_size(args)
-            await erase_func(args, r_queue, writer, addr, size)
-            await next_func(r_queue, writer, 272)
-            await write_func(args, w_queue, r_queue)
-            await next_re_func(r_queue, writer, 16)
+            fast = await fast_baud_func(args, r_queue, writer)
+            if args.delta:
+                await delta_func(args, w_queue, r_queue, writer)
+            else:
+                await erase_func(args, r_queue, writer, addr, size)
+                await write_func(args, w_queue, r_queue, writer)
+            if fast:
+                await baud_func(args, r_queue, writer, int(args.baud))
             print('write done')
+        elif args.cmd == 'install':
+            await install_func(args, w_queue, r_queue, writer)
         elif args.cmd == 'write_only':
-            await next_func(r_queue, writer, 272)
-            await write_func(args, w_queue, r_queue)
-            await next_re_func(r_queue, writer, 16)
+            await write_func(args, w_queue, r_queue, writer)
+        elif args.cmd == 'sector_crc':
+            addr, size = parse_addr_size(args)
+            count = max(1, ceil(size / SECTOR_SIZE))
+            crcs = await sector_crc_func(r_queue, writer, addr, count)
+            for i in range(count):
+                crc = 'none' if crcs[i] is None else f'{crcs[i]:08x}'
+                print(f'{addr + i * SECTOR_SIZE:#010x}: {crc}')
         elif args.cmd == 'read':
             addr, size = parse_addr_size(args)
+            fast = await fast_baud_func(args, r_queue, writer)
             await read_func(args, r_queue, writer, addr, size)
+            if fast:
+                await baud_func(args, r_queue, writer, int(args.baud))
         elif args.cmd == 'check':
             await check_func(args, r_queue, writer)
         elif args.cmd == 'jump':
@@ -454,6 +896,8 @@ async def cmd_handler(running, r_queue, w_queue, args, task_read, task_write, wr
             pass
         elif args.cmd == 'info':
             await info_func(args, r_queue, writer)
+        elif args.cmd == 'baud':
+            await baud_func(args, r_queue, writer, args.fast_baud)
         elif args.cmd == 'elf2bin':
             await elf2bin()
         elif args.cmd == 'update':
@@ -480,14 +924,7 @@ async def cmd_handler(running, r_queue, w_queue, args, task_read, task_write, wr
             if current == 'boot':
                 if savebrick:
                     print('save brick ok')
-                    await erase_func(args, r_queue, writer, 0x00400000, 0)
-                    await next_func(r_queue, writer, 272)
-                    await write_func(args, w_queue, r_queue)
-                    await next_re_func(r_queue, writer, 16)
-                    check_result = await check_func(args, r_queue, writer)
-                    if check_result:
-                        print('check ok, jump to app')
-                        await jump_func(args, r_queue, writer)
+                    await install_func(args, w_queue, r_queue, writer)
                 else:
                     print('save brick failed')
         else: